@@ -0,0 +1,627 @@
+/**
+* @file bench.c
+* @brief Offline micro-benchmarks of the conversion, encoding and ring buffer paths.
+*
+* Runs without a camera: frames come from a recorded raw YUYV file
+* (concatenated width * height * 2 byte frames, e.g. from
+* `v4l2-ctl --stream-mmap --stream-to=frames.yuyv`) or, by default, from a
+* deterministic synthetic scene at several resolutions.
+*
+* For every resolution it measures:
+*   1. convert_yuyv_to_rgb() (dispatching kernel) and the scalar kernel
+*   2. convert_rgb_to_jpeg() (one-shot) and the persistent RGB encoder
+*   3. convert_yuyv_to_jpeg() (one-shot) and the persistent direct YUYV encoder
+*   4. the direct YUYV encoder in every encoding profile (4:2:2, fast DCT,
+*      restart markers, optimal, trained and abbreviated tables), against
+*      yuyv_to_jpeg as the default profile at the same quality
+* and then cb_write()/cb_read() with a writer and a reader thread racing on
+* one ring, for every full-queue policy.
+*
+* Each result reports ns/frame (median of the runs), MB/s of input, heap
+* allocations per frame and, for the encoders, bytes per frame. Allocations are counted by interposing malloc and
+* friends, so libjpeg's own allocations are included. With -o the results
+* are also written as JSON, tagged with the build (kernel in use, SIMD), for
+* tracking regressions across releases and comparing SIMD=0 builds.
+*
+* The trained profile uses tables loaded with -H, or else tables trained on
+* the benchmarked frames themselves (an upper bound of the gain); -W
+* writes them for the jpeg_huffman config key.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <jpeglib.h>
+
+#include "image/image_encoder.h"
+#include "image/jpeg_huffman.h"
+#include "image/yuyv_rgb.h"
+#include "cb/circular_buffer.h"
+
+/** @brief Resolutions benchmarked with synthetic frames. */
+static const struct { unsigned int w, h; } default_sizes[] = {
+    { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 },
+};
+
+/** @brief Default timed runs per benchmark (the median is reported). */
+#define BENCH_RUNS          9
+
+/** @brief Default minimum duration of one timed run. */
+#define BENCH_RUN_NS        50000000ULL
+
+/** @brief Frames pushed through the ring per policy. */
+#define RING_OPS            2000000
+
+/** @brief Most results kept for the JSON report. */
+#define MAX_RESULTS         96
+
+/** @brief Quality every encoder benchmark runs at. */
+#define BENCH_QUALITY       80
+
+/** @brief Most recorded frames loaded from disk. */
+#define MAX_FRAMES          64
+
+/**
+* @brief One benchmark result.
+*/
+struct result {
+    char name[48];                  /**< Benchmark name */
+    unsigned int width;             /**< Frame width (0 for the ring) */
+    unsigned int height;            /**< Frame height (0 for the ring) */
+    double ns_per_op;               /**< Median nanoseconds per frame or ring operation */
+    double mb_per_s;                /**< Input megabytes per second (0 for the ring) */
+    double allocs_per_op;           /**< Heap allocations per frame or operation */
+    double out_bytes;               /**< Average output size (JPEG benchmarks), else 0 */
+};
+
+static struct result results[MAX_RESULTS];
+static unsigned int n_results;
+
+/* ------------------------------------------------------------------------ */
+/* Allocation counting                                                      */
+/* ------------------------------------------------------------------------ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static atomic_ulong n_allocs;
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&n_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Timing                                                                   */
+/* ------------------------------------------------------------------------ */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+* @brief Frame-level benchmark: the operation and its state
+*/
+struct frame_bench {
+    const char *name;
+    int (*run)(void *state, unsigned int frame);    /**< Process one frame, returns output bytes or -1 */
+    void *state;
+};
+
+static unsigned int bench_runs = BENCH_RUNS;
+static uint64_t bench_run_ns = BENCH_RUN_NS;
+
+/**
+* @brief Time a frame benchmark and record its result
+*
+* One untimed warm-up pass; then each run processes frames until it lasted
+* at least bench_run_ns, and the median per-frame time is kept.
+*/
+static void time_frames(const struct frame_bench *b, unsigned int w, unsigned int h,
+                        unsigned long in_bytes, unsigned int n_frames)
+{
+    double samples[64];
+    unsigned long allocs = 0, ops = 0;
+    double out_total = 0;
+
+    if (b->run(b->state, 0) < 0) {
+        fprintf(stderr, "bench: %s failed at %ux%u\n", b->name, w, h);
+        return;
+    }
+
+    for (unsigned int r = 0; r < bench_runs; r++) {
+        unsigned long before = atomic_load(&n_allocs);
+        unsigned long count = 0;
+        uint64_t start = now_ns(), elapsed;
+
+        do {
+            int out = b->run(b->state, count % n_frames);
+            if (out > 0) out_total += out;
+            count++;
+            elapsed = now_ns() - start;
+        } while (elapsed < bench_run_ns);
+
+        allocs += atomic_load(&n_allocs) - before;
+        ops += count;
+        samples[r] = (double)elapsed / count;
+    }
+
+    qsort(samples, bench_runs, sizeof(samples[0]), cmp_double);
+    if (n_results == MAX_RESULTS) return;
+
+    struct result *res = &results[n_results++];
+    snprintf(res->name, sizeof(res->name), "%s", b->name);
+    res->width = w;
+    res->height = h;
+    res->ns_per_op = samples[bench_runs / 2];
+    res->mb_per_s = in_bytes / res->ns_per_op * 1e3;
+    res->allocs_per_op = (double)allocs / ops;
+    res->out_bytes = out_total / ops;
+
+    printf("%-24s %5ux%-5u %12.0f ns/frame %9.1f MB/s %8.2f allocs/frame",
+           res->name, w, h, res->ns_per_op, res->mb_per_s, res->allocs_per_op);
+    if (res->out_bytes > 0) printf(" %9.0f B out", res->out_bytes);
+    printf("\n");
+}
+
+/* ------------------------------------------------------------------------ */
+/* Frame benchmarks                                                         */
+/* ------------------------------------------------------------------------ */
+
+/**
+* @brief Input frames and scratch buffers shared by the frame benchmarks
+*/
+struct frame_set {
+    unsigned int width, height;
+    unsigned int n_frames;
+    unsigned char *yuyv[MAX_FRAMES];
+    struct rgb_frame rgb[MAX_FRAMES];   /**< Pre-converted frames for the RGB encoders */
+    unsigned char *rgb_out;             /**< Conversion destination */
+    struct jpeg_encoder *enc;           /**< Persistent encoder */
+    struct jpeg_encoder *profile_enc;   /**< Encoder of the profile being measured */
+    struct jpeg_frame jpeg;             /**< Reused output frame */
+};
+
+static struct yuyv_frame set_yuyv(struct frame_set *fs, unsigned int i)
+{
+    return (struct yuyv_frame){
+        .data = fs->yuyv[i],
+        .width = fs->width,
+        .height = fs->height,
+        .size = (unsigned long)fs->width * fs->height * 2,
+        .dmabuf_fd = -1,
+    };
+}
+
+static int run_convert(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    struct yuyv_frame in = set_yuyv(fs, i);
+    struct rgb_frame out = { .data = fs->rgb_out };
+    return convert_yuyv_to_rgb(&in, &out) == 0 ? 0 : -1;
+}
+
+static int run_convert_scalar(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    yuyv_to_rgb_scalar(fs->yuyv[i], fs->rgb_out, (size_t)fs->width * fs->height);
+    return 0;
+}
+
+static int run_rgb_jpeg_oneshot(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    if (convert_rgb_to_jpeg(&fs->rgb[i], &fs->jpeg) != 0) return -1;
+    return (int)fs->jpeg.size;
+}
+
+static int run_rgb_jpeg(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    if (jpeg_encoder_encode_rgb(fs->enc, &fs->rgb[i], &fs->jpeg) != 0) return -1;
+    return (int)fs->jpeg.size;
+}
+
+static int run_yuyv_jpeg_oneshot(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    if (convert_yuyv_to_jpeg(fs->yuyv[i], fs->width, fs->height, &fs->jpeg) != 0) return -1;
+    return (int)fs->jpeg.size;
+}
+
+static int run_yuyv_jpeg(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    struct yuyv_frame in = set_yuyv(fs, i);
+    if (jpeg_encoder_encode_yuyv(fs->enc, &in, &fs->jpeg) != 0) return -1;
+    return (int)fs->jpeg.size;
+}
+
+static int run_profile_jpeg(void *state, unsigned int i)
+{
+    struct frame_set *fs = state;
+    struct yuyv_frame in = set_yuyv(fs, i);
+    if (jpeg_encoder_encode_yuyv(fs->profile_enc, &in, &fs->jpeg) != 0) return -1;
+    return (int)fs->jpeg.size;
+}
+
+/**
+* @brief Encoding profiles measured on the direct YUYV encoder
+*/
+static const struct {
+    const char *name;
+    struct jpeg_profile profile;
+} profiles[] = {
+    { "profile_422",         { .subsampling = JPEG_SUBSAMPLE_422 } },
+    { "profile_fast_dct",    { .fast_dct = true } },
+    { "profile_restart",     { .restart_rows = 1 } },
+    { "profile_optimized",   { .huffman = JPEG_HUFFMAN_OPTIMIZED } },
+    { "profile_trained",     { .huffman = JPEG_HUFFMAN_TRAINED } },
+    { "profile_abbreviated", { .abbreviated = true } },
+    { "profile_compact",     { .huffman = JPEG_HUFFMAN_TRAINED, .abbreviated = true, .fast_dct = true } },
+};
+
+/** @brief Tables of the trained profiles: from -H, else trained per frame set. */
+static struct jpeg_huffman_set trained;
+static bool tables_loaded;
+static const char *tables_out;
+
+/**
+* @brief Measure every encoding profile on one frame set
+*/
+static void bench_profiles(struct frame_set *fs, unsigned long in_bytes)
+{
+    if (!tables_loaded) {
+        struct yuyv_frame train[MAX_FRAMES];
+        for (unsigned int i = 0; i < fs->n_frames; i++) train[i] = set_yuyv(fs, i);
+
+        if (jpeg_huffman_train(train, fs->n_frames, BENCH_QUALITY, NULL, &trained) < 0) {
+            fprintf(stderr, "bench: Failed to train Huffman tables at %ux%u\n", fs->width, fs->height);
+            return;
+        }
+        if (tables_out && jpeg_huffman_save(tables_out, &trained) == 0) {
+            printf("bench: Tables trained at %ux%u written to %s\n", fs->width, fs->height, tables_out);
+        }
+    }
+
+    for (unsigned int p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        struct jpeg_profile profile = profiles[p].profile;
+        if (profile.huffman == JPEG_HUFFMAN_TRAINED) profile.tables = &trained;
+
+        fs->profile_enc = jpeg_encoder_create_profile(BENCH_QUALITY, &profile);
+        if (!fs->profile_enc) continue;
+
+        const struct frame_bench b = { profiles[p].name, run_profile_jpeg, fs };
+        time_frames(&b, fs->width, fs->height, in_bytes, fs->n_frames);
+
+        jpeg_encoder_destroy(fs->profile_enc);
+        fs->profile_enc = NULL;
+    }
+}
+
+/**
+* @brief Fill a frame with a deterministic scene: gradients, edges and mild noise
+*
+* Compresses roughly like camera content, unlike flat or random frames.
+*/
+static void synth_frame(unsigned char *p, unsigned int w, unsigned int h, unsigned int seed)
+{
+    uint32_t rng = 2463534242u ^ seed;
+
+    for (unsigned int y = 0; y < h; y++) {
+        for (unsigned int x = 0; x < w; x += 2) {
+            rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+            unsigned int noise = rng & 7;
+            unsigned int block = ((x / 64) ^ (y / 64)) & 1;
+            unsigned int luma = 16 + (x * 160 / w + y * 40 / h) + block * 20 + noise;
+            unsigned char *px = p + ((size_t)y * w + x) * 2;
+            px[0] = luma;
+            px[1] = 128 + (int)(x * 64 / w) - 32;
+            px[2] = luma + (noise >> 1);
+            px[3] = 128 + (int)(y * 64 / h) - 32;
+        }
+    }
+}
+
+/**
+* @brief Run every frame benchmark on one frame set
+*/
+static int bench_frames(struct frame_set *fs)
+{
+    unsigned long in_bytes = (unsigned long)fs->width * fs->height * 2;
+    unsigned long rgb_size = (unsigned long)fs->width * fs->height * 3;
+
+    fs->rgb_out = malloc(rgb_size);
+    fs->enc = jpeg_encoder_create(BENCH_QUALITY);
+    if (!fs->rgb_out || !fs->enc) return -1;
+
+    for (unsigned int i = 0; i < fs->n_frames; i++) {
+        struct yuyv_frame in = set_yuyv(fs, i);
+        fs->rgb[i].data = NULL;
+        if (convert_yuyv_to_rgb(&in, &fs->rgb[i]) != 0) return -1;
+    }
+
+    const struct frame_bench benches[] = {
+        { "yuyv_to_rgb",           run_convert,           fs },
+        { "yuyv_to_rgb_scalar",    run_convert_scalar,    fs },
+        { "rgb_to_jpeg_oneshot",   run_rgb_jpeg_oneshot,  fs },
+        { "rgb_to_jpeg",           run_rgb_jpeg,          fs },
+        { "yuyv_to_jpeg_oneshot",  run_yuyv_jpeg_oneshot, fs },
+        { "yuyv_to_jpeg",          run_yuyv_jpeg,         fs },
+    };
+
+    for (unsigned int b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        time_frames(&benches[b], fs->width, fs->height,
+                    b < 2 || b >= 4 ? in_bytes : rgb_size, fs->n_frames);
+    }
+    bench_profiles(fs, in_bytes);
+
+    for (unsigned int i = 0; i < fs->n_frames; i++) free(fs->rgb[i].data);
+    free(fs->rgb_out);
+    free(fs->jpeg.data);
+    jpeg_encoder_destroy(fs->enc);
+    memset(&fs->jpeg, 0, sizeof(fs->jpeg));
+    return 0;
+}
+
+/**
+* @brief Load up to MAX_FRAMES recorded frames of the given size
+*
+* @return Number of frames loaded, 0 on failure
+*/
+static unsigned int load_frames(struct frame_set *fs, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("bench: Failed to open recorded frames");
+        return 0;
+    }
+
+    size_t frame_size = (size_t)fs->width * fs->height * 2;
+    unsigned int n = 0;
+    while (n < MAX_FRAMES) {
+        unsigned char *p = malloc(frame_size);
+        if (!p) break;
+        if (fread(p, 1, frame_size, f) != frame_size) {
+            free(p);
+            break;
+        }
+        fs->yuyv[n++] = p;
+    }
+    fclose(f);
+
+    if (n == 0) fprintf(stderr, "bench: %s holds no complete %ux%u frame\n", path, fs->width, fs->height);
+    fs->n_frames = n;
+    return n;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Ring benchmark                                                           */
+/* ------------------------------------------------------------------------ */
+
+/**
+* @brief State shared by the ring writer and reader threads
+*/
+struct ring_bench {
+    CircularBuffer cb;
+    struct jpeg_frame frames[BUFFER_SIZE_MAX];  /**< Dummy frames (only their addresses travel) */
+    atomic_bool done;                           /**< Writer finished */
+    unsigned long reads;                        /**< Frames taken by the reader */
+    unsigned long evicted;                      /**< Frames handed back to the writer */
+};
+
+static void *ring_reader(void *arg)
+{
+    struct ring_bench *rb = arg;
+    struct jpeg_frame *frame;
+
+    for (;;) {
+        if (cb_read(&rb->cb, &frame)) {
+            rb->reads++;
+        } else if (atomic_load_explicit(&rb->done, memory_order_acquire)) {
+            // Drain what is left after the writer stopped
+            while (cb_read(&rb->cb, &frame)) rb->reads++;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief Race one writer against one reader on a ring
+*/
+static void bench_ring(enum cb_policy policy, const char *policy_name, unsigned int depth)
+{
+    static struct ring_bench rb;
+    pthread_t reader;
+
+    memset(&rb, 0, sizeof(rb));
+    if (circular_buffer_init(&rb.cb, depth, policy) < 0) return;
+
+    unsigned long before = atomic_load(&n_allocs);
+    if (pthread_create(&reader, NULL, ring_reader, &rb) != 0) {
+        circular_buffer_destroy(&rb.cb);
+        return;
+    }
+
+    uint64_t start = now_ns();
+    for (unsigned long i = 0; i < RING_OPS; i++) {
+        if (cb_write(&rb.cb, &rb.frames[i % BUFFER_SIZE_MAX])) rb.evicted++;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    atomic_store_explicit(&rb.done, true, memory_order_release);
+    pthread_join(reader, NULL);
+    unsigned long allocs = atomic_load(&n_allocs) - before;
+
+    if (rb.reads + rb.evicted != RING_OPS) {
+        fprintf(stderr, "bench: ring %s lost frames (%lu read + %lu evicted != %d)\n",
+                policy_name, rb.reads, rb.evicted, RING_OPS);
+    }
+    circular_buffer_destroy(&rb.cb);
+
+    if (n_results == MAX_RESULTS) return;
+    struct result *res = &results[n_results++];
+    snprintf(res->name, sizeof(res->name), "ring_%s_d%u", policy_name, depth);
+    res->ns_per_op = (double)elapsed / RING_OPS;
+    res->allocs_per_op = (double)allocs / RING_OPS;
+    res->out_bytes = 0;
+
+    printf("%-24s %11s %12.1f ns/write %8.2f%% evicted %6.2f allocs/op\n",
+           res->name, "", res->ns_per_op, 100.0 * rb.evicted / RING_OPS, res->allocs_per_op);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Report                                                                   */
+/* ------------------------------------------------------------------------ */
+
+static int write_json(const char *path)
+{
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!f) {
+        perror("bench: Failed to open JSON output");
+        return -1;
+    }
+
+    fprintf(f, "{\n  \"build\": {\"rgb_kernel\": \"%s\", \"simd\": %s, \"libjpeg\": %d, "
+               "\"compiler\": \"%s\"},\n  \"results\": [\n",
+            yuyv_to_rgb_impl(), IMAGE_HAVE_NEON ? "true" : "false", JPEG_LIB_VERSION, __VERSION__);
+
+    for (unsigned int i = 0; i < n_results; i++) {
+        const struct result *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"width\": %u, \"height\": %u, \"ns_per_op\": %.1f, "
+                   "\"mb_per_s\": %.2f, \"allocs_per_op\": %.3f, \"out_bytes\": %.0f}%s\n",
+                r->name, r->width, r->height, r->ns_per_op, r->mb_per_s, r->allocs_per_op,
+                r->out_bytes, i + 1 < n_results ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (f != stdout) fclose(f);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -i file     Recorded raw YUYV frames (needs -s); default: synthetic frames\n"
+            "  -s WxH      Size of the recorded frames, or the only synthetic size to run\n"
+            "  -r runs     Timed runs per benchmark, median reported (default %d)\n"
+            "  -t ms       Minimum duration of one run (default %llu)\n"
+            "  -o file     Also write the results as JSON ('-' = stdout)\n"
+            "  -H file     Huffman tables for the trained profiles (default: trained on the frames)\n"
+            "  -W file     Write the tables trained on the frames (of the last size run)\n"
+            "  -R          Ring benchmark only\n",
+            prog, BENCH_RUNS, BENCH_RUN_NS / 1000000ULL);
+}
+
+int main(int argc, char **argv)
+{
+    const char *input = NULL, *json = NULL;
+    unsigned int w = 0, h = 0;
+    bool ring_only = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:s:r:t:o:H:W:R")) != -1) {
+        switch (opt) {
+            case 'i': input = optarg; break;
+            case 's':
+                if (sscanf(optarg, "%ux%u", &w, &h) != 2 || w < 2 || h < 1 || (w & 1)) {
+                    fprintf(stderr, "bench: Invalid size '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                bench_runs = (unsigned int)strtoul(optarg, NULL, 10);
+                if (bench_runs < 1) bench_runs = 1;
+                if (bench_runs > 64) bench_runs = 64;
+                break;
+            case 't': bench_run_ns = strtoull(optarg, NULL, 10) * 1000000ULL; break;
+            case 'o': json = optarg; break;
+            case 'H':
+                if (jpeg_huffman_load(optarg, &trained) < 0) return 1;
+                tables_loaded = true;
+                break;
+            case 'W': tables_out = optarg; break;
+            case 'R': ring_only = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (input && !w) {
+        fprintf(stderr, "bench: -i needs the frame size (-s WxH)\n");
+        return 1;
+    }
+
+    printf("bench: RGB kernel %s, %u runs of >= %llu ms\n", yuyv_to_rgb_impl(), bench_runs,
+           (unsigned long long)(bench_run_ns / 1000000ULL));
+
+    if (!ring_only) {
+        static struct frame_set fs;
+        unsigned int n_sizes = w ? 1 : sizeof(default_sizes) / sizeof(default_sizes[0]);
+
+        for (unsigned int s = 0; s < n_sizes; s++) {
+            memset(&fs, 0, sizeof(fs));
+            fs.width = w ? w : default_sizes[s].w;
+            fs.height = w ? h : default_sizes[s].h;
+
+            if (input) {
+                if (!load_frames(&fs, input)) return 1;
+            } else {
+                for (fs.n_frames = 0; fs.n_frames < 4; fs.n_frames++) {
+                    fs.yuyv[fs.n_frames] = malloc((size_t)fs.width * fs.height * 2);
+                    if (!fs.yuyv[fs.n_frames]) return 1;
+                    synth_frame(fs.yuyv[fs.n_frames], fs.width, fs.height, fs.n_frames);
+                }
+            }
+
+            if (bench_frames(&fs) < 0) {
+                fprintf(stderr, "bench: Failed to set up %ux%u\n", fs.width, fs.height);
+                return 1;
+            }
+            for (unsigned int i = 0; i < fs.n_frames; i++) free(fs.yuyv[i]);
+        }
+    }
+
+    bench_ring(CB_DROP_OLDEST, "oldest", BUFFER_SIZE);
+    bench_ring(CB_LATEST_ONLY, "latest", 1);
+    bench_ring(CB_BLOCK, "block", BUFFER_SIZE);
+
+    if (json && write_json(json) < 0) return 1;
+    return 0;
+}
@@ -1,24 +1,44 @@
 /**
 * @file cam_stream.c
-* @brief Kernel module providing LED control for camera streaming.
+* @brief Kernel module providing LED control and health telemetry for camera streaming.
 *
 * This module exposes simple IOCTL commands that allow a user-space application
 * to control two GPIO-driven LEDs. GREEN for "streaming ON" and RED for "streaming OFF".
-* 
+*
 * The driver registers a character device and responds to:
 *   - CAM_IOC_START - turn on GREEN LED (stream active)
 *   - CAM_IOC_STOP - turn on RED LED (stream stopped)
 *   - CAM_IOC_RESET - reset both LEDs to OFF
+*   - CAM_IOC_SET_LED / CAM_IOC_GET_LED - pin or read the LED pattern
+*   - CAM_IOC_SET_POLICY - thresholds of the derived health
+*   - CAM_IOC_GET_STATUS - current health and counters
+*   - CAM_IOC_SET_EVENTFD - eventfd signalled on health changes
+*
+* It also shares one telemetry page (struct cam_shared) through mmap(). The
+* streaming application keeps its frame and drop counters there with plain
+* memory writes, and a timer samples them to derive the stream health and
+* the LED pattern (blinking on drops or stalls). Health changes wake read()
+* and poll() callers and signal the registered eventfds, so neither the
+* application nor monitoring daemons make a system call per frame.
 */
 
 #include <linux/fs.h>
+#include <linux/mm.h>
 #include <linux/err.h>
 #include <linux/init.h>
 #include <linux/gpio.h>
+#include <linux/list.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
 #include <linux/ioctl.h>
+#include <linux/mutex.h>
 #include <linux/device.h>
 #include <linux/module.h>
+#include <linux/eventfd.h>
+#include <linux/jiffies.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
 #include <linux/gpio/consumer.h>
 
 #include "cam_stream_ioctl.h"
@@ -32,6 +52,22 @@
 /** @brief GPIO number for GREEN LED. */
 #define LED_GREEN_GPIO      (GPIO_BASE + 20)
 
+/** @brief Period of the health sampling timer; blinking patterns toggle at this rate. */
+#define HEALTH_TICK_MS          250
+
+/** @brief Default time without a frame after which a stream is STALLED. */
+#define DEFAULT_STALL_MS        2000
+
+/** @brief Default time a stream stays DROPPING after its last dropped frame. */
+#define DEFAULT_DROP_HOLD_MS    3000
+
+/** @brief eventfd_signal() lost its count argument in Linux 6.8. */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+#define cam_eventfd_signal(ctx) eventfd_signal(ctx)
+#else
+#define cam_eventfd_signal(ctx) eventfd_signal(ctx, 1)
+#endif
+
 /* -------------------------------------------------------------------------- */
 /*                           Module Metadata                                  */
 /* -------------------------------------------------------------------------- */
@@ -61,20 +97,282 @@ static struct gpio_desc *red_led;
 /** @brief GPIO descriptor for GREEN LED. */
 static struct gpio_desc *green_led;
 
+/** @brief Telemetry page mapped into userspace (one zeroed page). */
+static struct cam_shared *shared;
+
+/**
+* @brief Per-open state of /dev/cam_stream.
+*/
+struct cam_file {
+    struct list_head node;          /**< Entry in open_files */
+    u32 seen;                       /**< cam_shared.events at this file's last read() */
+    struct eventfd_ctx *efd;        /**< eventfd signalled on health changes, or NULL */
+};
+
+/** @brief Serializes the state below, the LEDs and the file list. */
+static DEFINE_MUTEX(cam_lock);
+
+/** @brief Every open file, for eventfd signalling. */
+static LIST_HEAD(open_files);
+
+/** @brief Number of open files; the timer only runs while there are any. */
+static unsigned int n_open;
+
+/** @brief Woken on every health change (read() and poll()). */
+static DECLARE_WAIT_QUEUE_HEAD(cam_wq);
+
+/** @brief Health thresholds set by CAM_IOC_SET_POLICY. */
+static struct cam_led_policy policy = {
+    .stall_ms = DEFAULT_STALL_MS,
+    .drop_hold_ms = DEFAULT_DROP_HOLD_MS,
+};
+
+/** @brief Pattern pinned by CAM_IOC_SET_LED, or CAM_LED_AUTO. */
+static u32 led_pinned = CAM_LED_AUTO;
+
+/** @brief Frame and drop counters at the last sample, and when each last moved. */
+static u64 seen_frames, seen_drops;
+static unsigned long progress_at, drop_at;
+static bool dropped;
+
+/** @brief Blink phase, toggled every tick. */
+static bool blink_on;
+
+/** @brief GPIO pattern currently driven, to touch the GPIOs only on changes. */
+static int driven_red = -1, driven_green = -1;
+
+static void health_tick(struct work_struct *work);
+
+/** @brief Health sampling timer (a work item, since GPIO access may sleep). */
+static DECLARE_DELAYED_WORK(health_work, health_tick);
+
+/**
+* @brief Drive both LEDs
+*
+* @note The LEDs are anode long-lead type:
+*           - Setting the GPIO to 1 turns the LED off
+*           - Setting the GPIO to 0 turns the LED on
+*
+* @param red    RED on
+* @param green  GREEN on
+*/
+static void led_drive(bool red, bool green)
+{
+    if (red == driven_red && green == driven_green) return;
+    driven_red = red;
+    driven_green = green;
+
+    if (gpio_ready) {
+        gpiod_set_value_cansleep(red_led, !red);
+        gpiod_set_value_cansleep(green_led, !green);
+    }
+    pr_debug("cam_stream: LED RED %s, GREEN %s%s\n", red ? "on" : "off", green ? "on" : "off",
+             gpio_ready ? "" : " (Simulated - GPIO not ready)");
+}
+
+/**
+* @brief Show an LED pattern at the current blink phase
+*
+* @param led enum cam_led
+*/
+static void led_show(u32 led)
+{
+    bool on = blink_on;
+
+    switch (led) {
+        case CAM_LED_RED:           led_drive(true, false);  break;
+        case CAM_LED_GREEN:         led_drive(false, true);  break;
+        case CAM_LED_YELLOW:        led_drive(true, true);   break;
+        case CAM_LED_RED_BLINK:     led_drive(on, false);    break;
+        case CAM_LED_GREEN_BLINK:   led_drive(false, on);    break;
+        case CAM_LED_YELLOW_BLINK:  led_drive(on, on);       break;
+        default:                    led_drive(false, false); break;
+    }
+}
+
+/**
+* @brief Whether a pattern needs the timer to blink
+*/
+static bool led_blinks(u32 led)
+{
+    return led == CAM_LED_RED_BLINK || led == CAM_LED_GREEN_BLINK || led == CAM_LED_YELLOW_BLINK;
+}
+
+/**
+* @brief Sample the counters and derive the stream health
+*
+* Progress and drops are detected as changes of the shared counters. If
+* the application never marked the page as maintained (version 0), a
+* streaming device is taken to be healthy, as with the START/STOP-only
+* protocol. Called with cam_lock held.
+*
+* @return enum cam_health
+*/
+static u32 health_sample(void)
+{
+    unsigned long now = jiffies;
+    u64 frames = READ_ONCE(shared->frames);
+    u64 drops = READ_ONCE(shared->drops);
+
+    if (frames != seen_frames) {
+        seen_frames = frames;
+        progress_at = now;
+    }
+    if (drops != seen_drops) {
+        seen_drops = drops;
+        drop_at = now;
+        dropped = true;
+    }
+
+    switch (READ_ONCE(shared->state)) {
+        case CAM_STATE_STREAMING:
+            if (READ_ONCE(shared->version) != CAM_SHARED_VERSION) return CAM_HEALTH_OK;
+            if (policy.stall_ms &&
+                time_after(now, progress_at + msecs_to_jiffies(policy.stall_ms))) {
+                return CAM_HEALTH_STALLED;
+            }
+            if (policy.drop_hold_ms && dropped &&
+                time_before(now, drop_at + msecs_to_jiffies(policy.drop_hold_ms))) {
+                return CAM_HEALTH_DROPPING;
+            }
+            return CAM_HEALTH_OK;
+        case CAM_STATE_RESET:
+            return CAM_HEALTH_RESET;
+        case CAM_STATE_ERROR:
+            return CAM_HEALTH_ERROR;
+        default:
+            return CAM_HEALTH_STOPPED;
+    }
+}
+
+/**
+* @brief LED pattern shown for a health
+*/
+static u32 health_led(u32 health)
+{
+    switch (health) {
+        case CAM_HEALTH_OK:         return CAM_LED_GREEN;
+        case CAM_HEALTH_DROPPING:   return CAM_LED_GREEN_BLINK;
+        case CAM_HEALTH_STALLED:    return CAM_LED_YELLOW_BLINK;
+        case CAM_HEALTH_RESET:      return CAM_LED_YELLOW;
+        case CAM_HEALTH_ERROR:      return CAM_LED_RED_BLINK;
+        default:                    return CAM_LED_RED;
+    }
+}
+
+/**
+* @brief Re-derive the health, show the LED pattern and publish changes
+*
+* A change of health or pattern bumps cam_shared.events, wakes read() and
+* poll() callers and signals every registered eventfd. Called with cam_lock
+* held.
+*/
+static void health_update(void)
+{
+    struct cam_file *cf;
+    u32 health = health_sample();
+    u32 led = led_pinned != CAM_LED_AUTO ? led_pinned : health_led(health);
+
+    led_show(led);
+
+    if (health == READ_ONCE(shared->health) && led == READ_ONCE(shared->led)) return;
+
+    WRITE_ONCE(shared->health, health);
+    WRITE_ONCE(shared->led, led);
+    WRITE_ONCE(shared->events, READ_ONCE(shared->events) + 1);
+    pr_debug("cam_stream: health %u, LED pattern %u\n", health, led);
+
+    list_for_each_entry(cf, &open_files, node) {
+        if (cf->efd) cam_eventfd_signal(cf->efd);
+    }
+    wake_up_interruptible(&cam_wq);
+}
+
+/**
+* @brief Health sampling timer
+*
+* Runs every HEALTH_TICK_MS while the device is open, or while a blinking
+* pattern is shown.
+*
+* @param work Unused
+*/
+static void health_tick(struct work_struct *work)
+{
+    mutex_lock(&cam_lock);
+    blink_on = !blink_on;
+    health_update();
+    if (n_open || led_blinks(READ_ONCE(shared->led))) {
+        schedule_delayed_work(&health_work, msecs_to_jiffies(HEALTH_TICK_MS));
+    }
+    mutex_unlock(&cam_lock);
+}
+
+/**
+* @brief Set the stream state from an ioctl and show it at once
+*
+* The counters are taken as the baseline, so a new stream is judged on
+* frames from now on. Called with cam_lock held.
+*
+* @param state enum cam_state
+*/
+static void state_set(u32 state)
+{
+    WRITE_ONCE(shared->state, state);
+    seen_frames = READ_ONCE(shared->frames);
+    seen_drops = READ_ONCE(shared->drops);
+    progress_at = jiffies;
+    dropped = false;
+    blink_on = true;
+    health_update();
+
+    // A blinking pattern keeps the timer alive even with the device closed
+    if (led_blinks(READ_ONCE(shared->led))) {
+        mod_delayed_work(system_wq, &health_work, msecs_to_jiffies(HEALTH_TICK_MS));
+    }
+}
+
+/**
+* @brief Snapshot of the status. Called with cam_lock held.
+*/
+static void status_get(struct cam_event *ev)
+{
+    ev->events = READ_ONCE(shared->events);
+    ev->health = READ_ONCE(shared->health);
+    ev->led = READ_ONCE(shared->led);
+    ev->state = READ_ONCE(shared->state);
+    ev->frames = READ_ONCE(shared->frames);
+    ev->drops = READ_ONCE(shared->drops);
+}
+
 /**
 * @brief Open the cam_stream device.
 *
-* This function is invoked when a user space program opens the device node 
-* '/dev/cam_stream'. It logs that the device has been opened.
+* This function is invoked when a user space program opens the device node
+* '/dev/cam_stream'. It allocates the per-file event state and starts the
+* health timer for the first opener.
 *
 * @param inode Pointer to the inode structure representing the device file.
 * @param file Pointer to the file structure for the opened device.
 *
-* @return int 0 on success
+* @return int 0 on success, -ENOMEM on allocation failure
 */
-static int cam_stream_open(struct inode *inode, struct file *file) 
+static int cam_stream_open(struct inode *inode, struct file *file)
 {
-    printk(KERN_INFO "cam_stream open: /dev/cam_stream opened by user-space\n");
+    struct cam_file *cf = kzalloc(sizeof(*cf), GFP_KERNEL);
+
+    if (!cf) return -ENOMEM;
+
+    mutex_lock(&cam_lock);
+    // The first read() returns the current status at once
+    cf->seen = READ_ONCE(shared->events) - 1;
+    list_add(&cf->node, &open_files);
+    if (n_open++ == 0) {
+        mod_delayed_work(system_wq, &health_work, msecs_to_jiffies(HEALTH_TICK_MS));
+    }
+    mutex_unlock(&cam_lock);
+
+    file->private_data = cf;
+    pr_debug("cam_stream open: /dev/cam_stream opened by user-space\n");
     return 0;
 }
 
@@ -82,79 +380,201 @@ static int cam_stream_open(struct inode *inode, struct file *file)
 * @brief Release the cam_stream device.
 *
 * This function is invoked when a user space process closes the device node
-* '/dev/cam_stream'. It logs that the device has been released.
+* '/dev/cam_stream'. When the last file closes while the state still says
+* streaming, the application went away without CAM_IOC_STOP (it crashed),
+* and the stream is shown as stopped.
 *
 * @param inode Pointer to the inode structure representing the device file.
 * @param file Pointer to the file structure for the device being closed.
 *
 * @return int 0 on success
 */
-static int cam_stream_release(struct inode *inode, struct file *file) 
+static int cam_stream_release(struct inode *inode, struct file *file)
 {
-    printk(KERN_INFO "cam_stream release: /dev/cam_stream released by user-space\n");
+    struct cam_file *cf = file->private_data;
+
+    mutex_lock(&cam_lock);
+    list_del(&cf->node);
+    if (--n_open == 0 && READ_ONCE(shared->state) == CAM_STATE_STREAMING) {
+        printk(KERN_WARNING "cam_stream release: Closed while streaming, stream stopped\n");
+        state_set(CAM_STATE_STOPPED);
+    }
+    mutex_unlock(&cam_lock);
+
+    if (cf->efd) eventfd_ctx_put(cf->efd);
+    kfree(cf);
+    pr_debug("cam_stream release: /dev/cam_stream released by user-space\n");
     return 0;
 }
 
+/**
+* @brief Wait for the next health change.
+*
+* Returns one struct cam_event once the health or LED pattern changed since
+* this file's previous read, blocking unless the file is non-blocking.
+*
+* @param file Pointer to the file structure of the device.
+* @param buf User buffer receiving the event.
+* @param count Size of buf; at least sizeof(struct cam_event).
+* @param ppos Unused
+*
+* @return ssize_t sizeof(struct cam_event), -EINVAL for a short buffer,
+*         -EAGAIN without a change on a non-blocking file, -ERESTARTSYS on a signal
+*/
+static ssize_t cam_stream_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct cam_file *cf = file->private_data;
+    struct cam_event ev;
+
+    if (count < sizeof(ev)) return -EINVAL;
+
+    if (READ_ONCE(shared->events) == READ_ONCE(cf->seen)) {
+        if (file->f_flags & O_NONBLOCK) return -EAGAIN;
+        if (wait_event_interruptible(cam_wq, READ_ONCE(shared->events) != READ_ONCE(cf->seen))) {
+            return -ERESTARTSYS;
+        }
+    }
+
+    mutex_lock(&cam_lock);
+    status_get(&ev);
+    cf->seen = ev.events;
+    mutex_unlock(&cam_lock);
+
+    if (copy_to_user(buf, &ev, sizeof(ev))) return -EFAULT;
+    return sizeof(ev);
+}
+
+/**
+* @brief Report whether a health change is waiting to be read.
+*
+* @param file Pointer to the file structure of the device.
+* @param wait Poll table
+*
+* @return __poll_t EPOLLIN | EPOLLRDNORM when read() would not block
+*/
+static __poll_t cam_stream_poll(struct file *file, poll_table *wait)
+{
+    struct cam_file *cf = file->private_data;
+
+    poll_wait(file, &cam_wq, wait);
+    return READ_ONCE(shared->events) != READ_ONCE(cf->seen) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/**
+* @brief Map the telemetry page into userspace.
+*
+* @param file Pointer to the file structure of the device.
+* @param vma Mapping to fill; at most one page at offset 0.
+*
+* @return int 0 on success, -EINVAL for a larger or offset mapping
+*/
+static int cam_stream_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE) return -EINVAL;
+
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    return remap_pfn_range(vma, vma->vm_start, virt_to_phys(shared) >> PAGE_SHIFT,
+                           PAGE_SIZE, vma->vm_page_prot);
+}
+
 /**
 * @brief Handle custom IOCTL commands from user space for LED control.
-* 
+*
 * This function is invoked when a user-space process calls 'ioctl()' on '/dev/cam_stream'.
-* It interprets the command and toggles the corresponding GPIO LEDs to indicate camera
-* streaming status.
+* It interprets the command and updates the streaming state, the LED pattern
+* or the health thresholds.
 *
 * Supported commands:
-*   - CAM_IOC_START : Turn GREEN LED on, RED LED off (camera streaming started)
-*   - CAM_IOC_STOP  : Turn RED LED on, GREEN LED off (camera streaming stopped)
-*   - CAM_IOC_RESET : Turn both RED and GREEN LEDs on (camera reset / YELLOW)
+*   - CAM_IOC_START : Streaming started (GREEN LED)
+*   - CAM_IOC_STOP  : Streaming stopped (RED LED)
+*   - CAM_IOC_RESET : Camera reset (RED and GREEN LEDs on / YELLOW)
+*   - CAM_IOC_SET_LED : Pin an LED pattern, or CAM_LED_AUTO to follow the health
+*   - CAM_IOC_GET_LED : Read the LED pattern shown
+*   - CAM_IOC_SET_POLICY : Set the stall and drop thresholds
+*   - CAM_IOC_GET_STATUS : Read the health and counters
+*   - CAM_IOC_SET_EVENTFD : Signal an eventfd on every health change (-1 detaches)
 *
 * If GPIOs are not initialized (`gpio_ready == false`), the LED actions are
-* simulated via kernel log messages.
+* simulated via debug log messages.
 *
 * @param file Pointer to the file structure representing the device file.
-* @param cmd IOCTL command code (CAM_IOC_START, CAM_IOC_STOP, CAM_IOC_RESET).
-* @param arg Unused argument
-* 
+* @param cmd IOCTL command code.
+* @param arg User pointer to the command's argument, if it has one
+*
 * @return long
 *           - 0 on success
-*           - -EINVAL if an unknown IOCTL command is received
+*           - -EFAULT if the argument cannot be copied
+*           - -EINVAL if an unknown IOCTL command or pattern is received
 */
 static long cam_stream_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
+    struct cam_file *cf = file->private_data;
+    void __user *uarg = (void __user *)arg;
+    struct eventfd_ctx *efd, *old;
+    struct cam_led_policy p;
+    struct cam_event ev;
+    u32 led;
+    s32 fd;
+
     switch (cmd) {
         case CAM_IOC_START:
-            /**
-            * @note The LEDs are anode long-lead type:
-            *           - Setting the GPIO to 1 turns the LED off
-            *           - Setting the GPIO to 0 turns the LED on
-            */
-            printk(KERN_INFO "cam_stream ioctl: START command received\n");
-            if (gpio_ready) {
-                gpiod_set_value(red_led, 1);        // Turn off RED
-                gpiod_set_value(green_led, 0);      // Turn on GREEN
-                printk(KERN_INFO "cam_stream ioctl: LED is GREEN\n");
-            } else {
-                printk(KERN_INFO "cam_stream ioctl: LED is GREEN (Simulated - GPIO not ready)\n");
-            }
+            pr_debug("cam_stream ioctl: START command received\n");
+            mutex_lock(&cam_lock);
+            state_set(CAM_STATE_STREAMING);
+            mutex_unlock(&cam_lock);
             break;
         case CAM_IOC_STOP:
-            printk(KERN_INFO "cam_stream ioctl: STOP command received\n");
-            if (gpio_ready) {
-                gpiod_set_value(green_led, 1);      // Turn off GREEN
-                gpiod_set_value(red_led, 0);        // Turn on RED
-                printk(KERN_INFO "cam_stream ioctl: LED is RED\n\n");
-            } else {
-                printk(KERN_INFO "cam_stream ioctl: LED is RED (Simulated - GPIO not ready)\n");
-            }
+            pr_debug("cam_stream ioctl: STOP command received\n");
+            mutex_lock(&cam_lock);
+            state_set(CAM_STATE_STOPPED);
+            mutex_unlock(&cam_lock);
             break;
         case CAM_IOC_RESET:
-            printk(KERN_INFO "cam_stream ioctl: RESET command received\n");
-            if (gpio_ready) {
-                gpiod_set_value(green_led, 0);      // Turn on RED
-                gpiod_set_value(red_led, 0);        // Turn on GREEN -> Turn on both RED + GREEN = YELLOW
-                printk(KERN_INFO "cam_stream ioctl: LED is YELLOW\n");
-            } else {
-                printk(KERN_INFO "cam_stream ioctl: LED is YELLOW - RESET (simulated)\n");
+            pr_debug("cam_stream ioctl: RESET command received\n");
+            mutex_lock(&cam_lock);
+            state_set(CAM_STATE_RESET);
+            mutex_unlock(&cam_lock);
+            break;
+        case CAM_IOC_SET_LED:
+            if (get_user(led, (u32 __user *)uarg)) return -EFAULT;
+            if (led > CAM_LED_YELLOW_BLINK) return -EINVAL;
+            mutex_lock(&cam_lock);
+            led_pinned = led;
+            blink_on = true;
+            health_update();
+            if (led_blinks(led)) {
+                mod_delayed_work(system_wq, &health_work, msecs_to_jiffies(HEALTH_TICK_MS));
             }
+            mutex_unlock(&cam_lock);
+            break;
+        case CAM_IOC_GET_LED:
+            if (put_user(READ_ONCE(shared->led), (u32 __user *)uarg)) return -EFAULT;
+            break;
+        case CAM_IOC_SET_POLICY:
+            if (copy_from_user(&p, uarg, sizeof(p))) return -EFAULT;
+            mutex_lock(&cam_lock);
+            policy = p;
+            health_update();
+            mutex_unlock(&cam_lock);
+            break;
+        case CAM_IOC_GET_STATUS:
+            mutex_lock(&cam_lock);
+            status_get(&ev);
+            mutex_unlock(&cam_lock);
+            if (copy_to_user(uarg, &ev, sizeof(ev))) return -EFAULT;
+            break;
+        case CAM_IOC_SET_EVENTFD:
+            if (get_user(fd, (s32 __user *)uarg)) return -EFAULT;
+            efd = NULL;
+            if (fd >= 0) {
+                efd = eventfd_ctx_fdget(fd);
+                if (IS_ERR(efd)) return PTR_ERR(efd);
+            }
+            mutex_lock(&cam_lock);
+            old = cf->efd;
+            cf->efd = efd;
+            mutex_unlock(&cam_lock);
+            if (old) eventfd_ctx_put(old);
             break;
         default:
             return -EINVAL;
@@ -165,14 +585,18 @@ static long cam_stream_ioctl(struct file *file, unsigned int cmd, unsigned long
 /**
 * @brief File operations structure for /dev/cam_stream
 *
-* This structure defines the set of operations that the kernel will invoke when a 
+* This structure defines the set of operations that the kernel will invoke when a
 * user-space process interactes with the /dv/cam_stream device. It links system calls
-* open(), release(), and ioctl() to the corresponding function in this driver.
+* open(), release(), read(), poll(), mmap() and ioctl() to the corresponding function
+* in this driver.
 */
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = cam_stream_open,
     .release = cam_stream_release,
+    .read = cam_stream_read,
+    .poll = cam_stream_poll,
+    .mmap = cam_stream_mmap,
     .unlocked_ioctl = cam_stream_ioctl,
 };
 
@@ -180,15 +604,16 @@ static struct file_operations fops = {
 * @brief Module initialization routine for the cam_stream driver.
 *
 * This function is executed when the module is loaded into the kernel. It performs all
-* required setup to make the /dev/cam_stream device functional and ready for user-space 
+* required setup to make the /dev/cam_stream device functional and ready for user-space
 * interaction.
 *
 * The initialization sequence includes:
-*   1. Allocating a dynamic major device number.
-*   2. Creating a device class entry under /sys/class/.
-*   3. Creating the device node /dev/cam_stream.
-*   4. Acquiring GPIO descriptors for the RED and GREEN LEDs.
-*   5. Configuring both LEDS as output and setting the initial LED state.
+*   1. Allocating the shared telemetry page.
+*   2. Allocating a dynamic major device number.
+*   3. Creating a device class entry under /sys/class/.
+*   4. Creating the device node /dev/cam_stream.
+*   5. Acquiring GPIO descriptors for the RED and GREEN LEDs.
+*   6. Configuring both LEDS as output and setting the initial LED state.
 *
 * If any step fails, the function performs appropriate cleanup and returns an error code,
 * preventing the driver from loading in a partially initialized state.
@@ -196,42 +621,55 @@ static struct file_operations fops = {
 * @return 0 on successful initialization
 *         -error code on failure
 */
-static int __init my_init(void) 
+static int __init my_init(void)
 {
     int status_red, status_green;
 
+    BUILD_BUG_ON(sizeof(struct cam_shared) > PAGE_SIZE);
+
     printk(KERN_INFO "cam_stream init: Initializing...\n");
 
-    // 1. Allocate a major number dynamically
+    // 1. Allocate the telemetry page (zeroed: STOPPED, no counters)
+    shared = (struct cam_shared *)get_zeroed_page(GFP_KERNEL);
+    if (!shared) {
+        printk(KERN_ERR "cam_stream init: Failed to allocate the telemetry page\n");
+        return -ENOMEM;
+    }
+    shared->led = CAM_LED_RED;
+
+    // 2. Allocate a major number dynamically
     major = register_chrdev(0, "cam_stream", &fops);
     if (major < 0) {
+        free_page((unsigned long)shared);
         printk(KERN_ERR "cam_stream init: Error registering a major number\n");
         return major;
     }
     printk(KERN_INFO "cam_stream init: Major Device Number - %d\n", major);
 
-    // 2. Create a device class (appears in /sys/class/)
+    // 3. Create a device class (appears in /sys/class/)
     cls = class_create("cam_class");
     if (IS_ERR(cls)) {
         unregister_chrdev(major, "cam_stream");
+        free_page((unsigned long)shared);
         printk(KERN_ALERT "cam_stream init: Failed to create class\n");
         return PTR_ERR(cls);
     }
 
-    // 3. Create the Device Node (/dev/cam_stream)
+    // 4. Create the Device Node (/dev/cam_stream)
     dev = device_create(cls, NULL, MKDEV(major, 0), NULL, "cam_stream");
     if (IS_ERR(dev)) {
         class_destroy(cls);
         unregister_chrdev(major, "cam_stream");
+        free_page((unsigned long)shared);
         printk(KERN_ALERT "cam_stream init: Failed to create Device Node\n");
         return PTR_ERR(dev);
     }
 
-    // 4. Request GPIOs for LED
+    // 5. Request GPIOs for LED
     red_led = gpio_to_desc(LED_RED_GPIO);
     green_led = gpio_to_desc(LED_GREEN_GPIO);
 
-    if (!red_led || !green_led) {      
+    if (!red_led || !green_led) {
         printk(KERN_WARNING "cam_stream init: Failed to add to descriptor one or both GPIOs (RED:%d, GREEN:%d)\n", LED_RED_GPIO, LED_GREEN_GPIO);
         gpio_ready = false;
 
@@ -241,9 +679,9 @@ static int __init my_init(void)
         if (green_led)
             gpiod_put(green_led);
 
-    } else {      
+    } else {
 
-        // 5. Configure LEDs as output and set the initial LED state (OFF)
+        // 6. Configure LEDs as output and set the initial LED state (OFF)
         status_red = gpiod_direction_output(red_led, 1);
         status_green = gpiod_direction_output(green_led, 1);
 
@@ -253,12 +691,12 @@ static int __init my_init(void)
 
         printk(KERN_INFO "cam_stream init: GPIO %d (RED) and %d (GREEN) initialized for LED\n", LED_RED_GPIO, LED_GREEN_GPIO);
         gpio_ready = true;
-
-        // RED LED is the default at the start
-        gpiod_set_value(red_led, 0);
-        printk(KERN_INFO "cam_stream init: LED is RED\n");
     }
 
+    // RED LED is the default at the start
+    led_show(CAM_LED_RED);
+    printk(KERN_INFO "cam_stream init: LED is RED\n");
+
     printk(KERN_INFO "cam_stream init: Device created successfully\n\n");
     return 0;
 }
@@ -271,42 +709,54 @@ static int __init my_init(void)
 * consistent state.
 *
 * The cleanup steps include:
-*   1. Restoring LED GPIOs to their default (inactive) state.
-*   2. Releasing GPIO descriptors if they were successfully acquired.
-*   3. Destroying the /dev/cam_stream device node.
-*   4. Destroying the device class created under /sys/class.
-*   5. Unregistering the dynamically allocated major number.
+*   1. Stopping the health timer.
+*   2. Restoring LED GPIOs to their default (inactive) state.
+*   3. Releasing GPIO descriptors if they were successfully acquired.
+*   4. Destroying the /dev/cam_stream device node.
+*   5. Destroying the device class created under /sys/class.
+*   6. Unregistering the dynamically allocated major number.
+*   7. Freeing the telemetry page.
 */
-static void __exit my_exit(void) 
+static void __exit my_exit(void)
 {
     printk(KERN_INFO "cam_stream exit: Exiting...\n");
 
+    // 1. No file is open any more; only a blinking pattern may still re-arm it
+    mutex_lock(&cam_lock);
+    led_pinned = CAM_LED_OFF;
+    WRITE_ONCE(shared->led, CAM_LED_OFF);
+    mutex_unlock(&cam_lock);
+    cancel_delayed_work_sync(&health_work);
+
     if (gpio_ready) {
-        // 1. Reset the GPIO to inactive state (1 = inactive, 0 = active)
-        gpiod_set_value(red_led, 1);    
-        gpiod_set_value(green_led, 1);    
+        // 2. Reset the GPIO to inactive state (1 = inactive, 0 = active)
+        gpiod_set_value(red_led, 1);
+        gpiod_set_value(green_led, 1);
 
-        // 2. Release the GPIO descriptors
-        gpiod_put(red_led);            
-        gpiod_put(green_led); 
+        // 3. Release the GPIO descriptors
+        gpiod_put(red_led);
+        gpiod_put(green_led);
 
         printk(KERN_INFO "cam_stream exit: GPIO Resources released");
     } else {
         printk(KERN_INFO "cam_stream exit: No GPIO Resources to release");
     }
 
-    // 3. Destroy device node
+    // 4. Destroy device node
     device_destroy(cls, MKDEV(major, 0));
 
-    // 4. Destroy device class
+    // 5. Destroy device class
     class_destroy(cls);
 
-    // 5. Unregister major number
+    // 6. Unregister major number
     unregister_chrdev(major, "cam_stream");
 
+    // 7. Free the telemetry page (no mapping can outlive the module: it holds a reference)
+    free_page((unsigned long)shared);
+
     printk(KERN_INFO "cam_stream exit: Unloaded successfully\n\n");
 }
 
 /* Module initialization and cleanup callbacks */
 module_init(my_init);
-module_exit(my_exit);
\ No newline at end of file
+module_exit(my_exit);
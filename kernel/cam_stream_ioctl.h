@@ -2,17 +2,115 @@
 #define CAM_STREAM_IOCTL_H
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 /**
 * @file cam_stream_ioctl.h
 * @brief Shared IOCTL definitions for cam_stream kernel module and userspace.
 *
-* Provides the IOCTL command codes used by both the kernel module and the userspace application.
+* Provides the IOCTL command codes used by both the kernel module and the userspace application,
+* and the layout of the telemetry page the module maps into userspace.
 */
 
 /** @brief Magic number for IOCTL commands */
 #define CAM_IOC_MAGIC 'k'
 
+/** @brief Layout version of struct cam_shared, written by the streaming application. */
+#define CAM_SHARED_VERSION 1
+
+/**
+* @brief Stream state, kept in cam_shared.state.
+*
+* START, STOP and RESET set the first three; the application sets
+* CAM_STATE_ERROR itself when capture fails.
+*/
+enum cam_state {
+    CAM_STATE_STOPPED = 0,          /**< Not streaming */
+    CAM_STATE_STREAMING,            /**< Streaming */
+    CAM_STATE_RESET,                /**< Device reset */
+    CAM_STATE_ERROR,                /**< Capture failed (see cam_shared.last_error) */
+};
+
+/**
+* @brief Health the module derives from the state and counters.
+*/
+enum cam_health {
+    CAM_HEALTH_STOPPED = 0,         /**< Not streaming */
+    CAM_HEALTH_OK,                  /**< Frames arriving, none dropped lately */
+    CAM_HEALTH_DROPPING,            /**< Frames arriving, some dropped within drop_hold_ms */
+    CAM_HEALTH_STALLED,             /**< Streaming, but no frame for stall_ms */
+    CAM_HEALTH_RESET,               /**< Device reset */
+    CAM_HEALTH_ERROR,               /**< Capture failed */
+};
+
+/**
+* @brief LED patterns.
+*
+* In CAM_LED_AUTO the pattern follows the health: STOPPED red, OK green,
+* DROPPING blinking green, STALLED blinking yellow, RESET yellow, ERROR
+* blinking red. Any other value set with CAM_IOC_SET_LED pins that pattern.
+*/
+enum cam_led {
+    CAM_LED_AUTO = 0,               /**< Follow the health (CAM_IOC_SET_LED only) */
+    CAM_LED_OFF,                    /**< Both LEDs off */
+    CAM_LED_RED,                    /**< RED */
+    CAM_LED_GREEN,                  /**< GREEN */
+    CAM_LED_YELLOW,                 /**< RED + GREEN */
+    CAM_LED_RED_BLINK,              /**< Blinking RED */
+    CAM_LED_GREEN_BLINK,            /**< Blinking GREEN */
+    CAM_LED_YELLOW_BLINK,           /**< Blinking RED + GREEN */
+};
+
+/**
+* @brief Telemetry page shared by the module and userspace (mmap of /dev/cam_stream).
+*
+* The streaming application stores its counters here with plain memory
+* writes, so updating them per frame costs no system call; the module
+* samples them from a timer to derive the health and the LED pattern.
+* Monitoring daemons may map the page read-only. Counters are cumulative
+* since the application mapped the page.
+*/
+struct cam_shared {
+    /* Written by the streaming application */
+    __u32 version;                  /**< CAM_SHARED_VERSION once the counters are maintained (0 = never) */
+    __u32 state;                    /**< enum cam_state */
+    __u64 frames;                   /**< Frames captured */
+    __u64 drops;                    /**< Frames the capture driver dropped */
+    __u64 last_frame_ns;            /**< CLOCK_MONOTONIC time of the last frame */
+    __u32 fps_milli;                /**< Smoothed frame rate, in 1/1000 frames per second */
+    __s32 last_error;               /**< errno of the last capture failure (0 = none) */
+
+    /* Written by the module */
+    __u32 health;                   /**< enum cam_health */
+    __u32 led;                      /**< enum cam_led shown */
+    __u32 events;                   /**< Health or LED changes so far */
+    __u32 reserved;                 /**< Zero */
+};
+
+/**
+* @brief One health change, as returned by read() on /dev/cam_stream.
+*
+* read() blocks until the health or LED pattern changed since the caller's
+* previous read; poll() reports POLLIN meanwhile. The first read after open()
+* returns at once with the current status.
+*/
+struct cam_event {
+    __u32 events;                   /**< cam_shared.events at the change */
+    __u32 health;                   /**< enum cam_health */
+    __u32 led;                      /**< enum cam_led shown */
+    __u32 state;                    /**< enum cam_state */
+    __u64 frames;                   /**< Frames captured */
+    __u64 drops;                    /**< Frames dropped */
+};
+
+/**
+* @brief Thresholds of the derived health.
+*/
+struct cam_led_policy {
+    __u32 stall_ms;                 /**< STALLED once no frame arrived for this long (0 = never) */
+    __u32 drop_hold_ms;             /**< DROPPING for this long after the last drop (0 = never) */
+};
+
 /** @brief IOCTL command to start LED (GREEN) */
 #define CAM_IOC_START _IO(CAM_IOC_MAGIC, 1)
 
@@ -22,4 +120,19 @@
 /** @brief IOCTL command to reset the device */
 #define CAM_IOC_RESET _IO(CAM_IOC_MAGIC, 3)
 
-#endif /* CAM_STREAM_IOCTL_H */
\ No newline at end of file
+/** @brief IOCTL command to pin an LED pattern (enum cam_led), or CAM_LED_AUTO to follow the health */
+#define CAM_IOC_SET_LED _IOW(CAM_IOC_MAGIC, 4, __u32)
+
+/** @brief IOCTL command to read the LED pattern shown (enum cam_led) */
+#define CAM_IOC_GET_LED _IOR(CAM_IOC_MAGIC, 5, __u32)
+
+/** @brief IOCTL command to set the health thresholds */
+#define CAM_IOC_SET_POLICY _IOW(CAM_IOC_MAGIC, 6, struct cam_led_policy)
+
+/** @brief IOCTL command to read the current status without consuming an event */
+#define CAM_IOC_GET_STATUS _IOR(CAM_IOC_MAGIC, 7, struct cam_event)
+
+/** @brief IOCTL command to signal an eventfd on every health change (-1 detaches) */
+#define CAM_IOC_SET_EVENTFD _IOW(CAM_IOC_MAGIC, 8, __s32)
+
+#endif /* CAM_STREAM_IOCTL_H */
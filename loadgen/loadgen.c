@@ -0,0 +1,986 @@
+/**
+* @file loadgen.c
+* @brief Multi-client load generator and soak-test harness for the streaming server.
+*
+* Opens N concurrent connections to a running camera_client and consumes
+* what it serves:
+*   1. stream:   GET /stream, multipart parts parsed by their boundary
+*   2. ws:       GET /ws, WebSocket binary messages, each one acked
+*   3. snapshot: GET /snapshot.jpg repeatedly (-f per client and second)
+*
+* A number of the clients can be made slow: their reads are limited to a
+* byte rate by a token bucket and their receive buffer can be shrunk, so
+* the server sees the backpressure of a real slow link. Every client that
+* loses its connection reconnects after a second, so a soak run survives
+* server restarts and reports them.
+*
+* Every report interval it prints the connected clients, per-client fps
+* (median and minimum), inter-frame jitter (standard deviation of the gap
+* between frames), receive rate and reconnects, next to the server's own
+* drop and skip counters scraped from /metrics. At the end each client is
+* summarized, and with -o everything is also written as JSON.
+*
+* Single-threaded on epoll, so one instance drives thousands of clients;
+* run several on other hosts to load a server beyond one NIC.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+/** @brief Receive buffer of one client (response and part headers must fit). */
+#define CLIENT_BUF          16384
+
+/** @brief Delay before a lost connection is retried. */
+#define RECONNECT_NS        1000000000ULL
+
+/** @brief Longest sleep of the event loop (token refill granularity). */
+#define TICK_MS             10
+
+/** @brief Default number of clients. */
+#define DEFAULT_CLIENTS     10
+
+/** @brief Default report interval in seconds. */
+#define DEFAULT_INTERVAL    5
+
+/** @brief Largest /metrics response read. */
+#define METRICS_MAX         65536
+
+/** @brief Transports a client can use. */
+enum client_mode {
+    MODE_STREAM,            /**< multipart/x-mixed-replace MJPEG */
+    MODE_WS,                /**< WebSocket binary messages with acks */
+    MODE_SNAPSHOT,          /**< One still frame per request */
+};
+
+static const char *const mode_names[] = { "stream", "ws", "snapshot" };
+static const char *const mode_paths[] = { "/stream", "/ws", "/snapshot.jpg" };
+
+/** @brief Where a client is in its connection. */
+enum client_state {
+    CL_IDLE,                /**< Not connected; (re)connects at next_connect_ns */
+    CL_CONNECTING,          /**< Non-blocking connect in progress */
+    CL_RESPONSE,            /**< Waiting for the HTTP response header */
+    CL_PART,                /**< Waiting for a multipart part header */
+    CL_WS_HEAD,             /**< Waiting for a WebSocket frame header */
+    CL_BODY,                /**< Consuming body_left bytes of payload */
+};
+
+/**
+* @brief Frame statistics over some period
+*/
+struct client_stats {
+    unsigned long frames;   /**< Complete frames received */
+    unsigned long bytes;    /**< Bytes received (headers included) */
+    unsigned long gaps;     /**< Inter-frame gaps measured */
+    double gap_sum;         /**< Sum of the gaps (ns) */
+    double gap_sq;          /**< Sum of the squared gaps */
+    double gap_max;         /**< Longest gap (ns) */
+};
+
+/**
+* @brief One simulated viewer
+*/
+struct client {
+    unsigned int id;
+    int fd;
+    enum client_state state;
+    bool slow;                      /**< Bandwidth limited */
+    char buf[CLIENT_BUF];           /**< Bytes read and not yet parsed */
+    size_t len;                     /**< Valid bytes in buf */
+    char boundary[72];              /**< "--" plus the multipart boundary */
+    unsigned long body_left;        /**< Payload bytes still to consume */
+    bool body_frame;                /**< The payload is a JPEG frame */
+    bool check_magic;               /**< The payload's first bytes are still to be checked */
+    unsigned int ws_opcode;         /**< Opcode of the current WebSocket frame */
+    bool ws_fin;                    /**< The current WebSocket frame ends its message */
+    uint64_t next_connect_ns;       /**< When to (re)connect in CL_IDLE */
+    uint64_t last_frame_ns;         /**< Completion of the previous frame (0 = none yet) */
+    double tokens;                  /**< Bytes the client may read now (slow clients) */
+    uint64_t token_ns;              /**< Last refill of tokens */
+    bool throttled;                 /**< Reading paused until tokens are refilled */
+    struct client_stats iv;         /**< Current report interval */
+    struct client_stats total;      /**< Whole run */
+    unsigned long reconnects;       /**< Connections lost (and retried) */
+    unsigned long bad_frames;       /**< Payloads that did not start like a JPEG */
+};
+
+/** @brief Server counters reported as deltas next to the client view. */
+static const struct { const char *metric, *label; } server_counters[] = {
+    { "camera_frames_published_total", "published" },
+    { "camera_ring_drops_total",       "ring_drops" },
+    { "camera_rate_skips_total",       "rate_skips" },
+    { "camera_encoder_drops_total",    "encoder_drops" },
+    { "camera_capture_drops_total",    "capture_drops" },
+    { "camera_ws_acks_total",          "ws_acks" },
+};
+#define N_SERVER_COUNTERS   (sizeof(server_counters) / sizeof(server_counters[0]))
+
+/** @brief Settings from the command line. */
+static struct {
+    const char *host;
+    const char *port;
+    unsigned int n_clients;
+    enum client_mode mode;
+    const char *path;
+    unsigned int n_slow;            /**< Clients 0 .. n_slow-1 are slow */
+    double slow_rate;               /**< Bytes per second of a slow client */
+    int slow_rcvbuf;                /**< SO_RCVBUF of a slow client (0 = system default) */
+    double snapshot_fps;            /**< Requests per second and snapshot client (0 = back to back) */
+    unsigned int duration_s;        /**< Run time (0 = until interrupted) */
+    unsigned int interval_s;        /**< Report interval */
+    double ramp;                    /**< Clients started per second (0 = all at once) */
+    const char *json;               /**< JSON summary file, or NULL */
+    bool verbose;                   /**< Per-client lines in every report */
+    bool scrape;                    /**< Scrape /metrics */
+} opt = {
+    .host = "127.0.0.1",
+    .port = "8080",
+    .n_clients = DEFAULT_CLIENTS,
+    .interval_s = DEFAULT_INTERVAL,
+    .scrape = true,
+};
+
+static struct addrinfo *server_addr;
+static struct client *clients;
+static int epfd = -1;
+static volatile sig_atomic_t stop;
+
+/** @brief Server counters at the start of the run and of the interval. */
+static double counters_start[N_SERVER_COUNTERS], counters_prev[N_SERVER_COUNTERS];
+static bool counters_valid;
+
+/** Function Prototypes */
+static void client_drop(struct client *c, uint64_t now, const char *why);
+
+/* ------------------------------------------------------------------------ */
+/* Helpers                                                                  */
+/* ------------------------------------------------------------------------ */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+* @brief Find a byte sequence in a buffer
+*
+* @return Offset of the first match, or -1
+*/
+static long find(const char *buf, size_t len, const char *needle)
+{
+    size_t n = strlen(needle);
+
+    for (size_t i = 0; i + n <= len; i++) {
+        if (memcmp(buf + i, needle, n) == 0) return (long)i;
+    }
+    return -1;
+}
+
+/**
+* @brief Value of a header in a header block (name matched case-insensitively)
+*
+* @return true if the header was found
+*/
+static bool header_value(const char *hdr, size_t len, const char *name, char *out, size_t cap)
+{
+    size_t n = strlen(name);
+    const char *end = hdr + len;
+
+    for (const char *line = hdr; line < end; ) {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        if (!eol) eol = end;
+
+        if ((size_t)(eol - line) > n && strncasecmp(line, name, n) == 0 && line[n] == ':') {
+            const char *v = line + n + 1;
+            while (v < eol && *v == ' ') v++;
+            size_t vlen = (size_t)(eol - v);
+            while (vlen && (v[vlen - 1] == '\r' || v[vlen - 1] == ' ')) vlen--;
+            if (vlen >= cap) vlen = cap - 1;
+            memcpy(out, v, vlen);
+            out[vlen] = '\0';
+            return true;
+        }
+        line = eol + 1;
+    }
+    return false;
+}
+
+/**
+* @brief Mean and standard deviation of the gaps of a period, in ms
+*/
+static double gap_mean_ms(const struct client_stats *s)
+{
+    return s->gaps ? s->gap_sum / s->gaps / 1e6 : 0.0;
+}
+
+static double jitter_ms(const struct client_stats *s)
+{
+    if (s->gaps < 2) return 0.0;
+    double mean = s->gap_sum / s->gaps;
+    double var = s->gap_sq / s->gaps - mean * mean;
+    return var > 0 ? sqrt(var) / 1e6 : 0.0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Connections                                                              */
+/* ------------------------------------------------------------------------ */
+
+/**
+* @brief Change the events a client waits for
+*/
+static void client_watch(struct client *c, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/**
+* @brief Start a non-blocking connection to the server
+*/
+static void client_connect(struct client *c, uint64_t now)
+{
+    c->fd = socket(server_addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) {
+        perror("loadgen: socket");
+        c->next_connect_ns = now + RECONNECT_NS;
+        return;
+    }
+
+    if (c->slow && opt.slow_rcvbuf > 0) {
+        setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &opt.slow_rcvbuf, sizeof(opt.slow_rcvbuf));
+    }
+
+    if (connect(c->fd, server_addr->ai_addr, server_addr->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        client_drop(c, now, strerror(errno));
+        return;
+    }
+
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        perror("loadgen: epoll_ctl");
+        close(c->fd);
+        c->fd = -1;
+        c->next_connect_ns = now + RECONNECT_NS;
+        return;
+    }
+
+    c->state = CL_CONNECTING;
+    c->len = 0;
+    c->throttled = false;
+    c->token_ns = now;
+    c->tokens = 0;
+}
+
+/**
+* @brief Close a client's connection and schedule the next one
+*
+* @param why    Reason (printed with -v), or NULL for a planned close
+*/
+static void client_drop(struct client *c, uint64_t now, const char *why)
+{
+    if (c->fd >= 0) close(c->fd);          // Also removes it from the epoll set
+    c->fd = -1;
+    c->state = CL_IDLE;
+
+    if (why) {
+        c->last_frame_ns = 0;               // The outage is not an inter-frame gap
+        c->reconnects++;
+        c->next_connect_ns = now + RECONNECT_NS;
+        if (opt.verbose) fprintf(stderr, "loadgen: Client %u: %s, reconnecting\n", c->id, why);
+    } else {
+        c->next_connect_ns = now + (opt.snapshot_fps > 0 ? (uint64_t)(1e9 / opt.snapshot_fps) : 0);
+    }
+}
+
+/**
+* @brief Connection established: send the request of the client's mode
+*
+* @return 0 on success, -1 on failure
+*/
+static int client_send_request(struct client *c)
+{
+    char req[512];
+    int err = 0;
+    socklen_t elen = sizeof(err);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &elen) < 0 || err) {
+        errno = err;
+        return -1;
+    }
+
+    int n;
+    if (opt.mode == MODE_WS) {
+        n = snprintf(req, sizeof(req),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "\r\n", opt.path, opt.host);
+    } else {
+        n = snprintf(req, sizeof(req),
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "Connection: close\r\n"
+                     "\r\n", opt.path, opt.host);
+    }
+
+    if (write(c->fd, req, (size_t)n) != n) return -1;
+
+    c->state = CL_RESPONSE;
+    client_watch(c, EPOLLIN);
+    return 0;
+}
+
+/**
+* @brief Count a complete frame and its gap to the previous one
+*/
+static void frame_done(struct client *c, uint64_t now)
+{
+    c->iv.frames++;
+    c->total.frames++;
+
+    if (c->last_frame_ns) {
+        double gap = (double)(now - c->last_frame_ns);
+        struct client_stats *s[2] = { &c->iv, &c->total };
+        for (int i = 0; i < 2; i++) {
+            s[i]->gaps++;
+            s[i]->gap_sum += gap;
+            s[i]->gap_sq += gap * gap;
+            if (gap > s[i]->gap_max) s[i]->gap_max = gap;
+        }
+    }
+    c->last_frame_ns = now;
+}
+
+/**
+* @brief Acknowledge a WebSocket message (empty masked binary frame)
+*
+* @return 0 on success, -1 on failure
+*/
+static int ws_ack(struct client *c)
+{
+    static const unsigned char ack[] = { 0x82, 0x80, 0x12, 0x34, 0x56, 0x78 };
+    return write(c->fd, ack, sizeof(ack)) == (ssize_t)sizeof(ack) ? 0 : -1;
+}
+
+/**
+* @brief Parse the HTTP response header of a new connection
+*
+* @return Bytes consumed, 0 if incomplete, -1 on an unexpected response
+*/
+static long parse_response(struct client *c, const char *p, size_t avail)
+{
+    long end = find(p, avail, "\r\n\r\n");
+    if (end < 0) return 0;
+    size_t hlen = (size_t)end + 4;
+    char value[128];
+
+    const char *expect = opt.mode == MODE_WS ? " 101" : " 200";
+    if (avail < 12 || memcmp(p + 8, expect, 4) != 0) return -1;
+
+    switch (opt.mode) {
+        case MODE_STREAM: {
+            if (!header_value(p, hlen, "Content-Type", value, sizeof(value))) return -1;
+            char *b = strstr(value, "boundary=");
+            if (!b) return -1;
+            b += strlen("boundary=");
+            b[strcspn(b, "; ")] = '\0';
+            snprintf(c->boundary, sizeof(c->boundary), "--%s", b);
+            c->state = CL_PART;
+            break;
+        }
+        case MODE_WS:
+            c->state = CL_WS_HEAD;
+            break;
+        case MODE_SNAPSHOT:
+            if (!header_value(p, hlen, "Content-Length", value, sizeof(value))) return -1;
+            c->body_left = strtoul(value, NULL, 10);
+            c->body_frame = true;
+            c->check_magic = true;
+            c->state = CL_BODY;
+            break;
+    }
+    return (long)hlen;
+}
+
+/**
+* @brief Parse a multipart part header ("--boundary", headers, blank line)
+*
+* @return Bytes consumed, 0 if incomplete, -1 on a malformed part
+*/
+static long parse_part(struct client *c, const char *p, size_t avail)
+{
+    long end = find(p, avail, "\r\n\r\n");
+    char value[32];
+
+    if (end < 0) return 0;
+
+    // The block starts with the previous part's trailing CRLF
+    size_t hlen = (size_t)end + 4;
+    if (find(p, hlen, c->boundary) < 0) return -1;
+    if (!header_value(p, hlen, "Content-Length", value, sizeof(value))) return -1;
+
+    c->body_left = strtoul(value, NULL, 10);
+    c->body_frame = true;
+    c->check_magic = true;
+    c->state = CL_BODY;
+    return (long)hlen;
+}
+
+/**
+* @brief Parse a WebSocket frame header from the server (unmasked)
+*
+* @return Bytes consumed, 0 if incomplete, -1 on a malformed frame
+*/
+static long parse_ws_head(struct client *c, const unsigned char *p, size_t avail)
+{
+    if (avail < 2) return 0;
+    if (p[1] & 0x80) return -1;                 // Server frames are never masked
+
+    unsigned long len = p[1] & 0x7F;
+    size_t hlen = 2;
+    if (len == 126) {
+        if (avail < 4) return 0;
+        len = (unsigned long)p[2] << 8 | p[3];
+        hlen = 4;
+    } else if (len == 127) {
+        if (avail < 10) return 0;
+        len = 0;
+        for (int i = 0; i < 8; i++) len = len << 8 | p[2 + i];
+        hlen = 10;
+    }
+
+    c->ws_fin = p[0] & 0x80;
+    c->ws_opcode = p[0] & 0x0F;
+    c->body_left = len;
+    c->body_frame = c->ws_opcode <= 0x2;        // Continuation, text or binary
+    c->check_magic = c->ws_opcode == 0x2;       // First fragment of a binary message
+    c->state = CL_BODY;
+    return (long)hlen;
+}
+
+/**
+* @brief A payload has been consumed completely
+*
+* @return 0 to go on parsing, 1 if the connection was closed as planned, -1 on error
+*/
+static int body_done(struct client *c, uint64_t now)
+{
+    switch (opt.mode) {
+        case MODE_STREAM:
+            frame_done(c, now);
+            c->state = CL_PART;
+            return 0;
+        case MODE_WS:
+            if (c->ws_opcode == 0x8) return -1;             // Close from the server
+            if (c->body_frame && c->ws_fin) {
+                frame_done(c, now);
+                if (ws_ack(c) < 0) return -1;
+            }
+            c->state = CL_WS_HEAD;
+            return 0;
+        case MODE_SNAPSHOT:
+            frame_done(c, now);
+            client_drop(c, now, NULL);
+            return 1;
+    }
+    return -1;
+}
+
+/**
+* @brief Parse what a client has buffered
+*
+* @return 0 on success, 1 if the connection was closed as planned, -1 on a protocol error
+*/
+static int client_parse(struct client *c, uint64_t now)
+{
+    size_t off = 0;
+
+    for (;;) {
+        const char *p = c->buf + off;
+        size_t avail = c->len - off;
+        long used = 0;
+
+        switch (c->state) {
+            case CL_RESPONSE: used = parse_response(c, p, avail); break;
+            case CL_PART:     used = parse_part(c, p, avail); break;
+            case CL_WS_HEAD:  used = parse_ws_head(c, (const unsigned char *)p, avail); break;
+            case CL_BODY:
+                if (c->check_magic && c->body_left >= 2) {
+                    if (avail < 2) break;
+                    if ((unsigned char)p[0] != 0xFF || (unsigned char)p[1] != 0xD8) c->bad_frames++;
+                }
+                c->check_magic = false;
+
+                used = (long)(avail < c->body_left ? avail : c->body_left);
+                c->body_left -= (unsigned long)used;
+                off += (size_t)used;
+                if (c->body_left == 0) {
+                    int r = body_done(c, now);
+                    if (r != 0) return r;
+                    continue;
+                }
+                used = 0;
+                break;
+            default:
+                return -1;
+        }
+
+        if (used < 0) return -1;
+        if (used == 0) break;
+        off += (size_t)used;
+    }
+
+    // Headers larger than the buffer cannot be parsed
+    if (off == 0 && c->len == sizeof(c->buf)) return -1;
+
+    memmove(c->buf, c->buf + off, c->len - off);
+    c->len -= off;
+    return 0;
+}
+
+/**
+* @brief Read what the socket (and, for a slow client, its tokens) allows
+*/
+static void client_read(struct client *c, uint64_t now)
+{
+    size_t room = sizeof(c->buf) - c->len;
+
+    if (c->slow) {
+        if (c->tokens < 1) {
+            c->throttled = true;
+            client_watch(c, 0);
+            return;
+        }
+        if ((double)room > c->tokens) room = (size_t)c->tokens;
+    }
+
+    ssize_t n = read(c->fd, c->buf + c->len, room);
+    if (n == 0) {
+        client_drop(c, now, "closed by the server");
+        return;
+    }
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR) client_drop(c, now, strerror(errno));
+        return;
+    }
+
+    c->len += (size_t)n;
+    c->iv.bytes += (unsigned long)n;
+    c->total.bytes += (unsigned long)n;
+    if (c->slow) c->tokens -= (double)n;
+
+    if (client_parse(c, now) < 0) client_drop(c, now, "unexpected data");
+}
+
+/**
+* @brief Refill the token buckets of slow clients and resume reading
+*/
+static void refill_tokens(uint64_t now)
+{
+    double burst = opt.slow_rate / 10 > 1024 ? opt.slow_rate / 10 : 1024;
+
+    for (unsigned int i = 0; i < opt.n_slow; i++) {
+        struct client *c = &clients[i];
+        if (c->state == CL_IDLE || c->state == CL_CONNECTING) continue;
+
+        c->tokens += opt.slow_rate * (double)(now - c->token_ns) / 1e9;
+        if (c->tokens > burst) c->tokens = burst;
+        c->token_ns = now;
+
+        if (c->throttled && c->tokens >= 1) {
+            c->throttled = false;
+            client_watch(c, EPOLLIN);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------ */
+/* Server counters                                                          */
+/* ------------------------------------------------------------------------ */
+
+/**
+* @brief Fetch /metrics and pick out the server counters
+*
+* Blocking with a 2 s timeout; the clients are not served meanwhile.
+*
+* @param values Receives one value per server_counters entry
+*
+* @return 0 on success, -1 if the metrics could not be fetched
+*/
+static int scrape_counters(double values[N_SERVER_COUNTERS])
+{
+    static char resp[METRICS_MAX];
+    struct timeval tv = { .tv_sec = 2 };
+    size_t len = 0;
+    int fd = socket(server_addr->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (connect(fd, server_addr->ai_addr, server_addr->ai_addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char req[256];
+    int n = snprintf(req, sizeof(req), "GET /metrics HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+                     opt.host);
+    if (write(fd, req, (size_t)n) != n) {
+        close(fd);
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t r = read(fd, resp + len, sizeof(resp) - 1 - len);
+        if (r <= 0) break;
+        len += (size_t)r;
+        if (len == sizeof(resp) - 1) break;
+    }
+    close(fd);
+    resp[len] = '\0';
+
+    bool found = false;
+    memset(values, 0, sizeof(double) * N_SERVER_COUNTERS);
+    for (char *line = resp; line && *line; ) {
+        char *eol = strchr(line, '\n');
+        if (eol) *eol = '\0';
+        if (strncmp(line, "camera_", 7) == 0) found = true;
+
+        for (unsigned int i = 0; i < N_SERVER_COUNTERS; i++) {
+            size_t m = strlen(server_counters[i].metric);
+            if (strncmp(line, server_counters[i].metric, m) == 0 && (line[m] == ' ' || line[m] == '{')) {
+                const char *v = strrchr(line, ' ');
+                if (v) values[i] += strtod(v + 1, NULL);
+            }
+        }
+        line = eol ? eol + 1 : NULL;
+    }
+    return found ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Reports                                                                  */
+/* ------------------------------------------------------------------------ */
+
+/**
+* @brief Print one interval line and reset the interval statistics
+*/
+static void report(uint64_t elapsed_ns, double interval_s)
+{
+    static double *fps, *jit;
+    unsigned int connected = 0, n = 0;
+    unsigned long frames = 0, bytes = 0, reconnects = 0;
+    double max_jit = 0;
+
+    if (!fps) {
+        fps = calloc(opt.n_clients, sizeof(*fps));
+        jit = calloc(opt.n_clients, sizeof(*jit));
+        if (!fps || !jit) return;
+    }
+
+    for (unsigned int i = 0; i < opt.n_clients; i++) {
+        struct client *c = &clients[i];
+        if (c->state != CL_IDLE && c->state != CL_CONNECTING) connected++;
+        frames += c->iv.frames;
+        bytes += c->iv.bytes;
+        reconnects += c->reconnects;
+
+        if (c->iv.frames > 0 || c->state >= CL_RESPONSE) {
+            fps[n] = c->iv.frames / interval_s;
+            jit[n] = jitter_ms(&c->iv);
+            if (jit[n] > max_jit) max_jit = jit[n];
+            n++;
+        }
+
+        if (opt.verbose) {
+            printf("  client %-4u %-8s %s %7.1f fps  gap %7.1f ms  jitter %7.1f ms  max %7.1f ms  %9.1f kB/s\n",
+                   c->id, mode_names[opt.mode], c->slow ? "slow" : "    ", c->iv.frames / interval_s,
+                   gap_mean_ms(&c->iv), jitter_ms(&c->iv), c->iv.gap_max / 1e6, c->iv.bytes / interval_s / 1e3);
+        }
+        memset(&c->iv, 0, sizeof(c->iv));
+    }
+
+    qsort(fps, n, sizeof(*fps), cmp_double);
+    qsort(jit, n, sizeof(*jit), cmp_double);
+
+    printf("[%6.0f s] %u/%u clients %8.1f fps (client p50 %.1f, min %.1f)  jitter p50 %.1f ms max %.1f ms"
+           "  %7.2f MB/s  reconnects %lu",
+           elapsed_ns / 1e9, connected, opt.n_clients, frames / interval_s,
+           n ? fps[n / 2] : 0.0, n ? fps[0] : 0.0, n ? jit[n / 2] : 0.0, max_jit,
+           bytes / interval_s / 1e6, reconnects);
+
+    double now_counters[N_SERVER_COUNTERS];
+    if (opt.scrape && scrape_counters(now_counters) == 0) {
+        if (!counters_valid) {
+            memcpy(counters_start, now_counters, sizeof(counters_start));
+            memcpy(counters_prev, now_counters, sizeof(counters_prev));
+            counters_valid = true;
+        }
+        printf("  | server:");
+        for (unsigned int i = 0; i < N_SERVER_COUNTERS; i++) {
+            printf(" %s %.0f", server_counters[i].label, now_counters[i] - counters_prev[i]);
+        }
+        memcpy(counters_prev, now_counters, sizeof(counters_prev));
+    } else if (opt.scrape) {
+        printf("  | server: /metrics unavailable");
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+* @brief Print the per-client summary of the whole run and write the JSON report
+*
+* @return 0 on success, -1 if the JSON file could not be written
+*/
+static int summarize(double run_s)
+{
+    printf("\nclient mode     slow  frames     fps   gap ms  jitter ms  max gap ms      kB/s  reconnects  bad\n");
+    for (unsigned int i = 0; i < opt.n_clients; i++) {
+        const struct client *c = &clients[i];
+        printf("%-6u %-8s %-4s %7lu %7.1f %8.1f %10.1f %11.1f %9.1f %11lu %4lu\n",
+               c->id, mode_names[opt.mode], c->slow ? "yes" : "no", c->total.frames,
+               c->total.frames / run_s, gap_mean_ms(&c->total), jitter_ms(&c->total),
+               c->total.gap_max / 1e6, c->total.bytes / run_s / 1e3, c->reconnects, c->bad_frames);
+    }
+
+    if (!opt.json) return 0;
+
+    FILE *f = strcmp(opt.json, "-") == 0 ? stdout : fopen(opt.json, "w");
+    if (!f) {
+        perror("loadgen: Failed to open JSON output");
+        return -1;
+    }
+
+    fprintf(f, "{\n  \"config\": {\"host\": \"%s\", \"port\": \"%s\", \"mode\": \"%s\", \"path\": \"%s\", "
+               "\"clients\": %u, \"slow\": %u, \"slow_rate\": %.0f, \"seconds\": %.1f},\n",
+            opt.host, opt.port, mode_names[opt.mode], opt.path, opt.n_clients, opt.n_slow,
+            opt.slow_rate, run_s);
+
+    fprintf(f, "  \"server\": {");
+    double end[N_SERVER_COUNTERS];
+    if (counters_valid && scrape_counters(end) == 0) {
+        for (unsigned int i = 0; i < N_SERVER_COUNTERS; i++) {
+            fprintf(f, "%s\"%s\": %.0f", i ? ", " : "", server_counters[i].label, end[i] - counters_start[i]);
+        }
+    }
+    fprintf(f, "},\n  \"clients\": [\n");
+
+    for (unsigned int i = 0; i < opt.n_clients; i++) {
+        const struct client *c = &clients[i];
+        fprintf(f, "    {\"id\": %u, \"slow\": %s, \"frames\": %lu, \"fps\": %.2f, \"gap_ms\": %.2f, "
+                   "\"jitter_ms\": %.2f, \"max_gap_ms\": %.2f, \"bytes_per_s\": %.0f, "
+                   "\"reconnects\": %lu, \"bad_frames\": %lu}%s\n",
+                c->id, c->slow ? "true" : "false", c->total.frames, c->total.frames / run_s,
+                gap_mean_ms(&c->total), jitter_ms(&c->total), c->total.gap_max / 1e6,
+                c->total.bytes / run_s, c->reconnects, c->bad_frames, i + 1 < opt.n_clients ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (f != stdout) fclose(f);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Main                                                                     */
+/* ------------------------------------------------------------------------ */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [host[:port]]   (default 127.0.0.1:8080)\n"
+            "  -n clients  Concurrent clients (default %d)\n"
+            "  -m mode     stream, ws or snapshot (default stream)\n"
+            "  -u path     Request path, e.g. /cam1/stream?res=320x240 (default per mode)\n"
+            "  -s count    Clients that are bandwidth limited (default 0)\n"
+            "  -b rate     Bytes per second of a slow client (default 100000)\n"
+            "  -k bytes    Receive buffer of a slow client (default: system)\n"
+            "  -f fps      Snapshot requests per second and client (default: back to back)\n"
+            "  -r rate     Clients started per second (default: all at once)\n"
+            "  -d seconds  Run time (default: until interrupted)\n"
+            "  -i seconds  Report interval (default %d)\n"
+            "  -o file     Also write the summary as JSON ('-' = stdout)\n"
+            "  -M          Do not scrape the server's /metrics\n"
+            "  -v          Per-client lines in every report\n",
+            prog, DEFAULT_CLIENTS, DEFAULT_INTERVAL);
+}
+
+int main(int argc, char **argv)
+{
+    int o;
+
+    opt.slow_rate = 100000;
+    opt.path = NULL;
+
+    while ((o = getopt(argc, argv, "n:m:u:s:b:k:f:r:d:i:o:Mv")) != -1) {
+        switch (o) {
+            case 'n': opt.n_clients = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'm':
+                if (strcmp(optarg, "stream") == 0) opt.mode = MODE_STREAM;
+                else if (strcmp(optarg, "ws") == 0) opt.mode = MODE_WS;
+                else if (strcmp(optarg, "snapshot") == 0) opt.mode = MODE_SNAPSHOT;
+                else {
+                    fprintf(stderr, "loadgen: Unknown mode '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'u': opt.path = optarg; break;
+            case 's': opt.n_slow = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'b': opt.slow_rate = strtod(optarg, NULL); break;
+            case 'k': opt.slow_rcvbuf = atoi(optarg); break;
+            case 'f': opt.snapshot_fps = strtod(optarg, NULL); break;
+            case 'r': opt.ramp = strtod(optarg, NULL); break;
+            case 'd': opt.duration_s = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'i': opt.interval_s = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'o': opt.json = optarg; break;
+            case 'M': opt.scrape = false; break;
+            case 'v': opt.verbose = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind < argc) {
+        static char host[256];
+        snprintf(host, sizeof(host), "%s", argv[optind]);
+        char *colon = strrchr(host, ':');
+        if (colon) {
+            *colon = '\0';
+            opt.port = colon + 1;
+        }
+        opt.host = host;
+    }
+    if (!opt.path) opt.path = mode_paths[opt.mode];
+    if (opt.n_clients < 1) opt.n_clients = 1;
+    if (opt.n_slow > opt.n_clients) opt.n_slow = opt.n_clients;
+    if (opt.interval_s < 1) opt.interval_s = 1;
+    if (opt.slow_rate < 1) opt.slow_rate = 1;
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int err = getaddrinfo(opt.host, opt.port, &hints, &server_addr);
+    if (err) {
+        fprintf(stderr, "loadgen: %s:%s: %s\n", opt.host, opt.port, gai_strerror(err));
+        return 1;
+    }
+
+    // Every client needs a descriptor
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < opt.n_clients + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < opt.n_clients + 16) {
+            fprintf(stderr, "loadgen: Only %lu descriptors allowed (raise ulimit -n)\n",
+                    (unsigned long)rl.rlim_cur);
+        }
+    }
+
+    clients = calloc(opt.n_clients, sizeof(*clients));
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!clients || epfd < 0) {
+        perror("loadgen: Failed to set up");
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t start = now_ns();
+    for (unsigned int i = 0; i < opt.n_clients; i++) {
+        clients[i].id = i;
+        clients[i].fd = -1;
+        clients[i].slow = i < opt.n_slow;
+        clients[i].next_connect_ns = start + (opt.ramp > 0 ? (uint64_t)(i * 1e9 / opt.ramp) : 0);
+    }
+
+    printf("loadgen: %u %s clients on %s:%s%s (%u slow at %.0f B/s)\n", opt.n_clients,
+           mode_names[opt.mode], opt.host, opt.port, opt.path, opt.n_slow, opt.slow_rate);
+
+    uint64_t interval_ns = (uint64_t)opt.interval_s * 1000000000ULL;
+    uint64_t next_report = start + interval_ns, last_report = start;
+    uint64_t end = opt.duration_s ? start + (uint64_t)opt.duration_s * 1000000000ULL : 0;
+
+    if (opt.scrape && scrape_counters(counters_start) == 0) {
+        memcpy(counters_prev, counters_start, sizeof(counters_prev));
+        counters_valid = true;
+    }
+
+    while (!stop) {
+        struct epoll_event events[256];
+        uint64_t now = now_ns();
+
+        for (unsigned int i = 0; i < opt.n_clients; i++) {
+            if (clients[i].state == CL_IDLE && clients[i].next_connect_ns <= now) client_connect(&clients[i], now);
+        }
+        if (opt.n_slow) refill_tokens(now);
+
+        int n = epoll_wait(epfd, events, 256, TICK_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("loadgen: epoll_wait");
+            break;
+        }
+
+        now = now_ns();
+        for (int e = 0; e < n; e++) {
+            struct client *c = events[e].data.ptr;
+            if (c->fd < 0) continue;
+
+            if (c->state == CL_CONNECTING) {
+                if (client_send_request(c) < 0) client_drop(c, now, strerror(errno));
+            } else if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                client_read(c, now);
+            }
+        }
+
+        if (now >= next_report) {
+            report(now - start, (now - last_report) / 1e9);
+            last_report = now;
+            next_report += interval_ns;
+        }
+        if (end && now >= end) break;
+    }
+
+    double run_s = (now_ns() - start) / 1e9;
+    int ret = summarize(run_s) < 0 ? 1 : 0;
+
+    for (unsigned int i = 0; i < opt.n_clients; i++) {
+        if (clients[i].fd >= 0) close(clients[i].fd);
+    }
+    close(epfd);
+    free(clients);
+    freeaddrinfo(server_addr);
+    return ret;
+}
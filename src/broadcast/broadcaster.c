@@ -0,0 +1,383 @@
+/**
+* @file broadcaster.c
+* @brief Encode-once, fan-out-to-many distribution of JPEG frames.
+*
+* The producer publishes each encoded frame exactly once. The broadcaster
+* takes one reference per subscriber and pushes the frame into that
+* subscriber's private lock-free ring. When a subscriber falls behind, its
+* ring's policy decides: the oldest queued frame is dropped and released,
+* only the latest frame is kept, or the publisher briefly waits. Other
+* subscribers are not affected by drops. A frame is freed when the last
+* subscriber releases it.
+*
+* Subscribers on slow links can move to a lower quality tier. The producer
+* asks which tiers have subscribers, encodes one variant per such tier and
+* publishes the set; each subscriber gets the variant of its tier.
+*
+* The last published frame stays cached (one reference, replaced by the
+* next publish) so a still image can be served without touching the encoder.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "broadcaster.h"
+#include "image/image_encoder.h"
+#include "metrics/metrics.h"
+
+/**
+* @brief Initialize an empty broadcaster
+*
+* @param bc Pointer to the broadcaster instance
+*
+* @return 0 on success, -1 on failure
+*/
+int broadcaster_init(struct broadcaster *bc)
+{
+    bc->subs = NULL;
+    bc->n_subs = 0;
+    bc->latest = NULL;
+    memset(bc->tier_subs, 0, sizeof(bc->tier_subs));
+
+    if (pthread_mutex_init(&bc->lock, NULL) != 0) {
+        perror("broadcaster: Failed to initialize mutex");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief Release all subscribers and destroy the broadcaster
+*
+* @param bc Pointer to the broadcaster instance
+*
+* @return void
+*/
+void broadcaster_destroy(struct broadcaster *bc)
+{
+    while (bc->subs) {
+        broadcaster_unsubscribe(bc, bc->subs);
+    }
+    jpeg_frame_release(bc->latest);
+    bc->latest = NULL;
+    pthread_mutex_destroy(&bc->lock);
+}
+
+/**
+* @brief Register a new subscriber
+*
+* The subscriber starts with an empty queue in tier 0 and only receives
+* frames published after this call.
+*
+* @note A CB_BLOCK subscriber stalls the publisher (and so every other
+*       subscriber) for up to CB_BLOCK_TIMEOUT_MS per frame while it is
+*       behind; it is meant for local consumers, not network clients.
+*
+* @param bc     Pointer to the broadcaster instance
+* @param depth  Queue capacity in frames (0 = BUFFER_SIZE)
+* @param policy What to do when the queue is full
+*
+* @return Pointer to the new subscriber, or NULL on failure
+*/
+struct subscriber *broadcaster_subscribe(struct broadcaster *bc, unsigned int depth,
+                                         enum cb_policy policy)
+{
+    struct subscriber *sub = calloc(1, sizeof(*sub));
+    if (!sub) {
+        perror("broadcaster: Failed to allocate subscriber");
+        return NULL;
+    }
+
+    if (circular_buffer_init(&sub->queue, depth, policy) < 0) {
+        perror("broadcaster: Failed to allocate subscriber queue");
+        free(sub);
+        return NULL;
+    }
+
+    sub->event_fd = eventfd(0, EFD_CLOEXEC);
+    if (sub->event_fd < 0) {
+        perror("broadcaster: Failed to create eventfd");
+        circular_buffer_destroy(&sub->queue);
+        free(sub);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&bc->lock);
+    sub->next = bc->subs;
+    bc->subs = sub;
+    bc->n_subs++;
+    bc->tier_subs[0]++;
+    pthread_mutex_unlock(&bc->lock);
+
+    return sub;
+}
+
+/**
+* @brief Remove a subscriber and release every frame still queued for it
+*
+* @param bc  Pointer to the broadcaster instance
+* @param sub Subscriber previously returned by broadcaster_subscribe()
+*
+* @return void
+*/
+void broadcaster_unsubscribe(struct broadcaster *bc, struct subscriber *sub)
+{
+    if (!sub) return;
+
+    // Unlink first so the publisher can no longer reach this subscriber
+    pthread_mutex_lock(&bc->lock);
+    for (struct subscriber **pp = &bc->subs; *pp; pp = &(*pp)->next) {
+        if (*pp == sub) {
+            *pp = sub->next;
+            bc->n_subs--;
+            bc->tier_subs[sub->tier]--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bc->lock);
+
+    // Drain the remaining frames
+    struct jpeg_frame *frame = NULL;
+    while (cb_read(&sub->queue, &frame)) {
+        jpeg_frame_release(frame);
+    }
+
+    circular_buffer_destroy(&sub->queue);
+    close(sub->event_fd);
+    free(sub);
+}
+
+/**
+* @brief Drop a reference under the list lock, keeping the last one for later
+*
+* Dropping the last reference may recycle a pool frame or requeue a capture
+* buffer, which must not happen under the lock. The last reference is
+* instead chained onto *deferred: its holder is the only one, so the link
+* is free to use.
+*
+* @param frame      Frame to release (NULL is ignored)
+* @param deferred   List of frames to release once the lock is dropped
+*
+* @return void
+*/
+static void release_locked(struct jpeg_frame *frame, struct jpeg_frame **deferred)
+{
+    if (!frame) return;
+
+    unsigned int refs = atomic_load_explicit(&frame->refcount, memory_order_relaxed);
+    while (refs > 1) {
+        if (atomic_compare_exchange_weak_explicit(&frame->refcount, &refs, refs - 1,
+                                                  memory_order_acq_rel, memory_order_relaxed)) {
+            return;
+        }
+    }
+
+    frame->release_next = *deferred;
+    *deferred = frame;
+}
+
+/**
+* @brief Publish an encoded frame to all subscribers
+*
+* The caller keeps its own reference; one additional reference is taken for
+* every subscriber queue the frame is stored in. Subscribers in every tier
+* receive this same frame.
+*
+* @param bc    Pointer to the broadcaster instance
+* @param frame Encoded frame to distribute
+*
+* @return void
+*/
+void broadcaster_publish(struct broadcaster *bc, struct jpeg_frame *frame)
+{
+    struct jpeg_frame *frames[BROADCAST_TIERS] = { frame };
+    broadcaster_publish_tiers(bc, frames);
+}
+
+/**
+* @brief Publish one captured frame encoded in several quality tiers
+*
+* Every subscriber receives the variant of its tier. A tier without a
+* variant (the subscriber moved since broadcaster_tier_mask() was read, or
+* the source cannot be re-encoded) falls back to the nearest better one.
+* The caller keeps its own references to every variant. The publish time
+* is stamped on every variant before any subscriber can see it. frames[0]
+* replaces the cached latest frame.
+*
+* @param bc     Pointer to the broadcaster instance
+* @param frames Variant per tier; frames[0] is required, the others may be NULL
+*
+* @return void
+*/
+void broadcaster_publish_tiers(struct broadcaster *bc, struct jpeg_frame *const frames[BROADCAST_TIERS])
+{
+    const uint64_t one = 1;
+    uint64_t now = metrics_now();
+    unsigned long drops = 0;
+    struct jpeg_frame *evicted_list = NULL;
+
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        if (frames[t]) frames[t]->t.publish = now;
+    }
+    metrics_count(CNT_FRAMES_PUBLISHED, 1);
+    metrics_count(CNT_BYTES_ENCODED, frames[0]->size);
+
+    // The list lock only keeps subscribers alive; the queues themselves are lock-free
+    pthread_mutex_lock(&bc->lock);
+    struct jpeg_frame *previous = bc->latest;
+    bc->latest = jpeg_frame_retain(frames[0]);
+
+    for (struct subscriber *sub = bc->subs; sub; sub = sub->next) {
+        unsigned int tier = sub->tier;
+        while (tier > 0 && !frames[tier]) tier--;
+
+        struct jpeg_frame *evicted = cb_write(&sub->queue, jpeg_frame_retain(frames[tier]));
+
+        // Slow subscriber: its oldest frame is discarded, nobody else is affected
+        if (evicted) drops++;
+        release_locked(evicted, &evicted_list);
+
+        if (write(sub->event_fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("broadcaster: Failed to signal subscriber");
+        }
+    }
+    pthread_mutex_unlock(&bc->lock);
+
+    // May recycle a pool frame or requeue a capture buffer, so not under the lock
+    jpeg_frame_release(previous);
+    while (evicted_list) {
+        struct jpeg_frame *next = evicted_list->release_next;
+        jpeg_frame_release(evicted_list);
+        evicted_list = next;
+    }
+    if (drops) metrics_count(CNT_RING_DROPS, drops);
+}
+
+/**
+* @brief Number of currently registered subscribers
+*
+* @param bc Pointer to the broadcaster instance
+*
+* @return Subscriber count
+*/
+unsigned int broadcaster_subscriber_count(struct broadcaster *bc)
+{
+    pthread_mutex_lock(&bc->lock);
+    unsigned int n = bc->n_subs;
+    pthread_mutex_unlock(&bc->lock);
+    return n;
+}
+
+/**
+* @brief Take a reference to the most recently published frame
+*
+* The frame is the tier 0 variant, already encoded; the caller releases it
+* with jpeg_frame_release() once sent. While the pipeline idles the cache
+* goes stale, which max_age_ms lets the caller detect.
+*
+* @param bc         Pointer to the broadcaster instance
+* @param max_age_ms Oldest acceptable frame in milliseconds since publish (0 = any)
+*
+* @return Pointer to the frame, or NULL if nothing (recent enough) was published
+*/
+struct jpeg_frame *broadcaster_latest(struct broadcaster *bc, unsigned int max_age_ms)
+{
+    uint64_t now = metrics_now();
+    struct jpeg_frame *frame = NULL;
+
+    pthread_mutex_lock(&bc->lock);
+    if (bc->latest && (max_age_ms == 0 || now - bc->latest->t.publish < max_age_ms * 1000000ULL)) {
+        frame = jpeg_frame_retain(bc->latest);
+    }
+    pthread_mutex_unlock(&bc->lock);
+    return frame;
+}
+
+/**
+* @brief Quality tiers that currently have at least one subscriber
+*
+* Lets the producer encode only the variants somebody will receive.
+*
+* @param bc Pointer to the broadcaster instance
+*
+* @return Bit mask, bit t set if tier t has subscribers
+*/
+unsigned int broadcaster_tier_mask(struct broadcaster *bc)
+{
+    unsigned int mask = 0;
+
+    pthread_mutex_lock(&bc->lock);
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        if (bc->tier_subs[t]) mask |= 1u << t;
+    }
+    pthread_mutex_unlock(&bc->lock);
+    return mask;
+}
+
+/**
+* @brief Move a subscriber to another quality tier
+*
+* Takes effect from the next published frame.
+*
+* @param bc     Pointer to the broadcaster instance
+* @param sub    Subscriber previously returned by broadcaster_subscribe()
+* @param tier   New tier (clamped to BROADCAST_TIERS - 1)
+*
+* @return void
+*/
+void broadcaster_set_tier(struct broadcaster *bc, struct subscriber *sub, unsigned int tier)
+{
+    if (tier >= BROADCAST_TIERS) tier = BROADCAST_TIERS - 1;
+
+    pthread_mutex_lock(&bc->lock);
+    bc->tier_subs[sub->tier]--;
+    bc->tier_subs[tier]++;
+    sub->tier = tier;
+    pthread_mutex_unlock(&bc->lock);
+}
+
+/**
+* @brief Block until at least one frame has been published to a subscriber
+*
+* Reading the eventfd resets its counter, so a single wakeup covers every
+* frame queued since the previous call. Drain with subscriber_next().
+*
+* @param sub Pointer to the subscriber
+*
+* @return 0 on success, -1 on failure
+*/
+int subscriber_wait(struct subscriber *sub)
+{
+    uint64_t count;
+
+    while (read(sub->event_fd, &count, sizeof(count)) < 0) {
+        if (errno == EINTR) continue;
+        perror("broadcaster: Failed to wait on subscriber");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief Pop the oldest queued frame of a subscriber
+*
+* Ownership of one reference passes to the caller, who must release it with
+* jpeg_frame_release() once the frame has been sent. Only the subscriber's
+* own thread may call this.
+*
+* @param sub Pointer to the subscriber
+*
+* @return Pointer to the frame, or NULL if the queue is empty
+*/
+struct jpeg_frame *subscriber_next(struct subscriber *sub)
+{
+    struct jpeg_frame *frame = NULL;
+
+    if (!cb_read(&sub->queue, &frame)) return NULL;
+    return frame;
+}
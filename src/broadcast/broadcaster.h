@@ -0,0 +1,77 @@
+#ifndef BROADCASTER_H
+#define BROADCASTER_H
+
+/**
+* @file broadcaster.h
+* @brief Fan-out of encoded JPEG frames to any number of streaming clients.
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "cb/circular_buffer.h"
+
+// Forward declare the JPEG frame struct
+struct jpeg_frame;
+
+/**
+* @brief Number of quality tiers a frame can be published in.
+*
+* Tier 0 is the configured quality; higher tiers are smaller variants for
+* clients on slow links. Each variant is encoded once and shared by every
+* subscriber in its tier.
+*/
+#define BROADCAST_TIERS     3
+
+/** @brief A cached frame younger than this counts as current (see broadcaster_latest()). */
+#define BROADCAST_FRESH_MS  500
+
+/**
+* @brief A single consumer of the frame broadcast.
+*
+* Every subscriber owns a private lock-free ring acting as its read cursor,
+* so a slow client only drops its own frames. The publisher is the ring's
+* only writer and the subscriber's thread its only reader. The eventfd is
+* signalled each time a frame is queued and can be waited on directly.
+*
+* Delivery and drop counts are kept by the ring (queue.written, queue.dropped).
+*/
+struct subscriber {
+    CircularBuffer queue;           /**< Frames pending delivery to this subscriber */
+    int event_fd;                   /**< eventfd signalled on every published frame */
+    unsigned int tier;              /**< Quality tier received (protected by the broadcaster lock) */
+    struct subscriber *next;        /**< Next subscriber in the broadcaster list */
+};
+
+/**
+* @brief Publisher side of the frame broadcast.
+*
+* Holds the list of active subscribers. Each published frame is encoded once
+* and then referenced by every subscriber queue. The most recent frame
+* (tier 0) is also kept for still-image requests.
+*/
+struct broadcaster {
+    pthread_mutex_t lock;           /**< Protects the subscriber list and tiers */
+    struct subscriber *subs;        /**< Singly-linked list of subscribers */
+    unsigned int n_subs;            /**< Number of active subscribers */
+    unsigned int tier_subs[BROADCAST_TIERS];    /**< Subscribers per quality tier */
+    struct jpeg_frame *latest;      /**< Reference to the last published frame, or NULL */
+};
+
+/** Function prototypes */
+int broadcaster_init(struct broadcaster *bc);
+void broadcaster_destroy(struct broadcaster *bc);
+struct subscriber *broadcaster_subscribe(struct broadcaster *bc, unsigned int depth,
+                                         enum cb_policy policy);
+void broadcaster_unsubscribe(struct broadcaster *bc, struct subscriber *sub);
+void broadcaster_publish(struct broadcaster *bc, struct jpeg_frame *frame);
+void broadcaster_publish_tiers(struct broadcaster *bc, struct jpeg_frame *const frames[BROADCAST_TIERS]);
+unsigned int broadcaster_subscriber_count(struct broadcaster *bc);
+struct jpeg_frame *broadcaster_latest(struct broadcaster *bc, unsigned int max_age_ms);
+unsigned int broadcaster_tier_mask(struct broadcaster *bc);
+void broadcaster_set_tier(struct broadcaster *bc, struct subscriber *sub, unsigned int tier);
+
+int subscriber_wait(struct subscriber *sub);
+struct jpeg_frame *subscriber_next(struct subscriber *sub);
+
+#endif  // BROADCASTER_H
@@ -4,20 +4,24 @@
 *
 * This module handles low-level operations required to prepare a V4L2 camera
 * device for streaming, including:
-*   1. Opening control module /dev/cam_stream
-*   2. Opening camera device /dev/video0
-*   3. Configuring camera device
+*   1. Opening control module /dev/cam_stream and mapping its telemetry page
+*      (one camera per process: the module has a single LED and page)
+*   2. Opening the camera device (opts.device, /dev/video0 by default)
+*   3. Negotiating format, frame size and frame rate with the camera device
 *   4. Requesting streaming buffers
-*   5. Memory-mapping kernel buffers to user-space
-*   6. Queueing memory-mapped buffers for capture
+*   5. Memory-mapping kernel buffers to user-space and exporting them as DMABUFs,
+*      or allocating our own (optionally huge page) capture pool for USERPTR I/O
+*   6. Queueing the buffers for capture
 *   7. Starting and stopping the video stream
 *   8. Capturing and outputing video frames
-*   8. Releasing all allocated resources on shutdown
+*   9. Holding MJPEG capture buffers while clients still send them
+*  10. Releasing all allocated resources on shutdown
 * 
-* Only three public functions are exposed through camera.h:
-*   1. initialize_camera() - Initialize and prepare the camera device for streaming.
+* The main public functions exposed through camera.h:
+*   1. camera_init() - Initialize and prepare the camera device for streaming.
 *   2. capture_frames() - Captures and outputs video frames.
 *   3. close_camera() - Stop the camera stream and release all associated resources.
+*   4. camera_list_caps() - Print the formats, sizes and frame rates a device offers.
 *
 * All other help functions are kept private to ensure proper encapsulation and
 * prevent external modules from depending on internal implementation details.
@@ -29,6 +33,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 
@@ -37,18 +42,47 @@
 #include "http/mjpeg_stream.h"
 #include "image/image_encoder.h"
 #include "image/image_processor.h"
+#include "metrics/metrics.h"
+
+// Each camera's gauges are labelled with its index
+#if CAMERA_MAX > METRICS_CAMERAS
+#error "METRICS_CAMERAS must cover CAMERA_MAX"
+#endif
 
 /** @brief Internal helper functions.  */
 static int open_control_device(struct camera_ctx *cctx);
+static void map_telemetry(struct camera_ctx *cctx);
+static void telemetry_frame(struct camera_ctx *cctx, uint64_t now_ns, unsigned int dropped);
+static void telemetry_error(struct camera_ctx *cctx, int err);
 static int configure_camera(struct camera_ctx *cctx);
-static int request_mmap_buffers(struct camera_ctx *cctx);
+static void negotiate_frame_size(struct camera_ctx *cctx);
+static void negotiate_frame_rate(struct camera_ctx *cctx);
+static int request_buffers(struct camera_ctx *cctx);
 static int map_buffers(struct camera_ctx *cctx);
+static int alloc_user_buffers(struct camera_ctx *cctx);
+static int queue_user_buffer(struct camera_ctx *cctx, unsigned int slot, struct buffer *b);
+static struct buffer *take_buffer(struct camera_ctx *cctx);
+static void export_buffers(struct camera_ctx *cctx);
+static void requeue_buffer(struct camera_ctx *cctx, unsigned int index);
 static int queue_buffers(struct camera_ctx *cctx);
 static int start_stream(struct camera_ctx *cctx);
 static int stop_stream(struct camera_ctx *cctx);
 static int led_stream_on(struct camera_ctx *cctx);
 static int led_stream_off(struct camera_ctx *cctx);
 static void cleanup_buffers(struct camera_ctx *cctx);
+static struct jpeg_frame *hold_buffer(struct camera_ctx *cctx, unsigned int index,
+                                      unsigned int bytesused);
+static void requeue_held_buffer(struct jpeg_frame *frame);
+static void stamp_frame(struct camera_ctx *cctx, struct frame_times *t);
+
+/** @brief Capture settings used when the caller passes none. */
+static const struct camera_opts default_opts = {
+    .device = CAMERA_PATH,
+    .width = 640,
+    .height = 480,
+    .pixelformat = V4L2_PIX_FMT_YUYV,
+    .control = true,
+};
 
 /**
 * @brief Initialize and prepare the camera device for streaming
@@ -60,20 +94,32 @@ static void cleanup_buffers(struct camera_ctx *cctx);
 * up to the failure point by calling close_camera().
 *
 * @param cctx Pointer to the camera context structure that holds all the states.
+* @param opts Requested capture settings, or NULL for 640x480 YUYV on CAMERA_PATH
 *             
 * @return 0 on success
 *         Negative value on failure
 */
-int camera_init(struct camera_ctx *cctx)
+int camera_init(struct camera_ctx *cctx, const struct camera_opts *opts)
 {
     memset(cctx, 0, sizeof(*cctx));
     cctx->cam_fd = -1;
     cctx->dev_fd = -1;
+    cctx->opts = opts ? *opts : default_opts;
+    if (!cctx->opts.device[0]) {
+        snprintf(cctx->opts.device, sizeof(cctx->opts.device), "%s", CAMERA_PATH);
+    }
+    atomic_init(&cctx->n_held, 0);
+    atomic_init(&cctx->stopping, false);
 
-    if (open_control_device(cctx) < 0) goto error;
+    if (cctx->opts.control && open_control_device(cctx) < 0) goto error;
     if (configure_camera(cctx) < 0) goto error;
-    if (request_mmap_buffers(cctx) < 0) goto error;
-    if (map_buffers(cctx) < 0) goto error;
+    if (request_buffers(cctx) < 0) goto error;
+    if (cctx->memory == V4L2_MEMORY_USERPTR) {
+        if (alloc_user_buffers(cctx) < 0) goto error;
+    } else {
+        if (map_buffers(cctx) < 0) goto error;
+        export_buffers(cctx);
+    }
     if (queue_buffers(cctx) < 0) goto error;
     if (start_stream(cctx) < 0) goto error;
 
@@ -106,6 +152,12 @@ void close_camera(struct camera_ctx *cctx)
     stop_stream(cctx);         // If stream started
     cleanup_buffers(cctx);     // If mmap buffers allocated
 
+    // Unmap the telemetry page
+    if (cctx->shared) {
+        munmap(cctx->shared, sizeof(*cctx->shared));
+        cctx->shared = NULL;
+    }
+
     // Close control device
     if (cctx->cam_fd >= 0) {
         close(cctx->cam_fd);
@@ -127,7 +179,7 @@ void close_camera(struct camera_ctx *cctx)
 * This function opens the custom kernel driver used for LED signaling
 * and camera control. It attempts to open @ref DEVICE_PATH with read/write 
 * permission and stores the resulting file descriptor in the global 
-* variable @ref cctx->dev_fd.
+* variable @ref cctx->dev_fd, then maps the driver's telemetry page.
 *
 * @param cctx Pointer to the camera context structure that holds all session state.
 *
@@ -142,15 +194,102 @@ static int open_control_device(struct camera_ctx *cctx) {
         return -1;
     }
     printf("camera: Device /dev/cam_stream opened successfully\n");
+
+    map_telemetry(cctx);
     return 0;
 }
 
 /**
-* @brief Initializes and configures the camera device (dev/video0)
+* @brief Map the telemetry page of the control device
+*
+* The capture loop keeps the frame and drop counters in this page with
+* plain stores; the driver samples them to derive the stream health and
+* the LED pattern, so no frame costs a system call. A driver without the
+* page leaves cctx->shared NULL and only START/STOP drive the LEDs.
+*
+* @param cctx Pointer to the camera context structure that holds all session state.
+*
+* @return void
+*/
+static void map_telemetry(struct camera_ctx *cctx)
+{
+    void *page = mmap(NULL, sizeof(struct cam_shared), PROT_READ | PROT_WRITE, MAP_SHARED,
+                      cctx->dev_fd, 0);
+    if (page == MAP_FAILED) {
+        perror("camera: No telemetry page on /dev/cam_stream (LED shows START/STOP only)");
+        return;
+    }
+
+    cctx->shared = page;
+    __atomic_store_n(&cctx->shared->frames, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cctx->shared->drops, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cctx->shared->last_error, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&cctx->shared->version, CAM_SHARED_VERSION, __ATOMIC_RELEASE);
+}
+
+/**
+* @brief Publish one captured frame to the telemetry page
+*
+* @param cctx       Pointer to the camera context
+* @param now_ns     metrics_now() time of the dequeue (CLOCK_MONOTONIC)
+* @param dropped    Frames the driver dropped before this one
+*
+* @return void
+*/
+static void telemetry_frame(struct camera_ctx *cctx, uint64_t now_ns, unsigned int dropped)
+{
+    struct cam_shared *sh = cctx->shared;
+
+    // Same smoothing as the frame interval gauge
+    if (cctx->last_dequeue_ns && now_ns > cctx->last_dequeue_ns) {
+        int64_t delta = (int64_t)(now_ns - cctx->last_dequeue_ns) - (int64_t)cctx->interval_ns;
+        cctx->interval_ns = cctx->interval_ns ? (uint64_t)((int64_t)cctx->interval_ns + delta / 16)
+                                              : now_ns - cctx->last_dequeue_ns;
+    }
+    __atomic_store_n(&cctx->last_dequeue_ns, now_ns, __ATOMIC_RELAXED);     // Read by camera_last_frame()
+    cctx->n_dropped += dropped;
+
+    if (!sh) return;
+    __atomic_store_n(&sh->frames, cctx->n_captured, __ATOMIC_RELAXED);
+    __atomic_store_n(&sh->drops, cctx->n_dropped, __ATOMIC_RELAXED);
+    __atomic_store_n(&sh->last_frame_ns, now_ns, __ATOMIC_RELAXED);
+    if (cctx->interval_ns) {
+        __atomic_store_n(&sh->fps_milli, (uint32_t)(1000000000000ULL / cctx->interval_ns),
+                         __ATOMIC_RELAXED);
+    }
+}
+
+/**
+* @brief Record a capture failure in the telemetry page
+*
+* The driver shows it (blinking RED) from its next sample on, and it stays
+* visible after the application exits, until the next CAM_IOC_START.
+*
+* @param cctx   Pointer to the camera context
+* @param err    errno of the failure
+*
+* @return void
+*/
+static void telemetry_error(struct camera_ctx *cctx, int err)
+{
+    if (!cctx->shared) return;
+    __atomic_store_n(&cctx->shared->last_error, err, __ATOMIC_RELAXED);
+    __atomic_store_n(&cctx->shared->state, CAM_STATE_ERROR, __ATOMIC_RELEASE);
+}
+
+/**
+* @brief Initializes and configures the camera device (opts.device)
 * 
 * This function opens the camera device with read/write access and applies
-* a predefined video capture format based on the Logitech C270 HD webcam 
-* specs obtained from 'v4l2-ctl -all'.
+* the requested video capture format (by default based on the Logitech C270
+* HD webcam specs obtained from 'v4l2-ctl -all').
+*
+* The requested size is first snapped to the nearest size the driver
+* enumerates for the format, and the frame rate is set afterwards since
+* the available intervals depend on the negotiated size.
+*
+* If MJPEG passthrough is requested but the driver substitutes another
+* format, capture continues with that format and software encoding.
 *
 * @param cctx Pointer to the camera context structure that holds all session state.
 * @return int:
@@ -159,13 +298,13 @@ static int open_control_device(struct camera_ctx *cctx) {
 */
 static int configure_camera(struct camera_ctx *cctx) 
 {
-    // --- Open camera device (/dev/video0) ---
-    cctx->cam_fd = open(CAMERA_PATH, O_RDWR);
+    // --- Open camera device ---
+    cctx->cam_fd = open(cctx->opts.device, O_RDWR);
     if (cctx->cam_fd < 0) {
-        perror("camera: Failed to open /dev/video0");
+        perror("camera: Failed to open camera device");
         return -errno;
     }
-    printf("camera: Device /dev/video0 opened successfully\n");
+    printf("camera: Device %s opened successfully\n", cctx->opts.device);
 
    /*  
     * Based on Logitech C270 HD Webcam capabilities (from `v4l2-ctl --all`):
@@ -175,16 +314,19 @@ static int configure_camera(struct camera_ctx *cctx)
     *   Colorspace        : sRGB
     *   Transfer Function : Rec. 709
     *   Encoding          : ITU-R 601
+    *   Also offers       : Motion-JPEG (MJPG) at the same sizes
     *
     * We explicitly set width, height, pixel format, and field.  
     * The driver fills the remaining fields if needed.
     */
 
+    negotiate_frame_size(cctx);
+
     memset(&(cctx->fmt), 0, sizeof(cctx->fmt));
     cctx->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    cctx->fmt.fmt.pix.width = 640;
-    cctx->fmt.fmt.pix.height = 480;
-    cctx->fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    cctx->fmt.fmt.pix.width = cctx->opts.width;
+    cctx->fmt.fmt.pix.height = cctx->opts.height;
+    cctx->fmt.fmt.pix.pixelformat = cctx->opts.pixelformat;
     cctx->fmt.fmt.pix.field = V4L2_FIELD_NONE;
 
     if (ioctl(cctx->cam_fd, VIDIOC_S_FMT, &cctx->fmt) < 0) {
@@ -194,35 +336,205 @@ static int configure_camera(struct camera_ctx *cctx)
         return -errno;
     }
 
+    if (cctx->fmt.fmt.pix.pixelformat != cctx->opts.pixelformat) {
+        printf("camera: Requested format not supported, falling back to driver's choice\n");
+    }
+    if (cctx->fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV &&
+        cctx->fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG) {
+        fprintf(stderr, "camera: Driver chose an unsupported pixel format\n");
+        close(cctx->cam_fd);
+        cctx->cam_fd = -1;
+        return -EINVAL;
+    }
+
+    negotiate_frame_rate(cctx);
+
+    printf("camera: Capturing %ux%u %s", cctx->fmt.fmt.pix.width, cctx->fmt.fmt.pix.height,
+           cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG ? "MJPEG (passthrough)" : "YUYV");
+    if (cctx->fps) printf(" at %u fps", cctx->fps);
+    printf("\n");
+
     printf("camera: Camera configuration successful\n");
     return 0;
 }
 
 /**
-* @brief Requests memory-mapped buffers from the video device.
+* @brief Snap the requested frame size to the nearest one the driver offers
+*
+* Discrete sizes are compared by the sum of the width and height errors;
+* stepwise and continuous ranges are clamped and rounded to their step.
+* Drivers without VIDIOC_ENUM_FRAMESIZES keep the request as-is, and
+* VIDIOC_S_FMT adjusts it.
+*
+* @param cctx Pointer to the camera context (opts.width/height are updated)
+* @return void
+*/
+static void negotiate_frame_size(struct camera_ctx *cctx)
+{
+    struct v4l2_frmsizeenum fs = { .pixel_format = cctx->opts.pixelformat };
+    unsigned int want_w = cctx->opts.width;
+    unsigned int want_h = cctx->opts.height;
+    unsigned int best_w = 0, best_h = 0;
+    unsigned long best_err = ULONG_MAX;
+
+    for (fs.index = 0; ioctl(cctx->cam_fd, VIDIOC_ENUM_FRAMESIZES, &fs) == 0; fs.index++) {
+        if (fs.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            unsigned long err = (unsigned long)abs((int)fs.discrete.width - (int)want_w) +
+                                (unsigned long)abs((int)fs.discrete.height - (int)want_h);
+            if (err < best_err) {
+                best_err = err;
+                best_w = fs.discrete.width;
+                best_h = fs.discrete.height;
+            }
+            continue;
+        }
+
+        // Stepwise / continuous: a single range describes every size
+        struct v4l2_frmsize_stepwise *sw = &fs.stepwise;
+        unsigned int step_w = sw->step_width ? sw->step_width : 1;
+        unsigned int step_h = sw->step_height ? sw->step_height : 1;
+        unsigned int w = want_w < sw->min_width ? sw->min_width :
+                         want_w > sw->max_width ? sw->max_width : want_w;
+        unsigned int h = want_h < sw->min_height ? sw->min_height :
+                         want_h > sw->max_height ? sw->max_height : want_h;
+
+        best_w = sw->min_width + (w - sw->min_width) / step_w * step_w;
+        best_h = sw->min_height + (h - sw->min_height) / step_h * step_h;
+        break;
+    }
+
+    if (!best_w) return;    // Not enumerable: leave it to VIDIOC_S_FMT
+
+    if (best_w != want_w || best_h != want_h) {
+        printf("camera: %ux%u not offered, using nearest size %ux%u\n",
+               want_w, want_h, best_w, best_h);
+    }
+    cctx->opts.width = best_w;
+    cctx->opts.height = best_h;
+}
+
+/**
+* @brief Set the capture frame rate and read back what the driver applied
+*
+* The requested rate is snapped to the nearest interval enumerated for the
+* negotiated format and size, then applied with VIDIOC_S_PARM. Without a
+* request the driver's current rate is kept. In both cases VIDIOC_G_PARM
+* fills cctx->timeperframe and cctx->fps.
 *
-* Initializes the v4l2_requestbuffers structure and requests a 
-* fixed number of buffers (4) for memory-mapped I/O.
-* - 4 buffers seems to be a widely used amount
+* Failure is not fatal: many drivers have no frame rate control at all.
+*
+* @param cctx Pointer to the camera context
+* @return void
+*/
+static void negotiate_frame_rate(struct camera_ctx *cctx)
+{
+    struct v4l2_streamparm parm = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+
+    if (cctx->opts.fps) {
+        struct v4l2_frmivalenum fi = {
+            .pixel_format = cctx->fmt.fmt.pix.pixelformat,
+            .width = cctx->fmt.fmt.pix.width,
+            .height = cctx->fmt.fmt.pix.height,
+        };
+        struct v4l2_fract ival = { 1, cctx->opts.fps };
+        double want = 1.0 / cctx->opts.fps;
+        double best_err = 1e9;
+
+        for (fi.index = 0; ioctl(cctx->cam_fd, VIDIOC_ENUM_FRAMEINTERVALS, &fi) == 0; fi.index++) {
+            if (fi.type != V4L2_FRMIVAL_TYPE_DISCRETE) break;   // Any interval in range works
+            if (!fi.discrete.denominator) continue;
+
+            double t = (double)fi.discrete.numerator / fi.discrete.denominator;
+            double err = t > want ? t - want : want - t;
+            if (err < best_err) {
+                best_err = err;
+                ival = fi.discrete;
+            }
+        }
+
+        parm.parm.capture.timeperframe = ival;
+        if (ioctl(cctx->cam_fd, VIDIOC_S_PARM, &parm) < 0) {
+            perror("camera: Failed to set frame rate");
+        }
+    }
+
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (ioctl(cctx->cam_fd, VIDIOC_G_PARM, &parm) == 0 &&
+        (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME) &&
+        parm.parm.capture.timeperframe.numerator) {
+        cctx->timeperframe = parm.parm.capture.timeperframe;
+        cctx->fps = (cctx->timeperframe.denominator + cctx->timeperframe.numerator / 2) /
+                    cctx->timeperframe.numerator;
+    }
+
+    if (cctx->opts.fps && cctx->fps != cctx->opts.fps) {
+        printf("camera: %u fps not offered, driver runs at %u fps\n", cctx->opts.fps, cctx->fps);
+    }
+}
+
+/**
+* @brief Requests streaming buffers from the video device.
+*
+* Initializes the v4l2_requestbuffers structure and requests the configured
+* number of buffers for memory-mapped I/O, or by default:
+* - 4 buffers seems to be a widely used amount for raw capture
+* - MJPEG passthrough asks for more, since clients hold buffers while sending
+*
+* With opts.memory = V4L2_MEMORY_USERPTR, raw capture requests user pointer
+* I/O instead; a driver without it falls back to memory-mapped buffers.
+*
+* The driver may grant a different count; cctx->req.count holds the result.
 *
 * @param cctx Pointer to the camera context structure that holds all session state.
 * @return int
 *           - 0 on success
 *           - -errno on failure
 * */
-static int request_mmap_buffers(struct camera_ctx *cctx) 
+static int request_buffers(struct camera_ctx *cctx) 
 {
+    unsigned int count = cctx->opts.n_buffers;
+    if (!count) {
+        count = (cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+                ? CAMERA_MJPEG_BUFFERS : CAMERA_BUFFERS;
+    }
+    if (count > CAMERA_MAX_BUFFERS) count = CAMERA_MAX_BUFFERS;
+
+    // Pool-owned buffers only for raw frames: MJPEG passthrough lends the driver's buffers out
+    cctx->memory = V4L2_MEMORY_MMAP;
+    if (cctx->opts.memory == V4L2_MEMORY_USERPTR) {
+        if (cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
+            printf("camera: USERPTR capture is for raw frames, MJPEG passthrough uses MMAP\n");
+        } else {
+            cctx->memory = V4L2_MEMORY_USERPTR;
+        }
+    }
+
     memset(&cctx->req, 0, sizeof(cctx->req));
-    cctx->req.count = 4;
+    cctx->req.count = count;
     cctx->req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    cctx->req.memory = V4L2_MEMORY_MMAP;
+    cctx->req.memory = cctx->memory;
 
-    if (ioctl(cctx->cam_fd, VIDIOC_REQBUFS, &cctx->req) < 0) {
+    int ret = ioctl(cctx->cam_fd, VIDIOC_REQBUFS, &cctx->req);
+    if (ret < 0 && cctx->memory == V4L2_MEMORY_USERPTR) {
+        perror("camera: Driver refused USERPTR buffers, using MMAP");
+        cctx->memory = V4L2_MEMORY_MMAP;
+        cctx->req.count = count;
+        cctx->req.memory = V4L2_MEMORY_MMAP;
+        ret = ioctl(cctx->cam_fd, VIDIOC_REQBUFS, &cctx->req);
+    }
+    if (ret < 0) {
         perror("camera: Failed to request buffers");
         return -errno;
     }
+    if (cctx->req.count == 0) {
+        fprintf(stderr, "camera: Driver granted no buffers\n");
+        return -ENOMEM;
+    }
 
-    printf("camera: Buffer request successful\n");
+    cctx->n_slots = cctx->req.count;
+    printf("camera: Buffer request successful (%u %s buffers)\n", cctx->req.count,
+           cctx->memory == V4L2_MEMORY_USERPTR ? "USERPTR" : "MMAP");
     return 0;
 }
 
@@ -253,6 +565,7 @@ static int map_buffers(struct camera_ctx *cctx)
     }
 
     cctx->n_buffers = cctx->req.count;
+    for (unsigned int i = 0; i < cctx->n_buffers; i++) cctx->buffers[i].dmabuf_fd = -1;
 
     // Map each kernel buffer into user space
     for (unsigned int i = 0; i < cctx->n_buffers; i++) {
@@ -270,6 +583,9 @@ static int map_buffers(struct camera_ctx *cctx)
         }
 
         // Store metadata amd map the kernel buffer into user space
+        cctx->buffers[i].index = i;
+        cctx->buffers[i].cctx = cctx;
+        atomic_init(&cctx->buffers[i].refs, 0);
         cctx->buffers[i].length = cctx->buf.length;
         cctx->buffers[i].start = mmap(NULL, 
                                     cctx->buf.length,
@@ -289,18 +605,137 @@ static int map_buffers(struct camera_ctx *cctx)
         }
     }
 
+    // MJPEG passthrough: one frame container per buffer for buffer-hold
+    if (cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
+        cctx->held = calloc(cctx->n_buffers, sizeof(*cctx->held));
+        if (!cctx->held) {
+            perror("camera: Failed to allocate held buffer frames");
+            return -errno;
+        }
+
+        for (unsigned int i = 0; i < cctx->n_buffers; i++) {
+            cctx->held[i].data = cctx->buffers[i].start;
+            cctx->held[i].capacity = cctx->buffers[i].length;
+            cctx->held[i].borrowed = true;
+            cctx->held[i].device_mem = true;
+            cctx->held[i].recycle = requeue_held_buffer;
+            cctx->held[i].owner = cctx;
+        }
+    }
+
     printf("camera: Mapping successful\n");
     return 0;
 }
 
 /**
-* @brief Queues memory-mapped buffers to the video device
+* @brief Allocate the application's own capture pool for USERPTR I/O
+*
+* Every block lives in one anonymous region, page aligned (and so cache
+* line aligned) at a stride of sizeimage rounded up to a page. With
+* opts.hugepages the region comes from hugetlbfs, so a frame spans one or
+* two TLB entries instead of hundreds; without reserved huge pages it falls
+* back to transparent huge pages. The pool holds opts.spare_buffers blocks
+* beyond the driver's, which stand in for frames held downstream.
+*
+* @param cctx Pointer to the camera context structure that holds all session state.
+* @return int
+*           - 0 on success
+*           - -errno on failure
+*/
+static int alloc_user_buffers(struct camera_ctx *cctx)
+{
+    unsigned int spare = cctx->opts.spare_buffers ? cctx->opts.spare_buffers : CAMERA_SPARE_BUFFERS;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = cctx->fmt.fmt.pix.sizeimage;
+    bool huge = false;
+
+    if (!size) size = (size_t)cctx->fmt.fmt.pix.width * cctx->fmt.fmt.pix.height * 2;
+    cctx->pool_stride = (size + page - 1) / page * page;
+    cctx->n_buffers = cctx->n_slots + spare;
+    cctx->pool_len = cctx->pool_stride * cctx->n_buffers;
+
+    void *mem = MAP_FAILED;
+    if (cctx->opts.hugepages) {
+        size_t len = (cctx->pool_len + CAMERA_HUGEPAGE_SIZE - 1) / CAMERA_HUGEPAGE_SIZE * CAMERA_HUGEPAGE_SIZE;
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            cctx->pool_len = len;
+            huge = true;
+        } else {
+            perror("camera: No hugetlb pages for the capture pool, using transparent huge pages");
+        }
+    }
+    if (mem == MAP_FAILED) {
+        mem = mmap(NULL, cctx->pool_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            perror("camera: Failed to allocate the capture pool");
+            return -errno;
+        }
+        if (cctx->opts.hugepages) madvise(mem, cctx->pool_len, MADV_HUGEPAGE);
+    }
+    cctx->pool_mem = mem;
+
+    cctx->buffers = calloc(cctx->n_buffers, sizeof(*cctx->buffers));
+    cctx->free_blocks = calloc(cctx->n_buffers, sizeof(*cctx->free_blocks));
+    cctx->parked = calloc(cctx->n_slots, sizeof(*cctx->parked));
+    if (!cctx->buffers || !cctx->free_blocks || !cctx->parked) {
+        perror("camera: Failed to allocate buffer array");
+        return -errno;
+    }
+    pthread_mutex_init(&cctx->pool_lock, NULL);
+
+    for (unsigned int i = 0; i < cctx->n_buffers; i++) {
+        cctx->buffers[i].start = (unsigned char *)mem + (size_t)i * cctx->pool_stride;
+        cctx->buffers[i].length = size;
+        cctx->buffers[i].dmabuf_fd = -1;
+        cctx->buffers[i].index = i;
+        cctx->buffers[i].cctx = cctx;
+        atomic_init(&cctx->buffers[i].refs, 0);
+    }
+
+    printf("camera: Capture pool of %u buffers (%u spare), %zu KiB%s\n", cctx->n_buffers, spare,
+           cctx->pool_len >> 10, huge ? " in huge pages" : "");
+    return 0;
+}
+
+/**
+* @brief Queue one pool block into a driver slot (USERPTR)
+*
+* Safe to call from any thread: uses its own v4l2_buffer rather than cctx->buf.
+*
+* @param cctx   Pointer to the camera context
+* @param slot   V4L2 buffer index
+* @param b      Pool block the driver captures into next
+*
+* @return 0 on success, -1 on failure
+*/
+static int queue_user_buffer(struct camera_ctx *cctx, unsigned int slot, struct buffer *b)
+{
+    struct v4l2_buffer buf = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory = V4L2_MEMORY_USERPTR,
+        .index = slot,
+        .m.userptr = (unsigned long)b->start,
+        .length = (unsigned int)cctx->pool_stride,
+    };
+
+    if (cctx->cam_fd < 0 || ioctl(cctx->cam_fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("camera: Failed to queue pool buffer");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief Queues the buffers to the video device
 *
 * After buffers are mapped into user space using @ref map_buffers(),
 * they must be queued to the kernel driver before streaming. This allows
 * the driver to know which buffers are available for the camera to write 
 * captured frames into.
 *
+* In USERPTR mode slot i gets pool block i and the spare blocks start out free.
+*
 * @param cctx Pointer to the camera context structure that holds all session state.
 * @return int
 *           - 0 on success
@@ -308,6 +743,17 @@ static int map_buffers(struct camera_ctx *cctx)
 */
 static int queue_buffers(struct camera_ctx *cctx) 
 {
+    if (cctx->memory == V4L2_MEMORY_USERPTR) {
+        for (unsigned int i = 0; i < cctx->n_slots; i++) {
+            if (queue_user_buffer(cctx, i, &cctx->buffers[i]) < 0) return -errno;
+        }
+        for (unsigned int i = cctx->n_buffers; i > cctx->n_slots; i--) {
+            cctx->free_blocks[cctx->n_free_blocks++] = &cctx->buffers[i - 1];
+        }
+        printf("camera: Buffer queue successful\n");
+        return 0;
+    }
+
     for (unsigned int i = 0; i < cctx->n_buffers; i++) {
         memset(&cctx->buf, 0, sizeof(cctx->buf));
 
@@ -364,11 +810,20 @@ static int start_stream(struct camera_ctx *cctx)
 *
 * This function runs the main capture loop. It repeteadly:
 *   1. Dequeues a filled buffer using VIDIOC_DQBUF
-*   2. Sends the YUYV frame for processing
+*   2. Sends the YUYV frame for processing, or publishes the camera's
+*      own MJPEG frame
 *   3. Re-queues the buffer with VIDIOC_QBUF for reuse
 *
+* In MJPEG passthrough a buffer may instead be held by the clients; it is
+* then re-queued when the last of them releases the frame. In USERPTR mode
+* the driver slot is refilled from the capture pool as soon as it is
+* dequeued, so processing a frame never holds up the next capture.
+*
+* While nothing consumes frames (see pipeline_has_demand()) a buffer goes
+* straight back to the driver: the queue keeps cycling, so exposure stays
+* settled and the first frame after a viewer attaches is encoded at once.
+*
 * @param cctx       Pointer to the camera context structure that holds camera sessions.
-* @param sctx       Pointer to the stream context containing stream session info.
 * @param pipeline   Pointer to the pipeline context containing thread and synchronization primitives
 *
 * @note STREAMON must have been called before entering this loop.
@@ -376,44 +831,145 @@ static int start_stream(struct camera_ctx *cctx)
 *
 * @return 0 on success, negative value on error.
 */
-int capture_frames(struct camera_ctx *cctx, struct stream_ctx *sctx, struct pipeline_ctx *pipeline) 
+int capture_frames(struct camera_ctx *cctx, struct pipeline_ctx *pipeline) 
 {
     for (;;) {
         // Prepare the buffer struct
         memset(&cctx->buf, 0, sizeof(cctx->buf));
         cctx->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        cctx->buf.memory =V4L2_MEMORY_MMAP;
+        cctx->buf.memory = cctx->memory;
 
-        // Dequeue a frame buffer
+        // Dequeue a frame buffer (camera_stop_capture() makes it fail)
         if (ioctl(cctx->cam_fd, VIDIOC_DQBUF, &cctx->buf) < 0) {
+            if (atomic_load(&cctx->stopping)) break;
             perror("camera: Failed to dequeue buffer");
+            telemetry_error(cctx, errno);
             break;
         }
 
+        struct frame_times t = {0};
+        stamp_frame(cctx, &t);
+
+        // Nobody watching: no conversion, no encoding
+        if (!pipeline_has_demand(pipeline)) {
+            metrics_count(CNT_IDLE_FRAMES, 1);
+            capture_buffer_release(take_buffer(cctx));
+            continue;
+        }
+
+        // MJPEG passthrough: no conversion, no encoding
+        if (cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) {
+            unsigned int index = cctx->buf.index;
+            struct jpeg_frame *held = hold_buffer(cctx, index, cctx->buf.bytesused);
+
+            if (mjpeg_processor(cctx->buffers[index].start, cctx->buf.bytesused,
+                                held, &t, pipeline) != 0) {
+                fprintf(stderr, "camera: Error publishing MJPEG frame\n");
+            }
+
+            // A held buffer is re-queued by its last release
+            if (held) continue;
+
+            if (ioctl(cctx->cam_fd, VIDIOC_QBUF, &cctx->buf) < 0) {
+                perror("camera: Failed to requeue buffer");
+                break;
+            }
+            continue;
+        }
+
         struct yuyv_frame yuyv = {0};
+        struct buffer *b = take_buffer(cctx);
 
-        // Prepare YUYV frame
-        yuyv.data = cctx->buffers[cctx->buf.index].start;
+        // Prepare YUYV frame; the capture loop holds the first buffer reference
+        yuyv.data = b->start;
         yuyv.width = cctx->fmt.fmt.pix.width;
         yuyv.height = cctx->fmt.fmt.pix.height;
         yuyv.size = yuyv.width * yuyv.height * 2;
+        yuyv.dmabuf_fd = b->dmabuf_fd;
+        yuyv.capture = b;
+        yuyv.t = t;
 
         // Send frame for processing
-        if (image_processor(&yuyv, cctx, sctx, pipeline) != 0) {
+        if (image_processor(&yuyv, pipeline) != 0) {
             perror("camera: Error sending YUYV frame for processing");
         }
   
-        // 3. Requeue the buffer to be filled again
-        if (ioctl(cctx->cam_fd, VIDIOC_QBUF, &cctx->buf) < 0){
-            perror("camera: Failed to requeue buffer");
-            break;
-        }
+        // 3. Requeue the buffer to be filled again (once every importer is done)
+        capture_buffer_release(b);
     } 
 
     printf("Capture stopped.\n");
     return 0;
 }
 
+/**
+* @brief Make a running capture_frames() return
+*
+* Called from another thread. STREAMOFF wakes a VIDIOC_DQBUF blocked in the
+* driver, and the capture loop takes the failure for the stop request. The
+* caller joins the capture thread before closing the camera.
+*
+* @param cctx Pointer to the camera context structure that holds all session state.
+*
+* @return void
+*/
+void camera_stop_capture(struct camera_ctx *cctx)
+{
+    atomic_store(&cctx->stopping, true);
+    stop_stream(cctx);
+}
+
+/**
+* @brief Take the capture timestamps of the buffer just dequeued
+*
+* Records the driver's own timestamp (when it is on the monotonic clock),
+* the dequeue time, frames the driver dropped since the previous buffer, and
+* the capture-stage latency, and publishes the counters to the telemetry page.
+*
+* @param cctx   Pointer to the camera context (cctx->buf is the dequeued buffer)
+* @param t      Timestamps to fill
+*
+* @return void
+*/
+static void stamp_frame(struct camera_ctx *cctx, struct frame_times *t)
+{
+    const struct v4l2_buffer *buf = &cctx->buf;
+    unsigned int dropped = 0;
+
+    t->dequeue = metrics_now();
+    if ((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        t->capture = (uint64_t)buf->timestamp.tv_sec * 1000000000ULL +
+                     (uint64_t)buf->timestamp.tv_usec * 1000ULL;
+    }
+
+    // Sequence numbers count every frame the sensor produced, queued or not
+    if (cctx->n_captured > 0 && buf->sequence > cctx->last_sequence + 1) {
+        dropped = buf->sequence - cctx->last_sequence - 1;
+        metrics_count(CNT_CAPTURE_DROPS, dropped);
+    }
+    cctx->last_sequence = buf->sequence;
+    cctx->n_captured++;
+    telemetry_frame(cctx, t->dequeue, dropped);
+
+    metrics_count(CNT_FRAMES_CAPTURED, 1);
+    metrics_frame_interval(cctx->opts.index, t->dequeue);
+    metrics_observe(STAGE_CAPTURE, t->capture, t->dequeue);
+}
+
+/**
+* @brief Time this camera last delivered a frame
+*
+* Safe to call from any thread while the capture loop runs.
+*
+* @param cctx   Pointer to the camera context
+*
+* @return metrics_now() time of the last dequeue, 0 if none yet
+*/
+uint64_t camera_last_frame(const struct camera_ctx *cctx)
+{
+    return __atomic_load_n(&cctx->last_dequeue_ns, __ATOMIC_RELAXED);
+}
+
 /**
 * @brief Stops the video capture stream.
 * 
@@ -438,8 +994,10 @@ static int stop_stream(struct camera_ctx *cctx)
     
     printf("camera: Stream stopped.\n");
     
-    // Notify LED driver that streaming has ended
-    led_stream_off(cctx);
+    // Notify LED driver that streaming has ended; a recorded error stays shown instead
+    if (!cctx->shared || __atomic_load_n(&cctx->shared->state, __ATOMIC_RELAXED) != CAM_STATE_ERROR) {
+        led_stream_off(cctx);
+    }
 
     return 0;
 }
@@ -455,6 +1013,7 @@ static int stop_stream(struct camera_ctx *cctx)
 *           - -errno on failure
 */
 static int led_stream_on(struct camera_ctx *cctx) {
+    if (cctx->dev_fd < 0) return 0;         // Another camera drives the LED
     if (ioctl(cctx->dev_fd, CAM_IOC_START) < 0) {
         perror("camera: Failed to send LED GREEN command");
         return -errno;
@@ -475,6 +1034,7 @@ static int led_stream_on(struct camera_ctx *cctx) {
 *           - -errno on failure
 */
 static int led_stream_off(struct camera_ctx *cctx) {
+    if (cctx->dev_fd < 0) return 0;
     if (ioctl(cctx->dev_fd, CAM_IOC_STOP) < 0) {
         perror("camera: Failed to send LED RED command");
         return -errno;
@@ -485,22 +1045,303 @@ static int led_stream_off(struct camera_ctx *cctx) {
 }
 
 /**
-* @brief Unmaps all V4L2 buffers and frees buffer array.
+* @brief Unmaps all V4L2 buffers (or the capture pool) and frees buffer array.
 *
 * @param cctx Pointer to the camera context structure that holds all session state.
 * @return void 
 */
 static void cleanup_buffers(struct camera_ctx *cctx)
 {
+    if (cctx->pool_mem) {
+        munmap(cctx->pool_mem, cctx->pool_len);
+        if (cctx->buffers) pthread_mutex_destroy(&cctx->pool_lock);
+        free(cctx->buffers);
+        free(cctx->free_blocks);
+        free(cctx->parked);
+        cctx->pool_mem = NULL;
+        cctx->buffers = NULL;
+        cctx->free_blocks = NULL;
+        cctx->parked = NULL;
+        cctx->n_buffers = 0;
+        return;
+    }
     if (!cctx->buffers) return;
 
     for (unsigned int i = 0; i < cctx->n_buffers; i++) {
         if (cctx->buffers[i].start && cctx->buffers[i].start != MAP_FAILED) {
             munmap(cctx->buffers[i].start, cctx->buffers[i].length);
         }
+        if (cctx->buffers[i].dmabuf_fd >= 0) close(cctx->buffers[i].dmabuf_fd);
     }
 
     free(cctx->buffers);
+    free(cctx->held);
     cctx->buffers = NULL;
+    cctx->held = NULL;
     cctx->n_buffers = 0;
 }
+
+/**
+* @brief Lend a dequeued MJPEG buffer to the clients (buffer-hold)
+*
+* The buffer is wrapped in its preallocated frame and stays out of the
+* driver queue until the frame's last reference is released. To never
+* starve the driver, at least CAMERA_MIN_QUEUED buffers stay queued; past
+* that the caller gets NULL and must copy the frame and requeue the buffer.
+*
+* @param cctx       Pointer to the camera context
+* @param index      Index of the dequeued buffer
+* @param bytesused  Compressed size reported by the driver
+*
+* @return Frame holding one reference to the buffer, or NULL
+*/
+static struct jpeg_frame *hold_buffer(struct camera_ctx *cctx, unsigned int index,
+                                      unsigned int bytesused)
+{
+    if (!cctx->held) return NULL;
+    if (atomic_load(&cctx->n_held) + CAMERA_MIN_QUEUED >= cctx->n_buffers) return NULL;
+
+    struct jpeg_frame *frame = &cctx->held[index];
+    frame->size = bytesused;
+    frame->part_head_len = 0;
+    frame->ws_head_len = 0;
+    atomic_init(&frame->refcount, 1);
+    atomic_fetch_add(&cctx->n_held, 1);
+    return frame;
+}
+
+/**
+* @brief Recycle hook of held buffers: give the buffer back to the driver
+*
+* Runs on whichever thread drops the last reference (usually the network
+* thread), so it uses its own v4l2_buffer rather than cctx->buf.
+*
+* @param frame  Held buffer frame (frame->owner is the camera context)
+*/
+static void requeue_held_buffer(struct jpeg_frame *frame)
+{
+    struct camera_ctx *cctx = frame->owner;
+
+    atomic_fetch_sub(&cctx->n_held, 1);
+    requeue_buffer(cctx, (unsigned int)(frame - cctx->held));
+}
+
+/**
+* @brief Give a dequeued buffer back to the driver
+*
+* Safe to call from any thread: uses its own v4l2_buffer rather than cctx->buf.
+*
+* @param cctx   Pointer to the camera context
+* @param index  V4L2 buffer index
+*/
+static void requeue_buffer(struct camera_ctx *cctx, unsigned int index)
+{
+    struct v4l2_buffer buf = {
+        .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+        .memory = V4L2_MEMORY_MMAP,
+        .index = index,
+    };
+
+    if (cctx->cam_fd >= 0 && ioctl(cctx->cam_fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("camera: Failed to requeue buffer");
+    }
+}
+
+/**
+* @brief Export every capture buffer as a DMABUF file descriptor
+*
+* Failure is not fatal: drivers without VIDIOC_EXPBUF simply leave
+* dmabuf_fd at -1 and consumers fall back to the CPU mapping.
+*
+* @param cctx Pointer to the camera context structure that holds all session state.
+* @return void
+*/
+static void export_buffers(struct camera_ctx *cctx)
+{
+    unsigned int exported = 0;
+
+    for (unsigned int i = 0; i < cctx->n_buffers; i++) {
+        struct v4l2_exportbuffer expbuf = {
+            .type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+            .index = i,
+            .flags = O_RDONLY | O_CLOEXEC,
+        };
+
+        if (ioctl(cctx->cam_fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+            perror("camera: Failed to export buffer (zero-copy hand-off disabled)");
+            break;
+        }
+        cctx->buffers[i].dmabuf_fd = expbuf.fd;
+        exported++;
+    }
+
+    // All or nothing, so importers can rely on every buffer having an fd
+    if (exported != cctx->n_buffers) {
+        for (unsigned int i = 0; i < exported; i++) {
+            close(cctx->buffers[i].dmabuf_fd);
+            cctx->buffers[i].dmabuf_fd = -1;
+        }
+        return;
+    }
+
+    printf("camera: Exported %u buffers as DMABUF\n", exported);
+}
+
+/**
+* @brief Take a reference to a dequeued capture buffer
+*
+* For importers (hardware encoder, inference) that keep using a frame after
+* the processing call returned.
+*
+* @param b  Capture buffer (yuyv_frame.capture)
+*
+* @return void
+*/
+void capture_buffer_retain(struct buffer *b)
+{
+    atomic_fetch_add_explicit(&b->refs, 1, memory_order_relaxed);
+}
+
+/**
+* @brief Drop a reference to a capture buffer; the last one re-queues it
+*
+* @param b  Capture buffer (yuyv_frame.capture)
+*
+* @return void
+*/
+void capture_buffer_release(struct buffer *b)
+{
+    if (atomic_fetch_sub_explicit(&b->refs, 1, memory_order_acq_rel) != 1) return;
+
+    struct camera_ctx *cctx = b->cctx;
+    if (cctx->memory != V4L2_MEMORY_USERPTR) {
+        requeue_buffer(cctx, b->index);
+        return;
+    }
+
+    // A slot that ran out of blocks takes this one, otherwise it returns to the pool
+    pthread_mutex_lock(&cctx->pool_lock);
+    if (cctx->n_parked) {
+        unsigned int slot = cctx->parked[--cctx->n_parked];
+        pthread_mutex_unlock(&cctx->pool_lock);
+        queue_user_buffer(cctx, slot, b);
+        return;
+    }
+    cctx->free_blocks[cctx->n_free_blocks++] = b;
+    pthread_mutex_unlock(&cctx->pool_lock);
+}
+
+/**
+* @brief Whether a capture buffer can be held without starving the driver
+*
+* True for USERPTR pool blocks: the driver slot was already refilled, so
+* a consumer may keep the frame (and skip copying it) until it is done.
+* MMAP buffers stay out of the driver queue while held.
+*
+* @param b  Capture buffer (yuyv_frame.capture)
+*
+* @return true if holding b costs the driver nothing
+*/
+bool capture_buffer_swappable(const struct buffer *b)
+{
+    return b->cctx->memory == V4L2_MEMORY_USERPTR;
+}
+
+/**
+* @brief The buffer just dequeued, holding the capture loop's reference
+*
+* In USERPTR mode the driver slot is refilled with a free pool block at
+* once; when none is free the slot waits for the next release.
+*
+* @param cctx   Pointer to the camera context (cctx->buf is the dequeued buffer)
+*
+* @return Capture buffer with one reference
+*/
+static struct buffer *take_buffer(struct camera_ctx *cctx)
+{
+    struct buffer *b;
+
+    if (cctx->memory != V4L2_MEMORY_USERPTR) {
+        b = &cctx->buffers[cctx->buf.index];
+        atomic_store(&b->refs, 1);
+        return b;
+    }
+
+    b = &cctx->buffers[(cctx->buf.m.userptr - (unsigned long)cctx->pool_mem) / cctx->pool_stride];
+    atomic_store(&b->refs, 1);
+
+    pthread_mutex_lock(&cctx->pool_lock);
+    struct buffer *fresh = cctx->n_free_blocks ? cctx->free_blocks[--cctx->n_free_blocks] : NULL;
+    if (!fresh) cctx->parked[cctx->n_parked++] = cctx->buf.index;
+    pthread_mutex_unlock(&cctx->pool_lock);
+
+    if (fresh) {
+        queue_user_buffer(cctx, cctx->buf.index, fresh);
+    } else {
+        metrics_count(CNT_CAPTURE_STARVED, 1);
+    }
+    return b;
+}
+
+/**
+* @brief Print every format, frame size and frame rate a camera offers
+*
+* Walks VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES and VIDIOC_ENUM_FRAMEINTERVALS
+* so a site can pick its configuration without extra tools.
+*
+* @param path   V4L2 device path (NULL = CAMERA_PATH)
+*
+* @return 0 on success, -errno if the device cannot be opened
+*/
+int camera_list_caps(const char *path)
+{
+    if (!path || !*path) path = CAMERA_PATH;
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        perror("camera: Failed to open camera device");
+        return -errno;
+    }
+
+    printf("%s:\n", path);
+
+    struct v4l2_fmtdesc fd_desc = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
+    for (fd_desc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &fd_desc) == 0; fd_desc.index++) {
+        unsigned int pf = fd_desc.pixelformat;
+        printf("  %c%c%c%c  %s\n", pf & 0xff, (pf >> 8) & 0xff, (pf >> 16) & 0xff, (pf >> 24) & 0xff,
+               (const char *)fd_desc.description);
+
+        struct v4l2_frmsizeenum fs = { .pixel_format = pf };
+        for (fs.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fs) == 0; fs.index++) {
+            if (fs.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+                printf("    %ux%u - %ux%u (step %ux%u)\n",
+                       fs.stepwise.min_width, fs.stepwise.min_height,
+                       fs.stepwise.max_width, fs.stepwise.max_height,
+                       fs.stepwise.step_width, fs.stepwise.step_height);
+                break;
+            }
+
+            printf("    %ux%u:", fs.discrete.width, fs.discrete.height);
+
+            struct v4l2_frmivalenum fi = {
+                .pixel_format = pf,
+                .width = fs.discrete.width,
+                .height = fs.discrete.height,
+            };
+            for (fi.index = 0; ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &fi) == 0; fi.index++) {
+                if (fi.type != V4L2_FRMIVAL_TYPE_DISCRETE) {
+                    printf(" %u/%u - %u/%u s", fi.stepwise.min.numerator, fi.stepwise.min.denominator,
+                           fi.stepwise.max.numerator, fi.stepwise.max.denominator);
+                    break;
+                }
+                if (fi.discrete.numerator) {
+                    printf(" %.4g", (double)fi.discrete.denominator / fi.discrete.numerator);
+                }
+            }
+            printf(" fps\n");
+        }
+    }
+
+    close(fd);
+    return 0;
+}
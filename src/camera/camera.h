@@ -7,18 +7,68 @@
 */
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <linux/videodev2.h>
 
 /** @brief Path to the LED/camera control deivce. */
 #define DEVICE_PATH         "/dev/cam_stream"
 
-/** @brief Path to the V4L2 camera device. */
+/** @brief Default path of the V4L2 camera device. */
 #define CAMERA_PATH         "/dev/video0"
 
+/** @brief Longest accepted camera device path. */
+#define CAMERA_PATH_MAX     64
+
+/** @brief Most cameras one process captures from. */
+#define CAMERA_MAX          4
+
+/** @brief Capture buffers requested for raw (YUYV) capture unless configured. */
+#define CAMERA_BUFFERS          4
+
+/** @brief Capture buffers requested in MJPEG passthrough (clients may hold some) unless configured. */
+#define CAMERA_MJPEG_BUFFERS    8
+
+/** @brief Buffers always left queued with the driver; below this, frames are copied out. */
+#define CAMERA_MIN_QUEUED       2
+
+/** @brief Upper bound on configurable capture buffers (V4L2's VIDEO_MAX_FRAME). */
+#define CAMERA_MAX_BUFFERS      32
+
+/** @brief Pool buffers beyond the driver's in USERPTR mode unless configured (frames held downstream). */
+#define CAMERA_SPARE_BUFFERS    6
+
+/** @brief Size of a huge page, to which a hugetlb capture pool is rounded up. */
+#define CAMERA_HUGEPAGE_SIZE    (2ul << 20)
+
 // Forward declare the context structures
-struct stream_ctx;
 struct yuyv_frame;
+struct jpeg_frame;
 struct pipeline_ctx;
+struct cam_shared;
+
+/**
+* @brief Capture settings requested by the application.
+*
+* The size is snapped to the nearest one the driver enumerates and the
+* frame rate to the nearest enumerated interval. The negotiated values end
+* up in camera_ctx.fmt, camera_ctx.fps and camera_ctx.n_buffers.
+*/
+struct camera_opts {
+    char device[CAMERA_PATH_MAX];   /**< V4L2 device path (empty = CAMERA_PATH) */
+    unsigned int width;             /**< Requested frame width in pixels */
+    unsigned int height;            /**< Requested frame height in pixels */
+    unsigned int pixelformat;       /**< V4L2_PIX_FMT_YUYV, or V4L2_PIX_FMT_MJPEG for passthrough */
+    unsigned int fps;               /**< Requested frame rate (0 = driver default) */
+    unsigned int n_buffers;         /**< Capture buffers to request (0 = per-format default) */
+    unsigned int memory;            /**< V4L2_MEMORY_USERPTR for pool-owned buffers (0 = V4L2_MEMORY_MMAP) */
+    unsigned int spare_buffers;     /**< Pool buffers beyond the driver's (USERPTR, 0 = CAMERA_SPARE_BUFFERS) */
+    bool hugepages;                 /**< Back the USERPTR pool with huge pages */
+    bool control;                   /**< Drive /dev/cam_stream (LED, telemetry page); one camera per process */
+    unsigned int index;             /**< Camera number, labels its metrics */
+};
 
 /**
 * @brief Describes a single memory-mapped video buffer.
@@ -26,10 +76,26 @@ struct pipeline_ctx;
 * This structure holds the starting address and length of a buffer
 * that is mapped into user-space from the kernel by the V4L2 driver.
 * Each buffer corresponds to one frame that the camera can write to.
+*
+* The buffer is also exported as a DMABUF so other devices (hardware
+* encoder, inference accelerator) can import the frame without a copy.
+* While dequeued it is reference counted: the capture loop holds one
+* reference and every importer that outlives the processing call takes
+* another. The buffer is re-queued to the driver on the last release.
+*
+* In USERPTR mode the buffer is one block of the application's own capture
+* pool instead. The driver slot it was dequeued from is refilled at once
+* with a free block, so a held buffer never leaves the driver short, and
+* on the last release the block goes back to the pool (see
+* capture_buffer_swappable()).
 */
 struct buffer {
     void *start;    /**< Pointer to the start of the mapped buffer in user space*/
     size_t length;  /**< Size of the buffer in bytes */
+    int dmabuf_fd;  /**< Exported DMABUF (VIDIOC_EXPBUF), or -1 if unsupported */
+    unsigned int index;             /**< V4L2 buffer index (MMAP) or pool block index (USERPTR) */
+    atomic_uint refs;               /**< References while dequeued */
+    struct camera_ctx *cctx;        /**< Owning camera, for re-queueing */
 };
 
 /**
@@ -41,7 +107,7 @@ struct buffer {
 * variables, improving modularity and maintainability.
 */
 struct camera_ctx {
-    int dev_fd;                     /**< File descriptor for LED/control device */
+    int dev_fd;                     /**< File descriptor for LED/control device, or -1 without control */
     int cam_fd;                     /**< File descriptor for camera device */
 
     struct v4l2_format fmt;         /**< Video format configuration */
@@ -49,12 +115,43 @@ struct camera_ctx {
     struct v4l2_buffer buf;         /**< Temporary buffer struct for operations */
 
     struct buffer *buffers;         /**< Pointer to an array of mapped buffers */
-    unsigned int n_buffers;         /**< Number of mapped buffers */
+    unsigned int n_buffers;         /**< Number of mapped buffers (USERPTR: pool blocks) */
+    unsigned int n_slots;           /**< Buffers the driver granted (MMAP: n_buffers) */
+    unsigned int memory;            /**< V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR in use */
+
+    struct camera_opts opts;        /**< Requested capture settings */
+    struct v4l2_fract timeperframe; /**< Negotiated frame interval (0/0 if the driver has none) */
+    unsigned int fps;               /**< Negotiated frame rate, rounded (0 if unknown) */
+    unsigned int last_sequence;     /**< v4l2_buffer.sequence of the last dequeued buffer */
+    unsigned long n_captured;       /**< Buffers dequeued since streaming started */
+    struct jpeg_frame *held;        /**< Per-buffer frames for MJPEG buffer-hold, or NULL */
+    atomic_uint n_held;             /**< Buffers currently held by clients (not queued) */
+    atomic_bool stopping;           /**< camera_stop_capture() was called */
+
+    struct cam_shared *shared;      /**< Telemetry page of the control device, or NULL */
+    unsigned long n_dropped;        /**< Frames the driver dropped since streaming started */
+    uint64_t last_dequeue_ns;       /**< metrics_now() time of the last dequeue */
+    uint64_t interval_ns;           /**< Smoothed interval between dequeues */
+
+    void *pool_mem;                 /**< USERPTR pool: one region holding every block, or NULL */
+    size_t pool_len;                /**< Length of pool_mem */
+    size_t pool_stride;             /**< Distance between blocks (sizeimage rounded up to a page) */
+    pthread_mutex_t pool_lock;      /**< Protects free_blocks and parked (USERPTR) */
+    struct buffer **free_blocks;    /**< Stack of pool blocks neither queued nor held */
+    unsigned int n_free_blocks;     /**< Valid entries in free_blocks */
+    unsigned int *parked;           /**< Driver slots waiting for a free block */
+    unsigned int n_parked;          /**< Valid entries in parked */
 };
 
 /** Function Prototypes */
-int camera_init(struct camera_ctx *cctx);
+int camera_init(struct camera_ctx *cctx, const struct camera_opts *opts);
 void close_camera(struct camera_ctx *cctx);
-int capture_frames(struct camera_ctx *cctx, struct stream_ctx *sctx, struct pipeline_ctx *pipeline);
+void camera_stop_capture(struct camera_ctx *cctx);
+int camera_list_caps(const char *path);
+uint64_t camera_last_frame(const struct camera_ctx *cctx);
+int capture_frames(struct camera_ctx *cctx, struct pipeline_ctx *pipeline);
+void capture_buffer_retain(struct buffer *b);
+void capture_buffer_release(struct buffer *b);
+bool capture_buffer_swappable(const struct buffer *b);
 
 #endif /* CAMERA_H */
\ No newline at end of file
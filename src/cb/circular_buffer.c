@@ -1,13 +1,29 @@
 /**
 * @file circular_buffer.c
-* @brief Circular buffer implementation for storing JPEG frame pointers
+* @brief Lock-free circular buffer implementation for storing JPEG frame pointers
 *
-* This module provides a FIFO circular buffer with overwrite-on-full behaviour.
-* It is intended for producer-consumer pipelines where old frames are dropped.
+* This module provides a FIFO ring of frame pointers for one writer and one
+* reader, built on C11 atomics only. What happens when the ring is full is
+* chosen per buffer:
+*   1. CB_DROP_OLDEST: the oldest frame is evicted and returned to the writer
+*      so its reference can be released
+*   2. CB_LATEST_ONLY: a one-slot ring, the reader always gets the newest frame
+*   3. CB_BLOCK: the writer sleeps on a futex until the reader makes room
+*      (bounded by CB_BLOCK_TIMEOUT_MS, after which the oldest is dropped)
+*
+* Readers are woken externally (the broadcaster signals an eventfd), so the
+* ring itself never makes a system call except for a CB_BLOCK writer.
 */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "circular_buffer.h"
 #include "image/image_encoder.h"
@@ -15,46 +31,132 @@
 /**
 * @brief Initialize the circular buffer
 *
-* Sets the head and tail indices to zero, marking the buffer as empty.
+* Allocates the slot array and marks the buffer as empty. The capacity is
+* rounded up to a power of two so counters can be masked instead of divided.
+*
+* @param cb         Pointer to the CircularBuffer instance.
+* @param capacity   Number of frames to hold (0 = BUFFER_SIZE)
+* @param policy     Behaviour of cb_write() on a full buffer
+*
+* @return 0 on success, -1 on failure
+*/
+int circular_buffer_init(CircularBuffer *cb, unsigned int capacity, enum cb_policy policy)
+{
+    if (capacity == 0) capacity = BUFFER_SIZE;
+    if (capacity > BUFFER_SIZE_MAX) capacity = BUFFER_SIZE_MAX;
+    if (policy == CB_LATEST_ONLY) capacity = 1;
+
+    uint32_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+
+    cb->entries = calloc(cap, sizeof(*cb->entries));
+    if (!cb->entries) return -1;
+
+    cb->mask = cap - 1;
+    cb->policy = policy;
+    atomic_init(&cb->head, 0);
+    atomic_init(&cb->tail, 0);
+    atomic_init(&cb->waiters, 0);
+    atomic_init(&cb->written, 0);
+    atomic_init(&cb->dropped, 0);
+    return 0;
+}
+
+/**
+* @brief Release the slot array
+*
+* Frames still queued are not released; drain the buffer with cb_read() first.
 *
 * @param cb Pointer to the CircularBuffer instance.
 */
-void circular_buffer_init(CircularBuffer *cb) {
-    cb->head = 0;
-    cb->tail = 0;
+void circular_buffer_destroy(CircularBuffer *cb)
+{
+    free(cb->entries);
+    cb->entries = NULL;
+}
+
+/**
+* @brief Sleep until the reader frees a slot (CB_BLOCK)
+*
+* @param cb     Pointer to the CircularBuffer instance.
+* @param head   Current write counter
+*/
+static void cb_wait_for_space(CircularBuffer *cb, uint32_t head)
+{
+    const uint32_t cap = cb->mask + 1;
+    uint32_t tail = atomic_load_explicit(&cb->tail, memory_order_acquire);
+    if (head - tail < cap) return;
+
+    struct timespec timeout = {
+        .tv_sec = CB_BLOCK_TIMEOUT_MS / 1000,
+        .tv_nsec = (CB_BLOCK_TIMEOUT_MS % 1000) * 1000000L
+    };
+
+    // Announce the waiter before re-checking, pairs with the check in cb_read()
+    atomic_fetch_add(&cb->waiters, 1);
+    while (head - (tail = atomic_load(&cb->tail)) >= cap) {
+        // Sleeps only while tail still has the value just checked
+        if (syscall(SYS_futex, &cb->tail, FUTEX_WAIT_PRIVATE, tail, &timeout, NULL, 0) < 0 &&
+            errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    atomic_fetch_sub(&cb->waiters, 1);
 }
 
 /**
 * @brief Write a JPEG frame pointer into the circular buffer
 * 
-* The frame pointer is stored at the current head position.
-* If the buffer is full, the oldest frame is overwritten by 
-* advancing the tail index.
+* The frame pointer is stored at the current head position. If the buffer
+* is full (after the CB_BLOCK wait, if any), the oldest frame is evicted by
+* advancing the tail counter. Must only be called by the single writer.
+*
+* The evicted frame is handed back to the caller so that its reference
+* can be released; dropping it silently would leak the frame.
 *
 * @param cb Pointer to the CircularBuffer instance.
 * @param frame Pointer to the jpeg_frame to store
 *
-* @return void
+* @return Pointer to the discarded oldest frame, or NULL if nothing was evicted
 */
-void cb_write(CircularBuffer *cb, struct jpeg_frame *frame)
+struct jpeg_frame *cb_write(CircularBuffer *cb, struct jpeg_frame *frame)
 {
-    // Store frame pointer at current write position
-    cb->entries[cb->head] = frame;
+    const uint32_t cap = cb->mask + 1;
+    struct jpeg_frame *evicted = NULL;
+
+    // Only this thread moves head
+    uint32_t head = atomic_load_explicit(&cb->head, memory_order_relaxed);
 
-    // Advance head index (wrap around at BUFFER_SIZE)
-    cb->head = (cb->head + 1) % BUFFER_SIZE;
+    if (cb->policy == CB_BLOCK) cb_wait_for_space(cb, head);
 
-    // If head catches up to tail, buffer was full
-    // Advance tail to discard the oldes entry 
-    if (cb->head == cb->tail) {
-        cb->tail = (cb->tail + 1) % BUFFER_SIZE;
+    uint32_t tail = atomic_load_explicit(&cb->tail, memory_order_acquire);
+    while (head - tail >= cap) {
+        // Full: race the reader for the oldest slot, the CAS winner owns it
+        struct jpeg_frame *oldest = atomic_load_explicit(&cb->entries[tail & cb->mask],
+                                                         memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&cb->tail, &tail, tail + 1,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+            evicted = oldest;
+            atomic_fetch_add_explicit(&cb->dropped, 1, memory_order_relaxed);
+            break;
+        }
+        // CAS failure reloaded tail: the reader made room or we retry the eviction
     }
+
+    // Store frame pointer at current write position, then publish it
+    atomic_store_explicit(&cb->entries[head & cb->mask], frame, memory_order_relaxed);
+    atomic_store_explicit(&cb->head, head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&cb->written, 1, memory_order_relaxed);
+
+    return evicted;
 }
 
 /**
 * @brief Read a JPEG frame pointer from the circular buffer
 * 
-* Retrieves the oldest frame in FIFO order.
+* Retrieves the oldest frame in FIFO order. Must only be called by the
+* single reader; it may run concurrently with cb_write().
 *
 * @param cb Pointer to the CircularBuffer instance.
 * @param output Address of a jpeg_frame pointer to receive the frame
@@ -64,17 +166,57 @@ void cb_write(CircularBuffer *cb, struct jpeg_frame *frame)
 */
 bool cb_read(CircularBuffer *cb, struct jpeg_frame **output) 
 {
-    // Buffer is empty if head equals tail
-    if (cb->head == cb->tail) {
-        return false;
-    }
+    uint32_t tail = atomic_load_explicit(&cb->tail, memory_order_relaxed);
 
-    // Retrieve the oldest frame
-    *output = cb->entries[cb->tail];
+    for (;;) {
+        // Buffer is empty if head equals tail
+        uint32_t head = atomic_load_explicit(&cb->head, memory_order_acquire);
+        if (head == tail) return false;
 
-    // Advance tail index
-    cb->tail = (cb->tail + 1) % BUFFER_SIZE;
+        // Read the oldest frame, then claim it (the writer may be evicting it)
+        struct jpeg_frame *frame = atomic_load_explicit(&cb->entries[tail & cb->mask],
+                                                        memory_order_relaxed);
+        if (atomic_compare_exchange_weak(&cb->tail, &tail, tail + 1)) {
+            *output = frame;
+            break;
+        }
+    }
+
+    // Wake a CB_BLOCK writer waiting for this slot
+    if (atomic_load(&cb->waiters)) {
+        syscall(SYS_futex, &cb->tail, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
 
     return true;
 }
 
+/**
+* @brief Number of frames currently queued
+*
+* @param cb Pointer to the CircularBuffer instance.
+*
+* @return Frame count (a snapshot when called concurrently)
+*/
+unsigned int cb_count(CircularBuffer *cb)
+{
+    uint32_t tail = atomic_load_explicit(&cb->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&cb->head, memory_order_acquire);
+    return head - tail;
+}
+
+/**
+* @brief Parse a policy name ("oldest", "latest" or "block")
+*
+* @param name   Policy name
+* @param policy Receives the parsed policy
+*
+* @return 0 on success, -1 if the name is unknown
+*/
+int cb_policy_parse(const char *name, enum cb_policy *policy)
+{
+    if (strcmp(name, "oldest") == 0) *policy = CB_DROP_OLDEST;
+    else if (strcmp(name, "latest") == 0) *policy = CB_LATEST_ONLY;
+    else if (strcmp(name, "block") == 0) *policy = CB_BLOCK;
+    else return -1;
+    return 0;
+}
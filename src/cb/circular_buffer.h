@@ -3,34 +3,65 @@
 
 /**
 * @file circular_buffer.h
-* @brief Circular buffer interface for storing pointers to JPEG frames.
+* @brief Lock-free circular buffer interface for storing pointers to JPEG frames.
 */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
-/** @brief Max number of JPEG frames held in the circular buffer. */
-#define BUFFER_SIZE     10
+/** @brief Default number of JPEG frames held in a circular buffer. */
+#define BUFFER_SIZE     8
+
+/** @brief Largest accepted circular buffer capacity. */
+#define BUFFER_SIZE_MAX 1024
+
+/** @brief Longest time a CB_BLOCK writer waits for space before dropping the oldest frame. */
+#define CB_BLOCK_TIMEOUT_MS     100
 
 // Forward declare the JPEG frame struct
 struct jpeg_frame;
 
 /**
-* @brief Circular buffer structure for storing pointers to JPEG frames.
+* @brief What cb_write() does when the buffer is full.
+*/
+enum cb_policy {
+    CB_DROP_OLDEST,         /**< Evict the oldest frame and hand it back for release */
+    CB_LATEST_ONLY,         /**< Keep only the newest frame (capacity forced to 1) */
+    CB_BLOCK,               /**< Wait for the reader, up to CB_BLOCK_TIMEOUT_MS, then drop oldest */
+};
+
+/**
+* @brief Lock-free ring of JPEG frame pointers (one writer, one reader).
+*
+* head and tail are free-running counters; the slot of counter n is
+* n & mask. Only the writer advances head. Both sides advance tail with a
+* compare-and-swap: the reader to consume a frame, the writer to evict one
+* when the ring is full. Whoever wins the CAS owns the frame, so an evicted
+* frame is never lost and never released twice.
 *
-* - entries: array of pointers to jpeg_frame elements
-* - head: index for writing new frames (producer position)
-* - tail: index for reading frames (consumer position)
+* - entries: array of capacity pointers to jpeg_frame elements
+* - head: counter for writing new frames (producer position)
+* - tail: counter for reading frames (consumer position); also the futex
+*   word a CB_BLOCK writer sleeps on
 */
 typedef struct CircularBuffer{
-    struct jpeg_frame* entries[BUFFER_SIZE];        /**< Array of pointers to frames */ 
-    uint32_t head;                                  /**< write index */ 
-    uint32_t tail;                                  /**< read index */ 
+    _Atomic(struct jpeg_frame *) *entries;          /**< Array of pointers to frames */
+    uint32_t mask;                                  /**< capacity - 1 (capacity is a power of two) */
+    enum cb_policy policy;                          /**< Behaviour on a full buffer */
+    _Atomic uint32_t head;                          /**< write counter */
+    _Atomic uint32_t tail;                          /**< read counter */
+    atomic_uint waiters;                            /**< Writers sleeping on tail (CB_BLOCK) */
+    atomic_ulong written;                           /**< Frames written */
+    atomic_ulong dropped;                           /**< Frames evicted before being read */
 } CircularBuffer;
 
 /** Function prototypes */
-void circular_buffer_init(CircularBuffer *cb);
-void cb_write(CircularBuffer *cb, struct jpeg_frame* frame);
+int circular_buffer_init(CircularBuffer *cb, unsigned int capacity, enum cb_policy policy);
+void circular_buffer_destroy(CircularBuffer *cb);
+struct jpeg_frame *cb_write(CircularBuffer *cb, struct jpeg_frame* frame);
 bool cb_read(CircularBuffer *cb, struct jpeg_frame** frame);
+unsigned int cb_count(CircularBuffer *cb);
+int cb_policy_parse(const char *name, enum cb_policy *policy);
 
-#endif  // CIRCULAR_BUFFER_H
\ No newline at end of file
+#endif  // CIRCULAR_BUFFER_H
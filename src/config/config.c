@@ -0,0 +1,468 @@
+/**
+* @file config.c
+* @brief Runtime configuration from a config file and the command line.
+*
+* The config file is a list of "key = value" lines; blank lines and lines
+* starting with '#' are ignored. Keys mirror the long names of the command
+* line options:
+*
+*     device        = /dev/video0
+*     format        = yuyv          # or mjpeg (passthrough)
+*     size          = 1280x720
+*     fps           = 30
+*     buffers       = 4
+*     io            = userptr       # or mmap; userptr: capture into our own pool
+*     spare_buffers = 6             # pool buffers beyond the driver's (userptr)
+*     hugepages     = 1             # back the capture pool with huge pages (userptr)
+*     port          = 8080
+*     quality       = 80
+*     jpeg_subsampling = 420        # or 422 (chroma at full height)
+*     jpeg_dct      = islow         # or fast (JDCT_IFAST)
+*     jpeg_restart  = 0             # MCU rows between restart markers (0 = none)
+*     jpeg_huffman  = standard      # optimized (per frame) or a table file trained by camera_bench -W
+*     zerocopy      = 16384         # 0 = off
+*     queue_depth   = 8
+*     queue_policy  = oldest        # or latest
+*     workers       = 4
+*     hw_encoder    = 1
+*     tiers         = 3             # quality tiers for slow clients (1 = off)
+*     resolutions   = 3             # full, 1/2 and 1/4 size substreams (1 = full only)
+*     idle          = 1             # skip encoding while nobody is watching
+*     motion        = skip          # off, reuse (re-send last JPEG) or skip unchanged frames
+*     motion_threshold = 4.0        # mean luma change (grey levels) counting as motion
+*     motion_keepalive = 1000       # ms between re-sends of a static scene (skip)
+*     motion_regions   = 0,0,320,240;320,240,320,240
+*     detect        = 1             # object detection thread
+*     detect_fps    = 5             # inferences per second, whatever the capture rate
+*     detect_threads = 2            # TFLite interpreter threads
+*     detect_score  = 0.5           # minimum box confidence
+*     detect_overlay = 1            # draw boxes into the stream
+*     detect_model  = src/detection/models/detect.tflite    # empty: built-in motion blobs
+*     detect_labels = src/detection/models/labelmap.txt
+*     record        = /mnt/footage  # record segments into this directory
+*     record_segment = 60           # seconds per segment file
+*     record_keep   = 1440          # delete the oldest beyond this many (0 = keep all)
+*     record_mode   = event         # or continuous; event: only around motion, detections, POST /trigger
+*     record_preroll = 5            # seconds kept from before a trigger
+*     record_preroll_mb = 16        # memory budget of that footage
+*     record_postroll = 10          # seconds recorded after the last trigger
+*     cpu_capture   = 3             # CPU list per thread role: "2", "0-1,3" or any
+*     cpu_encoder   = 0-2           # (unpinned roles keep off the capture CPUs)
+*     cpu_network   = 0
+*     cpu_detect    = 1-2
+*     cpu_record    = 0
+*     capture_priority = 50         # SCHED_FIFO priority of the capture thread (0 = normal)
+*     mlock         = 1             # lock memory in RAM and pre-fault the frame pools
+*/
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "http/event_loop.h"
+#include "http/ws_stream.h"
+#include "broadcast/broadcaster.h"
+#include "image/ladder.h"
+
+/**
+* @brief Fill a configuration with the built-in defaults
+*
+* @param cfg    Pointer to the configuration
+*
+* @return void
+*/
+void config_defaults(struct app_config *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    snprintf(cfg->camera.device, sizeof(cfg->camera.device), "%s", CAMERA_PATH);
+    snprintf(cfg->devices[0], sizeof(cfg->devices[0]), "%s", CAMERA_PATH);
+    cfg->n_cameras = 1;
+    cfg->camera.control = true;
+    cfg->camera.width = 640;
+    cfg->camera.height = 480;
+    cfg->camera.pixelformat = V4L2_PIX_FMT_YUYV;
+    cfg->port = CONFIG_DEFAULT_PORT;
+    cfg->quality = CONFIG_DEFAULT_QUALITY;
+    cfg->queue_policy = CB_DROP_OLDEST;
+    cfg->ws_credits = WS_DEFAULT_CREDITS;
+    cfg->n_workers = 1;
+    cfg->tiers = 1;
+    cfg->resolutions = LADDER_MAX_RUNGS;
+    cfg->idle = true;
+    cfg->motion.mode = MOTION_OFF;
+    cfg->motion.threshold = MOTION_DEFAULT_THRESHOLD;
+    cfg->motion.keepalive_ms = MOTION_DEFAULT_KEEPALIVE_MS;
+    cfg->detect.fps = DETECT_DEFAULT_FPS;
+    cfg->detect.threads = 1;
+    cfg->record.segment_s = REC_DEFAULT_SEGMENT_S;
+    cfg->record.preroll_s = REC_DEFAULT_PREROLL_S;
+    cfg->record.preroll_mb = REC_DEFAULT_PREROLL_MB;
+    cfg->record.postroll_s = REC_DEFAULT_POSTROLL_S;
+    cfg->detect.min_score = DETECT_DEFAULT_SCORE;
+}
+
+/**
+* @brief Parse an unsigned number, rejecting trailing garbage
+*
+* @return 0 on success, -1 on failure
+*/
+static int parse_uint(const char *s, unsigned long *out)
+{
+    char *end;
+    if (!*s) return -1;
+    *out = strtoul(s, &end, 10);
+    return (*end == '\0') ? 0 : -1;
+}
+
+/**
+* @brief Parse the camera device list, e.g. "/dev/video0,/dev/video2"
+*
+* @return 0 on success, -1 on an empty entry or more than CAMERA_MAX devices
+*/
+static int parse_devices(struct app_config *cfg, const char *list)
+{
+    unsigned int n = 0;
+    const char *p = list;
+
+    for (;;) {
+        size_t len = strcspn(p, ",");
+        if (len == 0 || len >= CAMERA_PATH_MAX || n == CAMERA_MAX) return -1;
+
+        snprintf(cfg->devices[n++], CAMERA_PATH_MAX, "%.*s", (int)len, p);
+        if (p[len] == '\0') break;
+        p += len + 1;
+    }
+
+    cfg->n_cameras = n;
+    snprintf(cfg->camera.device, sizeof(cfg->camera.device), "%s", cfg->devices[0]);
+    return 0;
+}
+
+/**
+* @brief Apply one setting given by name
+*
+* Shared by the config file and the command line.
+*
+* @return 0 on success, -1 on an unknown key or invalid value
+*/
+static int config_set(struct app_config *cfg, const char *key, const char *value)
+{
+    unsigned long n = 0;
+
+    if (strcmp(key, "device") == 0) {
+        return parse_devices(cfg, value);
+    }
+    if (strcmp(key, "format") == 0) {
+        if (strcmp(value, "yuyv") == 0) cfg->camera.pixelformat = V4L2_PIX_FMT_YUYV;
+        else if (strcmp(value, "mjpeg") == 0) cfg->camera.pixelformat = V4L2_PIX_FMT_MJPEG;
+        else return -1;
+        return 0;
+    }
+    if (strcmp(key, "size") == 0) {
+        unsigned int w, h;
+        char extra;
+        if (sscanf(value, "%ux%u%c", &w, &h, &extra) != 2 || w == 0 || h == 0) return -1;
+        cfg->camera.width = w;
+        cfg->camera.height = h;
+        return 0;
+    }
+    if (strcmp(key, "io") == 0) {
+        if (strcmp(value, "mmap") == 0) cfg->camera.memory = V4L2_MEMORY_MMAP;
+        else if (strcmp(value, "userptr") == 0) cfg->camera.memory = V4L2_MEMORY_USERPTR;
+        else return -1;
+        return 0;
+    }
+    if (strcmp(key, "queue_policy") == 0) {
+        if (cb_policy_parse(value, &cfg->queue_policy) < 0) return -1;
+
+        // A stalled client would hold up the publisher, and with it every encoder
+        // worker and camera lane; block is meant for local consumers only
+        if (cfg->queue_policy == CB_BLOCK) {
+            fprintf(stderr, "config: queue_policy = block ignored for network clients, using oldest\n");
+            cfg->queue_policy = CB_DROP_OLDEST;
+        }
+        return 0;
+    }
+    if (strcmp(key, "motion") == 0) {
+        return motion_mode_parse(value, &cfg->motion.mode);
+    }
+    if (strcmp(key, "motion_regions") == 0) {
+        return motion_regions_parse(value, &cfg->motion);
+    }
+    if (strcmp(key, "jpeg_subsampling") == 0) {
+        if (strcmp(value, "420") == 0) cfg->jpeg.subsampling = JPEG_SUBSAMPLE_420;
+        else if (strcmp(value, "422") == 0) cfg->jpeg.subsampling = JPEG_SUBSAMPLE_422;
+        else return -1;
+        return 0;
+    }
+    if (strcmp(key, "jpeg_dct") == 0) {
+        if (strcmp(value, "islow") == 0) cfg->jpeg.fast_dct = false;
+        else if (strcmp(value, "fast") == 0) cfg->jpeg.fast_dct = true;
+        else return -1;
+        return 0;
+    }
+    if (strcmp(key, "jpeg_huffman") == 0) {
+        cfg->jpeg_tables[0] = '\0';
+        if (strcmp(value, "standard") == 0) cfg->jpeg.huffman = JPEG_HUFFMAN_STANDARD;
+        else if (strcmp(value, "optimized") == 0) cfg->jpeg.huffman = JPEG_HUFFMAN_OPTIMIZED;
+        else snprintf(cfg->jpeg_tables, sizeof(cfg->jpeg_tables), "%s", value);
+        return 0;
+    }
+    if (strcmp(key, "detect_model") == 0) {
+        snprintf(cfg->detect.model, sizeof(cfg->detect.model), "%s", value);
+        return 0;
+    }
+    if (strcmp(key, "detect_labels") == 0) {
+        snprintf(cfg->detect.labels, sizeof(cfg->detect.labels), "%s", value);
+        return 0;
+    }
+    if (strcmp(key, "record") == 0) {
+        snprintf(cfg->record.dir, sizeof(cfg->record.dir), "%s", value);
+        return 0;
+    }
+    if (strcmp(key, "record_mode") == 0) {
+        if (strcmp(value, "event") == 0) cfg->record.event = true;
+        else if (strcmp(value, "continuous") == 0) cfg->record.event = false;
+        else return -1;
+        return 0;
+    }
+    if (strncmp(key, "cpu_", 4) == 0) {
+        for (unsigned int r = 0; r < THREAD_COUNT; r++) {
+            if (strcmp(key + 4, metrics_thread_name(r)) == 0) {
+                return topology_parse_cpus(value, &cfg->topology.cpus[r]);
+            }
+        }
+        return -1;
+    }
+    if (strcmp(key, "detect_score") == 0) {
+        char *end;
+        double s = strtod(value, &end);
+        if (*end != '\0' || s < 0.0 || s > 1.0) return -1;
+        cfg->detect.min_score = (float)s;
+        return 0;
+    }
+    if (strcmp(key, "motion_threshold") == 0) {
+        char *end;
+        double t = strtod(value, &end);
+        if (*end != '\0' || !(t > 0.0)) return -1;
+        cfg->motion.threshold = t;
+        return 0;
+    }
+
+    // Every remaining key takes a number
+    if (parse_uint(value, &n) < 0) return -1;
+
+    if (strcmp(key, "fps") == 0) cfg->camera.fps = n;
+    else if (strcmp(key, "buffers") == 0) cfg->camera.n_buffers = n;
+    else if (strcmp(key, "spare_buffers") == 0 && n <= CAMERA_MAX_BUFFERS) cfg->camera.spare_buffers = n;
+    else if (strcmp(key, "hugepages") == 0) cfg->camera.hugepages = (n != 0);
+    else if (strcmp(key, "port") == 0 && n > 0 && n < 65536) cfg->port = n;
+    else if (strcmp(key, "quality") == 0 && n >= 1 && n <= 100) cfg->quality = n;
+    else if (strcmp(key, "jpeg_restart") == 0 && n <= 65535) cfg->jpeg.restart_rows = n;
+    else if (strcmp(key, "zerocopy") == 0) cfg->zerocopy_min = n;
+    else if (strcmp(key, "queue_depth") == 0 && n <= BUFFER_SIZE_MAX) cfg->queue_depth = n;
+    else if (strcmp(key, "ws_credits") == 0 && n >= 1 && n <= WS_CREDITS_MAX) cfg->ws_credits = n;
+    else if (strcmp(key, "workers") == 0 && n >= 1) cfg->n_workers = n;
+    else if (strcmp(key, "hw_encoder") == 0) cfg->use_hw = (n != 0);
+    else if (strcmp(key, "tiers") == 0 && n >= 1 && n <= BROADCAST_TIERS) cfg->tiers = n;
+    else if (strcmp(key, "resolutions") == 0 && n >= 1 && n <= LADDER_MAX_RUNGS) cfg->resolutions = n;
+    else if (strcmp(key, "idle") == 0) cfg->idle = (n != 0);
+    else if (strcmp(key, "motion_keepalive") == 0 && n >= 1) cfg->motion.keepalive_ms = n;
+    else if (strcmp(key, "detect") == 0) cfg->detect.enabled = (n != 0);
+    else if (strcmp(key, "detect_fps") == 0 && n >= 1 && n <= 1000) {
+        cfg->detect.fps = n;
+        cfg->detect.enabled = true;
+    }
+    else if (strcmp(key, "detect_threads") == 0 && n >= 1 && n <= 64) cfg->detect.threads = n;
+    else if (strcmp(key, "detect_overlay") == 0) cfg->detect.overlay = (n != 0);
+    else if (strcmp(key, "record_segment") == 0 && n >= 1) cfg->record.segment_s = n;
+    else if (strcmp(key, "record_keep") == 0 && n <= REC_KEEP_MAX) cfg->record.keep = n;
+    else if (strcmp(key, "record_preroll") == 0 && n <= 3600) cfg->record.preroll_s = n;
+    else if (strcmp(key, "record_preroll_mb") == 0 && n >= 1 && n <= 1024) cfg->record.preroll_mb = n;
+    else if (strcmp(key, "record_postroll") == 0 && n >= 1) cfg->record.postroll_s = n;
+    else if (strcmp(key, "capture_priority") == 0 && n <= TOPOLOGY_MAX_PRIORITY) {
+        cfg->topology.capture_priority = n;
+    }
+    else if (strcmp(key, "mlock") == 0) cfg->topology.mlock = (n != 0);
+    else return -1;
+
+    return 0;
+}
+
+/**
+* @brief Strip leading and trailing whitespace in place
+*/
+static char *trim(char *s)
+{
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+/**
+* @brief Load settings from a config file
+*
+* @param cfg    Pointer to the configuration
+* @param path   Config file path
+*
+* @return 0 on success, -1 on failure (the offending line is reported)
+*/
+int config_load_file(struct app_config *cfg, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("config: Failed to open config file");
+        return -1;
+    }
+
+    char line[CONFIG_LINE_MAX];
+    int lineno = 0;
+    int ret = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char *key = trim(line);
+        if (!*key) continue;
+
+        char *eq = strchr(key, '=');
+        if (!eq) {
+            fprintf(stderr, "config: %s:%d: expected key = value\n", path, lineno);
+            ret = -1;
+            break;
+        }
+        *eq = '\0';
+
+        char *value = trim(eq + 1);
+        key = trim(key);
+        if (config_set(cfg, key, value) < 0) {
+            fprintf(stderr, "config: %s:%d: invalid setting '%s = %s'\n", path, lineno, key, value);
+            ret = -1;
+            break;
+        }
+    }
+
+    fclose(f);
+    return ret;
+}
+
+/**
+* @brief Print the command line synopsis
+*
+* @param prog   Program name (argv[0])
+*
+* @return void
+*/
+void config_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -c file     Load settings from a config file (options below override it)\n"
+            "  -d devices  Camera device, or up to %d comma-separated, served as /camN/ (default " CAMERA_PATH ")\n"
+            "  -s WxH      Capture size (default 640x480)\n"
+            "  -f fps      Capture frame rate (default: driver's choice)\n"
+            "  -b count    Capture buffers (default: 4, 8 in MJPEG passthrough)\n"
+            "  -m          MJPEG passthrough: serve the camera's own JPEG frames\n"
+            "  -U          Capture into our own buffer pool (USERPTR), swapped out instead of waited for\n"
+            "  -L          List the camera's formats, sizes and frame rates, then exit\n"
+            "  -P port     HTTP port (default %d)\n"
+            "  -Q quality  JPEG quality 1-100 (default %d)\n"
+            "  -z          Send large frames with MSG_ZEROCOPY\n"
+            "  -q depth    Frames queued per client, up to %d (default %d)\n"
+            "  -p policy   Full-queue policy per client: oldest or latest\n"
+            "  -w workers  Software encoder threads (default 1)\n"
+            "  -H          Use the V4L2 M2M hardware JPEG encoder if present\n"
+            "  -T tiers    Lower quality tiers slow clients may step down to, 1-%d (default 1: off)\n"
+            "  -R rungs    Resolutions served via ?res=WxH: full, 1/2, 1/4 (1-%d, default %d)\n"
+            "  -A          Always encode, even while nobody is watching\n"
+            "  -M mode     Unchanged frames: off (encode all), reuse (re-send last JPEG) or skip\n"
+            "  -D fps      Run object detection at fps inferences per second (default model: motion blobs)\n"
+            "  -O          Draw detection boxes into the stream\n"
+            "  -r dir      Record the stream into segment files in dir\n"
+            "  -e          Record only around events (motion, detections, POST /trigger), with pre-roll\n"
+            "  -F prio     Run the capture thread SCHED_FIFO at prio 1-%d (pin threads with cpu_* keys)\n"
+            "  -K          Lock memory in RAM (mlockall) and pre-fault the frame pools\n",
+            prog, CAMERA_MAX, CONFIG_DEFAULT_PORT, CONFIG_DEFAULT_QUALITY, BUFFER_SIZE_MAX, BUFFER_SIZE,
+            BROADCAST_TIERS, LADDER_MAX_RUNGS, LADDER_MAX_RUNGS, TOPOLOGY_MAX_PRIORITY);
+}
+
+/**
+* @brief Apply the command line on top of the current configuration
+*
+* A config file given with -c is loaded first, whatever its position, so
+* every other option overrides it.
+*
+* @param cfg    Pointer to the configuration (defaults already applied)
+* @param argc   Argument count
+* @param argv   Argument vector
+*
+* @return 0 on success, -1 on invalid usage
+*/
+int config_parse_args(struct app_config *cfg, int argc, char **argv)
+{
+    static const char optstring[] = "c:d:s:f:b:mULP:Q:zq:p:w:HT:R:AM:D:Or:eF:K";
+    int opt;
+
+    // Pass 1: the config file
+    opterr = 0;
+    while ((opt = getopt(argc, argv, optstring)) != -1) {
+        if (opt == 'c' && config_load_file(cfg, optarg) < 0) return -1;
+    }
+
+    // Pass 2: everything else
+    optind = 1;
+    opterr = 1;
+    while ((opt = getopt(argc, argv, optstring)) != -1) {
+        const char *key = NULL;
+        const char *value = optarg;
+
+        switch (opt) {
+            case 'c': continue;
+            case 'd': key = "device"; break;
+            case 's': key = "size"; break;
+            case 'f': key = "fps"; break;
+            case 'b': key = "buffers"; break;
+            case 'm': key = "format"; value = "mjpeg"; break;
+            case 'U': key = "io"; value = "userptr"; break;
+            case 'P': key = "port"; break;
+            case 'Q': key = "quality"; break;
+            case 'q': key = "queue_depth"; break;
+            case 'p': key = "queue_policy"; break;
+            case 'w': key = "workers"; break;
+            case 'H': key = "hw_encoder"; value = "1"; break;
+            case 'T': key = "tiers"; break;
+            case 'R': key = "resolutions"; break;
+            case 'A': key = "idle"; value = "0"; break;
+            case 'M': key = "motion"; break;
+            case 'D': key = "detect_fps"; break;
+            case 'O': key = "detect_overlay"; value = "1"; break;
+            case 'r': key = "record"; break;
+            case 'e': key = "record_mode"; value = "event"; break;
+            case 'F': key = "capture_priority"; break;
+            case 'K': key = "mlock"; value = "1"; break;
+            case 'z':
+                cfg->zerocopy_min = ZEROCOPY_MIN_DEFAULT;
+                continue;
+            case 'L':
+                cfg->list_caps = true;
+                continue;
+            default:
+                config_usage(argv[0]);
+                return -1;
+        }
+
+        if (config_set(cfg, key, value) < 0) {
+            fprintf(stderr, "config: Invalid value '%s' for -%c\n", value, opt);
+            return -1;
+        }
+    }
+
+    return 0;
+}
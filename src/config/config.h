@@ -0,0 +1,64 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/**
+* @file config.h
+* @brief Runtime configuration from a config file and the command line.
+*/
+
+#include <stdbool.h>
+
+#include "camera/camera.h"
+#include "cb/circular_buffer.h"
+#include "image/motion.h"
+#include "detection/detection.h"
+#include "record/recorder.h"
+#include "sched/topology.h"
+#include "image/image_encoder.h"
+
+/** @brief Default TCP port of the HTTP server. */
+#define CONFIG_DEFAULT_PORT     8080
+
+/** @brief Default JPEG quality of software and hardware encoders. */
+#define CONFIG_DEFAULT_QUALITY  80
+
+/** @brief Longest accepted config file line. */
+#define CONFIG_LINE_MAX         256
+
+/**
+* @brief Every setting that can be tuned per site without rebuilding.
+*
+* Filled with defaults, then from the config file (-c), then from the other
+* command line options, so the command line always wins.
+*/
+struct app_config {
+    struct camera_opts camera;      /**< Device, format, size, frame rate and buffer count */
+    char devices[CAMERA_MAX][CAMERA_PATH_MAX];  /**< Camera devices; the other settings apply to each */
+    unsigned int n_cameras;         /**< Valid entries in devices (camera.device is devices[0]) */
+    unsigned int port;              /**< HTTP server port */
+    int quality;                    /**< JPEG quality (1-100) */
+    struct jpeg_profile jpeg;       /**< Software encoding profile (tables: see jpeg_tables) */
+    char jpeg_tables[CONFIG_LINE_MAX];  /**< Trained Huffman table file, or empty */
+    unsigned long zerocopy_min;     /**< MSG_ZEROCOPY threshold in bytes (0 = off) */
+    unsigned int queue_depth;       /**< Frames queued per client (0 = BUFFER_SIZE, at most BUFFER_SIZE_MAX) */
+    enum cb_policy queue_policy;    /**< Full-queue policy per client (oldest or latest, never block) */
+    unsigned int ws_credits;        /**< Unacknowledged frames per WebSocket client */
+    unsigned int n_workers;         /**< Software encoder threads */
+    bool use_hw;                    /**< Try the V4L2 M2M hardware encoder */
+    unsigned int tiers;             /**< Quality tiers slow clients can step down to (1 = off) */
+    unsigned int resolutions;       /**< Rungs of the resolution ladder, full size included */
+    bool idle;                      /**< Skip conversion and encoding while nothing consumes frames */
+    struct motion_opts motion;      /**< Change detection gating the encoder */
+    struct detect_opts detect;      /**< Object detection thread */
+    struct record_opts record;      /**< Segmented recording to disk */
+    struct topology_opts topology;  /**< CPU placement, capture priority and memory locking */
+    bool list_caps;                 /**< Print the camera's capabilities and exit */
+};
+
+/** Function prototypes */
+void config_defaults(struct app_config *cfg);
+int config_load_file(struct app_config *cfg, const char *path);
+int config_parse_args(struct app_config *cfg, int argc, char **argv);
+void config_usage(const char *prog);
+
+#endif  // CONFIG_H
@@ -0,0 +1,653 @@
+/**
+* @file detection.c
+* @brief Asynchronous object detection fed through a latest-frame mailbox.
+*
+* The stream never waits for inference: the producer thread only downscales
+* one frame per inference interval (nearest neighbour, YUYV -> RGB24 at the
+* model input size) and drops it in the mailbox. The detection thread picks
+* up whatever frame is newest when it becomes free, so a slow model lowers
+* the detection rate, never the frame rate.
+*
+* Backends:
+*   - TensorFlow Lite (built with TFLITE=1): an SSD-style model with the
+*     usual TFLite_Detection_PostProcess outputs (boxes, classes, scores,
+*     count), uint8 or float input
+*   - Built-in motion blobs: cells of the downscaled frame whose brightness
+*     changed since the previous inference, grouped into boxes. Needs no
+*     model and keeps the stage usable on builds without TFLite.
+*
+* Results are published as one struct detect_result under the detector
+* lock; detector_draw() can burn the latest boxes into frames captured after
+* the analysed one.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+
+#include "detection.h"
+#include "image/image_encoder.h"
+#include "metrics/metrics.h"
+#include "sched/topology.h"
+
+#ifdef HAVE_TFLITE
+#include <tensorflow/lite/c/c_api.h>
+#endif
+
+/** @brief Ensure value stays within 8-bit pixel range: [0, 255]  */
+#define CLIP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
+
+/** @brief Boxes are drawn only while the result is younger than this many inference intervals. */
+#define DETECT_OVERLAY_INTERVALS    3
+
+/** @brief Luma drawn for overlay boxes. */
+#define DETECT_OVERLAY_LUMA         235
+
+/** @brief Blob detector: cell size in input pixels and brightness change that marks a cell. */
+#define DETECT_BLOB_CELL            8
+#define DETECT_BLOB_DELTA           12
+
+/**
+* @brief One inference implementation.
+*/
+struct detect_backend {
+    const char *name;
+    /** Load the model and set d->in_width / d->in_height */
+    int (*open)(struct detector *d);
+    /** Analyse one RGB24 input and fill res->boxes / res->n_boxes */
+    int (*infer)(struct detector *d, const unsigned char *rgb, struct detect_result *res);
+    void (*close)(struct detector *d);
+};
+
+/* ------------------------------------------------------------------------ */
+/* Built-in motion blob backend                                             */
+/* ------------------------------------------------------------------------ */
+
+#define BLOB_COLS   (DETECT_BLOB_WIDTH / DETECT_BLOB_CELL)
+#define BLOB_ROWS   (DETECT_BLOB_HEIGHT / DETECT_BLOB_CELL)
+
+/**
+* @brief Motion blob state: mean luma of every cell at the previous inference
+*/
+struct blob_state {
+    int prev[BLOB_ROWS][BLOB_COLS];
+    bool have_prev;
+};
+
+static int blob_open(struct detector *d)
+{
+    d->in_width = DETECT_BLOB_WIDTH;
+    d->in_height = DETECT_BLOB_HEIGHT;
+    d->backend_state = calloc(1, sizeof(struct blob_state));
+    return d->backend_state ? 0 : -1;
+}
+
+/**
+* @brief Group changed cells into boxes (4-connected components)
+*/
+static int blob_infer(struct detector *d, const unsigned char *rgb, struct detect_result *res)
+{
+    struct blob_state *st = d->backend_state;
+    int cur[BLOB_ROWS][BLOB_COLS] = {{0}};
+    int delta[BLOB_ROWS][BLOB_COLS];
+    bool marked[BLOB_ROWS][BLOB_COLS] = {{false}};
+
+    for (unsigned int y = 0; y < BLOB_ROWS * DETECT_BLOB_CELL; y++) {
+        const unsigned char *px = rgb + (size_t)y * DETECT_BLOB_WIDTH * 3;
+        for (unsigned int x = 0; x < BLOB_COLS * DETECT_BLOB_CELL; x++, px += 3) {
+            cur[y / DETECT_BLOB_CELL][x / DETECT_BLOB_CELL] += (77 * px[0] + 150 * px[1] + 29 * px[2]) >> 8;
+        }
+    }
+
+    for (int r = 0; r < BLOB_ROWS; r++) {
+        for (int c = 0; c < BLOB_COLS; c++) {
+            cur[r][c] /= DETECT_BLOB_CELL * DETECT_BLOB_CELL;
+            delta[r][c] = st->have_prev ? abs(cur[r][c] - st->prev[r][c]) : 0;
+            marked[r][c] = delta[r][c] >= DETECT_BLOB_DELTA;
+        }
+    }
+    memcpy(st->prev, cur, sizeof(cur));
+    st->have_prev = true;
+
+    static const int step[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+    res->n_boxes = 0;
+    for (int r0 = 0; r0 < BLOB_ROWS; r0++) {
+        for (int c0 = 0; c0 < BLOB_COLS; c0++) {
+            if (!marked[r0][c0]) continue;
+
+            // Flood fill one component, tracking its bounding cells
+            int stack[BLOB_ROWS * BLOB_COLS];
+            int top = 0, cells = 0, sum = 0;
+            int rmin = r0, rmax = r0, cmin = c0, cmax = c0;
+
+            marked[r0][c0] = false;
+            stack[top++] = r0 * BLOB_COLS + c0;
+            while (top > 0) {
+                int cell = stack[--top];
+                int r = cell / BLOB_COLS, c = cell % BLOB_COLS;
+
+                cells++;
+                sum += delta[r][c];
+                if (r < rmin) rmin = r;
+                if (r > rmax) rmax = r;
+                if (c < cmin) cmin = c;
+                if (c > cmax) cmax = c;
+
+                for (int k = 0; k < 4; k++) {
+                    int nr = r + step[k][0], nc = c + step[k][1];
+                    if (nr < 0 || nr >= BLOB_ROWS || nc < 0 || nc >= BLOB_COLS || !marked[nr][nc]) continue;
+                    marked[nr][nc] = false;
+                    stack[top++] = nr * BLOB_COLS + nc;
+                }
+            }
+
+            // A single cell is usually noise
+            float score = (float)sum / cells / 64.0f;
+            if (cells < 2 || res->n_boxes == DETECT_MAX_BOXES) continue;
+            if (score > 1.0f) score = 1.0f;
+            if (score < d->opts.min_score) continue;
+
+            struct detect_box *b = &res->boxes[res->n_boxes++];
+            b->x0 = (float)cmin / BLOB_COLS;
+            b->y0 = (float)rmin / BLOB_ROWS;
+            b->x1 = (float)(cmax + 1) / BLOB_COLS;
+            b->y1 = (float)(rmax + 1) / BLOB_ROWS;
+            b->score = score;
+            b->class_id = -1;
+            snprintf(b->label, sizeof(b->label), "motion");
+        }
+    }
+    return 0;
+}
+
+static void blob_close(struct detector *d)
+{
+    free(d->backend_state);
+    d->backend_state = NULL;
+}
+
+static const struct detect_backend blob_backend = {
+    .name = "motion",
+    .open = blob_open,
+    .infer = blob_infer,
+    .close = blob_close,
+};
+
+/* ------------------------------------------------------------------------ */
+/* TensorFlow Lite backend                                                  */
+/* ------------------------------------------------------------------------ */
+
+#ifdef HAVE_TFLITE
+/** @brief Most labels read from the label map. */
+#define TFLITE_MAX_LABELS   256
+
+/**
+* @brief TFLite interpreter and its input conversion
+*/
+struct tflite_state {
+    TfLiteModel *model;
+    TfLiteInterpreter *interp;
+    TfLiteTensor *input;
+    bool float_input;               /**< Model takes float32 in [-1, 1] instead of uint8 */
+    float *finput;                  /**< Conversion buffer for float models */
+    char (*labels)[DETECT_LABEL_MAX];
+    unsigned int n_labels;
+};
+
+/**
+* @brief Load the label map; quotes and backslashes are dropped (labels end up in JSON)
+*/
+static void tflite_load_labels(struct tflite_state *st, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("detection: Failed to open label map");
+        return;
+    }
+
+    st->labels = calloc(TFLITE_MAX_LABELS, sizeof(*st->labels));
+    char line[DETECT_PATH_MAX];
+    while (st->labels && st->n_labels < TFLITE_MAX_LABELS && fgets(line, sizeof(line), f)) {
+        char *dst = st->labels[st->n_labels];
+        size_t n = 0;
+        for (const char *p = line; *p && *p != '\n' && *p != '\r' && n < DETECT_LABEL_MAX - 1; p++) {
+            if (*p != '"' && *p != '\\') dst[n++] = *p;
+        }
+        dst[n] = '\0';
+        st->n_labels++;
+    }
+    fclose(f);
+}
+
+static void tflite_close(struct detector *d);
+
+static int tflite_open(struct detector *d)
+{
+    struct tflite_state *st = calloc(1, sizeof(*st));
+    if (!st) return -1;
+    d->backend_state = st;
+
+    st->model = TfLiteModelCreateFromFile(d->opts.model);
+    if (!st->model) {
+        fprintf(stderr, "detection: Failed to load model %s\n", d->opts.model);
+        tflite_close(d);
+        return -1;
+    }
+
+    TfLiteInterpreterOptions *io = TfLiteInterpreterOptionsCreate();
+    TfLiteInterpreterOptionsSetNumThreads(io, (int32_t)d->opts.threads);
+    st->interp = TfLiteInterpreterCreate(st->model, io);
+    TfLiteInterpreterOptionsDelete(io);
+
+    if (!st->interp || TfLiteInterpreterAllocateTensors(st->interp) != kTfLiteOk) {
+        fprintf(stderr, "detection: Failed to create the TFLite interpreter\n");
+        tflite_close(d);
+        return -1;
+    }
+
+    // NHWC input with 3 channels
+    st->input = TfLiteInterpreterGetInputTensor(st->interp, 0);
+    if (!st->input || TfLiteTensorNumDims(st->input) != 4 || TfLiteTensorDim(st->input, 3) != 3 ||
+        TfLiteInterpreterGetOutputTensorCount(st->interp) < 4) {
+        fprintf(stderr, "detection: Model is not an SSD detector with an RGB input\n");
+        tflite_close(d);
+        return -1;
+    }
+    d->in_height = (unsigned int)TfLiteTensorDim(st->input, 1);
+    d->in_width = (unsigned int)TfLiteTensorDim(st->input, 2);
+
+    st->float_input = TfLiteTensorType(st->input) == kTfLiteFloat32;
+    if (st->float_input) {
+        st->finput = malloc((size_t)d->in_width * d->in_height * 3 * sizeof(float));
+        if (!st->finput) {
+            tflite_close(d);
+            return -1;
+        }
+    }
+
+    if (d->opts.labels[0]) tflite_load_labels(st, d->opts.labels);
+    return 0;
+}
+
+static int tflite_infer(struct detector *d, const unsigned char *rgb, struct detect_result *res)
+{
+    struct tflite_state *st = d->backend_state;
+    size_t n = (size_t)d->in_width * d->in_height * 3;
+    TfLiteStatus ret;
+
+    if (st->float_input) {
+        for (size_t i = 0; i < n; i++) st->finput[i] = (rgb[i] - 127.5f) / 127.5f;
+        ret = TfLiteTensorCopyFromBuffer(st->input, st->finput, n * sizeof(float));
+    } else {
+        ret = TfLiteTensorCopyFromBuffer(st->input, rgb, n);
+    }
+    if (ret != kTfLiteOk || TfLiteInterpreterInvoke(st->interp) != kTfLiteOk) {
+        fprintf(stderr, "detection: Inference failed\n");
+        return -1;
+    }
+
+    // Post-processed SSD outputs: boxes [1,N,4] (ymin, xmin, ymax, xmax), classes, scores, count
+    const TfLiteTensor *t_boxes = TfLiteInterpreterGetOutputTensor(st->interp, 0);
+    const TfLiteTensor *t_classes = TfLiteInterpreterGetOutputTensor(st->interp, 1);
+    const TfLiteTensor *t_scores = TfLiteInterpreterGetOutputTensor(st->interp, 2);
+    const TfLiteTensor *t_count = TfLiteInterpreterGetOutputTensor(st->interp, 3);
+    const float *boxes = TfLiteTensorData(t_boxes);
+    const float *classes = TfLiteTensorData(t_classes);
+    const float *scores = TfLiteTensorData(t_scores);
+    const float *count = TfLiteTensorData(t_count);
+    if (!boxes || !classes || !scores || !count) return -1;
+
+    int total = (int)count[0];
+    int cap = (int)(TfLiteTensorByteSize(t_scores) / sizeof(float));
+    if (total > cap) total = cap;
+
+    res->n_boxes = 0;
+    for (int i = 0; i < total && res->n_boxes < DETECT_MAX_BOXES; i++) {
+        if (scores[i] < d->opts.min_score) continue;
+
+        struct detect_box *b = &res->boxes[res->n_boxes++];
+        b->y0 = boxes[4 * i + 0];
+        b->x0 = boxes[4 * i + 1];
+        b->y1 = boxes[4 * i + 2];
+        b->x1 = boxes[4 * i + 3];
+        b->score = scores[i];
+        b->class_id = (int)classes[i];
+        if (b->class_id >= 0 && (unsigned int)b->class_id < st->n_labels) {
+            snprintf(b->label, sizeof(b->label), "%s", st->labels[b->class_id]);
+        } else {
+            snprintf(b->label, sizeof(b->label), "class %d", b->class_id);
+        }
+    }
+    return 0;
+}
+
+static void tflite_close(struct detector *d)
+{
+    struct tflite_state *st = d->backend_state;
+    if (!st) return;
+
+    if (st->interp) TfLiteInterpreterDelete(st->interp);
+    if (st->model) TfLiteModelDelete(st->model);
+    free(st->finput);
+    free(st->labels);
+    free(st);
+    d->backend_state = NULL;
+}
+
+static const struct detect_backend tflite_backend = {
+    .name = "tflite",
+    .open = tflite_open,
+    .infer = tflite_infer,
+    .close = tflite_close,
+};
+#endif  // HAVE_TFLITE
+
+/* ------------------------------------------------------------------------ */
+/* Detection stage                                                          */
+/* ------------------------------------------------------------------------ */
+
+/**
+* @brief Detection thread: analyse the newest mailbox frame, publish the result
+*/
+static void *detector_thread(void *arg)
+{
+    struct detector *d = arg;
+    struct detect_result res;
+    unsigned long seq = 0;
+
+    topology_enter(THREAD_DETECT);
+
+    for (;;) {
+        pthread_mutex_lock(&d->lock);
+        while (!d->has_pending && !d->stop) {
+            pthread_cond_wait(&d->cond, &d->lock);
+        }
+        if (d->stop) {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+
+        // Take the mailbox frame; the producer gets our previous buffer to fill later
+        unsigned int taken = d->pending;
+        d->pending = d->work;
+        d->work = taken;
+        d->has_pending = false;
+        pthread_mutex_unlock(&d->lock);
+
+        memset(&res, 0, sizeof(res));
+        uint64_t start = metrics_now();
+        if (d->backend->infer(d, d->buf[d->work], &res) != 0) continue;
+
+        res.done_ns = metrics_now();
+        res.infer_ns = res.done_ns - start;
+        res.capture_ns = d->buf_capture[d->work];
+        res.seq = ++seq;
+        metrics_observe(STAGE_DETECT, start, res.done_ns);
+        metrics_count(CNT_DETECTIONS, 1);
+
+        pthread_mutex_lock(&d->lock);
+        d->result = res;
+        pthread_mutex_unlock(&d->lock);
+    }
+    return NULL;
+}
+
+/**
+* @brief Load the detection backend and start the detection thread
+*
+* Uses the TFLite model when one is configured (and the build has TFLite),
+* the built-in motion blob detector otherwise.
+*
+* @param d      Pointer to the detector
+* @param opts   Settings
+* @param width  Captured frame width
+* @param height Captured frame height
+*
+* @return 0 on success, -1 on failure
+*/
+int detector_start(struct detector *d, const struct detect_opts *opts,
+                   unsigned int width, unsigned int height)
+{
+    memset(d, 0, sizeof(*d));
+    d->opts = *opts;
+    if (d->opts.fps == 0) d->opts.fps = DETECT_DEFAULT_FPS;
+    if (d->opts.threads == 0) d->opts.threads = 1;
+    d->src_width = width;
+    d->src_height = height;
+
+    d->backend = &blob_backend;
+    if (d->opts.model[0]) {
+#ifdef HAVE_TFLITE
+        d->backend = &tflite_backend;
+#else
+        fprintf(stderr, "detection: Built without TFLite (make TFLITE=1), using motion blobs\n");
+#endif
+    }
+
+    if (d->backend->open(d) < 0) return -1;
+
+    size_t in_size = (size_t)d->in_width * d->in_height * 3;
+    for (unsigned int i = 0; i < 3; i++) {
+        d->buf[i] = malloc(in_size);
+        if (!d->buf[i]) {
+            perror("detection: Failed to allocate input buffers");
+            detector_stop(d);
+            return -1;
+        }
+    }
+    d->fill = 0;
+    d->pending = 1;
+    d->work = 2;
+
+    if (pthread_mutex_init(&d->lock, NULL) != 0 || pthread_cond_init(&d->cond, NULL) != 0) {
+        perror("detection: Failed to initialize mailbox");
+        detector_stop(d);
+        return -1;
+    }
+    if (pthread_create(&d->thread, NULL, detector_thread, d) != 0) {
+        perror("detection: Failed to create thread");
+        detector_stop(d);
+        return -1;
+    }
+    d->running = true;
+
+    printf("detection: %s backend, %ux%u input, %u fps, %u thread(s)\n", d->backend->name,
+           d->in_width, d->in_height, d->opts.fps, d->opts.threads);
+    return 0;
+}
+
+/**
+* @brief Stop the detection thread and release the backend
+*
+* @param d  Pointer to the detector
+*
+* @return void
+*/
+void detector_stop(struct detector *d)
+{
+    if (d->running) {
+        pthread_mutex_lock(&d->lock);
+        d->stop = true;
+        pthread_cond_signal(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+        pthread_join(d->thread, NULL);
+        pthread_cond_destroy(&d->cond);
+        pthread_mutex_destroy(&d->lock);
+        d->running = false;
+    }
+
+    if (d->backend) d->backend->close(d);
+    for (unsigned int i = 0; i < 3; i++) {
+        free(d->buf[i]);
+        d->buf[i] = NULL;
+    }
+}
+
+/**
+* @brief Whether the frame captured at now_ns should be offered
+*
+* Paces submissions to the configured inference rate, so the producer only
+* pays for downscaling the frames that will actually be analysed.
+*
+* @param d      Pointer to the detector (producer thread only)
+* @param now_ns Dequeue time of the frame
+*
+* @return true if detector_submit() should be called for this frame
+*/
+bool detector_wants_frame(struct detector *d, uint64_t now_ns)
+{
+    if (now_ns < d->next_due_ns) return false;
+
+    uint64_t interval = 1000000000ULL / d->opts.fps;
+    d->next_due_ns = (now_ns - d->next_due_ns < interval) ? d->next_due_ns + interval
+                                                          : now_ns + interval;
+    return true;
+}
+
+/**
+* @brief Downscale a frame into the mailbox, replacing any frame still waiting
+*
+* Nearest-neighbour sampling straight from YUYV to RGB24 at the model input
+* size (BT.601, as yuyv_to_rgb()), on the producer thread; never blocks on
+* the detection thread beyond a pointer swap.
+*
+* @param d      Pointer to the detector (producer thread only)
+* @param yuyv   Captured frame (d->src_width x d->src_height)
+*
+* @return void
+*/
+void detector_submit(struct detector *d, const struct yuyv_frame *yuyv)
+{
+    unsigned char *dst = d->buf[d->fill];
+    const size_t stride = (size_t)d->src_width * 2;
+
+    for (unsigned int oy = 0; oy < d->in_height; oy++) {
+        const unsigned char *row = yuyv->data + (size_t)(oy * d->src_height / d->in_height) * stride;
+
+        for (unsigned int ox = 0; ox < d->in_width; ox++) {
+            unsigned int sx = ox * d->src_width / d->in_width;
+            const unsigned char *pair = row + (sx & ~1u) * 2;
+
+            int c = pair[(sx & 1) ? 2 : 0] - 16;
+            int u = pair[1] - 128;
+            int v = pair[3] - 128;
+            *dst++ = CLIP((298 * c + 409 * v + 128) >> 8);
+            *dst++ = CLIP((298 * c - 100 * u - 208 * v + 128) >> 8);
+            *dst++ = CLIP((298 * c + 516 * u + 128) >> 8);
+        }
+    }
+    d->buf_capture[d->fill] = yuyv->t.capture ? yuyv->t.capture : yuyv->t.dequeue;
+
+    pthread_mutex_lock(&d->lock);
+    unsigned int filled = d->fill;
+    d->fill = d->pending;
+    d->pending = filled;
+    if (d->has_pending) metrics_count(CNT_DETECT_DROPS, 1);   // Replaced before inference
+    d->has_pending = true;
+    pthread_cond_signal(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/**
+* @brief Copy the latest detection result
+*
+* Safe to call from any thread.
+*
+* @param d      Pointer to the detector
+* @param out    Receives the result
+*
+* @return 0 on success, -1 if no inference has completed yet
+*/
+int detector_latest(struct detector *d, struct detect_result *out)
+{
+    pthread_mutex_lock(&d->lock);
+    *out = d->result;
+    pthread_mutex_unlock(&d->lock);
+    return out->seq ? 0 : -1;
+}
+
+/**
+* @brief Set the luma of a horizontal run of pixels
+*/
+static void draw_hline(unsigned char *data, size_t stride, unsigned int y, unsigned int x0, unsigned int x1)
+{
+    unsigned char *p = data + y * stride;
+    for (unsigned int x = x0; x <= x1; x++) p[2 * x] = DETECT_OVERLAY_LUMA;
+}
+
+/**
+* @brief Set the luma of a vertical run of pixels
+*/
+static void draw_vline(unsigned char *data, size_t stride, unsigned int x, unsigned int y0, unsigned int y1)
+{
+    for (unsigned int y = y0; y <= y1; y++) data[y * stride + 2 * x] = DETECT_OVERLAY_LUMA;
+}
+
+/**
+* @brief Draw the latest boxes into a frame before it is encoded
+*
+* Only the Y samples are written (2 pixel wide outlines), and only for
+* frames captured after the analysed one while the result is recent, so
+* boxes never appear on older frames or linger after detections stop. A
+* frame exported as DMABUF is bracketed with DMA_BUF_IOCTL_SYNC so importers
+* see the CPU writes.
+*
+* @param d      Pointer to the detector
+* @param yuyv   Frame to draw into (d->src_width x d->src_height)
+*
+* @return void
+*/
+void detector_draw(struct detector *d, struct yuyv_frame *yuyv)
+{
+    struct detect_result res;
+    uint64_t captured = yuyv->t.capture ? yuyv->t.capture : yuyv->t.dequeue;
+
+    if (detector_latest(d, &res) < 0 || res.n_boxes == 0) return;
+    if (captured < res.capture_ns) return;
+    if (captured - res.capture_ns > DETECT_OVERLAY_INTERVALS * 1000000000ULL / d->opts.fps) return;
+
+    const size_t stride = (size_t)d->src_width * 2;
+    const unsigned int w = d->src_width, h = d->src_height;
+
+    struct dma_buf_sync sync = { .flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW };
+    if (yuyv->dmabuf_fd >= 0) ioctl(yuyv->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    for (unsigned int i = 0; i < res.n_boxes; i++) {
+        const struct detect_box *b = &res.boxes[i];
+        float fx0 = b->x0 < 0 ? 0 : b->x0, fy0 = b->y0 < 0 ? 0 : b->y0;
+        float fx1 = b->x1 > 1 ? 1 : b->x1, fy1 = b->y1 > 1 ? 1 : b->y1;
+        if (fx1 <= fx0 || fy1 <= fy0) continue;
+
+        unsigned int x0 = (unsigned int)(fx0 * (w - 1)), x1 = (unsigned int)(fx1 * (w - 1));
+        unsigned int y0 = (unsigned int)(fy0 * (h - 1)), y1 = (unsigned int)(fy1 * (h - 1));
+        if (x1 < x0 + 2 || y1 < y0 + 2) continue;
+
+        draw_hline(yuyv->data, stride, y0, x0, x1);
+        draw_hline(yuyv->data, stride, y0 + 1, x0, x1);
+        draw_hline(yuyv->data, stride, y1 - 1, x0, x1);
+        draw_hline(yuyv->data, stride, y1, x0, x1);
+        draw_vline(yuyv->data, stride, x0, y0, y1);
+        draw_vline(yuyv->data, stride, x0 + 1, y0, y1);
+        draw_vline(yuyv->data, stride, x1 - 1, y0, y1);
+        draw_vline(yuyv->data, stride, x1, y0, y1);
+    }
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+    if (yuyv->dmabuf_fd >= 0) ioctl(yuyv->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+/**
+* @brief Name of the backend in use
+*
+* @param d  Pointer to the detector
+*
+* @return "tflite" or "motion"
+*/
+const char *detector_backend_name(const struct detector *d)
+{
+    return d->backend ? d->backend->name : "none";
+}
@@ -0,0 +1,120 @@
+#ifndef DETECTION_H
+#define DETECTION_H
+
+/**
+* @file detection.h
+* @brief Object detection on its own thread, decoupled from the stream rate.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Forward declare the frame structure
+struct yuyv_frame;
+
+/** @brief Most boxes kept per detection result. */
+#define DETECT_MAX_BOXES        16
+
+/** @brief Longest model, labels file or label string. */
+#define DETECT_PATH_MAX         128
+#define DETECT_LABEL_MAX        32
+
+/** @brief Default inference rate. */
+#define DETECT_DEFAULT_FPS      5
+
+/** @brief Default minimum score of a reported box. */
+#define DETECT_DEFAULT_SCORE    0.5f
+
+/** @brief Model input size of the built-in motion-blob detector. */
+#define DETECT_BLOB_WIDTH       160
+#define DETECT_BLOB_HEIGHT      120
+
+/**
+* @brief Detection settings (see config.h).
+*/
+struct detect_opts {
+    bool enabled;                   /**< Run the detection thread */
+    unsigned int fps;               /**< Inference rate, independent of the capture rate */
+    unsigned int threads;           /**< Inference threads (TFLite interpreter) */
+    float min_score;                /**< Boxes scoring lower are dropped */
+    bool overlay;                   /**< Draw the latest boxes into frames before encoding */
+    char model[DETECT_PATH_MAX];    /**< TFLite SSD model; empty = built-in motion blobs */
+    char labels[DETECT_PATH_MAX];   /**< Label map, one name per class line, or empty */
+};
+
+/**
+* @brief One detected object.
+*
+* Coordinates are normalized to [0, 1] of the frame, so they apply to any
+* resolution the frame is later scaled to.
+*/
+struct detect_box {
+    float x0, y0;                   /**< Top-left corner */
+    float x1, y1;                   /**< Bottom-right corner */
+    float score;                    /**< Confidence in [0, 1] */
+    int class_id;                   /**< Model class, or -1 for a motion blob */
+    char label[DETECT_LABEL_MAX];   /**< Class name */
+};
+
+/**
+* @brief Outcome of one inference.
+*/
+struct detect_result {
+    unsigned long seq;              /**< Result number, 0 = no result yet */
+    uint64_t capture_ns;            /**< Capture time of the analysed frame */
+    uint64_t done_ns;               /**< metrics_now() time the inference finished */
+    uint64_t infer_ns;              /**< Inference duration */
+    unsigned int n_boxes;           /**< Valid entries in boxes */
+    struct detect_box boxes[DETECT_MAX_BOXES];  /**< Detected objects, best first */
+};
+
+struct detect_backend;
+
+/**
+* @brief Detection stage.
+*
+* The producer offers frames at up to opts.fps via detector_wants_frame()
+* and detector_submit(); a submitted frame is downscaled to the model input
+* (RGB24) into a private buffer and swapped into a single-slot mailbox.
+* A frame not yet picked up by the detection thread is simply replaced
+* (latest frame wins), so the producer never waits for inference. Three
+* buffers rotate: the producer fills one, one waits in the mailbox, the
+* detection thread reads the third.
+*/
+struct detector {
+    struct detect_opts opts;        /**< Settings */
+    const struct detect_backend *backend;   /**< Inference implementation */
+    void *backend_state;            /**< Backend private state */
+    unsigned int src_width;         /**< Captured frame width */
+    unsigned int src_height;        /**< Captured frame height */
+    unsigned int in_width;          /**< Model input width */
+    unsigned int in_height;         /**< Model input height */
+
+    unsigned char *buf[3];          /**< RGB24 model inputs */
+    uint64_t buf_capture[3];        /**< Capture time of the frame in each buffer */
+    unsigned int fill;              /**< Buffer the producer writes (producer only) */
+    unsigned int pending;           /**< Buffer in the mailbox (under lock) */
+    unsigned int work;              /**< Buffer being analysed (detection thread only) */
+    bool has_pending;               /**< The mailbox holds a frame (under lock) */
+    uint64_t next_due_ns;           /**< Earliest time of the next frame (producer only) */
+
+    pthread_t thread;               /**< Detection thread */
+    pthread_mutex_t lock;           /**< Protects the mailbox, result and stop */
+    pthread_cond_t cond;            /**< Signals a mailbox frame or stop */
+    bool stop;                      /**< Ask the thread to exit */
+    bool running;                   /**< Thread started */
+    struct detect_result result;    /**< Latest result (under lock) */
+};
+
+/** Function prototypes */
+int detector_start(struct detector *d, const struct detect_opts *opts,
+                   unsigned int width, unsigned int height);
+void detector_stop(struct detector *d);
+bool detector_wants_frame(struct detector *d, uint64_t now_ns);
+void detector_submit(struct detector *d, const struct yuyv_frame *yuyv);
+int detector_latest(struct detector *d, struct detect_result *out);
+void detector_draw(struct detector *d, struct yuyv_frame *yuyv);
+const char *detector_backend_name(const struct detector *d);
+
+#endif  // DETECTION_H
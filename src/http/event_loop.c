@@ -0,0 +1,869 @@
+/**
+* @file event_loop.c
+* @brief epoll-based reactor serving every HTTP/MJPEG client from one thread.
+*
+* The reactor multiplexes three kinds of descriptors in one epoll set:
+*   1. The non-blocking listening socket (new connections)
+*   2. Non-blocking client sockets (request bytes in, frames out)
+*   3. Subscriber eventfds (new frames published by the producer)
+*
+* Each connection owns a small fixed write queue. Writes are attempted
+* immediately; when the client's TCP window is full the remainder is sent
+* once EPOLLOUT fires, so one slow client never stalls any other.
+*
+* Everything queued on a connection (part header, JPEG payload, trailer,
+* possibly several frames) is gathered into a single sendmsg() call. Large
+* payloads can optionally be sent with MSG_ZEROCOPY; the frames are then
+* held until the kernel reports, on the socket error queue, that it no
+* longer references their pages.
+*
+* Every completed frame write feeds the connection's rate controller, which
+* may skip frames or move the client to a lower quality tier.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+#include "event_loop.h"
+#include "http_server.h"
+#include "mjpeg_stream.h"
+#include "broadcast/broadcaster.h"
+#include "image/image_encoder.h"
+#include "metrics/metrics.h"
+
+/** @brief Maximum number of events handled per epoll_wait() call. */
+#define EVENT_BATCH         64
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY         60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY        0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY   5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+#endif
+
+/** @brief Maximum number of iovecs gathered into one sendmsg() call. */
+#define SEND_IOV_MAX        (CONN_WQ_DEPTH * 3)
+
+/** @brief epoll tag of the listening socket. */
+static struct epoll_tag listen_tag = { .kind = TAG_LISTEN, .conn = NULL };
+
+/** Function Prototypes */
+static void handle_accept(struct stream_ctx *sctx);
+static void handle_socket(struct stream_ctx *sctx, struct connection *conn, uint32_t events);
+static void handle_frames(struct stream_ctx *sctx, struct connection *conn);
+static int read_request(struct stream_ctx *sctx, struct connection *conn);
+static int conn_flush(struct stream_ctx *sctx, struct connection *conn);
+static void conn_setup_socket(struct stream_ctx *sctx, struct connection *conn);
+static int conn_reap_zerocopy(struct connection *conn);
+static int conn_set_events(struct stream_ctx *sctx, struct connection *conn, bool want_out);
+static int conn_update_events(struct stream_ctx *sctx, struct connection *conn, bool want_out);
+static void conn_close(struct stream_ctx *sctx, struct connection *conn);
+static void conn_unsubscribe(struct stream_ctx *sctx, struct connection *conn);
+static int conn_answer_frame(struct stream_ctx *sctx, struct connection *conn);
+static void reap_dead(struct stream_ctx *sctx);
+
+/**
+* @brief Move published frames onto the write queue in the connection's transport
+*
+* @param conn   Pointer to the connection.
+*
+* @return Number of frames queued
+*/
+static int pump_frames(struct connection *conn)
+{
+    return conn->state == CONN_WEBSOCKET ? ws_pump_frames(conn) : mjpeg_pump_frames(conn);
+}
+
+/**
+* @brief Create the epoll instance and register the listening socket.
+*
+* @param sctx   Stream context whose server_fd is already listening.
+*
+* @return 0 on success, -1 on failure
+*/
+int event_loop_init(struct stream_ctx *sctx)
+{
+    sctx->conns = NULL;
+    sctx->dead = NULL;
+    sctx->n_conns = 0;
+
+    sctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (sctx->epoll_fd < 0) {
+        perror("event_loop: epoll_create1");
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &listen_tag };
+    if (epoll_ctl(sctx->epoll_fd, EPOLL_CTL_ADD, sctx->server_fd, &ev) < 0) {
+        perror("event_loop: epoll_ctl listen");
+        close(sctx->epoll_fd);
+        sctx->epoll_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* @brief Run the reactor until an unrecoverable error occurs.
+*
+* @param sctx   Stream context initialized by event_loop_init().
+*
+* @return -1 on fatal error (the loop does not return otherwise)
+*/
+int event_loop_run(struct stream_ctx *sctx)
+{
+    struct epoll_event events[EVENT_BATCH];
+
+    for (;;) {
+        int n = epoll_wait(sctx->epoll_fd, events, EVENT_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("event_loop: epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct epoll_tag *tag = events[i].data.ptr;
+
+            // Skip events for connections closed earlier in this batch
+            if (tag->conn && tag->conn->fd < 0) continue;
+
+            switch (tag->kind) {
+                case TAG_LISTEN:
+                    handle_accept(sctx);
+                    break;
+                case TAG_SOCKET:
+                    handle_socket(sctx, tag->conn, events[i].events);
+                    break;
+                case TAG_FRAMES:
+                    handle_frames(sctx, tag->conn);
+                    break;
+            }
+        }
+
+        reap_dead(sctx);
+    }
+}
+
+/**
+* @brief Close every connection and the epoll instance.
+*
+* @param sctx   Stream context initialized by event_loop_init().
+*
+* @return void
+*/
+void event_loop_close(struct stream_ctx *sctx)
+{
+    while (sctx->conns) {
+        conn_close(sctx, sctx->conns);
+    }
+    reap_dead(sctx);
+
+    if (sctx->epoll_fd >= 0) {
+        close(sctx->epoll_fd);
+        sctx->epoll_fd = -1;
+    }
+}
+
+/**
+* @brief Reserve the next free message slot on a connection's write queue.
+*
+* @param conn   Pointer to the connection.
+*
+* @return Zeroed message to fill in, or NULL if the write queue is full
+*/
+struct out_msg *conn_reserve_msg(struct connection *conn)
+{
+    if (conn->wq_count == CONN_WQ_DEPTH) return NULL;
+
+    struct out_msg *msg = &conn->wq[(conn->wq_head + conn->wq_count) % CONN_WQ_DEPTH];
+    memset(msg, 0, sizeof(*msg));
+    conn->wq_count++;
+    return msg;
+}
+
+/**
+* @brief Subscribe a connection to the frame broadcaster.
+*
+* The subscriber's eventfd is added to the epoll set so newly published
+* frames wake the reactor for this connection.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+* @param bus    Broadcaster to subscribe to (one per served resolution)
+* @param depth  Subscriber queue capacity in frames (0 = BUFFER_SIZE)
+* @param policy What the subscriber queue does when it is full
+*
+* @return 0 on success, -1 on failure
+*/
+int conn_subscribe(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus,
+                   unsigned int depth, enum cb_policy policy)
+{
+    conn->sub = broadcaster_subscribe(bus, depth, policy);
+    if (!conn->sub) return -1;
+    conn->bus = bus;
+
+    rate_ctl_init(&conn->rc, conn->cam ? conn->cam->n_tiers : 1);
+
+    conn->frames_tag.kind = TAG_FRAMES;
+    conn->frames_tag.conn = conn;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &conn->frames_tag };
+    if (epoll_ctl(sctx->epoll_fd, EPOLL_CTL_ADD, conn->sub->event_fd, &ev) < 0) {
+        perror("event_loop: epoll_ctl subscriber");
+        broadcaster_unsubscribe(bus, conn->sub);
+        conn->sub = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+* @brief Queue a complete HTTP response; the connection closes once it is sent.
+*
+* @param conn           Pointer to the connection.
+* @param status         Status line after "HTTP/1.1 ", e.g. "200 OK".
+* @param content_type   Value of the Content-Type header.
+* @param body           Response body (its reference passes to the connection), or NULL.
+*
+* @return 0 on success, -1 if the write queue is full
+*/
+int conn_respond(struct connection *conn, const char *status, const char *content_type,
+                 struct jpeg_frame *body)
+{
+    struct out_msg *msg = conn_reserve_msg(conn);
+    if (!msg) {
+        jpeg_frame_release(body);
+        return -1;
+    }
+
+    msg->head_len = snprintf(msg->head_buf, sizeof(msg->head_buf),
+                             "HTTP/1.1 %s\r\n"
+                             "Connection: close\r\n"
+                             "Cache-Control: no-cache\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %lu\r\n"
+                             "\r\n",
+                             status, content_type, body ? body->size : 0UL);
+    if (msg->head_len >= sizeof(msg->head_buf)) msg->head_len = sizeof(msg->head_buf) - 1;
+    msg->head = msg->head_buf;
+    msg->frame = body;
+
+    conn->state = CONN_RESPONDING;
+    return 0;
+}
+
+/**
+* @brief Accept every pending connection on the listening socket.
+*
+* @param sctx   Pointer to the stream context.
+*
+* @return void
+*/
+static void handle_accept(struct stream_ctx *sctx)
+{
+    for (;;) {
+        int fd = accept_client_connection(sctx);
+        if (fd < 0) return;                 // No more pending clients (or transient error)
+
+        struct connection *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            perror("event_loop: Failed to allocate connection");
+            close(fd);
+            continue;
+        }
+
+        conn->fd = fd;
+        conn->state = CONN_READING;
+        conn->sock_tag.kind = TAG_SOCKET;
+        conn->sock_tag.conn = conn;
+        conn_setup_socket(sctx, conn);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = &conn->sock_tag };
+        if (epoll_ctl(sctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("event_loop: epoll_ctl client");
+            close(fd);
+            free(conn);
+            continue;
+        }
+
+        // Link into the connection list
+        conn->next = sctx->conns;
+        if (sctx->conns) sctx->conns->prev = conn;
+        sctx->conns = conn;
+        sctx->n_conns++;
+
+        metrics_count(CNT_CONNECTIONS, 1);
+        metrics_set_gauge(GAUGE_CLIENTS, sctx->n_conns);
+    }
+}
+
+/**
+* @brief Handle readiness events on a client socket.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+* @param events epoll event mask reported for the socket.
+*
+* @return void
+*/
+static void handle_socket(struct stream_ctx *sctx, struct connection *conn, uint32_t events)
+{
+    // EPOLLERR also signals zerocopy completions waiting on the error queue
+    if ((events & EPOLLERR) && (conn->zerocopy || conn->zc_count > 0) &&
+        conn_reap_zerocopy(conn) == 0) {
+        events &= ~EPOLLERR;
+
+        // A sent response was only waiting for the last completions
+        if (conn->state == CONN_RESPONDING && conn->wq_count == 0 && conn->zc_count == 0) {
+            conn_close(sctx, conn);
+            return;
+        }
+    }
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        conn_close(sctx, conn);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP)) {
+        if (read_request(sctx, conn) < 0) {
+            conn_close(sctx, conn);
+            return;
+        }
+    }
+
+    if (events & EPOLLOUT) {
+        if (conn_flush(sctx, conn) < 0) {
+            conn_close(sctx, conn);
+        }
+    }
+}
+
+/**
+* @brief Handle a "frames published" notification for a streaming connection.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+*
+* @return void
+*/
+static void handle_frames(struct stream_ctx *sctx, struct connection *conn)
+{
+    uint64_t count;
+
+    // Reset the eventfd counter; the subscriber queue holds the actual frames
+    if (read(conn->sub->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        perror("event_loop: read subscriber eventfd");
+    }
+
+    if (conn->state == CONN_AWAITING_FRAME) {
+        if (conn_answer_frame(sctx, conn) < 0) conn_close(sctx, conn);
+        return;
+    }
+
+    // While a previous write is pending, frames wait in the subscriber queue
+    if (conn->out_armed) return;
+
+    pump_frames(conn);
+    if (conn_flush(sctx, conn) < 0) {
+        conn_close(sctx, conn);
+    }
+}
+
+/**
+* @brief Answer a connection waiting for the next frame with that frame alone
+*
+* The subscription is dropped first, so the connection stops counting as a
+* viewer while the image is still being sent.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection in CONN_AWAITING_FRAME.
+*
+* @return 0 on success, -1 if the connection must be closed
+*/
+static int conn_answer_frame(struct stream_ctx *sctx, struct connection *conn)
+{
+    struct jpeg_frame *frame = subscriber_next(conn->sub);
+    if (!frame) return 0;
+
+    conn_unsubscribe(sctx, conn);
+    metrics_count(CNT_SNAPSHOTS, 1);
+    if (conn_respond(conn, "200 OK", "image/jpeg", frame) < 0) return -1;
+    return conn_flush(sctx, conn);
+}
+
+/**
+* @brief Read request bytes from a client.
+*
+* Until the end of the request header ("\r\n\r\n") is seen, bytes are
+* accumulated. Once complete the request is routed (MJPEG stream, metrics).
+* While streaming, anything the client sends is discarded. On a WebSocket
+* the client's frames (acks) are collected and processed, and the write
+* queue is refilled with the credits they return.
+*
+* EOF closes the connection while the request is still being read, or on a
+* WebSocket, whose client has gone. In any other state the client only
+* half-closed after its request: reading stops and the answer (or stream)
+* is still written, the socket closing once it is done as usual.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+*
+* @return 0 to keep the connection, -1 to close it
+*/
+static int read_request(struct stream_ctx *sctx, struct connection *conn)
+{
+    char scratch[512];
+    bool ws_traffic = false;
+
+    for (;;) {
+        char *dst = scratch;
+        size_t room = sizeof(scratch);
+
+        if (conn->state == CONN_READING || conn->state == CONN_WEBSOCKET) {
+            dst = conn->req + conn->req_len;
+            room = sizeof(conn->req) - 1 - conn->req_len;
+            if (room == 0) {
+                fprintf(stderr, "event_loop: Request header too large\n");
+                return -1;
+            }
+        }
+
+        ssize_t n = read(conn->fd, dst, room);
+        if (n == 0) {
+            if (conn->state == CONN_READING || conn->state == CONN_WEBSOCKET) return -1;
+            conn->read_closed = true;
+            return conn_set_events(sctx, conn, conn->out_armed);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Acks returned credits (or a pong / close echo is queued)
+                return ws_traffic ? conn_flush(sctx, conn) : 0;
+            }
+            return -1;
+        }
+
+        if (conn->state == CONN_WEBSOCKET) {
+            conn->req_len += n;
+            if (ws_receive(conn) < 0) return -1;
+            ws_traffic = true;
+            continue;
+        }
+
+        if (conn->state != CONN_READING) continue;  // Ignore data sent while streaming
+
+        conn->req_len += n;
+        conn->req[conn->req_len] = '\0';
+
+        if (strstr(conn->req, "\r\n\r\n")) {
+            if (http_dispatch(sctx, conn) < 0) return -1;
+            return conn_flush(sctx, conn);
+        }
+    }
+}
+
+/**
+* @brief Configure a freshly accepted client socket.
+*
+* Frames are handed to the kernel whole in one sendmsg(), which already
+* gives the full-segment packing TCP_CORK would; Nagle's algorithm would
+* then only delay the tail segment of every frame, so it is disabled.
+* SO_ZEROCOPY is enabled when the stream context requests it.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the new connection.
+*
+* @return void
+*/
+static void conn_setup_socket(struct stream_ctx *sctx, struct connection *conn)
+{
+    int one = 1;
+
+    if (setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        perror("event_loop: setsockopt TCP_NODELAY");
+    }
+
+    if (sctx->zerocopy_min > 0) {
+        conn->zerocopy = setsockopt(conn->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+        if (!conn->zerocopy) perror("event_loop: setsockopt SO_ZEROCOPY (falling back to copy)");
+    }
+}
+
+/**
+* @brief Total number of bytes a message puts on the wire.
+*
+* @param msg    Message on the write queue.
+*
+* @return Message length in bytes
+*/
+static size_t msg_total(const struct out_msg *msg)
+{
+    return msg->head_len + (msg->frame ? msg->frame->size : 0) + msg->tail_len;
+}
+
+/**
+* @brief Append the unsent remainder of a message to an iovec array.
+*
+* @param msg    Message on the write queue.
+* @param iov    iovec array to append to.
+* @param n      Number of iovecs already used.
+*
+* @return New number of iovecs used
+*/
+static int msg_to_iov(const struct out_msg *msg, struct iovec *iov, int n)
+{
+    const void *base[3] = { msg->head, msg->frame ? msg->frame->data : NULL, msg->tail };
+    size_t len[3] = { msg->head_len, msg->frame ? msg->frame->size : 0, msg->tail_len };
+    size_t off = msg->off;
+
+    for (int seg = 0; seg < 3; seg++) {
+        if (off >= len[seg]) {
+            off -= len[seg];
+            continue;
+        }
+        iov[n].iov_base = (char *)base[seg] + off;
+        iov[n].iov_len = len[seg] - off;
+        n++;
+        off = 0;
+    }
+    return n;
+}
+
+/**
+* @brief Send as much of the write queue as possible with a single sendmsg().
+*
+* All queued messages are gathered into one scatter-gather call, so a frame
+* costs one syscall instead of three writes. When zerocopy is enabled and
+* the payload is large enough, the call uses MSG_ZEROCOPY and every frame it
+* touched is retained until the matching completion notification arrives.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+*
+* @return Bytes sent, or -1 with errno set
+*/
+static ssize_t conn_send(struct stream_ctx *sctx, struct connection *conn)
+{
+    struct iovec iov[SEND_IOV_MAX];
+    int iovcnt = 0;
+    unsigned int nmsgs = 0;
+    size_t payload = 0;
+    bool frames_only = true;
+
+    for (; nmsgs < conn->wq_count; nmsgs++) {
+        const struct out_msg *msg = &conn->wq[(conn->wq_head + nmsgs) % CONN_WQ_DEPTH];
+        iovcnt = msg_to_iov(msg, iov, iovcnt);
+        if (msg->frame && !msg->frame->device_mem && msg->head != msg->head_buf) {
+            payload += msg->frame->size;
+        } else {
+            frames_only = false;
+        }
+    }
+
+    // Only messages whose bytes are all owned by frames may go out zerocopy:
+    // head_buf is reused as soon as its queue slot is, and driver buffers may
+    // not be pinnable, so held capture buffers are copied. A response is
+    // copied too, so the connection can close as soon as it is sent.
+    bool zc = conn->zerocopy && frames_only && conn->state != CONN_RESPONDING &&
+              payload >= sctx->zerocopy_min && conn->zc_count + nmsgs <= ZC_PENDING_MAX;
+
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    ssize_t n = sendmsg(conn->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL | (zc ? MSG_ZEROCOPY : 0));
+    if (n < 0 || !zc) return n;
+
+    // Hold every frame the kernel may still be reading from
+    unsigned int id = conn->zc_next_id++;
+    size_t left = n;
+    for (unsigned int i = 0; i < nmsgs && left > 0; i++) {
+        const struct out_msg *msg = &conn->wq[(conn->wq_head + i) % CONN_WQ_DEPTH];
+        size_t remaining = msg_total(msg) - msg->off;
+
+        conn->zc[conn->zc_count].id = id;
+        conn->zc[conn->zc_count].frame = jpeg_frame_retain(msg->frame);
+        conn->zc_count++;
+
+        left -= (remaining < left) ? remaining : left;
+    }
+
+    return n;
+}
+
+/**
+* @brief Process zerocopy completion notifications from the socket error queue.
+*
+* Each notification covers a range of sendmsg() ids; the frames held for
+* those ids are released. If the kernel reports that it had to copy anyway
+* (e.g. loopback), zerocopy is turned off for the connection.
+*
+* @param conn   Pointer to the connection.
+*
+* @return 0 if only zerocopy notifications were queued, -1 on a real socket error
+*/
+static int conn_reap_zerocopy(struct connection *conn)
+{
+    for (;;) {
+        char control[128];
+        struct msghdr mh = { .msg_control = control, .msg_controllen = sizeof(control) };
+
+        if (recvmsg(conn->fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                return -1;                  // Genuine socket error
+            }
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                conn->zerocopy = false;     // Kernel copied anyway; zerocopy is pure overhead here
+            }
+
+            // Release every held frame whose id falls in [ee_info, ee_data]
+            unsigned int lo = serr->ee_info, hi = serr->ee_data, kept = 0;
+            for (unsigned int i = 0; i < conn->zc_count; i++) {
+                if (conn->zc[i].id - lo <= hi - lo) {
+                    jpeg_frame_release(conn->zc[i].frame);
+                } else {
+                    conn->zc[kept++] = conn->zc[i];
+                }
+            }
+            conn->zc_count = kept;
+        }
+    }
+}
+
+/**
+* @brief Write as much of the connection's write queue as the socket accepts.
+*
+* Completed messages release their frame reference and the queue is refilled
+* from the subscriber. When the socket would block, EPOLLOUT is armed and the
+* remainder is sent as soon as the client drains its TCP window.
+* Per-frame send and end-to-end latencies are recorded here.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+*
+* @return 0 on success, -1 if the connection must be closed
+*/
+static int conn_flush(struct stream_ctx *sctx, struct connection *conn)
+{
+    for (;;) {
+        // Top up the write queue so one sendmsg() can carry several frames
+        pump_frames(conn);
+        if (conn->wq_count == 0) break;             // Nothing left to send
+
+        ssize_t n = conn_send(sctx, conn);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                return conn_update_events(sctx, conn, true);
+            }
+            return -1;                              // Client disconnected or send error
+        }
+
+        // Advance through the messages covered by this send
+        size_t left = n;
+        while (conn->wq_count > 0) {
+            struct out_msg *msg = &conn->wq[conn->wq_head];
+            size_t remaining = msg_total(msg) - msg->off;
+
+            if (left < remaining) {
+                msg->off += left;
+                break;
+            }
+            left -= remaining;
+
+            // Message fully written: adapt to the link, drop the frame reference and pop it
+            if (msg->frame && conn->sub) {
+                uint64_t now = metrics_now();
+                metrics_observe(STAGE_SEND, msg->queued_ns, now);
+                metrics_observe(STAGE_TOTAL, msg->frame->t.capture, now);
+                metrics_count(CNT_FRAMES_SENT, 1);
+                metrics_count(CNT_BYTES_SENT, msg->frame->size);
+
+                if (rate_ctl_sample(&conn->rc, conn->fd, msg->frame->size, now - msg->queued_ns)) {
+                    broadcaster_set_tier(conn->bus, conn->sub, conn->rc.tier);
+                }
+            }
+            jpeg_frame_release(msg->frame);
+            msg->frame = NULL;
+            conn->wq_head = (conn->wq_head + 1) % CONN_WQ_DEPTH;
+            conn->wq_count--;
+        }
+
+        // Short write: the socket buffer is full, wait for EPOLLOUT
+        if (conn->wq_count > 0) {
+            return conn_update_events(sctx, conn, true);
+        }
+    }
+
+    // A single response has been sent in full. Frames of earlier zerocopy
+    // sends (a WebSocket's before its close echo) may still be pinned: end
+    // the stream and close once their completions arrive, instead of
+    // resetting the connection and losing the data still in flight.
+    if (conn->state == CONN_RESPONDING) {
+        if (conn->zc_count == 0) return -1;
+        if (shutdown(conn->fd, SHUT_WR) < 0 && errno != ENOTCONN) return -1;
+        return conn_update_events(sctx, conn, false);
+    }
+
+    return conn_update_events(sctx, conn, false);
+}
+
+/**
+* @brief Set the epoll mask of a connection socket.
+*
+* EPOLLIN stays armed until the client half-closes (conn->read_closed).
+*
+* @param sctx       Pointer to the stream context.
+* @param conn       Pointer to the connection.
+* @param want_out   true to be notified when the socket becomes writable.
+*
+* @return 0 on success, -1 on failure
+*/
+static int conn_set_events(struct stream_ctx *sctx, struct connection *conn, bool want_out)
+{
+    struct epoll_event ev = {
+        .events = (conn->read_closed ? 0 : EPOLLIN | EPOLLRDHUP) | (want_out ? EPOLLOUT : 0),
+        .data.ptr = &conn->sock_tag
+    };
+    if (epoll_ctl(sctx->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) < 0) {
+        perror("event_loop: epoll_ctl mod");
+        return -1;
+    }
+
+    conn->out_armed = want_out;
+    return 0;
+}
+
+/**
+* @brief Arm or disarm EPOLLOUT for a connection socket.
+*
+* @param sctx       Pointer to the stream context.
+* @param conn       Pointer to the connection.
+* @param want_out   true to be notified when the socket becomes writable.
+*
+* @return 0 on success, -1 on failure
+*/
+static int conn_update_events(struct stream_ctx *sctx, struct connection *conn, bool want_out)
+{
+    if (conn->out_armed == want_out) return 0;
+    return conn_set_events(sctx, conn, want_out);
+}
+
+/**
+* @brief Close a connection and move it to the dead list.
+*
+* The connection memory is only freed after the current event batch, since
+* later events in the same batch may still reference it.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+*
+* @return void
+*/
+static void conn_close(struct stream_ctx *sctx, struct connection *conn)
+{
+    if (conn->ws.acked) {
+        printf("event_loop: WebSocket client disconnected (%lu frames acknowledged, ack after %.1f ms).\n",
+               conn->ws.acked, conn->ws.rtt_ns / 1e6);
+    } else if (conn->rc.skipped) {
+        printf("event_loop: Client disconnected (%lu frames skipped by rate control).\n",
+               conn->rc.skipped);
+    } else {
+        printf("event_loop: Client disconnected.\n");
+    }
+
+    conn_unsubscribe(sctx, conn);
+
+    // Release every frame still on the write queue
+    for (unsigned int i = 0; i < conn->wq_count; i++) {
+        struct out_msg *msg = &conn->wq[(conn->wq_head + i) % CONN_WQ_DEPTH];
+        jpeg_frame_release(msg->frame);
+        msg->frame = NULL;
+    }
+    conn->wq_count = 0;
+
+    // Frames still pinned by zerocopy sends (only on error paths; a completed
+    // response never leaves any): abort the connection so the kernel drops its
+    // unsent data instead of transmitting pages we are about to recycle
+    if (conn->zc_count > 0) {
+        struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+
+    epoll_ctl(sctx->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->fd = -1;
+
+    for (unsigned int i = 0; i < conn->zc_count; i++) {
+        jpeg_frame_release(conn->zc[i].frame);
+    }
+    conn->zc_count = 0;
+
+    // Unlink from the connection list
+    if (conn->prev) conn->prev->next = conn->next;
+    else sctx->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    sctx->n_conns--;
+    metrics_set_gauge(GAUGE_CLIENTS, sctx->n_conns);
+
+    conn->prev = NULL;
+    conn->next = sctx->dead;
+    sctx->dead = conn;
+}
+
+/**
+* @brief Drop a connection's broadcast subscription, if any.
+*
+* @param sctx   Pointer to the stream context.
+* @param conn   Pointer to the connection.
+*
+* @return void
+*/
+static void conn_unsubscribe(struct stream_ctx *sctx, struct connection *conn)
+{
+    if (!conn->sub) return;
+
+    epoll_ctl(sctx->epoll_fd, EPOLL_CTL_DEL, conn->sub->event_fd, NULL);
+    broadcaster_unsubscribe(conn->bus, conn->sub);
+    conn->sub = NULL;
+    conn->bus = NULL;
+}
+
+/**
+* @brief Free connections closed during the last event batch.
+*
+* @param sctx   Pointer to the stream context.
+*
+* @return void
+*/
+static void reap_dead(struct stream_ctx *sctx)
+{
+    while (sctx->dead) {
+        struct connection *conn = sctx->dead;
+        sctx->dead = conn->next;
+        free(conn);
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+/**
+* @file event_loop.h
+* @brief Single-threaded epoll reactor serving all HTTP/MJPEG clients.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rate_control.h"
+#include "ws_stream.h"
+#include "cb/circular_buffer.h"
+
+// Forward declare the context structures
+struct stream_ctx;
+struct stream_camera;
+struct jpeg_frame;
+struct subscriber;
+struct broadcaster;
+
+/** @brief Number of outgoing messages a connection can have queued. */
+#define CONN_WQ_DEPTH       4
+
+/** @brief Maximum size of an HTTP request header accepted from a client. */
+#define HTTP_REQUEST_MAX    2048
+
+/** @brief Maximum size of the inline header part of an outgoing message. */
+#define OUT_MSG_HEAD_MAX    256
+
+/** @brief Maximum number of MSG_ZEROCOPY frame references awaiting completion per connection. */
+#define ZC_PENDING_MAX      16
+
+/** @brief Default payload size from which MSG_ZEROCOPY pays off over copying. */
+#define ZEROCOPY_MIN_DEFAULT    16384
+
+/**
+* @brief Identifies which file descriptor an epoll event belongs to.
+*
+* Every registered descriptor carries a tag so the reactor can dispatch
+* listening-socket, client-socket and subscriber events from one epoll set.
+*/
+struct epoll_tag {
+    enum {
+        TAG_LISTEN,                 /**< Listening server socket */
+        TAG_SOCKET,                 /**< Client TCP socket */
+        TAG_FRAMES,                 /**< Subscriber eventfd (new frames published) */
+    } kind;
+    struct connection *conn;        /**< Owning connection (NULL for TAG_LISTEN) */
+};
+
+/**
+* @brief One outgoing message on a connection's write queue.
+*
+* A message is made of up to three segments sent back-to-back:
+* a header, an optional JPEG payload and an optional constant trailer.
+* The write offset spans all three segments so partial writes can resume.
+*
+* Frame messages point their header at the frame's shared part header, so
+* every byte they reference lives as long as the frame reference itself.
+* Other response bodies travel the same way, in a heap jpeg_frame.
+*/
+struct out_msg {
+    char head_buf[OUT_MSG_HEAD_MAX];    /**< Inline storage for non-frame headers (HTTP response) */
+    const char *head;               /**< Header bytes: head_buf or the frame's part header */
+    size_t head_len;                /**< Number of valid bytes in head */
+    struct jpeg_frame *frame;       /**< Referenced JPEG payload, or NULL */
+    const char *tail;               /**< Constant trailer, or NULL */
+    size_t tail_len;                /**< Trailer length */
+    size_t off;                     /**< Bytes of the whole message already written */
+    uint64_t queued_ns;             /**< When the message was queued, for rate control */
+};
+
+/**
+* @brief A frame whose pages are still referenced by a MSG_ZEROCOPY send.
+*/
+struct zc_pending {
+    unsigned int id;                /**< Kernel notification id of the sendmsg() call */
+    struct jpeg_frame *frame;       /**< Frame reference held until the id completes */
+};
+
+/**
+* @brief State of a single client connection.
+*/
+struct connection {
+    int fd;                                 /**< Non-blocking client socket */
+    enum {
+        CONN_READING,                       /**< Waiting for the end of the HTTP request */
+        CONN_STREAMING,                     /**< Receiving multipart MJPEG frames */
+        CONN_RESPONDING,                    /**< Sending a single response, closed once written */
+        CONN_AWAITING_FRAME,                /**< Subscribed until the next frame, sent as one image */
+        CONN_WEBSOCKET,                     /**< Upgraded: JPEG binary messages paced by client acks */
+    } state;
+
+    char req[HTTP_REQUEST_MAX];             /**< Request bytes received so far (WebSocket: client frames) */
+    size_t req_len;                         /**< Valid bytes in req */
+
+    struct out_msg wq[CONN_WQ_DEPTH];       /**< Fixed ring of outgoing messages */
+    unsigned int wq_head;                   /**< Index of the message being written */
+    unsigned int wq_count;                  /**< Number of queued messages */
+    bool out_armed;                         /**< EPOLLOUT currently requested */
+    bool read_closed;                       /**< Client half-closed; EPOLLIN no longer polled */
+
+    bool zerocopy;                          /**< SO_ZEROCOPY enabled on this socket */
+    unsigned int zc_next_id;                /**< Id the kernel assigns to the next zerocopy send */
+    struct zc_pending zc[ZC_PENDING_MAX];   /**< Frames held until their completion arrives */
+    unsigned int zc_count;                  /**< Number of valid entries in zc */
+
+    struct subscriber *sub;                 /**< Broadcast subscription while streaming */
+    struct broadcaster *bus;                /**< Broadcaster (resolution) sub belongs to */
+    const struct stream_camera *cam;        /**< Camera the request addressed, set by http_dispatch() */
+    struct rate_ctl rc;                     /**< Frame rate / quality tier adaptation */
+    struct ws_flow ws;                      /**< Credit window (CONN_WEBSOCKET) */
+
+    struct epoll_tag sock_tag;              /**< epoll tag of the socket */
+    struct epoll_tag frames_tag;            /**< epoll tag of the subscriber eventfd */
+
+    struct connection *prev;                /**< Previous connection in the reactor list */
+    struct connection *next;                /**< Next connection in the reactor list */
+};
+
+/** Function prototypes */
+int event_loop_init(struct stream_ctx *sctx);
+int event_loop_run(struct stream_ctx *sctx);
+void event_loop_close(struct stream_ctx *sctx);
+
+struct out_msg *conn_reserve_msg(struct connection *conn);
+int conn_subscribe(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus,
+                   unsigned int depth, enum cb_policy policy);
+int conn_respond(struct connection *conn, const char *status, const char *content_type,
+                 struct jpeg_frame *body);
+
+#endif  // EVENT_LOOP_H
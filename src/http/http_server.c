@@ -4,10 +4,16 @@
 *
 * Implements basic HTTP request handling and response generation.
 * Provides initialization, routing, and utilities for sending responses.
+*
+* All sockets are non-blocking; they are driven by the epoll reactor in
+* event_loop.c.
 */
 
 #include <errno.h>
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -18,14 +24,306 @@
 #include <netinet/in.h>
 
 #include "http_server.h"
+#include "event_loop.h"
 #include "mjpeg_stream.h"
+#include "ws_stream.h"
+#include "broadcast/broadcaster.h"
+#include "detection/detection.h"
+#include "record/recorder.h"
 #include "camera/camera.h"
+#include "image/image_encoder.h"
+#include "image/ladder.h"
+#include "mem/frame_pool.h"
+#include "metrics/metrics.h"
+
+/** @brief Initial size of the /metrics response body; grown if the text is longer. */
+#define METRICS_BODY_SIZE   8192
+
+/** @brief Size of short generated response bodies (/health, errors). */
+#define TEXT_BODY_SIZE      256
+
+/** @brief Size of the /detections body (fits DETECT_MAX_BOXES boxes). */
+#define DETECT_BODY_SIZE    4096
+
+/**
+* @brief Pick the camera a request addresses
+*
+* A request target of /camN/... addresses camera N, anything else the
+* first camera.
+*
+* @param sctx   Pointer to the stream context
+* @param req    Request bytes, starting with the request line
+* @param path   Receives the request target with any /camN prefix removed
+*
+* @return The camera, or NULL if camera N does not exist
+*/
+static const struct stream_camera *request_camera(const struct stream_ctx *sctx, const char *req,
+                                                  const char **path)
+{
+    const char *target = strchr(req, ' ');
+    target = target ? target + 1 : req + strlen(req);
+    *path = target;
+
+    if (strncmp(target, "/cam", 4) != 0 || !isdigit((unsigned char)target[4])) return &sctx->cams[0];
+
+    char *end;
+    unsigned long n = strtoul(target + 4, &end, 10);
+    if (*end != '/') return &sctx->cams[0];         // e.g. /camera.html: not a camera prefix
+
+    *path = end;
+    return n < sctx->n_cams ? &sctx->cams[n] : NULL;
+}
+
+/**
+* @brief Check whether a request targets a path (ignoring any query string)
+*
+* @param req    Request bytes, starting with the request line
+* @param target Request target from request_camera() (camera prefix removed)
+* @param method Method, e.g. "GET"
+* @param path   Path to match exactly
+*
+* @return true on a match
+*/
+static bool request_is(const char *req, const char *target, const char *method, const char *path)
+{
+    size_t m = strlen(method), p = strlen(path);
+
+    if (strncmp(req, method, m) != 0 || req[m] != ' ') return false;
+    if (strncmp(target, path, p) != 0) return false;
+    return target[p] == ' ' || target[p] == '?';
+}
+
+/**
+* @brief Pick the broadcaster of the resolution a request asks for
+*
+* The size comes from a "res=WxH" query parameter; without one the full
+* capture size is served.
+*
+* @param cam    Camera the request addresses
+* @param target Request target (from request_camera())
+*
+* @return The broadcaster, or NULL if the requested size is not served
+*/
+static struct broadcaster *request_bus(const struct stream_camera *cam, const char *target)
+{
+    // Only the query string of the request target, never the headers
+    const char *end = target + strcspn(target, " \r\n");
+    const char *p = memchr(target, '?', (size_t)(end - target));
+    unsigned int w, h;
+
+    while (p) {
+        if (strncmp(p + 1, "res=", 4) == 0) {
+            if (sscanf(p + 5, "%ux%u", &w, &h) != 2) return NULL;
+            return cam->ladder ? ladder_find(cam->ladder, w, h) : NULL;
+        }
+        p = memchr(p + 1, '&', (size_t)(end - p - 1));
+    }
+    return cam->bus;
+}
+
+/**
+* @brief Send a short generated response and close the connection
+*
+* @param conn           Pointer to the connection
+* @param status         Status line, e.g. "404 Not Found"
+* @param content_type   Content-Type of the body
+* @param fmt            printf-style body
+*
+* @return 0 on success, -1 on failure
+*/
+static int respond_text(struct connection *conn, const char *status, const char *content_type,
+                        const char *fmt, ...)
+{
+    struct jpeg_frame *body = frame_pool_get_jpeg(NULL);       // Heap buffer, freed once sent
+    if (!body || jpeg_frame_reserve(body, TEXT_BODY_SIZE) < 0) {
+        jpeg_frame_release(body);
+        return -1;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf((char *)body->data, body->capacity, fmt, ap);
+    va_end(ap);
+    if (len < 0) len = 0;
+    body->size = ((unsigned long)len < body->capacity) ? (unsigned long)len : body->capacity - 1;
+
+    return conn_respond(conn, status, content_type, body);
+}
+
+/**
+* @brief Serve the most recently published frame as a still image
+*
+* The frame comes from the broadcaster's latest-frame cache, so a still
+* costs no capture or encode work no matter how many pollers there are.
+* When the cache is stale (the pipeline idles without viewers) the
+* connection subscribes for exactly one frame instead: that wakes the
+* pipeline for one encode, and it idles again once the still is answered.
+*
+* @param sctx   Pointer to the stream context
+* @param conn   Pointer to the connection
+* @param bus    Broadcaster of the requested resolution
+*
+* @return 0 on success, -1 on failure
+*/
+static int serve_snapshot(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus)
+{
+    struct jpeg_frame *frame = broadcaster_latest(bus, BROADCAST_FRESH_MS);
+    if (!frame) {
+        conn->state = CONN_AWAITING_FRAME;
+        return conn_subscribe(sctx, conn, bus, 1, CB_LATEST_ONLY);
+    }
+
+    metrics_count(CNT_SNAPSHOTS, 1);
+    return conn_respond(conn, "200 OK", "image/jpeg", frame);
+}
+
+/**
+* @brief Answer a request for a resolution that is not served
+*
+* @param cam    Camera the request addresses
+* @param conn   Pointer to the connection
+*
+* @return 0 on success, -1 on failure
+*/
+static int respond_no_res(const struct stream_camera *cam, struct connection *conn)
+{
+    char sizes[LADDER_MAX_RUNGS * 12] = "";
+    size_t len = 0;
+
+    for (unsigned int i = 0; cam->ladder && i < cam->ladder->n_rungs; i++) {
+        len += snprintf(sizes + len, sizeof(sizes) - len, " %ux%u",
+                        cam->ladder->rungs[i].width, cam->ladder->rungs[i].height);
+    }
+    return respond_text(conn, "404 Not Found", "text/plain", "Resolution not served, available:%s\n",
+                        len ? sizes : " full size only");
+}
+
+/**
+* @brief Report whether frames are flowing
+*
+* 200 while the camera delivered a frame within HEALTH_STALE_MS, 503
+* otherwise, so a supervisor or load balancer can act on the status code
+* alone. Capture keeps running while encoding idles, so an idle pipeline is
+* healthy. The client count covers every camera, the subscriber count is
+* the addressed camera's.
+*
+* @param sctx   Pointer to the stream context
+* @param cam    Camera the request addresses
+* @param conn   Pointer to the connection
+*
+* @return 0 on success, -1 on failure
+*/
+static int serve_health(struct stream_ctx *sctx, const struct stream_camera *cam, struct connection *conn)
+{
+    uint64_t last = camera_last_frame(cam->cctx);
+    long age_ms = last ? (long)((metrics_now() - last) / 1000000ULL) : -1;
+
+    bool ok = age_ms >= 0 && age_ms < HEALTH_STALE_MS;
+    return respond_text(conn, ok ? "200 OK" : "503 Service Unavailable", "application/json",
+                        "{\"status\":\"%s\",\"frame_age_ms\":%ld,\"clients\":%u,\"subscribers\":%u}\n",
+                        ok ? "ok" : "stalled", age_ms, sctx->n_conns,
+                        broadcaster_subscriber_count(cam->bus));
+}
+
+/**
+* @brief Serve the latest object-detection result as JSON
+*
+* Box coordinates are fractions of the frame; capture_age_ms tells how old
+* the analysed frame is, so a client can match boxes to what it displays.
+*
+* @param cam    Camera the request addresses
+* @param conn   Pointer to the connection
+*
+* @return 0 on success, -1 on failure
+*/
+static int serve_detections(const struct stream_camera *cam, struct connection *conn)
+{
+    struct detect_result res;
+
+    if (!cam->detector) {
+        return respond_text(conn, "404 Not Found", "text/plain", "Detection is not enabled\n");
+    }
+    if (detector_latest(cam->detector, &res) < 0) {
+        return respond_text(conn, "503 Service Unavailable", "text/plain", "No detection result yet\n");
+    }
+
+    struct jpeg_frame *body = frame_pool_get_jpeg(NULL);       // Heap buffer, freed once sent
+    if (!body || jpeg_frame_reserve(body, DETECT_BODY_SIZE) < 0) {
+        jpeg_frame_release(body);
+        return -1;
+    }
+
+    char *buf = (char *)body->data;
+    size_t cap = body->capacity, len = 0;
+    uint64_t now = metrics_now();
+
+    len += snprintf(buf + len, cap - len,
+                    "{\"backend\":\"%s\",\"seq\":%lu,\"capture_age_ms\":%llu,\"infer_ms\":%.1f,\"boxes\":[",
+                    detector_backend_name(cam->detector), res.seq,
+                    (unsigned long long)((now - res.capture_ns) / 1000000ULL), res.infer_ns / 1e6);
+    for (unsigned int i = 0; i < res.n_boxes && len < cap; i++) {
+        const struct detect_box *b = &res.boxes[i];
+        len += snprintf(buf + len, cap - len,
+                        "%s{\"label\":\"%s\",\"class\":%d,\"score\":%.3f,"
+                        "\"x0\":%.4f,\"y0\":%.4f,\"x1\":%.4f,\"y1\":%.4f}",
+                        i ? "," : "", b->label, b->class_id, b->score, b->x0, b->y0, b->x1, b->y1);
+    }
+    if (len < cap) len += snprintf(buf + len, cap - len, "]}\n");
+    body->size = len < cap ? len : cap - 1;
+
+    return conn_respond(conn, "200 OK", "application/json", body);
+}
+
+/**
+* @brief Start or extend a recorded event
+*
+* @param cam    Camera the request addresses
+* @param conn   Pointer to the connection
+*
+* @return 0 on success, -1 on failure
+*/
+static int serve_trigger(const struct stream_camera *cam, struct connection *conn)
+{
+    if (!cam->recorder || recorder_trigger(cam->recorder) < 0) {
+        return respond_text(conn, "409 Conflict", "text/plain", "Not recording on events\n");
+    }
+    return respond_text(conn, "202 Accepted", "application/json", "{\"event\":\"triggered\"}\n");
+}
+
+/**
+* @brief Serve the Prometheus metrics page
+*
+* @param conn   Pointer to the connection
+*
+* @return 0 on success, -1 on failure
+*/
+static int serve_metrics(struct connection *conn)
+{
+    struct jpeg_frame *body = frame_pool_get_jpeg(NULL);       // Heap buffer, freed once sent
+    if (!body || jpeg_frame_reserve(body, METRICS_BODY_SIZE) < 0) {
+        jpeg_frame_release(body);
+        return -1;
+    }
+
+    size_t len = metrics_render((char *)body->data, body->capacity);
+    if (len >= body->capacity) {
+        if (jpeg_frame_reserve(body, len + 1) < 0) {
+            jpeg_frame_release(body);
+            return -1;
+        }
+        len = metrics_render((char *)body->data, body->capacity);
+        if (len >= body->capacity) len = body->capacity - 1;
+    }
+    body->size = len;
+
+    return conn_respond(conn, "200 OK", "text/plain; version=0.0.4", body);
+}
 
 /**
 * @brief Initializes and starts a simple HTTP server for MJPEG streaming.
 *
-* This function creates a TCP socket, enables address reuse, binds it to 
-* the port, and begins listening for incoming client connections.
+* This function creates a non-blocking TCP socket, enables address reuse, 
+* binds it to the port, and begins listening for incoming client connections.
 * The resulting listening socket is stored in the stream context.
 *
 * @param sctx   Pointer to the stream context where the server socket will be stored.
@@ -42,9 +340,10 @@ int start_http_server(struct stream_ctx *sctx, unsigned short port)
     *  socket() arguements:
     *   1. domain: AF_INET (protocol family) -> IPv4 Internet protocol
     *   2. socket type: SOCK_STREAM -> connection-oriented stream (TCP)
+    *      SOCK_NONBLOCK -> accept() never blocks the event loop
     *   3. protocol = 0; -> exact protocol inside selected domain + type.
     */
-    sctx->server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sctx->server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sctx->server_fd < 0) {
         perror("http_server: socket");
         return -1;
@@ -71,8 +370,9 @@ int start_http_server(struct stream_ctx *sctx, unsigned short port)
         return -1;
     }
 
-    /* 4. Mark socket as listening (ready to accept clients) */
-    if (listen(sctx->server_fd, 4) < 0) {
+    /* 4. Mark socket as listening (ready to accept clients).
+    *  Many dashboards may connect at once, so use the system maximum backlog */
+    if (listen(sctx->server_fd, SOMAXCONN) < 0) {
         perror("http_server: listen");
         close(sctx->server_fd);
         return -1;
@@ -84,23 +384,25 @@ int start_http_server(struct stream_ctx *sctx, unsigned short port)
 /**
 * @brief Accepts an incoming HTTP client connection.
 *
-* This function blocks until a client connects to the listening socket.
-* On success, the newly accepted client is stored in 'sctx->client_fd'.
-* It also prints the remote client's IP and port.
+* The listening socket is non-blocking, so this returns immediately when no
+* connection is pending (errno is then EAGAIN/EWOULDBLOCK). The accepted 
+* socket is non-blocking as well. It also prints the remote client's IP and port.
 *
 * @param sctx Pointer to stream context containing listening server socket.
 *
-* @return The client file descriptor on success, -1 on failure.
+* @return The client file descriptor on success, -1 on failure or when no client is pending.
 */
 int accept_client_connection(struct stream_ctx *sctx) 
 {
     struct sockaddr_in client_addr;
     socklen_t addrlen = sizeof(client_addr);
 
-    // Block until a client connects
-    sctx->client_fd = accept(sctx->server_fd, (struct sockaddr*)&client_addr, &addrlen);
-    if (sctx->client_fd < 0) {
-        perror("http_server: accept");
+    int client_fd = accept4(sctx->server_fd, (struct sockaddr*)&client_addr, &addrlen,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("http_server: accept");
+        }
         return -1;
     }
 
@@ -112,35 +414,58 @@ int accept_client_connection(struct stream_ctx *sctx)
         printf("http_server: Accepted connection from <unknown>\n");
     }
     
-    return sctx->client_fd;
+    return client_fd;
 }
 
 /**
-* @brief Send a minimal HTTP header for MJPEG streaming.
+* @brief Route a fully received HTTP request
 *
-* Writes the required HTTP response headers to the socket to initialize 
-* an MJPEG multipart stream over HTTP.
+*   - GET / or /stream: the multipart MJPEG stream
+*   - GET /snapshot.jpg: the latest encoded frame, then close
+*   - GET /ws: WebSocket upgrade; binary JPEG messages, acked by the client
+*     (all three take ?res=WxH to pick a rung of the resolution ladder)
+*   - GET /metrics: pipeline latency histograms and counters (Prometheus text)
+*   - GET /health: stream liveness (JSON, 503 when stalled)
+*   - GET /detections: latest object-detection boxes (JSON)
+*   - POST /trigger: record an event now (event recording only)
+*   - anything else: 404 (405 for methods other than GET)
 *
-* @param sctx Pointer to stream context containing listening server socket.
+* Every route also exists per camera as /camN/..., e.g. /cam1/stream;
+* without the prefix it addresses the first camera (/metrics always
+* covers the whole process).
 *
-* @return 0 on success, -1 on failure
+* @param sctx   Pointer to the stream context.
+* @param conn   Connection whose request header is complete.
+*
+* @return 0 on success, -1 to close the connection
 */
-int send_mjpeg_http_header(struct stream_ctx *sctx)
+int http_dispatch(struct stream_ctx *sctx, struct connection *conn)
 {
-    // Send HTTP header
-    const char *header =
-        "HTTP/1.1 200 OK\r\n"
-        "Connection: close\r\n"
-        "Cache-Control: no-cache\r\n"
-        "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
-        "\r\n";
-        
-    ssize_t written = write(sctx->client_fd, header, strlen(header));
-    if (written != (ssize_t)strlen(header)) {
-        perror("write header");
-        return -1;
+    const char *req = conn->req;
+    const char *path;
+    const struct stream_camera *cam = request_camera(sctx, req, &path);
+
+    if (!cam) return respond_text(conn, "404 Not Found", "text/plain", "No such camera\n");
+    conn->cam = cam;
+
+    bool stream = request_is(req, path, "GET", "/stream") || request_is(req, path, "GET", "/");
+    bool still = request_is(req, path, "GET", "/snapshot.jpg");
+    bool ws = request_is(req, path, "GET", "/ws");
+
+    if (stream || still || ws) {
+        struct broadcaster *bus = request_bus(cam, path);
+        if (!bus) return respond_no_res(cam, conn);
+        if (ws) return ws_start_stream(sctx, conn, bus);
+        return stream ? mjpeg_start_stream(sctx, conn, bus) : serve_snapshot(sctx, conn, bus);
     }
+    if (request_is(req, path, "GET", "/metrics")) return serve_metrics(conn);
+    if (request_is(req, path, "GET", "/health")) return serve_health(sctx, cam, conn);
+    if (request_is(req, path, "GET", "/detections")) return serve_detections(cam, conn);
+    if (request_is(req, path, "POST", "/trigger")) return serve_trigger(cam, conn);
 
-    return 0;
+    if (strncmp(req, "GET ", 4) != 0) {
+        return respond_text(conn, "405 Method Not Allowed", "text/plain",
+                            "Only GET is supported, and POST on /trigger\n");
+    }
+    return respond_text(conn, "404 Not Found", "text/plain", "Not found\n");
 }
-
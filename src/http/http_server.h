@@ -7,14 +7,15 @@
 */
 
 // Forward declare the context structures
-struct camera_ctx;
 struct stream_ctx;
-struct jpeg_frame;
+struct connection;
+
+/** @brief A captured frame older than this makes /health report the camera stalled. */
+#define HEALTH_STALE_MS     2000
 
 /** Function prototypes */
 int start_http_server(struct stream_ctx *sctx, unsigned short port);
 int accept_client_connection(struct stream_ctx *sctx);
-int send_mjpeg_http_header(struct stream_ctx *sctx);
-int handle_http_client(struct jpeg_frame *frame, struct camera_ctx *cctx, struct stream_ctx *sctx);
+int http_dispatch(struct stream_ctx *sctx, struct connection *conn);
 
 #endif  // HTTP_SERVER_H
\ No newline at end of file
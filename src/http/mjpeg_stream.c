@@ -5,73 +5,124 @@
 * This module implements the MJPEG-over-HTTP streaming layer, responsible
 * for transmitting JPEG-encoded frames to connected clients using the
 * multipart/x-mixed-replace format.
+*
+* Frames are never written directly: they are turned into messages on the
+* connection's write queue and sent by the event loop as the socket becomes
+* writable, so a slow client never blocks the others.
 */
 
 #include <stdio.h>     
-#include <unistd.h>    
+#include <string.h>
 #include <stddef.h>    
 #include <stdlib.h> 
 
 #include "mjpeg_stream.h"
-#include "camera/camera.h"
-#include "http/http_server.h"
-#include "http/mjpeg_stream.h"
-#include "cb/circular_buffer.h"
+#include "http/event_loop.h"
+#include "broadcast/broadcaster.h"
 #include "image/image_encoder.h"
-#include "image/image_processor.h"
+#include "metrics/metrics.h"
+
+/** @brief HTTP response header opening a multipart MJPEG stream. */
+static const char mjpeg_http_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Connection: close\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+    "\r\n";
+
+/** @brief End-of-frame terminator sent after every JPEG payload. */
+static const char mjpeg_part_trailer[] = "\r\n";
 
 /** Function Prototypes */
-static int send_mjpeg_frame(struct jpeg_frame *frame, struct stream_ctx *sctx);
+static void format_mjpeg_frame(struct jpeg_frame *frame, struct out_msg *msg);
 
 /**
-* @brief Consume JPEG frames from the pipeline and stream them to the client
+* @brief Begin streaming MJPEG to a client whose request has been read.
 *
-* Performs the following pipeline stages:
-*   1. Retrieve a JPEG frame from the shared circular buffer
-*   2. Send the JPEG frame to the connected client as MJPEG frame
-*   3. Release associated memory after transmission
+* Queues the multipart HTTP response header and subscribes the connection to
+* the frame broadcaster. Frames then arrive through mjpeg_pump_frames().
 *
-* @note This function represents the consumer stage of the producer-consumer streaming pipeline.
+* Fast first frame: if the pipeline is running, the cached latest frame is
+* queued right behind the header, so the viewer sees a picture without
+* waiting for the next capture. (While idle the cache is stale; the
+* subscription wakes the pipeline and the next captured frame follows.)
 *
-* @param cctx   Pointer to the camera context structure that holds all session state
-* @param sctx   Pointer to the stream structure context that holds stream sessions
-* @param pipe   Pointer to the pipeline context containing thread and synchronization primitives
-* 
-* @return 0 on success, negative value on error
+* @param sctx   Pointer to the stream context owning the connection.
+* @param conn   Pointer to the client connection.
+* @param bus    Broadcaster of the requested resolution
+*
+* @return 0 on success, -1 on failure
 */
-int send_frames(struct camera_ctx *cctx, 
-                struct stream_ctx *sctx, 
-                struct pipeline_ctx *pipe) 
+int mjpeg_start_stream(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus)
 {
-    struct jpeg_frame *jpeg = NULL;
-
-    // Retrieve th JPEG frame from the circular buffer
-    pthread_mutex_lock(pipe->mutex);
-    cb_read(pipe->cb, &jpeg);
-    pthread_mutex_unlock(pipe->mutex);
-
-    if (!jpeg) { return 0; }
-
-    //  Send JPEG frame to client
-    int ret = send_mjpeg_frame(jpeg, sctx);
-    if (ret < 0) {
-        fprintf(stderr, "Client disconnected or send error (ret=%d)\n", ret);
-        free(jpeg->data);
-        free(jpeg);
-        return -1;
+    struct out_msg *msg = conn_reserve_msg(conn);
+    if (!msg) return -1;
+
+    // Send HTTP header
+    msg->head = mjpeg_http_header;
+    msg->head_len = sizeof(mjpeg_http_header) - 1;
+
+    // Taken before subscribing, so the subscriber cannot also receive it
+    struct jpeg_frame *first = broadcaster_latest(bus, BROADCAST_FRESH_MS);
+    if (first) {
+        msg = conn_reserve_msg(conn);
+        format_mjpeg_frame(first, msg);
+        msg->queued_ns = metrics_now();
     }
 
-    // Free allocated JPEG memory
-    free(jpeg->data);
-    free(jpeg);
+    conn->state = CONN_STREAMING;
+    return conn_subscribe(sctx, conn, bus, sctx->queue_depth, sctx->queue_policy);
+}
+
+/**
+* @brief Move published frames from the subscription onto the write queue
+*
+* Frames stay in the subscriber queue while the write queue is full; the
+* subscriber queue then drops its oldest frames, affecting only this client.
+* Frames the connection's rate controller skips are released unsent.
+*
+* @param conn   Pointer to the streaming connection.
+*
+* @return Number of frames queued
+*/
+int mjpeg_pump_frames(struct connection *conn)
+{
+    int queued = 0;
 
-    return 0;
+    if (conn->state != CONN_STREAMING || !conn->sub) return 0;
+
+    while (conn->wq_count < CONN_WQ_DEPTH) {
+        struct jpeg_frame *jpeg = subscriber_next(conn->sub);
+        if (!jpeg) break;
+
+        if (!jpeg->data || jpeg->size == 0) {
+            printf("Frames empty/not available");
+            jpeg_frame_release(jpeg);
+            continue;
+        }
+
+        // Slow link: thin out the frame rate for this client only
+        if (!rate_ctl_admit(&conn->rc)) {
+            metrics_count(CNT_RATE_SKIPS, 1);
+            jpeg_frame_release(jpeg);
+            continue;
+        }
+
+        // The message takes over the subscriber's reference
+        struct out_msg *msg = conn_reserve_msg(conn);
+        format_mjpeg_frame(jpeg, msg);
+        msg->queued_ns = metrics_now();
+        metrics_observe(STAGE_QUEUE, jpeg->t.publish, msg->queued_ns);
+        queued++;
+    }
+
+    return queued;
 }
 
 /**
-* @brief Send a single JPEG image as an MJPEG frame over an HTTP multipart stream.
+* @brief Build the write-queue message for a single MJPEG frame.
 * 
-* This function writes the following structure to the client socket:
+* The message describes the following structure on the wire:
 *
 *   --frame\r\n                         (multipart boundary marker)
 *   Content-Type: image/jpeg\r\n
@@ -83,43 +134,31 @@ int send_frames(struct camera_ctx *cctx,
 * This matches the MJPEG-over-HTTP format used by web browsers and video players
 * when receiving multipart/x-mixed-replace streams.
 *
+* The part header is formatted once per frame and stored in the frame, so
+* every client shares it and it stays valid for as long as the frame does
+* (required for MSG_ZEROCOPY sends).
+*
 * @param frame  Pointer to the JPEG image produced from YUYV data.
-* @param sctx   Pointer to structure context that contains client_fd.
+* @param msg    Reserved write-queue message to fill.
 *
-* @return 0 on success, negative value on error.
+* @return void
 */
-static int send_mjpeg_frame(struct jpeg_frame *frame, struct stream_ctx *sctx) 
+static void format_mjpeg_frame(struct jpeg_frame *frame, struct out_msg *msg) 
 {
-    if (!frame || !frame->data || frame->size == 0) {
-        printf("Frames empty/not available");
-        return -1;
+    // Construct MJPEG frame header (only the first client pays for it)
+    if (frame->part_head_len == 0) {
+        frame->part_head_len = snprintf(frame->part_head, sizeof(frame->part_head),
+            "--frame\r\n"                       // multipart boundary marker
+            "Content-Type: image/jpeg\r\n"
+            "Content-Length: %lu\r\n"
+            "\r\n",                             // separator btwn headers and binary data
+            frame->size
+        );
     }
 
-    // Construct MJPEG frame header
-    char header[256];
-    int header_len = snprintf(header, sizeof(header),
-        "--frame\r\n"                       // multipart boundary marker
-        "Content-Type: image/jpeg\r\n"
-        "Content-Length: %lu\r\n"
-        "\r\n",                             // separator btwn headers and binary data
-        frame->size
-    );
-
-    // 1. Send multipart header
-    if (write(sctx->client_fd, header, header_len) != header_len) {
-        return -2;      // header write error
-    }
-
-    // 2. Send JPEG binary payload
-    if (write(sctx->client_fd, frame->data, frame->size) != (size_t)frame->size) {
-        return -3;      // payload write error
-    }
-
-    // 3. Send end-of-frame terminator
-    const char *end = "\r\n";
-    if (write(sctx->client_fd, end, 2) != 2) {
-        return -4;      // Footer write error
-    }
-
-    return 0;           // success
-}
\ No newline at end of file
+    msg->head = frame->part_head;
+    msg->head_len = frame->part_head_len;
+    msg->frame = frame;
+    msg->tail = mjpeg_part_trailer;
+    msg->tail_len = sizeof(mjpeg_part_trailer) - 1;
+}
@@ -6,23 +6,55 @@
 * @brief Public API for MJPEG frame streaming over HTTP.
 */
 
+#include "cb/circular_buffer.h"
+#include "camera/camera.h"
+
 // Forward declare the context structures
 struct camera_ctx;
-struct stream_ctx;
 struct jpeg_frame;
-struct pipeline_ctx;
+struct connection;
+struct broadcaster;
+struct detector;
+struct res_ladder;
+struct recorder;
+
+/**
+* @brief What the server exposes of one camera.
+*
+* Camera N is served under /camN/ (the first camera also without prefix).
+*/
+struct stream_camera {
+    struct camera_ctx *cctx;       /**< Capture state, for the frame age on /health */
+    struct broadcaster *bus;       /**< Source of encoded frames for streaming clients */
+    unsigned int n_tiers;          /**< Quality tiers the producer serves (0/1 = one) */
+    struct detector *detector;     /**< Object detection results for /detections, or NULL */
+    const struct res_ladder *ladder;   /**< Resolutions clients can pick (?res=WxH), or NULL */
+    struct recorder *recorder;     /**< Recorder POST /trigger starts events on, or NULL */
+};
 
 /**
 * @brief Streaming context for MJPEG server.
 *
-* Holds the server socket and client socket used during streaming.
+* Holds the listening socket, the epoll reactor and the list of connected
+* clients. A single thread serves every client of every camera through
+* this context.
 */
 struct stream_ctx {
     int server_fd;                 /**< Listening socket for the HTTP/MJPEG server */        
-    int client_fd;                 /**< Connected client socket */
+    int epoll_fd;                  /**< epoll instance driving all sockets */
+    struct stream_camera cams[CAMERA_MAX];  /**< Served cameras */
+    unsigned int n_cams;           /**< Number of served cameras */
+    struct connection *conns;      /**< List of open client connections */
+    struct connection *dead;       /**< Connections closed during the current event batch */
+    unsigned int n_conns;          /**< Number of open client connections */
+    unsigned long zerocopy_min;    /**< Payload size from which MSG_ZEROCOPY is used (0 = off) */
+    unsigned int queue_depth;      /**< Frames queued per client (0 = BUFFER_SIZE) */
+    enum cb_policy queue_policy;   /**< What a client's queue does when it is full */
+    unsigned int ws_credits;       /**< Unacknowledged frames per WebSocket client (0 = WS_DEFAULT_CREDITS) */
 };
 
 /** Function Prototypes */
-int send_frames(struct camera_ctx *cctx, struct stream_ctx *sctx, struct pipeline_ctx *pipe);
+int mjpeg_start_stream(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus);
+int mjpeg_pump_frames(struct connection *conn);
 
-#endif  // MJPEG_STREAM_H
\ No newline at end of file
+#endif  // MJPEG_STREAM_H
@@ -0,0 +1,101 @@
+/**
+* @file rate_control.c
+* @brief Per-client frame rate and quality adaptation driven by socket backpressure.
+*
+* A fixed-quality stream at the full capture rate builds seconds of queueing
+* delay on a link that cannot carry it (LTE uplinks). Every connection runs
+* a small controller that reacts to two signals:
+*   1. The kernel send queue (SIOCOUTQ): bytes written but not yet
+*      acknowledged. More than a couple of frames means the path is full.
+*   2. The write latency of each frame, smoothed: how long the frame waited
+*      on the connection before the socket accepted all of it.
+*
+* Congestion first lowers the client's quality tier (smaller frames at the
+* same rate), then doubles the number of frames skipped. A calm streak
+* undoes one step at a time, frame rate first. Each change is followed by a
+* hold-off so the queue can drain before the next decision.
+*/
+
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include "rate_control.h"
+
+/**
+* @brief Initialize a connection's controller: top tier, no skipping
+*
+* @param rc         Pointer to the controller
+* @param n_tiers    Quality tiers the producer can serve (at least 1)
+*
+* @return void
+*/
+void rate_ctl_init(struct rate_ctl *rc, unsigned int n_tiers)
+{
+    *rc = (struct rate_ctl){ .n_tiers = n_tiers ? n_tiers : 1 };
+}
+
+/**
+* @brief Decide whether the next published frame is sent to this client
+*
+* @param rc Pointer to the controller
+*
+* @return true to send the frame, false to skip it
+*/
+bool rate_ctl_admit(struct rate_ctl *rc)
+{
+    if (rc->phase < rc->skip) {
+        rc->phase++;
+        rc->skipped++;
+        return false;
+    }
+    rc->phase = 0;
+    return true;
+}
+
+/**
+* @brief Feed one completed frame write into the controller
+*
+* @param rc         Pointer to the controller
+* @param fd         Client socket
+* @param frame_size Bytes of the frame just written
+* @param latency_ns Time between queueing the frame and its last byte being accepted
+*
+* @return true if the quality tier changed (the caller moves the subscription)
+*/
+bool rate_ctl_sample(struct rate_ctl *rc, int fd, unsigned long frame_size, uint64_t latency_ns)
+{
+    int outq = 0;
+    if (ioctl(fd, SIOCOUTQ, &outq) == 0 && outq >= 0) rc->outq = (unsigned int)outq;
+
+    // EWMA with a 1/8 gain: reacts within a few frames, ignores single spikes
+    int64_t delta = (int64_t)latency_ns - (int64_t)rc->latency_ns;
+    rc->latency_ns = (uint64_t)((int64_t)rc->latency_ns + delta / 8);
+
+    if (rc->holdoff > 0) {
+        rc->holdoff--;
+        return false;
+    }
+
+    bool congested = rc->outq > RATE_OUTQ_HIGH_FRAMES * frame_size ||
+                     rc->latency_ns > RATE_LATENCY_HIGH_NS;
+    bool keeping_up = rc->outq <= frame_size / 2 && rc->latency_ns < RATE_LATENCY_LOW_NS;
+    unsigned int tier = rc->tier;
+
+    if (congested) {
+        rc->calm = 0;
+        if (rc->tier + 1 < rc->n_tiers) rc->tier++;
+        else if (rc->skip < RATE_SKIP_MAX) rc->skip = rc->skip ? rc->skip * 2 : 1;
+        else return false;
+        rc->holdoff = RATE_HOLDOFF_FRAMES;
+    } else if (keeping_up && ++rc->calm >= RATE_CALM_FRAMES) {
+        rc->calm = 0;
+        if (rc->skip > 0) rc->skip /= 2;
+        else if (rc->tier > 0) rc->tier--;
+        else return false;
+        rc->holdoff = RATE_HOLDOFF_FRAMES;
+    } else if (!keeping_up) {
+        rc->calm = 0;
+    }
+
+    return rc->tier != tier;
+}
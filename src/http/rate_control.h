@@ -0,0 +1,56 @@
+#ifndef RATE_CONTROL_H
+#define RATE_CONTROL_H
+
+/**
+* @file rate_control.h
+* @brief Per-client frame rate and quality adaptation driven by socket backpressure.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief Kernel send-queue depth, in frames, above which a link counts as congested. */
+#define RATE_OUTQ_HIGH_FRAMES   2
+
+/** @brief Smoothed write latency above which a link counts as congested. */
+#define RATE_LATENCY_HIGH_NS    250000000ULL
+
+/** @brief Smoothed write latency below which a link counts as keeping up. */
+#define RATE_LATENCY_LOW_NS     80000000ULL
+
+/** @brief Frames sent without congestion before one step of quality or rate is restored. */
+#define RATE_CALM_FRAMES        30
+
+/** @brief Frames sent after a change before congestion is judged again. */
+#define RATE_HOLDOFF_FRAMES     5
+
+/** @brief Largest number of frames skipped between two sent ones. */
+#define RATE_SKIP_MAX           8
+
+/**
+* @brief Rate controller state of one streaming connection.
+*
+* After every frame written the controller samples the kernel send queue
+* (SIOCOUTQ: bytes not yet acknowledged by the client) and the frame's
+* write latency (queued on the connection -> fully handed to the kernel).
+* On congestion it first steps down the quality tier, then starts skipping
+* frames; once the link keeps up again it restores both in reverse order.
+*/
+struct rate_ctl {
+    unsigned int n_tiers;           /**< Quality tiers available (1 = frame skipping only) */
+    unsigned int tier;              /**< Current quality tier */
+    unsigned int skip;              /**< Frames skipped between two sent ones */
+    unsigned int phase;             /**< Frames skipped since the last sent one */
+    uint64_t latency_ns;            /**< Smoothed write latency */
+    unsigned int outq;              /**< Last sampled kernel send-queue depth in bytes */
+    unsigned int calm;              /**< Consecutive frames sent without congestion */
+    unsigned int holdoff;           /**< Frames left before congestion is judged again */
+    unsigned long skipped;          /**< Frames skipped in total */
+};
+
+/** Function prototypes */
+void rate_ctl_init(struct rate_ctl *rc, unsigned int n_tiers);
+bool rate_ctl_admit(struct rate_ctl *rc);
+bool rate_ctl_sample(struct rate_ctl *rc, int fd, unsigned long frame_size, uint64_t latency_ns);
+
+#endif  // RATE_CONTROL_H
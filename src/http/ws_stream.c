@@ -0,0 +1,427 @@
+/**
+* @file ws_stream.c
+* @brief JPEG streaming over WebSocket with client-acked flow control.
+*
+* A client upgrades GET /ws (or /camN/ws, with ?res=WxH like /stream) to a
+* WebSocket. Every frame is then pushed as one binary message holding the
+* plain JPEG, and the client answers each message it has shown with any
+* message of its own (an empty one will do). At most `credits` frames are
+* unacknowledged at a time; while none is left, the subscription keeps
+* only the newest frame. A multipart stream queues whatever the socket
+* accepts, so on a long round trip the picture lags further and further;
+* here the lag stays at most `credits` frames plus one round trip.
+*
+* The time from queueing a frame to its ack is reported per stage on
+* /metrics (ack, and ack_total from the driver timestamp) and smoothed per
+* client. Pings are answered, a close is echoed and ends the connection.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ws_stream.h"
+#include "mjpeg_stream.h"
+#include "http/event_loop.h"
+#include "broadcast/broadcaster.h"
+#include "image/image_encoder.h"
+#include "metrics/metrics.h"
+
+/** @brief Appended to Sec-WebSocket-Key before hashing (RFC 6455). */
+#define WS_GUID             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/** @brief Longest accepted Sec-WebSocket-Key (a base64 16-byte nonce is 24). */
+#define WS_KEY_MAX          64
+
+/** @brief Message opcodes. */
+enum ws_opcode {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA,
+};
+
+/**
+* @brief SHA-1 of a short message (at most 119 bytes, two blocks)
+*
+* Only the handshake needs it, so no general streaming interface.
+*
+* @param msg    Message
+* @param len    Message length (<= 119)
+* @param digest Receives the 20-byte digest
+*
+* @return void
+*/
+static void sha1(const unsigned char *msg, size_t len, unsigned char digest[20])
+{
+    unsigned char buf[128];
+    size_t total = ((len + 8) / 64 + 1) * 64;
+    uint64_t bits = (uint64_t)len * 8;
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    memset(buf, 0, total);
+    memcpy(buf, msg, len);
+    buf[len] = 0x80;
+    for (int i = 0; i < 8; i++) buf[total - 1 - i] = (unsigned char)(bits >> (8 * i));
+
+#define ROL(x, n)   (((x) << (n)) | ((x) >> (32 - (n))))
+    for (size_t off = 0; off < total; off += 64) {
+        uint32_t w[80];
+
+        for (int t = 0; t < 16; t++) {
+            const unsigned char *p = buf + off + 4 * t;
+            w[t] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        }
+        for (int t = 16; t < 80; t++) w[t] = ROL(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int t = 0; t < 80; t++) {
+            uint32_t f, k;
+            if (t < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (t < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (t < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+            uint32_t tmp = ROL(a, 5) + f + e + k + w[t];
+            e = d;
+            d = c;
+            c = ROL(b, 30);
+            b = a;
+            a = tmp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+#undef ROL
+
+    for (int i = 0; i < 5; i++) {
+        digest[4 * i] = (unsigned char)(h[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(h[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(h[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)h[i];
+    }
+}
+
+/**
+* @brief Base64-encode a buffer
+*
+* @param in     Bytes to encode
+* @param len    Number of bytes
+* @param out    Receives the NUL-terminated text (4 * ceil(len / 3) + 1 bytes)
+*
+* @return void
+*/
+static void base64(const unsigned char *in, size_t len, char *out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) v |= in[i + 2];
+
+        *out++ = alphabet[(v >> 18) & 63];
+        *out++ = alphabet[(v >> 12) & 63];
+        *out++ = (i + 1 < len) ? alphabet[(v >> 6) & 63] : '=';
+        *out++ = (i + 2 < len) ? alphabet[v & 63] : '=';
+    }
+    *out = '\0';
+}
+
+/**
+* @brief Find a request header (name matched case-insensitively)
+*
+* @param req    Complete request header
+* @param name   Header name without the colon
+* @param value  Receives the value, surrounding whitespace removed
+* @param cap    Size of value
+*
+* @return true if the header is present and its value fits
+*/
+static bool request_header(const char *req, const char *name, char *value, size_t cap)
+{
+    size_t n = strlen(name);
+
+    for (const char *line = strstr(req, "\r\n"); line && line[2] != '\r'; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, n) != 0 || line[n] != ':') continue;
+
+        const char *v = line + n + 1;
+        while (*v == ' ' || *v == '\t') v++;
+        size_t len = strcspn(v, "\r\n");
+        while (len > 0 && (v[len - 1] == ' ' || v[len - 1] == '\t')) len--;
+        if (len >= cap) return false;
+
+        memcpy(value, v, len);
+        value[len] = '\0';
+        return true;
+    }
+    return false;
+}
+
+/**
+* @brief Queue one frame as a binary message and take a credit for it
+*
+* The message header is formatted once per frame and kept in the frame,
+* like the multipart part header, so MSG_ZEROCOPY sends stay valid.
+*
+* @param conn   Pointer to the WebSocket connection (a write-queue slot and a credit free)
+* @param frame  Frame to send; the message takes over this reference
+*
+* @return The queued message
+*/
+static struct out_msg *queue_frame(struct connection *conn, struct jpeg_frame *frame)
+{
+    struct ws_flow *ws = &conn->ws;
+
+    if (frame->ws_head_len == 0) {
+        unsigned char *h = (unsigned char *)frame->ws_head;
+        unsigned long size = frame->size;
+
+        h[0] = 0x80 | WS_OP_BINARY;             // FIN, one frame per message
+        if (size < 126) {
+            h[1] = (unsigned char)size;
+            frame->ws_head_len = 2;
+        } else if (size <= 0xFFFF) {
+            h[1] = 126;
+            h[2] = (unsigned char)(size >> 8);
+            h[3] = (unsigned char)size;
+            frame->ws_head_len = 4;
+        } else {
+            h[1] = 127;
+            for (int i = 0; i < 8; i++) h[2 + i] = (unsigned char)((uint64_t)size >> (56 - 8 * i));
+            frame->ws_head_len = 10;
+        }
+    }
+
+    struct out_msg *msg = conn_reserve_msg(conn);
+    msg->head = frame->ws_head;
+    msg->head_len = frame->ws_head_len;
+    msg->frame = frame;
+    msg->queued_ns = metrics_now();
+
+    unsigned int slot = (ws->head + ws->in_flight) % WS_CREDITS_MAX;
+    ws->sent[slot].queued_ns = msg->queued_ns;
+    ws->sent[slot].capture_ns = frame->t.capture;
+    ws->in_flight++;
+    return msg;
+}
+
+/**
+* @brief Upgrade a request for /ws to a WebSocket and start streaming
+*
+* Answers the handshake, subscribes the connection for the newest frame
+* only and queues the cached latest frame right away, as the multipart
+* stream does. A request that is no valid upgrade gets 400.
+*
+* @param sctx   Pointer to the stream context owning the connection.
+* @param conn   Pointer to the client connection.
+* @param bus    Broadcaster of the requested resolution
+*
+* @return 0 on success, -1 on failure
+*/
+int ws_start_stream(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus)
+{
+    char upgrade[64], version[8], key[WS_KEY_MAX];
+
+    if (!request_header(conn->req, "Upgrade", upgrade, sizeof(upgrade)) ||
+        !strcasestr(upgrade, "websocket") ||
+        !request_header(conn->req, "Sec-WebSocket-Key", key, sizeof(key)) ||
+        !request_header(conn->req, "Sec-WebSocket-Version", version, sizeof(version)) ||
+        strcmp(version, "13") != 0) {
+        return conn_respond(conn, "400 Bad Request", "text/plain", NULL);
+    }
+
+    // Sec-WebSocket-Accept = base64(SHA-1(key + GUID))
+    unsigned char input[WS_KEY_MAX + sizeof(WS_GUID)];
+    unsigned char digest[20];
+    char accept[32];
+    int len = snprintf((char *)input, sizeof(input), "%s%s", key, WS_GUID);
+    sha1(input, (size_t)len, digest);
+    base64(digest, sizeof(digest), accept);
+
+    struct out_msg *msg = conn_reserve_msg(conn);
+    if (!msg) return -1;
+    msg->head_len = snprintf(msg->head_buf, sizeof(msg->head_buf),
+                             "HTTP/1.1 101 Switching Protocols\r\n"
+                             "Upgrade: websocket\r\n"
+                             "Connection: Upgrade\r\n"
+                             "Sec-WebSocket-Accept: %s\r\n"
+                             "\r\n",
+                             accept);
+    msg->head = msg->head_buf;
+
+    memset(&conn->ws, 0, sizeof(conn->ws));
+    conn->ws.credits = sctx->ws_credits ? sctx->ws_credits : WS_DEFAULT_CREDITS;
+    conn->req_len = 0;                          // The request buffer now collects client frames
+    conn->state = CONN_WEBSOCKET;
+
+    // Taken before subscribing, so the subscriber cannot also receive it
+    struct jpeg_frame *first = broadcaster_latest(bus, BROADCAST_FRESH_MS);
+    if (first) queue_frame(conn, first);
+
+    return conn_subscribe(sctx, conn, bus, 1, CB_LATEST_ONLY);
+}
+
+/**
+* @brief Move the newest published frame onto the write queue, credits permitting
+*
+* @param conn   Pointer to the WebSocket connection.
+*
+* @return Number of frames queued
+*/
+int ws_pump_frames(struct connection *conn)
+{
+    int queued = 0;
+
+    if (conn->state != CONN_WEBSOCKET || !conn->sub) return 0;
+
+    while (conn->wq_count < CONN_WQ_DEPTH && conn->ws.in_flight < conn->ws.credits) {
+        struct jpeg_frame *jpeg = subscriber_next(conn->sub);
+        if (!jpeg) break;
+
+        if (!jpeg->data || jpeg->size == 0) {
+            jpeg_frame_release(jpeg);
+            continue;
+        }
+
+        struct out_msg *msg = queue_frame(conn, jpeg);
+        metrics_observe(STAGE_QUEUE, jpeg->t.publish, msg->queued_ns);
+        queued++;
+    }
+
+    return queued;
+}
+
+/**
+* @brief Return the credit of the oldest unacknowledged frame
+*
+* @param conn   Pointer to the WebSocket connection.
+*
+* @return void
+*/
+static void ws_ack(struct connection *conn)
+{
+    struct ws_flow *ws = &conn->ws;
+
+    if (ws->in_flight == 0) return;             // More acks than frames: ignored
+
+    uint64_t now = metrics_now();
+    uint64_t queued = ws->sent[ws->head].queued_ns;
+
+    metrics_observe(STAGE_ACK, queued, now);
+    metrics_observe(STAGE_ACK_TOTAL, ws->sent[ws->head].capture_ns, now);
+    metrics_count(CNT_WS_ACKS, 1);
+
+    // Same smoothing as the rate controller's write latency
+    uint64_t rtt = now - queued;
+    ws->rtt_ns = ws->rtt_ns ? ws->rtt_ns - ws->rtt_ns / 8 + rtt / 8 : rtt;
+
+    ws->head = (ws->head + 1) % WS_CREDITS_MAX;
+    ws->in_flight--;
+    ws->acked++;
+}
+
+/**
+* @brief Queue a control frame (pong or close)
+*
+* @param conn       Pointer to the WebSocket connection.
+* @param opcode     WS_OP_PONG or WS_OP_CLOSE
+* @param payload    Payload to send
+* @param len        Payload length (<= WS_CONTROL_MAX)
+*
+* @return 0 on success, -1 if the write queue is full
+*/
+static int ws_send_control(struct connection *conn, enum ws_opcode opcode,
+                           const unsigned char *payload, size_t len)
+{
+    struct out_msg *msg = conn_reserve_msg(conn);
+    if (!msg) return -1;
+
+    msg->head_buf[0] = (char)(0x80 | opcode);
+    msg->head_buf[1] = (char)len;
+    memcpy(msg->head_buf + 2, payload, len);
+    msg->head = msg->head_buf;
+    msg->head_len = 2 + len;
+    return 0;
+}
+
+/**
+* @brief Process the client frames collected in the connection's request buffer
+*
+* Complete frames are consumed, a partial one is kept for the next read.
+* Every complete data message is an ack; a ping is answered with a pong; a
+* close is echoed, after which the connection ends once its write queue
+* is sent.
+*
+* @param conn   Pointer to the WebSocket connection (conn->req holds req_len bytes).
+*
+* @return 0 to keep the connection, -1 to close it (protocol error)
+*/
+int ws_receive(struct connection *conn)
+{
+    unsigned char *buf = (unsigned char *)conn->req;
+    size_t len = conn->req_len, off = 0;
+
+    while (conn->state == CONN_WEBSOCKET && len - off >= 2) {
+        unsigned char *p = buf + off;
+        bool fin = p[0] & 0x80;
+        unsigned int opcode = p[0] & 0x0F;
+        uint64_t plen = p[1] & 0x7F;
+        size_t hdr = 2;
+
+        if (!(p[1] & 0x80)) return -1;          // Client frames must be masked
+
+        if (plen == 126) {
+            if (len - off < 4) break;
+            plen = (uint64_t)p[2] << 8 | p[3];
+            hdr = 4;
+        } else if (plen == 127) {
+            if (len - off < 10) break;
+            plen = 0;
+            for (int i = 0; i < 8; i++) plen = plen << 8 | p[2 + i];
+            hdr = 10;
+        }
+        hdr += 4;                               // Masking key
+
+        // Acks are tiny; anything that cannot fit the buffer is refused
+        if (plen > sizeof(conn->req) - 1 - hdr) return -1;
+        if (len - off < hdr + plen) break;
+
+        unsigned char *payload = p + hdr;
+        for (uint64_t i = 0; i < plen; i++) payload[i] ^= p[hdr - 4 + (i & 3)];
+
+        switch (opcode) {
+            case WS_OP_CONTINUATION:
+            case WS_OP_TEXT:
+            case WS_OP_BINARY:
+                if (fin) ws_ack(conn);
+                break;
+            case WS_OP_PING:
+                if (plen > WS_CONTROL_MAX) return -1;
+                ws_send_control(conn, WS_OP_PONG, payload, (size_t)plen);   // Skipped if the queue is full
+                break;
+            case WS_OP_PONG:
+                break;
+            case WS_OP_CLOSE:
+                if (plen > WS_CONTROL_MAX) return -1;
+                if (ws_send_control(conn, WS_OP_CLOSE, payload, plen >= 2 ? 2 : 0) < 0) return -1;
+                conn->state = CONN_RESPONDING;  // Closed once the echo is sent
+                break;
+            default:
+                return -1;
+        }
+        off += hdr + (size_t)plen;
+    }
+
+    memmove(buf, buf + off, len - off);
+    conn->req_len = len - off;
+    return 0;
+}
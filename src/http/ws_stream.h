@@ -0,0 +1,50 @@
+#ifndef WS_STREAM_H
+#define WS_STREAM_H
+
+/**
+* @file ws_stream.h
+* @brief Public API for JPEG streaming over WebSocket with client-acked flow control.
+*/
+
+#include <stdint.h>
+
+// Forward declare the context structures
+struct stream_ctx;
+struct connection;
+struct broadcaster;
+
+/** @brief Frames a WebSocket client may have unacknowledged unless configured. */
+#define WS_DEFAULT_CREDITS  2
+
+/** @brief Largest configurable credit window. */
+#define WS_CREDITS_MAX      16
+
+/** @brief Largest control frame payload (RFC 6455). */
+#define WS_CONTROL_MAX      125
+
+/**
+* @brief Credit window of one WebSocket connection.
+*
+* Every frame queued for the client takes a credit, every message the
+* client sends back returns the oldest one. Without a credit no frame is
+* queued: the subscription keeps only the newest frame, so whatever the
+* client receives next is current however long the round trip is.
+*/
+struct ws_flow {
+    unsigned int credits;           /**< Frames the client may have unacknowledged */
+    unsigned int in_flight;         /**< Frames queued or sent and not yet acknowledged */
+    unsigned int head;              /**< Oldest unacknowledged entry in sent */
+    struct {
+        uint64_t queued_ns;         /**< When the frame was queued for the client */
+        uint64_t capture_ns;        /**< Driver timestamp of the frame */
+    } sent[WS_CREDITS_MAX];         /**< Unacknowledged frames, oldest first from head */
+    uint64_t rtt_ns;                /**< Smoothed queue -> ack time */
+    unsigned long acked;            /**< Frames acknowledged in total */
+};
+
+/** Function Prototypes */
+int ws_start_stream(struct stream_ctx *sctx, struct connection *conn, struct broadcaster *bus);
+int ws_pump_frames(struct connection *conn);
+int ws_receive(struct connection *conn);
+
+#endif  // WS_STREAM_H
@@ -0,0 +1,348 @@
+/**
+* @file encoder_pool.c
+* @brief Multi-core JPEG encoding with in-order publishing.
+*
+* The producer thread hands every captured frame to encoder_pool_submit(),
+* which copies it into a free job slot, so the capture buffer can go back to
+* the driver straight away. Capture buffers from the USERPTR pool are not
+* copied: the job holds a reference and the worker encodes the buffer it
+* was captured into, since the driver slot has already been refilled.
+* N worker threads, each with its own persistent encoder, take queued jobs
+* in capture order and encode them concurrently.
+*
+* Workers finish out of order; the job ring is also the reorder stage. A
+* worker that completes a job publishes every consecutive finished frame
+* starting at next_publish, so clients always see frames in capture order.
+*
+* With several cameras, one pool serves them all: every camera (lane) has
+* its own job ring, and a worker looking for work starts at the lane after
+* the one served last, so a busy camera cannot starve a slower one.
+*
+* If every slot is busy the new frame is dropped (the camera would drop it
+* anyway if capture stalled), and the count is reported on shutdown.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "encoder_pool.h"
+#include "camera/camera.h"
+#include "image_encoder.h"
+#include "image_processor.h"
+#include "mem/frame_pool.h"
+#include "broadcast/broadcaster.h"
+#include "metrics/metrics.h"
+#include "sched/topology.h"
+
+/** @brief Job slots beyond one per worker, so finished frames can wait for a slower neighbour. */
+#define REORDER_SLACK       2
+
+/**
+* @brief Publish every finished frame of a lane that is next in capture order
+*
+* Called with ep->lock held.
+*
+* @param lane   Pointer to the lane
+*
+* @return void
+*/
+static void publish_in_order(struct encoder_lane *lane)
+{
+    for (;;) {
+        struct encode_job *job = &lane->jobs[lane->next_publish % lane->n_jobs];
+        if (job->state != JOB_DONE) break;
+
+        // A failed frame is skipped, it does not stall the frames behind it
+        if (job->out[0]) image_publish_tiers(lane->pipe, job->out);
+
+        job->state = JOB_FREE;
+        lane->next_publish++;
+    }
+}
+
+/**
+* @brief Pick the lane the next job comes from
+*
+* Called with ep->lock held. Lanes are taken in turn, starting after the
+* lane served last.
+*
+* @param ep Pointer to the encoder pool
+*
+* @return Index of a lane with a queued frame, or -1 if none has one
+*/
+static int next_lane(struct encoder_pool *ep)
+{
+    for (unsigned int i = 0; i < ep->n_lanes; i++) {
+        unsigned int l = (ep->next_lane + i) % ep->n_lanes;
+
+        if (ep->lanes[l].next_encode != ep->lanes[l].next_submit) {
+            ep->next_lane = (l + 1) % ep->n_lanes;
+            return (int)l;
+        }
+    }
+    return -1;
+}
+
+/**
+* @brief Worker thread: encode queued jobs until the pool stops
+*/
+static void *encoder_worker(void *arg)
+{
+    struct encoder_worker *w = arg;
+    struct encoder_pool *ep = w->ep;
+
+    topology_enter(THREAD_ENCODER);
+
+    pthread_mutex_lock(&ep->lock);
+    for (;;) {
+        int l;
+        while (!ep->stopping && (l = next_lane(ep)) < 0) {
+            pthread_cond_wait(&ep->work, &ep->lock);
+        }
+        if (ep->stopping) break;
+
+        struct encoder_lane *lane = &ep->lanes[l];
+        struct encode_job *job = &lane->jobs[lane->next_encode % lane->n_jobs];
+        lane->next_encode++;
+        job->state = JOB_ENCODING;
+        pthread_mutex_unlock(&ep->lock);
+
+        // Encode outside the lock; the job slot belongs to this worker now
+        struct yuyv_frame in = {
+            .data = job->capture ? job->capture->start : job->yuyv,
+            .width = job->width,
+            .height = job->height,
+            .size = (unsigned long)job->width * job->height * 2,
+            .dmabuf_fd = -1,            // A private copy, or a pool buffer (no DMABUF)
+            .t = job->t
+        };
+
+        struct jpeg_frame *out[BROADCAST_TIERS];
+        image_encode_tiers(w->enc[l], &in, lane->pipe, out);
+        if (job->capture) {
+            capture_buffer_release(job->capture);
+            job->capture = NULL;
+        }
+
+        pthread_mutex_lock(&ep->lock);
+        memcpy(job->out, out, sizeof(job->out));
+        job->state = JOB_DONE;
+        publish_in_order(lane);
+    }
+    pthread_mutex_unlock(&ep->lock);
+
+    return NULL;
+}
+
+/**
+* @brief Start an encoder worker pool
+*
+* @param ep         Pointer to the encoder pool
+* @param n_workers  Number of worker threads (1 - ENCODER_POOL_MAX_WORKERS)
+* @param pipes      Pipelines (one per camera) whose frames the pool encodes
+* @param n_pipes    Number of pipelines (1 - ENCODER_POOL_MAX_LANES)
+*
+* @return 0 on success, -1 on failure
+*/
+int encoder_pool_init(struct encoder_pool *ep, unsigned int n_workers,
+                      struct pipeline_ctx *const pipes[], unsigned int n_pipes)
+{
+    memset(ep, 0, sizeof(*ep));
+
+    if (n_workers < 1 || n_workers > ENCODER_POOL_MAX_WORKERS) {
+        fprintf(stderr, "encoder_pool: Worker count must be 1-%d\n", ENCODER_POOL_MAX_WORKERS);
+        return -1;
+    }
+    if (n_pipes < 1 || n_pipes > ENCODER_POOL_MAX_LANES) {
+        fprintf(stderr, "encoder_pool: Pipeline count must be 1-%d\n", ENCODER_POOL_MAX_LANES);
+        return -1;
+    }
+
+    if (pthread_mutex_init(&ep->lock, NULL) != 0 || pthread_cond_init(&ep->work, NULL) != 0) {
+        perror("encoder_pool: Failed to initialize synchronization");
+        return -1;
+    }
+
+    // Preallocate every job's frame copy so submitting never allocates
+    for (unsigned int l = 0; l < n_pipes; l++) {
+        struct encoder_lane *lane = &ep->lanes[l];
+        const struct v4l2_pix_format *pix = &pipes[l]->cctx->fmt.fmt.pix;
+        unsigned long frame_size = (unsigned long)pix->width * pix->height * 2;
+
+        lane->pipe = pipes[l];
+        lane->n_jobs = n_workers + REORDER_SLACK;
+        lane->jobs = calloc(lane->n_jobs, sizeof(*lane->jobs));
+        ep->n_lanes++;
+        if (!lane->jobs) goto error;
+
+        for (unsigned int i = 0; i < lane->n_jobs; i++) {
+            lane->jobs[i].yuyv = malloc(frame_size);
+            if (!lane->jobs[i].yuyv) goto error;
+            lane->jobs[i].yuyv_cap = frame_size;
+        }
+    }
+
+    for (unsigned int i = 0; i < n_workers; i++) {
+        struct encoder_worker *w = &ep->workers[i];
+        w->ep = ep;
+
+        for (unsigned int l = 0; l < ep->n_lanes; l++) {
+            if (image_encoders_create(ep->lanes[l].pipe, w->enc[l]) < 0) {
+                while (l-- > 0) image_encoders_destroy(w->enc[l]);
+                goto error;
+            }
+        }
+
+        if (pthread_create(&w->thread, NULL, encoder_worker, w) != 0) {
+            perror("encoder_pool: Failed to create worker thread");
+            for (unsigned int l = 0; l < ep->n_lanes; l++) image_encoders_destroy(w->enc[l]);
+            goto error;
+        }
+        ep->n_workers++;
+    }
+
+    printf("encoder_pool: %u encoder workers for %u camera%s\n", ep->n_workers, ep->n_lanes,
+           ep->n_lanes == 1 ? "" : "s");
+    return 0;
+
+error:
+    perror("encoder_pool: Failed to start");
+    encoder_pool_destroy(ep);
+    return -1;
+}
+
+/**
+* @brief Stop the workers and release every job
+*
+* Frames still queued or waiting for reordering are discarded.
+*
+* @param ep Pointer to the encoder pool
+*
+* @return void
+*/
+void encoder_pool_destroy(struct encoder_pool *ep)
+{
+    pthread_mutex_lock(&ep->lock);
+    ep->stopping = true;
+    pthread_cond_broadcast(&ep->work);
+    pthread_mutex_unlock(&ep->lock);
+
+    for (unsigned int i = 0; i < ep->n_workers; i++) {
+        pthread_join(ep->workers[i].thread, NULL);
+        for (unsigned int l = 0; l < ep->n_lanes; l++) image_encoders_destroy(ep->workers[i].enc[l]);
+    }
+    ep->n_workers = 0;
+
+    for (unsigned int l = 0; l < ep->n_lanes; l++) {
+        struct encoder_lane *lane = &ep->lanes[l];
+
+        if (lane->dropped) {
+            printf("encoder_pool: camera %u: %lu frames dropped (all workers busy)\n", l, lane->dropped);
+        }
+        if (!lane->jobs) continue;
+
+        for (unsigned int i = 0; i < lane->n_jobs; i++) {
+            for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+                jpeg_frame_release(lane->jobs[i].out[t]);
+            }
+            if (lane->jobs[i].capture) capture_buffer_release(lane->jobs[i].capture);
+            free(lane->jobs[i].yuyv);
+        }
+        free(lane->jobs);
+        lane->jobs = NULL;
+    }
+    ep->n_lanes = 0;
+
+    pthread_cond_destroy(&ep->work);
+    pthread_mutex_destroy(&ep->lock);
+}
+
+/**
+* @brief Queue a captured frame for encoding
+*
+* Copies the frame into the next job slot (or, for a swappable capture
+* buffer, takes a reference to it) and wakes a worker. Must only be
+* called from the pipeline's producer thread. The frame is published
+* later, in order, by whichever worker completes the sequence.
+*
+* @param ep     Pointer to the encoder pool
+* @param pipe   Pipeline the frame was captured by (one of those given to encoder_pool_init())
+* @param yuyv   Captured frame; no longer referenced once this returns, unless
+*               its capture buffer is swappable (then until it is encoded)
+*
+* @return 0 on success (including a dropped frame), -1 on failure
+*/
+int encoder_pool_submit(struct encoder_pool *ep, struct pipeline_ctx *pipe, const struct yuyv_frame *yuyv)
+{
+    struct encoder_lane *lane = NULL;
+
+    // Set up before any producer starts, so the lanes can be searched unlocked
+    for (unsigned int l = 0; l < ep->n_lanes && !lane; l++) {
+        if (ep->lanes[l].pipe == pipe) lane = &ep->lanes[l];
+    }
+    if (!lane) return -1;
+
+    pthread_mutex_lock(&ep->lock);
+    struct encode_job *job = &lane->jobs[lane->next_submit % lane->n_jobs];
+    bool busy = (job->state != JOB_FREE);
+    if (busy) lane->dropped++;
+    pthread_mutex_unlock(&ep->lock);
+
+    // Every worker is behind: drop this frame rather than stall capture
+    if (busy) {
+        metrics_count(CNT_ENCODER_DROPS, 1);
+        return 0;
+    }
+
+    // Only the lane's producer moves a slot out of JOB_FREE, so it can be filled unlocked
+    if (yuyv->capture && capture_buffer_swappable(yuyv->capture)) {
+        capture_buffer_retain(yuyv->capture);
+        job->capture = yuyv->capture;
+    } else {
+        if (yuyv->size > job->yuyv_cap) {
+            unsigned char *data = realloc(job->yuyv, yuyv->size);
+            if (!data) return -1;
+            job->yuyv = data;
+            job->yuyv_cap = yuyv->size;
+        }
+        memcpy(job->yuyv, yuyv->data, yuyv->size);
+    }
+    job->width = yuyv->width;
+    job->height = yuyv->height;
+    job->t = yuyv->t;
+
+    pthread_mutex_lock(&ep->lock);
+    job->state = JOB_QUEUED;
+    lane->next_submit++;
+    pthread_cond_signal(&ep->work);
+    pthread_mutex_unlock(&ep->lock);
+
+    return 0;
+}
+
+/**
+* @brief Check whether every frame a pipeline submitted has been published
+*
+* Must only be called from the pipeline's producer thread: nothing new can
+* be queued for the lane until the caller submits again.
+*
+* @param ep     Pointer to the encoder pool
+* @param pipe   Pipeline to check (one of those given to encoder_pool_init())
+*
+* @return true if the lane has no queued, encoding or unpublished frames
+*/
+bool encoder_pool_idle(struct encoder_pool *ep, const struct pipeline_ctx *pipe)
+{
+    bool idle = true;
+
+    for (unsigned int l = 0; l < ep->n_lanes; l++) {
+        struct encoder_lane *lane = &ep->lanes[l];
+        if (lane->pipe != pipe) continue;
+
+        pthread_mutex_lock(&ep->lock);
+        idle = (lane->next_publish == lane->next_submit);
+        pthread_mutex_unlock(&ep->lock);
+    }
+    return idle;
+}
@@ -0,0 +1,104 @@
+#ifndef ENCODER_POOL_H
+#define ENCODER_POOL_H
+
+/**
+* @file encoder_pool.h
+* @brief Multi-core JPEG encoding with in-order publishing.
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "image/image_encoder.h"
+#include "camera/camera.h"
+#include "broadcast/broadcaster.h"
+
+// Forward declare structures
+struct yuyv_frame;
+struct jpeg_frame;
+struct pipeline_ctx;
+struct jpeg_encoder;
+struct encoder_pool;
+
+/** @brief Largest accepted number of encoder workers. */
+#define ENCODER_POOL_MAX_WORKERS    16
+
+/** @brief Pipelines (cameras) one pool can encode for. */
+#define ENCODER_POOL_MAX_LANES      CAMERA_MAX
+
+/**
+* @brief One frame travelling through the worker pool.
+*
+* Jobs live in a ring indexed by sequence number, which doubles as the
+* reorder buffer: frames are published strictly in slot order.
+*/
+struct encode_job {
+    enum {
+        JOB_FREE,                   /**< Slot available for a new frame */
+        JOB_QUEUED,                 /**< Frame copied in, waiting for a worker */
+        JOB_ENCODING,               /**< A worker is encoding it */
+        JOB_DONE,                   /**< Encoded (or failed), waiting to be published in order */
+    } state;
+    unsigned char *yuyv;            /**< Private copy of the captured frame */
+    struct buffer *capture;         /**< Capture buffer encoded in place instead of the copy, or NULL */
+    unsigned long yuyv_cap;         /**< Allocated size of yuyv */
+    unsigned int width;             /**< Frame width in pixels */
+    unsigned int height;            /**< Frame height in pixels */
+    struct frame_times t;           /**< Capture and dequeue times of the frame */
+    struct jpeg_frame *out[BROADCAST_TIERS];    /**< Encoded tier variants, out[0] NULL if encoding failed */
+};
+
+/**
+* @brief The frames of one pipeline (camera) in the pool.
+*
+* Each lane has its own job ring and sequence numbers, so frames are
+* reordered per camera and a camera that falls behind only fills its own
+* slots.
+*/
+struct encoder_lane {
+    struct pipeline_ctx *pipe;      /**< Frame pool and broadcaster of this camera */
+    struct encode_job *jobs;        /**< Ring of n_jobs job slots */
+    unsigned int n_jobs;            /**< Ring size (workers + reorder slack) */
+    unsigned long next_submit;      /**< Sequence number of the next captured frame */
+    unsigned long next_encode;      /**< Sequence number of the next frame to hand to a worker */
+    unsigned long next_publish;     /**< Sequence number of the next frame to publish */
+    unsigned long dropped;          /**< Frames dropped because every slot was busy */
+};
+
+/**
+* @brief One encoder thread and the encoders it owns.
+*/
+struct encoder_worker {
+    struct encoder_pool *ep;        /**< Owning pool */
+    struct jpeg_encoder *enc[ENCODER_POOL_MAX_LANES][BROADCAST_TIERS];  /**< Persistent encoders (per lane and tier) used only by this thread */
+    pthread_t thread;               /**< Worker thread */
+};
+
+/**
+* @brief Pool of encoder threads, each owning a persistent JPEG encoder.
+*
+* Parallelism is per frame: every worker compresses whole frames, so no
+* restart-marker stitching is needed and each output is a plain JPEG.
+* One pool serves every camera; idle workers take the lanes in turn.
+*/
+struct encoder_pool {
+    pthread_mutex_t lock;           /**< Protects the job rings and cursors */
+    pthread_cond_t work;            /**< Signalled when a job is queued or on shutdown */
+
+    struct encoder_lane lanes[ENCODER_POOL_MAX_LANES];  /**< One job ring per pipeline */
+    unsigned int n_lanes;           /**< Number of lanes in use */
+    unsigned int next_lane;         /**< Lane a worker looks at first for its next job (round robin) */
+
+    struct encoder_worker workers[ENCODER_POOL_MAX_WORKERS];    /**< Worker threads */
+    unsigned int n_workers;         /**< Number of running workers */
+    bool stopping;                  /**< Workers exit when set */
+};
+
+/** Function prototypes */
+int encoder_pool_init(struct encoder_pool *ep, unsigned int n_workers,
+                      struct pipeline_ctx *const pipes[], unsigned int n_pipes);
+void encoder_pool_destroy(struct encoder_pool *ep);
+int encoder_pool_submit(struct encoder_pool *ep, struct pipeline_ctx *pipe, const struct yuyv_frame *yuyv);
+bool encoder_pool_idle(struct encoder_pool *ep, const struct pipeline_ctx *pipe);
+
+#endif  // ENCODER_POOL_H
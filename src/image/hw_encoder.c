@@ -0,0 +1,408 @@
+/**
+* @file hw_encoder.c
+* @brief Hardware JPEG encoding through a V4L2 memory-to-memory device.
+*
+* SoCs like the BCM2835 family expose their JPEG block as a V4L2 M2M device
+* (bcm2835-codec, usually /dev/video31 for still/JPEG encode). This module:
+*   1. Probes /dev/video* for an M2M device that turns YUYV into JPEG
+*      (single- or multi-planar API)
+*   2. Configures both queues for the negotiated camera format
+*   3. Encodes a frame by importing the capture buffer's DMABUF into the
+*      OUTPUT queue (zero-copy) or, if that is not possible, by copying it
+*      into an OUTPUT buffer, then dequeues the compressed result from the
+*      CAPTURE buffer
+*
+* Callers fall back to libjpeg when no device is found or an encode fails.
+*/
+
+#include <stdio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include "hw_encoder.h"
+#include "image_encoder.h"
+#include "camera/camera.h"
+
+/** @brief Longest time to wait for the hardware to return a frame. */
+#define HW_ENCODE_TIMEOUT_MS    1000
+
+/**
+* @brief Prepare a v4l2_buffer for buffer 0 of a queue
+*/
+static void init_buf(const struct hw_encoder *hw, struct v4l2_buffer *buf,
+                     struct v4l2_plane *plane, unsigned int type)
+{
+    memset(buf, 0, sizeof(*buf));
+    memset(plane, 0, sizeof(*plane));
+    buf->type = type;
+    buf->memory = (type == hw->out_type && hw->import) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+    buf->index = 0;
+    if (hw->mplane) {
+        buf->m.planes = plane;
+        buf->length = 1;
+    }
+}
+
+/**
+* @brief Take every queued buffer back from the driver after a failed encode
+*
+* STREAMOFF returns all buffers to user space; streaming restarts at once
+* so the next frame can be encoded normally.
+*/
+static void reset_queues(struct hw_encoder *hw)
+{
+    ioctl(hw->fd, VIDIOC_STREAMOFF, &hw->out_type);
+    ioctl(hw->fd, VIDIOC_STREAMOFF, &hw->cap_type);
+    if (ioctl(hw->fd, VIDIOC_STREAMON, &hw->out_type) < 0 ||
+        ioctl(hw->fd, VIDIOC_STREAMON, &hw->cap_type) < 0) {
+        perror("hw_encoder: Failed to restart streaming");
+    }
+}
+
+/**
+* @brief Check whether a queue of the device offers a pixel format
+*
+* @return true if supported
+*/
+static bool supports_format(int fd, unsigned int type, unsigned int pixelformat)
+{
+    struct v4l2_fmtdesc desc = { .type = type };
+
+    for (desc.index = 0; ioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+        if (desc.pixelformat == pixelformat) return true;
+    }
+    return false;
+}
+
+/**
+* @brief Open a device node if it is a YUYV -> JPEG M2M encoder
+*
+* @return 0 if the device is usable, -1 otherwise
+*/
+static int probe_device(struct hw_encoder *hw, const char *path)
+{
+    struct v4l2_capability cap;
+
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) goto reject;
+
+    unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+        hw->mplane = true;
+        hw->out_type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        hw->cap_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else if (caps & V4L2_CAP_VIDEO_M2M) {
+        hw->mplane = false;
+        hw->out_type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        hw->cap_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else {
+        goto reject;
+    }
+
+    if (!supports_format(fd, hw->out_type, V4L2_PIX_FMT_YUYV)) goto reject;
+    if (!supports_format(fd, hw->cap_type, V4L2_PIX_FMT_JPEG)) goto reject;
+
+    hw->fd = fd;
+    snprintf(hw->path, sizeof(hw->path), "%s", path);
+    printf("hw_encoder: Using %s (%s)\n", path, (const char *)cap.card);
+    return 0;
+
+reject:
+    close(fd);
+    return -1;
+}
+
+/**
+* @brief Set the format of one queue
+*
+* @return 0 on success, -1 on failure
+*/
+static int set_format(struct hw_encoder *hw, unsigned int type, unsigned int pixelformat,
+                      unsigned int sizeimage, struct v4l2_format *fmt)
+{
+    memset(fmt, 0, sizeof(*fmt));
+    fmt->type = type;
+
+    if (hw->mplane) {
+        fmt->fmt.pix_mp.width = hw->width;
+        fmt->fmt.pix_mp.height = hw->height;
+        fmt->fmt.pix_mp.pixelformat = pixelformat;
+        fmt->fmt.pix_mp.field = V4L2_FIELD_NONE;
+        fmt->fmt.pix_mp.num_planes = 1;
+        fmt->fmt.pix_mp.plane_fmt[0].sizeimage = sizeimage;
+    } else {
+        fmt->fmt.pix.width = hw->width;
+        fmt->fmt.pix.height = hw->height;
+        fmt->fmt.pix.pixelformat = pixelformat;
+        fmt->fmt.pix.field = V4L2_FIELD_NONE;
+        fmt->fmt.pix.sizeimage = sizeimage;
+    }
+
+    if (ioctl(hw->fd, VIDIOC_S_FMT, fmt) < 0) {
+        perror("hw_encoder: Failed to set format");
+        return -1;
+    }
+
+    unsigned int w = hw->mplane ? fmt->fmt.pix_mp.width : fmt->fmt.pix.width;
+    unsigned int h = hw->mplane ? fmt->fmt.pix_mp.height : fmt->fmt.pix.height;
+    if (w != hw->width || h != hw->height) {
+        fprintf(stderr, "hw_encoder: %s does not support %ux%u\n", hw->path, hw->width, hw->height);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief Request and map the single buffer of one queue
+*
+* @return 0 on success, -1 on failure
+*/
+static int map_queue(struct hw_encoder *hw, unsigned int type, struct hw_buffer *mapped)
+{
+    struct v4l2_requestbuffers req = { .count = 1, .type = type, .memory = V4L2_MEMORY_MMAP };
+    if (ioctl(hw->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 1) {
+        perror("hw_encoder: Failed to request buffers");
+        return -1;
+    }
+
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    init_buf(hw, &buf, &plane, type);
+    if (ioctl(hw->fd, VIDIOC_QUERYBUF, &buf) < 0) {
+        perror("hw_encoder: Failed querying the buffer");
+        return -1;
+    }
+
+    mapped->length = hw->mplane ? plane.length : buf.length;
+    off_t offset = hw->mplane ? plane.m.mem_offset : buf.m.offset;
+    mapped->start = mmap(NULL, mapped->length, PROT_READ | PROT_WRITE, MAP_SHARED, hw->fd, offset);
+    if (mapped->start == MAP_FAILED) {
+        perror("hw_encoder: Failed mapping the buffer");
+        mapped->start = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief Set the OUTPUT queue up to import DMABUFs
+*
+* @return 0 on success, -1 if the driver refuses (the caller then copies)
+*/
+static int import_queue(struct hw_encoder *hw, unsigned int count)
+{
+    struct v4l2_requestbuffers req = { .count = count, .type = hw->out_type,
+                                       .memory = V4L2_MEMORY_DMABUF };
+    if (ioctl(hw->fd, VIDIOC_REQBUFS, &req) < 0 || req.count < count) {
+        perror("hw_encoder: DMABUF import not supported, copying frames");
+        return -1;
+    }
+
+    hw->import = true;
+    hw->n_import = count;
+    return 0;
+}
+
+/**
+* @brief Find and set up a hardware JPEG encoder
+*
+* @param path           Device node to use, or NULL to probe /dev/video0..63
+* @param width          Frame width in pixels
+* @param height         Frame height in pixels
+* @param quality        JPEG quality (1-100), applied if the driver supports it
+* @param import_bufs    Number of exported capture buffers to import, or 0 to copy frames
+*
+* @return Pointer to the encoder, or NULL if no usable device was found
+*/
+struct hw_encoder *hw_encoder_open(const char *path, unsigned int width,
+                                   unsigned int height, int quality,
+                                   unsigned int import_bufs)
+{
+    struct hw_encoder *hw = calloc(1, sizeof(*hw));
+    if (!hw) return NULL;
+    hw->fd = -1;
+    hw->width = width;
+    hw->height = height;
+
+    if (path) {
+        probe_device(hw, path);
+    } else {
+        char node[32];
+        for (int i = 0; i < HW_ENCODER_PROBE_MAX && hw->fd < 0; i++) {
+            snprintf(node, sizeof(node), "/dev/video%d", i);
+            probe_device(hw, node);
+        }
+    }
+
+    if (hw->fd < 0) {
+        printf("hw_encoder: No V4L2 JPEG encoder found\n");
+        free(hw);
+        return NULL;
+    }
+
+    struct v4l2_format fmt;
+    if (set_format(hw, hw->out_type, V4L2_PIX_FMT_YUYV, width * height * 2, &fmt) < 0) goto error;
+    hw->stride = hw->mplane ? fmt.fmt.pix_mp.plane_fmt[0].bytesperline : fmt.fmt.pix.bytesperline;
+    if (hw->stride < width * 2) hw->stride = width * 2;
+
+    if (set_format(hw, hw->cap_type, V4L2_PIX_FMT_JPEG, width * height, &fmt) < 0) goto error;
+
+    struct v4l2_control ctrl = { .id = V4L2_CID_JPEG_COMPRESSION_QUALITY, .value = quality };
+    if (ioctl(hw->fd, VIDIOC_S_CTRL, &ctrl) < 0) {
+        perror("hw_encoder: Failed to set JPEG quality (using driver default)");
+    }
+
+    // Import needs the camera's line layout, as nothing re-strides the frame
+    bool can_import = import_bufs > 0 && hw->stride == width * 2;
+    if (!(can_import && import_queue(hw, import_bufs) == 0)) {
+        if (map_queue(hw, hw->out_type, &hw->out) < 0) goto error;
+    }
+    if (map_queue(hw, hw->cap_type, &hw->cap) < 0) goto error;
+
+    if (ioctl(hw->fd, VIDIOC_STREAMON, &hw->out_type) < 0 ||
+        ioctl(hw->fd, VIDIOC_STREAMON, &hw->cap_type) < 0) {
+        perror("hw_encoder: Failed to start streaming");
+        goto error;
+    }
+
+    return hw;
+
+error:
+    hw_encoder_close(hw);
+    return NULL;
+}
+
+/**
+* @brief Stop the device and release the encoder
+*
+* @param hw Encoder returned by hw_encoder_open() (NULL is ignored)
+*
+* @return void
+*/
+void hw_encoder_close(struct hw_encoder *hw)
+{
+    if (!hw) return;
+
+    if (hw->fd >= 0) {
+        // STREAMOFF also detaches any imported DMABUFs
+        ioctl(hw->fd, VIDIOC_STREAMOFF, &hw->out_type);
+        ioctl(hw->fd, VIDIOC_STREAMOFF, &hw->cap_type);
+    }
+    if (hw->out.start) munmap(hw->out.start, hw->out.length);
+    if (hw->cap.start) munmap(hw->cap.start, hw->cap.length);
+    if (hw->fd >= 0) close(hw->fd);
+    free(hw);
+}
+
+/**
+* @brief Encode one YUYV frame in hardware
+*
+* In import mode the capture buffer itself is queued on the OUTPUT queue
+* by its DMABUF; the call is synchronous, so the buffer is back with the
+* caller when it returns. Otherwise the frame is copied into the OUTPUT
+* buffer (honouring the driver's stride). Either way, one encode runs and
+* the JPEG is copied from the CAPTURE buffer into out.
+*
+* @param hw     Pointer to the encoder
+* @param yuyv   Frame to encode (must match the configured size; in import
+*               mode it must come straight from the camera)
+* @param out    Destination frame (grown if needed)
+*
+* @return 0 on success, -1 on failure
+*/
+int hw_encoder_encode(struct hw_encoder *hw, const struct yuyv_frame *yuyv,
+                      struct jpeg_frame *out)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane plane;
+    const size_t row = (size_t)hw->width * 2;
+    const size_t used = (size_t)hw->stride * hw->height;
+
+    if (yuyv->width != hw->width || yuyv->height != hw->height) return -1;
+
+    // 1. Raw frame into the OUTPUT queue: imported as-is, or copied
+    bool import = hw->import && yuyv->capture && yuyv->dmabuf_fd >= 0 &&
+                  yuyv->capture->index < hw->n_import;
+
+    if (hw->import) {
+        if (!import) return -1;     // Not a camera frame: let libjpeg handle it
+    } else if (used > hw->out.length) {
+        return -1;
+    } else if (hw->stride == row) {
+        memcpy(hw->out.start, yuyv->data, used);
+    } else {
+        for (unsigned int y = 0; y < hw->height; y++) {
+            memcpy((unsigned char *)hw->out.start + (size_t)y * hw->stride, yuyv->data + y * row, row);
+        }
+    }
+
+    // 2. Queue an empty CAPTURE buffer and the filled OUTPUT buffer
+    init_buf(hw, &buf, &plane, hw->cap_type);
+    if (ioctl(hw->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("hw_encoder: Failed to queue capture buffer");
+        return -1;
+    }
+
+    init_buf(hw, &buf, &plane, hw->out_type);
+    if (hw->mplane) plane.bytesused = used;
+    else buf.bytesused = used;
+    if (import) {
+        buf.index = yuyv->capture->index;
+        if (hw->mplane) {
+            plane.m.fd = yuyv->dmabuf_fd;
+            plane.length = yuyv->capture->length;
+        } else {
+            buf.m.fd = yuyv->dmabuf_fd;
+            buf.length = yuyv->capture->length;
+        }
+    }
+    if (ioctl(hw->fd, VIDIOC_QBUF, &buf) < 0) {
+        perror("hw_encoder: Failed to queue output buffer");
+        reset_queues(hw);
+        return -1;
+    }
+
+    // 3. Wait for the encoded frame
+    struct pollfd pfd = { .fd = hw->fd, .events = POLLIN };
+    int ready;
+    while ((ready = poll(&pfd, 1, HW_ENCODE_TIMEOUT_MS)) < 0 && errno == EINTR);
+    if (ready <= 0) {
+        fprintf(stderr, "hw_encoder: Encode timed out\n");
+        reset_queues(hw);
+        return -1;
+    }
+
+    init_buf(hw, &buf, &plane, hw->cap_type);
+    if (ioctl(hw->fd, VIDIOC_DQBUF, &buf) < 0) {
+        perror("hw_encoder: Failed to dequeue capture buffer");
+        reset_queues(hw);
+        return -1;
+    }
+    size_t size = hw->mplane ? plane.bytesused : buf.bytesused;
+    bool failed = (buf.flags & V4L2_BUF_FLAG_ERROR) != 0;
+
+    // The OUTPUT buffer (or imported capture buffer) is released by this DQBUF
+    init_buf(hw, &buf, &plane, hw->out_type);
+    if (ioctl(hw->fd, VIDIOC_DQBUF, &buf) < 0) {
+        perror("hw_encoder: Failed to dequeue output buffer");
+        reset_queues(hw);
+        return -1;
+    }
+
+    // 4. Compressed frame out of the CAPTURE buffer
+    if (failed || size == 0 || size > hw->cap.length) return -1;
+    if (jpeg_frame_reserve(out, size) < 0) return -1;
+
+    memcpy(out->data, hw->cap.start, size);
+    out->size = size;
+    return 0;
+}
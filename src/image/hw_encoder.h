@@ -0,0 +1,62 @@
+#ifndef HW_ENCODER_H
+#define HW_ENCODER_H
+
+/**
+* @file hw_encoder.h
+* @brief Hardware JPEG encoding through a V4L2 memory-to-memory device.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Forward declare structures
+struct yuyv_frame;
+struct jpeg_frame;
+
+/** @brief Number of video device nodes probed for a JPEG M2M encoder. */
+#define HW_ENCODER_PROBE_MAX    64
+
+/**
+* @brief One mmap'd buffer of an M2M queue.
+*/
+struct hw_buffer {
+    void *start;                    /**< Mapping in user space */
+    size_t length;                  /**< Mapping length */
+};
+
+/**
+* @brief State of an opened M2M JPEG encoder.
+*
+* The OUTPUT queue takes raw YUYV frames, the CAPTURE queue returns JPEG.
+* Frames are encoded one at a time, so the CAPTURE queue needs a single
+* buffer. The OUTPUT queue either owns one mmap buffer that frames are
+* copied into, or imports the camera's exported DMABUFs directly (one slot
+* per capture buffer, so each slot always sees the same dmabuf and the
+* driver can keep it attached). Not thread-safe: used by one encoding thread.
+*/
+struct hw_encoder {
+    int fd;                         /**< M2M device */
+    char path[32];                  /**< Device node, for logging */
+    bool mplane;                    /**< Device uses the multi-planar API */
+    unsigned int out_type;          /**< OUTPUT (raw) buffer type */
+    unsigned int cap_type;          /**< CAPTURE (JPEG) buffer type */
+
+    unsigned int width;             /**< Frame width in pixels */
+    unsigned int height;            /**< Frame height in pixels */
+    unsigned int stride;            /**< OUTPUT bytes per line imposed by the driver */
+
+    bool import;                    /**< OUTPUT imports capture DMABUFs (zero-copy) */
+    unsigned int n_import;          /**< OUTPUT slots in import mode (= capture buffers) */
+    struct hw_buffer out;           /**< OUTPUT buffer (copy mode only) */
+    struct hw_buffer cap;           /**< CAPTURE buffer */
+};
+
+/** Function prototypes */
+struct hw_encoder *hw_encoder_open(const char *path, unsigned int width,
+                                   unsigned int height, int quality,
+                                   unsigned int import_bufs);
+void hw_encoder_close(struct hw_encoder *hw);
+int hw_encoder_encode(struct hw_encoder *hw, const struct yuyv_frame *yuyv,
+                      struct jpeg_frame *out);
+
+#endif  // HW_ENCODER_H
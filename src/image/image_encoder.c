@@ -5,27 +5,49 @@
 * Provides:
 *   1. Conversion from YUYV422 to RGB24
 *   2. JPEG compression of RGB frames using libjpeg
+*   3. Direct JPEG compression of YUYV frames (no RGB intermediate)
+*   4. A persistent encoder that keeps its libjpeg state and tables across
+*      frames and writes into caller-supplied, reusable output buffers
+*   5. Encoding profiles: chroma subsampling, DCT method, restart markers,
+*      trained or per-frame optimal Huffman tables and abbreviated frames
+*   6. Reference counting of encoded JPEG frames shared between clients
 *
 * These routines are designed to prepare frames for MJPEG HTTP transmission.
 */
 
 #include <stdio.h>   
 #include <stdlib.h> 
+#include <string.h>
 #include <setjmp.h>
+#include <pthread.h>
 #include <jpeglib.h>   
+#include <jerror.h>
 
 #include "image_encoder.h"
+#include "jpeg_huffman.h"
+#include "yuyv_rgb.h"
+
+/** @brief JPEG quality used by all encoders (80 = good balance). */
+#define JPEG_QUALITY        80
 
 /** @brief Ensure value stays within 8-bit pixel range: [0, 255]  */
 #define CLIP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
 
+/** @brief Studio-range to full-range lookup tables for the raw YUYV path. */
+static JSAMPLE luma_lut[256];
+static JSAMPLE chroma_lut[256];
+
 /**
 * @brief Convert YUYV422 frame to an RGB24 frame
 *
 * Converts a raw YUYV422 camera frame into an RGB24 format suitable for
 * JPEG compression and object detection (later extension).
 * The conversion follows the BT.601 color space specification and uses 
-* integer arithmetic for performance.
+* integer arithmetic for performance (see yuyv_rgb.c for the kernels).
+*
+* If rgb->data is NULL a buffer is allocated for the caller to free;
+* otherwise rgb->data must hold at least width * height * 3 bytes (e.g. a
+* frame pool buffer) and is written in place.
 *
 * @param yuyv  Pointer to the source YUYV422 frame
 * @param rgb   Pointer to the destination RGB frame
@@ -41,122 +63,709 @@ int convert_yuyv_to_rgb(const struct yuyv_frame *yuyv,
     rgb->height = yuyv->height;
     rgb->size   = yuyv->width * yuyv->height * 3;
 
-    rgb->data = malloc(rgb->size);              // Allocate memory for the pixel data
-    if (!rgb->data) return -1;
-
-    const unsigned char *src = yuyv->data;      // The data is const. You can move the pointer
-    unsigned char *dst = rgb->data;
-
-    /**   In each width iteration:
-    *       - Process 2 pixels
-    *       - Consumes 4 bytes of YUYV
-    *       - Produces 6 bytes of RGB (2 pixels x 3 channels) */
-    for (int y=0; y < yuyv->height; y++) {
-        for (int x=0; x < yuyv->width; x += 2) {
-
-            int y0 = src[0];
-            int u  = src[1];
-            int y1 = src[2];
-            int v  = src[3];
-            src += 4;
-
-            /**
-            u & v are initially stored as unsigned bytes, range: [0, 255]
-            - u = 128 -> no blue shift    (neutral chroma)
-            - v = 128 -> no red shift     (neutral chroma)
-            Subtract 128 to recenter chroma values:
-            original:    0 -> 255
-            Centered:  -128 -> +127    (neutral chroma at 0 now)
-            Result: d & e = signed color offsets
-                - Negative -> reduces color
-                - Positive -> increases color
-                - 0 -> no color contribution 
-            */ 
-            int d = u - 128;
-            int e = v - 128;
-
-            /** Pixel 0
-            Y is initially stored as unsigned byte, range: [0, 255]
-            BT.601 valid luma Range: [16, 235]
-                Y = 16 -> black
-                Y = 235 -> white
-                Subtract 16 to normalize so that black = 0
-            YUYV -> RGB Conversion equation:                                    -> Floating point is slow, scale by 256 to get integer
-                R = 1.164 * (Y - 16) + 1.596 * (V - 128)                        -> 298 * (Y - 16) + 409 * (V - 128)
-                G = 1.164 * (Y - 16) - 0.391 * (U - 128) - 0.813 * (V - 128)    -> 298 * (Y - 16) - 100 * (U - 128) - 208 * (V - 128)
-                B = 1.164 * (Y - 16) + 2.018 * (U - 128)                        -> 298 * (Y - 16) + 516 * (U - 128)
-            */
-            int c = y0 - 16; 
-            *dst++ = CLIP((298*c + 409*e + 128) >> 8);            // Red
-            *dst++ = CLIP((298*c - 100*d - 208*e + 128) >> 8);    // Green
-            *dst++ = CLIP((298*c + 516*d + 128) >> 8);            // Blue
-
-            // Pixel 1
-            c = y1 - 16;
-            *dst++ = CLIP((298*c + 409*e + 128) >> 8);
-            *dst++ = CLIP((298*c - 100*d - 208*e + 128) >> 8);
-            *dst++ = CLIP((298*c + 516*d + 128) >> 8);
+    if (!rgb->data) {
+        rgb->data = malloc(rgb->size);          // Allocate memory for the pixel data
+        if (!rgb->data) return -1;
+    }
+
+    // Dispatches to the NEON kernel when the CPU supports it (bit-exact with scalar)
+    yuyv_to_rgb(yuyv->data, rgb->data, (size_t)yuyv->width * yuyv->height);
+
+    return 0;
+}
+
+/**
+* @brief Build the limited-range -> full-range lookup tables
+*
+* V4L2 YUYV from UVC cameras uses BT.601 "studio" range (Y: 16-235,
+* Cb/Cr: 16-240) while JFIF expects full-range YCbCr. The RGB path gets
+* this expansion for free from the 298/256 luma scale; the raw path applies
+* it with two 256-entry tables so the picture looks identical.
+*
+* @return void
+*/
+static void init_range_luts(void)
+{
+    for (int i = 0; i < 256; i++) {
+        int y = ((i - 16) * 255 * 2 + 219) / (219 * 2);         // round((i - 16) * 255 / 219)
+        int c = 128 + ((i - 128) * 255 * 2 + (i >= 128 ? 224 : -224)) / (224 * 2);
+        luma_lut[i] = CLIP(y);
+        chroma_lut[i] = CLIP(c);
+    }
+}
+
+/**
+* @brief De-interleave one band of YUYV rows into Y, Cb and Cr planes
+*
+* Fills the row buffers handed to jpeg_write_raw_data(). Rows are padded on
+* the right by repeating the last pixel and rows past the bottom of the
+* image repeat the last row. With 4:2:0 sampling two source rows are
+* averaged into each chroma row.
+*
+* @param planes     Destination plane rows (Y, Cb, Cr)
+* @param yuyv       Source YUYV422 frame
+* @param width      Frame width in pixels (even)
+* @param height     Frame height in pixels
+* @param first_row  First source row of the band
+* @param v_samp     Luma vertical sampling factor (1 = 4:2:2, 2 = 4:2:0)
+* @param padded_w   Luma row width rounded up to a full MCU
+*
+* @return void
+*/
+static void deinterleave_band(JSAMPARRAY planes[3], const unsigned char *yuyv,
+                              int width, int height, int first_row,
+                              int v_samp, int padded_w)
+{
+    const int stride = width * 2;
+    const int luma_rows = DCTSIZE * v_samp;
+
+    for (int r = 0; r < luma_rows; r++) {
+        int sy = first_row + r < height ? first_row + r : height - 1;
+        const unsigned char *src = yuyv + (size_t)sy * stride;
+        JSAMPROW dst = planes[0][r];
+
+        for (int x = 0; x < width; x++) dst[x] = luma_lut[src[2 * x]];
+        for (int x = width; x < padded_w; x++) dst[x] = dst[width - 1];
+    }
+
+    for (int r = 0; r < DCTSIZE; r++) {
+        int sy0 = first_row + r * v_samp;
+        int sy1 = sy0 + v_samp - 1;
+        if (sy0 >= height) sy0 = height - 1;
+        if (sy1 >= height) sy1 = height - 1;
+
+        const unsigned char *s0 = yuyv + (size_t)sy0 * stride;
+        const unsigned char *s1 = yuyv + (size_t)sy1 * stride;
+        JSAMPROW cb = planes[1][r];
+        JSAMPROW cr = planes[2][r];
+        int cw = width / 2;
+
+        for (int x = 0; x < cw; x++) {
+            cb[x] = chroma_lut[(s0[4 * x + 1] + s1[4 * x + 1] + 1) >> 1];
+            cr[x] = chroma_lut[(s0[4 * x + 3] + s1[4 * x + 3] + 1) >> 1];
+        }
+        for (int x = cw; x < padded_w / 2; x++) {
+            cb[x] = cb[cw - 1];
+            cr[x] = cr[cw - 1];
         }
     }
+}
+
+/**
+* @brief libjpeg error manager that returns control to the encoder
+*
+* The default libjpeg error handler calls exit(); a long-lived encoder must
+* survive a bad frame, so errors longjmp back into the encode call instead.
+*/
+struct encoder_error_mgr {
+    struct jpeg_error_mgr pub;          /**< libjpeg public error fields */
+    jmp_buf jmp;                        /**< Return point of the current encode call */
+};
+
+/** @brief Input format the compressor is currently configured for. */
+enum encoder_input {
+    INPUT_NONE,                         /**< Not configured yet */
+    INPUT_RGB,                          /**< Packed RGB24 scanlines */
+    INPUT_YUYV,                         /**< YUYV422 via the raw-data interface */
+};
+
+/**
+* @brief Persistent JPEG encoder state
+*
+* Owned by exactly one encoding thread. The compressor, its quantization and
+* Huffman tables and the raw-data band buffers are set up once and reused for
+* every frame with the same input format and dimensions.
+*/
+struct jpeg_encoder {
+    struct jpeg_compress_struct cinfo;  /**< libjpeg compressor, reused across frames */
+    struct encoder_error_mgr err;       /**< Error manager */
+    struct jpeg_destination_mgr dest;   /**< Destination writing into the caller's frame buffer */
+    struct jpeg_frame *out;             /**< Frame currently being written */
+
+    int quality;                        /**< JPEG quality (1-100) */
+    struct jpeg_profile profile;        /**< Subsampling, DCT, restart and table choices */
+    enum encoder_input input;           /**< Configured input format */
+    unsigned int width;                 /**< Configured frame width */
+    unsigned int height;                /**< Configured frame height */
+
+    unsigned char *band;                /**< Raw-data band buffer (one MCU row of Y, Cb, Cr) */
+    JSAMPROW y_rows[2 * DCTSIZE];       /**< Luma row pointers into band */
+    JSAMPROW cb_rows[DCTSIZE];          /**< Cb row pointers into band */
+    JSAMPROW cr_rows[DCTSIZE];          /**< Cr row pointers into band */
+    int v_samp;                         /**< Luma vertical sampling factor (raw path) */
+    int padded_w;                       /**< Luma band width rounded up to a full MCU */
+
+    unsigned long high_water;           /**< Largest compressed frame produced so far */
+};
+
+/**
+* @brief libjpeg error_exit hook: print the message and unwind to the encode call
+*/
+static void encoder_error_exit(j_common_ptr cinfo)
+{
+    struct encoder_error_mgr *err = (struct encoder_error_mgr *)cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->jmp, 1);
+}
+
+/**
+* @brief Destination hook: start writing at the beginning of the frame buffer
+*/
+static void dest_init(j_compress_ptr cinfo)
+{
+    struct jpeg_encoder *enc = (struct jpeg_encoder *)cinfo;
+    enc->dest.next_output_byte = enc->out->data;
+    enc->dest.free_in_buffer = enc->out->capacity;
+}
+
+/**
+* @brief Resize a frame's output buffer, keeping its first bytes
+*
+* Borrowed buffers (pool slabs) are never passed to realloc(): the data is
+* copied into a fresh heap buffer that the frame then owns.
+*
+* @return 0 on success, -1 on failure
+*/
+static int frame_resize(struct jpeg_frame *out, unsigned long want, unsigned long keep)
+{
+    unsigned char *data;
+
+    if (out->borrowed) {
+        data = malloc(want);
+        if (!data) return -1;
+        if (keep) memcpy(data, out->data, keep);
+        out->borrowed = false;
+    } else {
+        data = realloc(out->data, want);
+        if (!data) return -1;
+    }
+
+    out->data = data;
+    out->capacity = want;
     return 0;
 }
 
 /**
-* @brief Encode RGB24 frame into JPEG format
+* @brief Destination hook: the frame buffer is full, double it
+*
+* Only reached when a frame is larger than anything seen before; buffers
+* are otherwise pre-sized from the high-water mark.
+*/
+static boolean dest_grow(j_compress_ptr cinfo)
+{
+    struct jpeg_encoder *enc = (struct jpeg_encoder *)cinfo;
+    struct jpeg_frame *out = enc->out;
+    unsigned long used = out->capacity;
+
+    if (frame_resize(out, out->capacity * 2, used) < 0) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    }
+
+    enc->dest.next_output_byte = out->data + used;
+    enc->dest.free_in_buffer = out->capacity - used;
+    return TRUE;
+}
+
+/**
+* @brief Destination hook: record the compressed size
+*/
+static void dest_term(j_compress_ptr cinfo)
+{
+    struct jpeg_encoder *enc = (struct jpeg_encoder *)cinfo;
+    enc->out->size = enc->out->capacity - enc->dest.free_in_buffer;
+    if (enc->out->size > enc->high_water) enc->high_water = enc->out->size;
+}
+
+/** @brief Guards the one-time initialization of the range lookup tables. */
+static pthread_once_t luts_once = PTHREAD_ONCE_INIT;
+
+/**
+* @brief Create the libjpeg compressor of a new encoder
 *
-* Compresses an RGB frame into a JPEG image using th libjpeg library.
-* The resulting JPEG data is written to a memory buffer owned by the jpeg_frame structure.
+* Kept apart from jpeg_encoder_create_profile() so nothing set after the
+* setjmp() lives in the frame longjmp() returns to.
 *
-* The function initializes and configures the JPEG compressor, writes scanlines
-* sequentially, and finalizes compression before returning.
+* @param enc    Zeroed encoder, quality and profile already set
 *
-* @param rgb   Pointer to the source RGB frame
-* @param jpeg  Pointer to the destination JPEG frame
+* @return 0 on success, -1 if libjpeg failed (the compressor is destroyed again)
+*/
+static int encoder_setup(struct jpeg_encoder *enc)
+{
+    enc->cinfo.err = jpeg_std_error(&enc->err.pub);
+    enc->err.pub.error_exit = encoder_error_exit;
+
+    if (setjmp(enc->err.jmp)) {
+        jpeg_destroy_compress(&enc->cinfo);
+        return -1;
+    }
+
+    // Initializes the compressor and allocate its internal memory once
+    jpeg_create_compress(&enc->cinfo);
+
+    enc->dest.init_destination = dest_init;
+    enc->dest.empty_output_buffer = dest_grow;
+    enc->dest.term_destination = dest_term;
+    enc->cinfo.dest = &enc->dest;
+    return 0;
+}
+
+/**
+* @brief Create a persistent JPEG encoder with the default profile
+*
+* Each encoding thread should own its own encoder; an encoder must not be
+* used from two threads at once.
+*
+* @param quality    JPEG quality (1-100)
+*
+* @return Pointer to the encoder, or NULL on failure
+*/
+struct jpeg_encoder *jpeg_encoder_create(int quality)
+{
+    return jpeg_encoder_create_profile(quality, NULL);
+}
+
+/**
+* @brief Create a persistent JPEG encoder with an encoding profile
+*
+* @param quality    JPEG quality (1-100)
+* @param profile    Encoding profile, copied (NULL = libjpeg defaults); trained
+*                   tables it points to must outlive the encoder
+*
+* @return Pointer to the encoder, or NULL on failure
+*/
+struct jpeg_encoder *jpeg_encoder_create_profile(int quality, const struct jpeg_profile *profile)
+{
+    struct jpeg_encoder *enc = calloc(1, sizeof(*enc));
+    if (!enc) {
+        perror("image_encoder: Failed to allocate encoder");
+        return NULL;
+    }
+
+    pthread_once(&luts_once, init_range_luts);
+
+    enc->quality = quality;
+    if (profile) enc->profile = *profile;
+    if (enc->profile.huffman == JPEG_HUFFMAN_TRAINED && !enc->profile.tables) {
+        enc->profile.huffman = JPEG_HUFFMAN_STANDARD;
+    }
+    if (encoder_setup(enc) < 0) {
+        free(enc);
+        return NULL;
+    }
+    return enc;
+}
+
+/**
+* @brief Destroy an encoder and release its libjpeg state
+*
+* @param enc    Encoder returned by jpeg_encoder_create() (NULL is ignored)
+*
+* @return void
+*/
+void jpeg_encoder_destroy(struct jpeg_encoder *enc)
+{
+    if (!enc) return;
+
+    jpeg_destroy_compress(&enc->cinfo);
+    free(enc->band);
+    free(enc);
+}
+
+/**
+* @brief Suggested output buffer size for the next frame
+*
+* Based on the largest frame produced so far plus some headroom, so the
+* destination rarely has to grow mid-frame. Before the first frame a
+* generous estimate of half a byte per pixel is used.
+*
+* @param enc    Pointer to the encoder
+*
+* @return Buffer size in bytes
+*/
+unsigned long jpeg_encoder_output_hint(const struct jpeg_encoder *enc)
+{
+    if (enc->high_water == 0) {
+        unsigned long estimate = (unsigned long)enc->width * enc->height / 2;
+        return estimate > 65536 ? estimate : 65536;
+    }
+    return enc->high_water + enc->high_water / 4;
+}
+
+/**
+* @brief Install one Huffman table into the compressor
+*
+* @return void
+*/
+static void set_huffman_table(j_compress_ptr cinfo, JHUFF_TBL **slot,
+                              const struct jpeg_huffman_table *table)
+{
+    unsigned int count = 0;
+
+    if (!*slot) *slot = jpeg_alloc_huff_table((j_common_ptr)cinfo);
+    for (int len = 1; len <= 16; len++) count += table->bits[len];
+
+    memcpy((*slot)->bits, table->bits, sizeof(table->bits));
+    memcpy((*slot)->huffval, table->vals, count);
+    (*slot)->sent_table = FALSE;
+}
+
+/**
+* @brief Apply the encoder's profile on top of jpeg_set_defaults()
+*
+* @return void
+*/
+static void apply_profile(struct jpeg_encoder *enc)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+    const struct jpeg_profile *p = &enc->profile;
+
+    cinfo->dct_method = p->fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo->restart_in_rows = (int)p->restart_rows;
+    cinfo->optimize_coding = p->huffman == JPEG_HUFFMAN_OPTIMIZED;
+
+    if (p->huffman == JPEG_HUFFMAN_TRAINED) {
+        for (int t = 0; t < 2; t++) {
+            set_huffman_table(cinfo, &cinfo->dc_huff_tbl_ptrs[t], &p->tables->dc[t]);
+            set_huffman_table(cinfo, &cinfo->ac_huff_tbl_ptrs[t], &p->tables->ac[t]);
+        }
+    }
+
+    // Luma 2x2 (4:2:0) by default; 2x1 leaves the chroma at full height
+    if (p->subsampling == JPEG_SUBSAMPLE_422) cinfo->comp_info[0].v_samp_factor = 1;
+}
+
+/**
+* @brief (Re)configure the compressor for an input format and size
+*
+* Does nothing when the format and size are unchanged, which is the steady
+* state: tables and band buffers are then reused as-is.
 *
 * @return 0 on success, -1 on failure
 */
-int convert_rgb_to_jpeg(const struct rgb_frame *rgb,
-                        struct jpeg_frame *jpeg)
+static int encoder_configure(struct jpeg_encoder *enc, enum encoder_input input,
+                             unsigned int width, unsigned int height)
 {
-    struct jpeg_compress_struct cinfo;      // main JPEG compression object
-    struct jpeg_error_mgr jerr;             // Error manager struct used by libjpeg
+    if (enc->input == input && enc->width == width && enc->height == height) return 0;
+
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    cinfo->input_components = 3;
+    cinfo->in_color_space = (input == INPUT_RGB) ? JCS_RGB : JCS_YCbCr;
 
-    // Link cinfo compression object to libjpeg internal error-handling system
-    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, enc->quality, TRUE);
+    apply_profile(enc);
 
-    // 1. Initializes the compressor, allocate internal memory and prep cinfo for compression
-    jpeg_create_compress(&cinfo);        
+    if (input == INPUT_YUYV) {
+        // Feed the planes as-is: Y at full resolution, chroma 4:2:0 or 4:2:2
+        enc->v_samp = cinfo->comp_info[0].v_samp_factor;
+        cinfo->raw_data_in = TRUE;
+        cinfo->comp_info[0].h_samp_factor = 2;
+        cinfo->comp_info[0].v_samp_factor = enc->v_samp;
+        cinfo->comp_info[1].h_samp_factor = 1;
+        cinfo->comp_info[1].v_samp_factor = 1;
+        cinfo->comp_info[2].h_samp_factor = 1;
+        cinfo->comp_info[2].v_samp_factor = 1;
 
-    // 2. Set output destination to memory buffer
-    jpeg_mem_dest(&cinfo, &jpeg->data, &jpeg->size);
+        // Band buffers: one MCU row of each plane
+        const int luma_rows = DCTSIZE * enc->v_samp;
+        enc->padded_w = (width + 15) & ~15;
 
-    // 3. Image parameters
-    cinfo.image_width = rgb->width;
-    cinfo.image_height = rgb->height;
-    cinfo.input_components = 3;         // # of color components in input image (RGB = 3 channels)
-    cinfo.in_color_space = JCS_RGB;     // color space of input image (Input is RGB)
+        unsigned char *band = realloc(enc->band, (size_t)enc->padded_w * (luma_rows + DCTSIZE));
+        if (!band) return -1;
+        enc->band = band;
 
-    // 4. Default config
-    jpeg_set_defaults(&cinfo);          
-    jpeg_set_quality(&cinfo, 80, TRUE);         // 80 = good balance
+        for (int r = 0; r < luma_rows; r++) enc->y_rows[r] = band + (size_t)r * enc->padded_w;
+        for (int r = 0; r < DCTSIZE; r++) {
+            enc->cb_rows[r] = band + (size_t)(luma_rows + r) * enc->padded_w;
+            enc->cr_rows[r] = enc->cb_rows[r] + enc->padded_w / 2;
+        }
+    }
+
+    enc->input = input;
+    enc->width = width;
+    enc->height = height;
+    enc->high_water = 0;
+    return 0;
+}
+
+/**
+* @brief Make sure the output frame has a buffer of at least the hinted size
+*
+* @return 0 on success, -1 on failure
+*/
+static int reserve_output(struct jpeg_encoder *enc, struct jpeg_frame *out)
+{
+    unsigned long want = jpeg_encoder_output_hint(enc);
+    if (out->data && out->capacity >= want) return 0;
+
+    return frame_resize(out, want, 0);
+}
+
+/**
+* @brief Encode an RGB24 frame with a persistent encoder
+*
+* The compressed data is written into out->data, which is grown if needed.
+*
+* @param enc    Pointer to the encoder
+* @param rgb    Pointer to the source RGB frame
+* @param out    Destination frame (its buffer may be reused from a previous frame)
+*
+* @return 0 on success, -1 on failure
+*/
+int jpeg_encoder_encode_rgb(struct jpeg_encoder *enc, const struct rgb_frame *rgb,
+                            struct jpeg_frame *out)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
 
-    // Start compressor
-    jpeg_start_compress(&cinfo, TRUE);       // TRUE = write full Q-tables and Huffman tables
+    if (encoder_configure(enc, INPUT_RGB, rgb->width, rgb->height) < 0) return -1;
+    if (reserve_output(enc, out) < 0) return -1;
+
+    enc->out = out;
+    if (setjmp(enc->err.jmp)) {
+        jpeg_abort_compress(cinfo);     // Keeps the configuration for the next frame
+        return -1;
+    }
+
+    // Start compressor; abbreviated frames only carry tables not written before
+    jpeg_start_compress(cinfo, !enc->profile.abbreviated);
 
     // Each scanline is width * 3 bytes
-    while (cinfo.next_scanline < cinfo.image_height) {
+    while (cinfo->next_scanline < cinfo->image_height) {
 
         JSAMPROW row_pointer[1];
-        row_pointer[0] = &rgb->data[cinfo.next_scanline * rgb->width * 3];
+        row_pointer[0] = &rgb->data[cinfo->next_scanline * rgb->width * 3];
+
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+
+    // Finish compression; the compressor stays ready for the next frame
+    jpeg_finish_compress(cinfo);
+    return 0;
+}
+
+/**
+* @brief Encode a YUYV422 frame directly with a persistent encoder
+*
+* Skips the RGB intermediate entirely: the interleaved camera samples are
+* split into Y/Cb/Cr planes one MCU row at a time and passed to libjpeg's
+* raw-data interface. Chroma is sampled 4:2:0 unless the profile asks for
+* 4:2:2, the same layout jpeg_set_defaults() gives the RGB path, so frame
+* sizes stay unchanged. This removes a full-frame colorspace round trip and the RGB frame allocation.
+*
+* @param enc    Pointer to the encoder
+* @param yuyv   Pointer to the source YUYV422 frame
+* @param out    Destination frame (its buffer may be reused from a previous frame)
+*
+* @return 0 on success, -1 on failure
+*/
+int jpeg_encoder_encode_yuyv(struct jpeg_encoder *enc, const struct yuyv_frame *yuyv,
+                             struct jpeg_frame *out)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+    JSAMPARRAY planes[3] = { enc->y_rows, enc->cb_rows, enc->cr_rows };
+
+    if (yuyv->width < 2 || yuyv->height < 1) return -1;
+    if (encoder_configure(enc, INPUT_YUYV, yuyv->width, yuyv->height) < 0) return -1;
+    if (reserve_output(enc, out) < 0) return -1;
 
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    enc->out = out;
+    if (setjmp(enc->err.jmp)) {
+        jpeg_abort_compress(cinfo);
+        return -1;
     }
 
-    // Finish compression
-    jpeg_finish_compress(&cinfo);
+    jpeg_start_compress(cinfo, !enc->profile.abbreviated);
 
-    // Cleanup
-    jpeg_destroy_compress(&cinfo);
+    while (cinfo->next_scanline < cinfo->image_height) {
+        deinterleave_band(planes, yuyv->data, yuyv->width, yuyv->height,
+                          cinfo->next_scanline, enc->v_samp, enc->padded_w);
+        jpeg_write_raw_data(cinfo, planes, DCTSIZE * enc->v_samp);
+    }
 
+    jpeg_finish_compress(cinfo);
     return 0;
-}
\ No newline at end of file
+}
+
+/**
+* @brief Write the encoder's tables as a tables-only JPEG stream
+*
+* For clients of an abbreviated profile: they keep this stream and decode
+* every following frame with it. Every frame after the first one the
+* encoder produced (or after this call) leaves these tables out.
+*
+* @param enc    Pointer to the encoder (configured by a previous frame)
+* @param out    Destination frame
+*
+* @return 0 on success, -1 on failure
+*/
+int jpeg_encoder_write_tables(struct jpeg_encoder *enc, struct jpeg_frame *out)
+{
+    unsigned long high_water = enc->high_water;
+
+    if (enc->input == INPUT_NONE) return -1;
+    if (jpeg_frame_reserve(out, 4096) < 0) return -1;
+
+    enc->out = out;
+    if (setjmp(enc->err.jmp)) {
+        jpeg_abort_compress(&enc->cinfo);
+        return -1;
+    }
+
+    jpeg_suppress_tables(&enc->cinfo, FALSE);  // Only unsent tables would be written otherwise
+    jpeg_write_tables(&enc->cinfo);
+    enc->high_water = high_water;           // Not a frame: keep the size hint
+    return 0;
+}
+
+/**
+* @brief Huffman tables the encoder coded its last frame with
+*
+* With JPEG_HUFFMAN_OPTIMIZED these are the optimal tables of that frame,
+* which is how jpeg_huffman_train() derives its tables.
+*
+* @param enc    Pointer to the encoder
+* @param set    Receives the luma and chroma DC and AC tables
+*
+* @return void
+*/
+void jpeg_encoder_huffman(const struct jpeg_encoder *enc, struct jpeg_huffman_set *set)
+{
+    const struct jpeg_compress_struct *cinfo = &enc->cinfo;
+
+    memset(set, 0, sizeof(*set));
+    for (int t = 0; t < 2; t++) {
+        const JHUFF_TBL *dc = cinfo->dc_huff_tbl_ptrs[t];
+        const JHUFF_TBL *ac = cinfo->ac_huff_tbl_ptrs[t];
+
+        if (dc) {
+            memcpy(set->dc[t].bits, dc->bits, sizeof(set->dc[t].bits));
+            memcpy(set->dc[t].vals, dc->huffval, sizeof(set->dc[t].vals));
+        }
+        if (ac) {
+            memcpy(set->ac[t].bits, ac->bits, sizeof(set->ac[t].bits));
+            memcpy(set->ac[t].vals, ac->huffval, sizeof(set->ac[t].vals));
+        }
+    }
+}
+
+/**
+* @brief Encode RGB24 frame into JPEG format
+*
+* One-shot convenience wrapper: creates an encoder, compresses a single frame
+* and destroys it again. Long-running pipelines should keep a jpeg_encoder
+* instead, which avoids the per-frame setup and allocator churn.
+*
+* @param rgb   Pointer to the source RGB frame
+* @param jpeg  Pointer to the destination JPEG frame
+*
+* @return 0 on success, -1 on failure
+*/
+int convert_rgb_to_jpeg(const struct rgb_frame *rgb,
+                        struct jpeg_frame *jpeg)
+{
+    struct jpeg_encoder *enc = jpeg_encoder_create(JPEG_QUALITY);
+    if (!enc) return -1;
+
+    int ret = jpeg_encoder_encode_rgb(enc, rgb, jpeg);
+
+    jpeg_encoder_destroy(enc);
+    return ret;
+}
+
+/**
+* @brief Encode a YUYV422 frame directly into JPEG format
+*
+* One-shot convenience wrapper around jpeg_encoder_encode_yuyv().
+*
+* @param yuyv_data  Pointer to the YUYV422 pixel data
+* @param width      Frame width in pixels
+* @param height     Frame height in pixels
+* @param frame      Pointer to the destination JPEG frame
+*
+* @return 0 on success, -1 on failure
+*/
+int convert_yuyv_to_jpeg(unsigned char *yuyv_data,
+                         int width,
+                         int height,
+                         struct jpeg_frame *frame)
+{
+    if (!yuyv_data || !frame || width < 2 || height < 1) return -1;
+
+    struct yuyv_frame yuyv = {
+        .data = yuyv_data,
+        .width = width,
+        .height = height,
+        .size = (unsigned long)width * height * 2,
+        .dmabuf_fd = -1
+    };
+
+    struct jpeg_encoder *enc = jpeg_encoder_create(JPEG_QUALITY);
+    if (!enc) return -1;
+
+    int ret = jpeg_encoder_encode_yuyv(enc, &yuyv, frame);
+
+    jpeg_encoder_destroy(enc);
+    return ret;
+}
+
+/**
+* @brief Make sure a frame's buffer holds at least size bytes
+*
+* Existing contents are not preserved. Used by code that fills frames
+* without the encoder, e.g. camera-compressed passthrough frames.
+*
+* @param frame  Pointer to the JPEG frame
+* @param size   Required capacity in bytes
+*
+* @return 0 on success, -1 on failure
+*/
+int jpeg_frame_reserve(struct jpeg_frame *frame, unsigned long size)
+{
+    if (frame->data && frame->capacity >= size) return 0;
+    return frame_resize(frame, size, 0);
+}
+
+/**
+* @brief Take an additional reference to a JPEG frame
+*
+* Called by every party that keeps the frame beyond the current call, such as
+* each subscriber queue the frame is published to.
+*
+* @param frame  Pointer to the JPEG frame
+*
+* @return The same frame pointer, for convenience
+*/
+struct jpeg_frame *jpeg_frame_retain(struct jpeg_frame *frame)
+{
+    atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    return frame;
+}
+
+/**
+* @brief Drop a reference to a JPEG frame
+*
+* When the last reference is dropped, the frame is handed to its recycle
+* hook if it has one (pooled frames), otherwise the compressed data and the
+* frame container are freed.
+*
+* @param frame  Pointer to the JPEG frame (NULL is ignored)
+*
+* @return void
+*/
+void jpeg_frame_release(struct jpeg_frame *frame)
+{
+    if (!frame) return;
+
+    // acq_rel: the last holder must observe every write made by the others
+    if (atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        if (frame->recycle) {
+            frame->recycle(frame);
+            return;
+        }
+        if (!frame->borrowed) free(frame->data);
+        free(frame);
+    }
+}
@@ -7,17 +7,44 @@
 */
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Forward declare the capture buffer (camera.h) and trained tables (jpeg_huffman.h)
+struct buffer;
+struct jpeg_huffman_set;
+
+/**
+* @brief Pipeline timestamps of one frame (metrics_now() clock, ns; 0 = unknown)
+*
+* Set as the frame moves from the camera to the subscriber rings; the
+* per-client dequeue and write times are kept by each connection.
+*/
+struct frame_times {
+    uint64_t capture;       /**< Driver timestamp (v4l2_buffer.timestamp) */
+    uint64_t dequeue;       /**< VIDIOC_DQBUF returned */
+    uint64_t convert;       /**< Encoder input ready */
+    uint64_t encode;        /**< JPEG complete */
+    uint64_t publish;       /**< Pushed into the subscriber rings */
+};
 
 /**
 * @brief Container for a raw YUYV422 camera frame
 *
 * Represents a single frame captured from the camera in YUYV422 pixel format.
+* Frames straight from the camera also carry the capture buffer's DMABUF;
+* anything that keeps using the frame after the processing call returns must
+* take a reference with capture_buffer_retain().
 */
 struct yuyv_frame {
     unsigned char *data;    /**< Pointer to raw YUYV422 frame data */
     unsigned int width;     /**< Frame width in pixels */
     unsigned int height;    /**< Frame height in pixels */
     unsigned long size;     /**< Size in bytes (width * height * 2) */
+    int dmabuf_fd;          /**< DMABUF of the capture buffer for zero-copy import, or -1 */
+    struct buffer *capture; /**< Capture buffer to retain beyond the call, or NULL */
+    struct frame_times t;   /**< Capture and dequeue times (later stages unused) */
 };
 
 /**
@@ -34,12 +61,63 @@ struct rgb_frame {
 
 /**
 * @brief Container for a JPEG-compressed image frame
+*
+* A frame is encoded once and shared by every streaming client. Each holder
+* owns one reference; the frame is freed when the last reference is released,
+* or handed back to its pool through the recycle hook.
 */
 struct jpeg_frame {
     unsigned char* data;    /**< Pointer to JPEG-compressed image data */
     unsigned long size;     /**< Size of the JPEG data in bytes */
+    unsigned long capacity; /**< Allocated size of data; reused across frames */
+    bool borrowed;          /**< data is not heap memory owned by the frame (e.g. a pool slab) */
+    bool device_mem;        /**< data is a capture buffer mapped from the driver */
+    atomic_uint refcount;   /**< Number of outstanding references to this frame */
+    char part_head[96];     /**< Transport header formatted once and shared by all clients */
+    unsigned int part_head_len; /**< Valid bytes in part_head (0 = not formatted yet) */
+    char ws_head[10];       /**< WebSocket binary message header, formatted once like part_head */
+    unsigned int ws_head_len;   /**< Valid bytes in ws_head (0 = not formatted yet) */
+    void (*recycle)(struct jpeg_frame *frame); /**< Called instead of free() on last release, or NULL */
+    void *owner;            /**< Owner of the frame (e.g. its frame pool), used by recycle */
+    struct jpeg_frame *release_next; /**< Link of a deferred release list, used by its sole holder */
+    struct frame_times t;   /**< Pipeline timestamps, for latency metrics */
+};
+
+/** @brief Chroma resolution of the encoded frames. */
+enum jpeg_subsampling {
+    JPEG_SUBSAMPLE_420,     /**< Chroma halved both ways (smallest frames, the default) */
+    JPEG_SUBSAMPLE_422,     /**< Chroma halved horizontally only, as YUYV is captured */
+};
+
+/** @brief Huffman tables frames are coded with. */
+enum jpeg_huffman {
+    JPEG_HUFFMAN_STANDARD,  /**< Example tables of the JPEG standard (libjpeg default) */
+    JPEG_HUFFMAN_TRAINED,   /**< Fixed tables trained offline (jpeg_profile.tables) */
+    JPEG_HUFFMAN_OPTIMIZED, /**< Optimal tables for every frame (an extra pass per frame) */
+};
+
+/**
+* @brief Encoding choices beyond the quality, fixed when an encoder is created
+*
+* All-zero is the libjpeg default: 4:2:0, accurate integer DCT, no restart
+* markers, standard Huffman tables, full tables in every frame.
+*/
+struct jpeg_profile {
+    enum jpeg_subsampling subsampling;      /**< Chroma subsampling */
+    bool fast_dct;                          /**< JDCT_IFAST instead of JDCT_ISLOW */
+    unsigned int restart_rows;              /**< MCU rows between restart markers (0 = none) */
+    enum jpeg_huffman huffman;              /**< Huffman table choice */
+    const struct jpeg_huffman_set *tables;  /**< Trained tables (JPEG_HUFFMAN_TRAINED), kept by the caller */
+    bool abbreviated;                       /**< Leave out tables a client already has (jpeg_encoder_write_tables()) */
 };
 
+/**
+* @brief Persistent JPEG encoder (one per encoding thread).
+*
+* Opaque: wraps the libjpeg compressor, which is set up once and reused.
+*/
+struct jpeg_encoder;
+
 /** Function Prototypes */
 int convert_yuyv_to_rgb(const struct yuyv_frame *in,
                          struct rgb_frame *out);
@@ -49,5 +127,20 @@ int convert_yuyv_to_jpeg(unsigned char *yuyv_data,
                          int width,
                          int height,
                          struct jpeg_frame *frame);
+struct jpeg_encoder *jpeg_encoder_create(int quality);
+struct jpeg_encoder *jpeg_encoder_create_profile(int quality, const struct jpeg_profile *profile);
+void jpeg_encoder_destroy(struct jpeg_encoder *enc);
+unsigned long jpeg_encoder_output_hint(const struct jpeg_encoder *enc);
+int jpeg_encoder_encode_rgb(struct jpeg_encoder *enc,
+                            const struct rgb_frame *rgb,
+                            struct jpeg_frame *out);
+int jpeg_encoder_encode_yuyv(struct jpeg_encoder *enc,
+                             const struct yuyv_frame *yuyv,
+                             struct jpeg_frame *out);
+int jpeg_encoder_write_tables(struct jpeg_encoder *enc, struct jpeg_frame *out);
+void jpeg_encoder_huffman(const struct jpeg_encoder *enc, struct jpeg_huffman_set *set);
+int jpeg_frame_reserve(struct jpeg_frame *frame, unsigned long size);
+struct jpeg_frame *jpeg_frame_retain(struct jpeg_frame *frame);
+void jpeg_frame_release(struct jpeg_frame *frame);
 
 #endif  /* JPEG_ENCODER_H */
\ No newline at end of file
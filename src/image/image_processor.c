@@ -3,71 +3,586 @@
 * @brief Image processing stage of the camera streaming pipeline.
 *
 * This modules implements the core image processing pipeline used by the procuder thread.
+*
+* Besides the configured quality, a frame can be encoded in lower quality
+* tiers for clients whose rate controller stepped down. A tier is only
+* encoded while at least one client is in it.
+*
+* Likewise for resolution: the frame is halved once per rung of the
+* resolution ladder that has subscribers (and for the rungs between), and
+* each such rung is encoded and published on its own broadcaster. The full
+* size is skipped when only reduced rungs are watched.
 */
 
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
-#include <pthread.h>
-#include <semaphore.h>
+#include <string.h>
 
 #include "image_encoder.h"
+#include "mjpeg_frame.h"
 #include "camera/camera.h"
 #include "image_processor.h"
 #include "http/mjpeg_stream.h"
-#include "cb/circular_buffer.h"
+#include "broadcast/broadcaster.h"
+#include "mem/frame_pool.h"
+#include "encoder_pool.h"
+#include "hw_encoder.h"
+#include "motion.h"
+#include "ladder.h"
+#include "detection/detection.h"
+#include "metrics/metrics.h"
+
+/** @brief Quality of each tier, in percent of the configured quality. */
+static const int tier_scale[BROADCAST_TIERS] = { 100, 65, 40 };
+
+/** @brief Lowest quality a tier is scaled down to. */
+#define TIER_QUALITY_MIN    10
+
+/**
+* @brief Set the configured JPEG quality and derive the lower tiers from it
+*
+* @param pipe       Pointer to the pipeline context
+* @param quality    Quality of tier 0 (1-100)
+* @param n_tiers    Number of tiers to serve (clamped to 1 - BROADCAST_TIERS)
+*
+* @return void
+*/
+void pipeline_set_quality(struct pipeline_ctx *pipe, int quality, unsigned int n_tiers)
+{
+    if (n_tiers < 1) n_tiers = 1;
+    if (n_tiers > BROADCAST_TIERS) n_tiers = BROADCAST_TIERS;
+    pipe->n_tiers = n_tiers;
+
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        int q = quality * tier_scale[t] / 100;
+        pipe->tier_quality[t] = (t == 0 || q >= TIER_QUALITY_MIN) ? q : TIER_QUALITY_MIN;
+    }
+}
+
+/**
+* @brief Create one persistent encoder per served quality tier
+*
+* @param pipe   Pointer to the pipeline context (tier qualities)
+* @param enc    Encoder set to fill; unused tiers are set to NULL
+*
+* @return 0 on success, -1 on failure (nothing is left allocated)
+*/
+int image_encoders_create(const struct pipeline_ctx *pipe, struct jpeg_encoder *enc[BROADCAST_TIERS])
+{
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        enc[t] = NULL;
+        if (t >= pipe->n_tiers && t > 0) continue;
+
+        enc[t] = jpeg_encoder_create_profile(pipe->tier_quality[t], pipe->profile);
+        if (!enc[t]) {
+            image_encoders_destroy(enc);
+            return -1;
+        }
+    }
+    return 0;
+}
 
 /**
-* @brief Process a captured camera frame and enqueue it for streaming.
+* @brief Destroy an encoder set created by image_encoders_create()
+*
+* @param enc    Encoder set; every entry is reset to NULL
+*
+* @return void
+*/
+void image_encoders_destroy(struct jpeg_encoder *enc[BROADCAST_TIERS])
+{
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        jpeg_encoder_destroy(enc[t]);
+        enc[t] = NULL;
+    }
+}
+
+/**
+* @brief Encode one YUYV frame into a JPEG frame with the given encoder.
+*
+* Uses the hardware encoder when one is configured, falling back to
+* libjpeg for any frame it fails on. In software, encodes the raw YUYV
+* camera frame directly into JPEG format, with no RGB intermediate.
+* Shared by the producer thread and the encoder worker pool; each caller
+* passes the encoder it owns. The frame's convert and encode times are
+* set here and both stages recorded.
+*
+* @param enc    Encoder owned by the calling thread
+* @param yuyv   Pointer to the YUYV frame to encode
+* @param pipe   Pointer to the pipeline context (hardware encoder)
+* @param jpeg   Destination frame
+*
+* @return 0 on success, -1 on failure
+*/
+int image_encode_frame(struct jpeg_encoder *enc,
+                       const struct yuyv_frame *yuyv,
+                       struct pipeline_ctx *pipe,
+                       struct jpeg_frame *jpeg)
+{
+    jpeg->t = yuyv->t;
+    jpeg->t.convert = metrics_now();
+
+    // Hardware offload: no CPU spent on compression
+    if (pipe->hw && hw_encoder_encode(pipe->hw, yuyv, jpeg) == 0) goto done;
+
+    // YUYV -> JPEG (no RGB intermediate, no color conversion in libjpeg)
+    if (jpeg_encoder_encode_yuyv(enc, yuyv, jpeg) != 0) {
+        perror("Error converting YUYV to JPEG");
+        metrics_count(CNT_ENCODE_ERRORS, 1);
+        return -1;
+    }
+
+done:
+    jpeg->t.encode = metrics_now();
+    metrics_observe(STAGE_CONVERT, jpeg->t.dequeue, jpeg->t.convert);
+    metrics_observe(STAGE_ENCODE, jpeg->t.convert, jpeg->t.encode);
+    metrics_count(CNT_FRAMES_ENCODED, 1);
+    return 0;
+}
+
+/**
+* @brief Encode one YUYV frame in every quality tier that has clients
+*
+* Tier 0 goes through image_encode_frame(): the V4L2 M2M hardware encoder
+* when one is open, otherwise libjpeg fed the YUYV planes as raw data.
+* Lower tiers are always encoded by libjpeg from YUYV with the tier's
+* encoder. MJPEG passthrough frames never get here; mjpeg_processor()
+* publishes them as the camera compressed them. Shared by the producer
+* thread and the encoder workers.
+*
+* @param enc    Encoder set owned by the calling thread
+* @param yuyv   Pointer to the YUYV frame to encode
+* @param pipe   Pointer to the pipeline context
+* @param out    Filled with one pooled frame per encoded tier, NULL elsewhere
+*
+* @return 0 on success, -1 if tier 0 failed (out is then all NULL)
+*/
+int image_encode_tiers(struct jpeg_encoder *const enc[BROADCAST_TIERS],
+                       const struct yuyv_frame *yuyv,
+                       struct pipeline_ctx *pipe,
+                       struct jpeg_frame *out[BROADCAST_TIERS])
+{
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) out[t] = NULL;
+
+    out[0] = frame_pool_get_jpeg(pipe->pool);       // Pooled frame, caller's reference
+    if (!out[0]) return -1;
+
+    if (image_encode_frame(enc[0], yuyv, pipe, out[0]) != 0) {
+        jpeg_frame_release(out[0]);
+        out[0] = NULL;
+        return -1;
+    }
+
+    if (pipe->n_tiers < 2) return 0;
+
+    // Only the tiers somebody is watching; a failed variant falls back to a better tier
+    unsigned int mask = broadcaster_tier_mask(pipe->bus);
+    for (unsigned int t = 1; t < pipe->n_tiers; t++) {
+        if (!(mask & (1u << t)) || !enc[t]) continue;
+
+        out[t] = frame_pool_get_jpeg(pipe->pool);
+        if (out[t] && jpeg_encoder_encode_yuyv(enc[t], yuyv, out[t]) != 0) {
+            jpeg_frame_release(out[t]);
+            out[t] = NULL;
+        }
+        if (out[t]) out[t]->t = out[0]->t;      // Latency is tracked on tier 0
+    }
+    return 0;
+}
+
+/**
+* @brief Publish a set of tier variants and drop the caller's references
+*
+* With change detection the set is kept as pipe->last_out instead, so an
+* unchanged frame can be repeated in every tier (see image_repeat_tiers()).
+* Called from the producer, or by an encoder worker with the pool lock held.
+*
+* @param pipe   Pointer to the pipeline context holding the frame broadcaster
+* @param out    Variants filled by image_encode_tiers(); reset to NULL
+*
+* @return void
+*/
+void image_publish_tiers(struct pipeline_ctx *pipe, struct jpeg_frame *out[BROADCAST_TIERS])
+{
+    broadcaster_publish_tiers(pipe->bus, out);
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        if (pipe->motion) {
+            jpeg_frame_release(pipe->last_out[t]);
+            pipe->last_out[t] = out[t];         // The caller's reference moves here
+        } else {
+            jpeg_frame_release(out[t]);
+        }
+        out[t] = NULL;
+    }
+}
+
+/**
+* @brief Drop the tier set kept for repeats
+*
+* Called once the producer and the encoder workers have stopped, before the
+* frame pool is destroyed.
+*
+* @param pipe   Pointer to the pipeline context
+*
+* @return void
+*/
+void pipeline_release_frames(struct pipeline_ctx *pipe)
+{
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        jpeg_frame_release(pipe->last_out[t]);
+        pipe->last_out[t] = NULL;
+    }
+}
+
+/**
+* @brief Subscribers over every served resolution
+*
+* @param pipe   Pointer to the pipeline context
+*
+* @return Total subscriber count
+*/
+static unsigned int pipeline_subscribers(struct pipeline_ctx *pipe)
+{
+    return pipe->ladder ? ladder_subscribers(pipe->ladder) : broadcaster_subscriber_count(pipe->bus);
+}
+
+/**
+* @brief Decide whether the frame just captured needs processing
+*
+* Frames are encoded while a client is subscribed (streams, and stills
+* waiting for a fresh frame) or idling is disabled. Checked once per
+* captured frame, so encoding resumes with the first frame after a
+* subscriber appears. The detection stage consumes
+* frames of its own: with a detector the frame is still wanted, but
+* image_processor() stops after feeding it while pipe->idle is set.
+*
+* @param pipe   Pointer to the pipeline context (producer thread only)
+*
+* @return true to process the frame, false to drop it unprocessed
+*/
+bool pipeline_has_demand(struct pipeline_ctx *pipe)
+{
+    bool viewers = !pipe->idle_enabled || pipeline_subscribers(pipe) > 0;
+
+    if (viewers == pipe->idle) {
+        printf(viewers ? "image_processor: Viewer attached, encoding resumed\n"
+                       : "image_processor: Nobody watching, encoding paused\n");
+        pipe->idle = !viewers;
+    }
+    metrics_set_camera_gauge(pipe->cctx->opts.index, CAM_GAUGE_ENCODING, viewers);
+    return viewers || pipe->detector;
+}
+
+/**
+* @brief Copy an earlier JPEG into a fresh pooled frame stamped with this capture
+*
+* Clients and latency metrics see an ordinary new frame; a memcpy of the
+* compressed image costs a small fraction of encoding it.
+*
+* @param pipe   Pointer to the pipeline context
+* @param prev   JPEG to repeat
+* @param yuyv   The unchanged captured frame (timestamps only)
+*
+* @return The copy (caller's reference), or NULL if the pool ran dry
+*/
+static struct jpeg_frame *image_copy_frame(struct pipeline_ctx *pipe, const struct jpeg_frame *prev,
+                                           const struct yuyv_frame *yuyv)
+{
+    struct jpeg_frame *copy = frame_pool_get_jpeg(pipe->pool);
+    if (!copy) return NULL;
+
+    if (jpeg_frame_reserve(copy, prev->size) < 0) {
+        jpeg_frame_release(copy);
+        return NULL;
+    }
+    memcpy(copy->data, prev->data, prev->size);
+    copy->size = prev->size;
+    copy->t = yuyv->t;
+    copy->t.convert = copy->t.encode = metrics_now();
+    return copy;
+}
+
+/**
+* @brief Repeat the previous JPEG of a reduced-resolution rung
+*
+* Rungs are single quality and published from the producer, so the frame
+* the broadcaster holds is the one to repeat.
+*
+* @param pipe   Pointer to the pipeline context
+* @param bus    Broadcaster of the rung
+* @param yuyv   The unchanged captured frame (timestamps only)
+*
+* @return void
+*/
+static void image_repeat_frame(struct pipeline_ctx *pipe, struct broadcaster *bus,
+                               const struct yuyv_frame *yuyv)
+{
+    struct jpeg_frame *prev = broadcaster_latest(bus, 0);
+    if (!prev) return;
+
+    struct jpeg_frame *copy = image_copy_frame(pipe, prev, yuyv);
+    if (copy) broadcaster_publish(bus, copy);
+
+    jpeg_frame_release(copy);
+    jpeg_frame_release(prev);
+}
+
+/**
+* @brief Repeat the previously published full-size tier set
+*
+* Every tier gets a copy of its own last variant, so clients stepped down
+* to a lower tier stay there. With an encoder pool the repeat is skipped
+* while this camera still has frames queued or waiting for reordering:
+* those are older captures and must reach the clients first, and once they
+* are published the lane is idle (only this producer submits to it), so
+* pipe->last_out can be read without the pool lock.
+*
+* @param pipe   Pointer to the pipeline context (producer thread only)
+* @param yuyv   The unchanged captured frame (timestamps only)
+*
+* @return void
+*/
+static void image_repeat_tiers(struct pipeline_ctx *pipe, const struct yuyv_frame *yuyv)
+{
+    if (pipe->encoders && !encoder_pool_idle(pipe->encoders, pipe)) return;
+    if (!pipe->last_out[0]) return;
+
+    struct jpeg_frame *out[BROADCAST_TIERS] = { NULL };
+    for (unsigned int t = 0; t < BROADCAST_TIERS; t++) {
+        if (pipe->last_out[t]) out[t] = image_copy_frame(pipe, pipe->last_out[t], yuyv);
+    }
+    if (!out[0]) {
+        for (unsigned int t = 0; t < BROADCAST_TIERS; t++) jpeg_frame_release(out[t]);
+        return;
+    }
+    image_publish_tiers(pipe, out);
+}
+
+/**
+* @brief Decide whether a captured frame is worth encoding
+*
+* A frame is encoded when the scene changed since the last encoded frame,
+* or a new subscriber appeared (it should not wait for motion or a
+* keepalive). An unchanged frame is either replaced by a copy of the last
+* JPEG (MOTION_REUSE, and MOTION_SKIP once per keepalive interval) or not
+* published at all.
+*
+* @param pipe   Pointer to the pipeline context (producer thread only)
+* @param yuyv   Captured frame
+*
+* @return true to encode the frame, false if it has been dealt with
+*/
+static bool image_motion_gate(struct pipeline_ctx *pipe, const struct yuyv_frame *yuyv)
+{
+    struct motion_ctx *m = pipe->motion;
+    uint64_t now = yuyv->t.dequeue;
+
+    unsigned int subs = pipeline_subscribers(pipe);
+    bool new_viewer = subs > m->last_subs;
+    m->last_subs = subs;
+
+    if (motion_detect(m, yuyv->data, now) || new_viewer) {
+        motion_set_reference(m, yuyv->data);
+        m->last_sent_ns = now;
+        return true;
+    }
+
+    metrics_count(CNT_STATIC_FRAMES, 1);
+    if (m->opts.mode == MOTION_SKIP && now - m->last_sent_ns < m->opts.keepalive_ms * 1000000ULL) {
+        return false;
+    }
+
+    if (pipe->ladder) {
+        for (unsigned int i = 1; i < pipe->ladder->n_rungs; i++) {
+            struct broadcaster *bus = pipe->ladder->rungs[i].bus;
+            if (broadcaster_subscriber_count(bus) > 0) image_repeat_frame(pipe, bus, yuyv);
+        }
+    }
+    if (!pipe->ladder || broadcaster_subscriber_count(pipe->bus) > 0) image_repeat_tiers(pipe, yuyv);
+    m->last_sent_ns = now;
+    return false;
+}
+
+/**
+* @brief Encode and publish the reduced-resolution rungs that have subscribers
+*
+* Each rung is halved from the one above it, so the capture buffer is read
+* once and every further halving works on a quarter of the bytes. Rungs are
+* encoded on the producer thread in one quality at tier 0's level; a small
+* rung costs a fraction of the full-size encode.
+*
+* @param pipe   Pointer to the pipeline context (producer thread only)
+* @param yuyv   Captured frame (rung 0)
+*
+* @return void
+*/
+static void image_encode_rungs(struct pipeline_ctx *pipe, const struct yuyv_frame *yuyv)
+{
+    struct res_ladder *l = pipe->ladder;
+    bool watched[LADDER_MAX_RUNGS] = { false };
+    unsigned int deepest = 0;
+
+    for (unsigned int i = 1; i < l->n_rungs; i++) {
+        watched[i] = broadcaster_subscriber_count(l->rungs[i].bus) > 0;
+        if (watched[i]) deepest = i;
+    }
+
+    const unsigned char *src = yuyv->data;
+    for (unsigned int i = 1; i <= deepest; i++) {
+        struct res_rung *r = &l->rungs[i];
+
+        yuyv_halve(src, r->data, l->rungs[i - 1].width, l->rungs[i - 1].height);
+        src = r->data;
+        if (!watched[i]) continue;
+
+        struct yuyv_frame small = {
+            .data = r->data, .width = r->width, .height = r->height, .size = r->size,
+            .dmabuf_fd = -1, .t = yuyv->t,
+        };
+        struct jpeg_frame *jpeg = frame_pool_get_jpeg(pipe->pool);
+        if (!jpeg) continue;
+
+        jpeg->t = yuyv->t;
+        jpeg->t.convert = metrics_now();
+        metrics_observe(STAGE_SCALE, yuyv->t.dequeue, jpeg->t.convert);
+
+        if (jpeg_encoder_encode_yuyv(r->encoder, &small, jpeg) == 0) {
+            jpeg->t.encode = metrics_now();
+            metrics_count(CNT_RUNG_FRAMES, 1);
+            broadcaster_publish(r->bus, jpeg);
+        } else {
+            metrics_count(CNT_ENCODE_ERRORS, 1);
+        }
+        jpeg_frame_release(jpeg);
+    }
+}
+
+/**
+* @brief Process a captured camera frame and publish it for streaming.
 *
 * Performs the following pipeline stages:
-*   1. Convert a raw YUYV camera frame to RGB
-*   2. Encode the RGB frame into JPEG format
-*   3. Push the encoded frame into a shared circular buffer
-*   4. Signal frame availability to the consumer thread
+*   1. Encode the frame (see image_encode_frame()), either right here on the
+*      producer thread or, when an encoder worker pool is configured, on the
+*      next free worker
+*   2. Publish the encoded frame once to every subscribed client; the worker
+*      pool does this itself, in capture order
+*
+* Lower quality variants are encoded alongside while clients need them.
+* With change detection, frames of an unchanged scene skip both stages (see
+* image_motion_gate()). With object detection, frames are offered to the
+* detection mailbox first (at the inference rate, never waiting for it), and
+* the latest boxes can be drawn into the frame before it is encoded.
+* Reduced-resolution rungs are scaled and encoded before the full size (see
+* image_encode_rungs()).
+*
+* The frame is encoded only once regardless of the number of clients, using
+* a persistent encoder so no libjpeg state is rebuilt per frame.
+* The output buffer is pre-sized from the largest recent frame. The
+* producer's own reference is dropped after publishing, so the frame returns
+* to the frame pool as soon as the last subscriber is done with it. Frames
+* come from the pool: no heap traffic per frame.
 *
 * @note This function represents the producer stage of the producer-consumer streaming pipeline.
 *
 * @param yuyv   Pointer to the captured YUYV frame from the camera
-* @param cctx   Pointer to the camera context structure that holds all session state
-* @param sctx   Pointer to the stream structure context that holds stream sessions
-* @param pipe   Pointer to the pipeline context containing thread and synchronization primitives
+* @param pipe   Pointer to the pipeline context holding the frame broadcaster
 *
 * @return 0 on success, -1 on failure
 */
-int image_processor(struct yuyv_frame *yuyv, 
-                    struct camera_ctx *cctx, 
-                    struct stream_ctx *sctx,
-                    struct pipeline_ctx *pipe)
+int image_processor(struct yuyv_frame *yuyv, struct pipeline_ctx *pipe)
 { 
-    struct rgb_frame rgb = {0};                            // Stack-allocated RGB frame 
-    struct jpeg_frame *jpeg = calloc(1, sizeof(*jpeg));    // Heap-allocated JPEG frame
-    if (!jpeg) return -1;
-
-    // 1. YUYV -> RGB
-    if (convert_yuyv_to_rgb(yuyv, &rgb) != 0) {
-        perror("Error converting YUYV to RGB");
-        goto cleanup;
+    // Detection runs on its own thread; this only downscales into its mailbox
+    if (pipe->detector && detector_wants_frame(pipe->detector, yuyv->t.dequeue)) {
+        detector_submit(pipe->detector, yuyv);
     }
+    if (pipe->idle) return 0;                   // Fed the detector, nobody to encode for
 
-    // 2. RGB -> JPEG
-    if (convert_rgb_to_jpeg(&rgb, jpeg) != 0) {
-        perror("Error converting RGB to JPEG");
-        goto cleanup;
+    // Static scene: reuse the last JPEG or send nothing
+    if (pipe->motion && !image_motion_gate(pipe, yuyv)) return 0;
+
+    // Overlay after the change check, so drawn boxes never count as motion
+    if (pipe->detector && pipe->detector->opts.overlay) detector_draw(pipe->detector, yuyv);
+
+    // Smaller substreams first; the full size only if somebody watches it
+    if (pipe->ladder && pipe->ladder->n_rungs > 1) {
+        image_encode_rungs(pipe, yuyv);
+        if (pipe->idle_enabled && broadcaster_subscriber_count(pipe->bus) == 0) return 0;
     }
 
-    // 3. Push JPEG into circular buffer
-    pthread_mutex_lock(pipe->mutex);
-    cb_write(pipe->cb, jpeg);                        // overwrite allowed
-    pthread_mutex_unlock(pipe->mutex);
+    // Multi-core: the pool copies the frame (or holds a USERPTR pool buffer), so
+    // the capture slot can be requeued
+    if (pipe->encoders) return encoder_pool_submit(pipe->encoders, pipe, yuyv);
+
+    struct jpeg_frame *out[BROADCAST_TIERS];    // Pooled frames, producer references
 
-    sem_post(pipe->sem);                             // Signal frame availability
+    // 1. Encode on the producer thread
+    if (image_encode_tiers(pipe->encoder, yuyv, pipe, out) != 0) return -1;
 
-    free(rgb.data);
+    // 2. Fan the JPEGs out to every subscriber, then drop the producer references
+    image_publish_tiers(pipe, out);
     return 0;
+}
+
+/**
+* @brief Publish a frame the camera already compressed (MJPEG passthrough).
+*
+* No conversion and no libjpeg: the compressed frame goes to the clients as
+* it came from the driver.
+*   1. If the capture buffer is held and the frame carries its Huffman
+*      tables, the held buffer itself is published; it is requeued to the
+*      driver once the last client releases it (buffer-hold)
+*   2. Otherwise the frame is copied into a pooled frame, with the standard
+*      Huffman tables inserted if the camera left them out, and the capture
+*      buffer is given back immediately (copy-on-dequeue)
+*
+* @param data   Compressed frame in the capture buffer
+* @param len    Bytes used in the capture buffer
+* @param held   Held capture buffer wrapping data, or NULL if the caller
+*               requeues the buffer itself; ownership passes to this function
+* @param t      Capture and dequeue times of the frame
+* @param pipe   Pointer to the pipeline context holding the frame broadcaster
+*
+* @return 0 on success, -1 on failure
+*/
+int mjpeg_processor(const unsigned char *data,
+                    size_t len,
+                    struct jpeg_frame *held,
+                    const struct frame_times *t,
+                    struct pipeline_ctx *pipe)
+{
+    int dht = mjpeg_find_dht(data, len);
+    if (dht < 0) {
+        fprintf(stderr, "image_processor: Dropping corrupt MJPEG frame (%zu bytes)\n", len);
+        jpeg_frame_release(held);
+        return -1;
+    }
+
+    // No encoder stages: the frame is ready as soon as it is dequeued
+    if (held) {
+        held->t = *t;
+        held->t.convert = held->t.encode = t->dequeue;
+    }
+
+    // 1. Zero-copy: the capture buffer stays with the clients
+    if (held && dht) {
+        broadcaster_publish(pipe->bus, held);
+        jpeg_frame_release(held);
+        return 0;
+    }
+
+    // 2. Copy out (adding the Huffman tables if needed) and requeue the capture buffer
+    struct jpeg_frame *jpeg = frame_pool_get_jpeg(pipe->pool);
+    int ret = jpeg ? mjpeg_copy_frame(data, len, dht == 0, jpeg) : -1;
+    jpeg_frame_release(held);
+
+    if (ret == 0) {
+        jpeg->t = *t;
+        jpeg->t.convert = t->dequeue;
+        jpeg->t.encode = metrics_now();
+    }
 
-cleanup:
-    free(rgb.data);
-    free(jpeg);
-    return -1;
-}
\ No newline at end of file
+    if (ret == 0) broadcaster_publish(pipe->bus, jpeg);
+    jpeg_frame_release(jpeg);
+    return ret;
+}
@@ -6,35 +6,73 @@
 * @brief Image processing interface for the camera streaming pipeline.
 */
 
-#include <pthread.h>
-#include <semaphore.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "broadcast/broadcaster.h"
 
 // Forward declare structures
 struct camera_ctx;
 struct stream_ctx;
 struct yuyv_frame;
-struct rgb_frame;
 struct jpeg_frame;
-typedef struct CircularBuffer CircularBuffer;
+struct frame_times;
+struct jpeg_encoder;
+struct jpeg_profile;
+struct frame_pool;
+struct encoder_pool;
+struct hw_encoder;
+struct motion_ctx;
+struct detector;
+struct res_ladder;
 
 /**
 * @brief Pipeline context for the producer-consumer image pipeline.
 *
-* Holds references to the circular buffer, synchronization primitives, and 
-* associated camera and streaming contexts used in the threads.
+* Holds references to the frame broadcaster and the associated camera and
+* streaming contexts used in the threads. The encoders are owned by the
+* producer thread and live for the whole capture session: one per quality
+* tier, since libjpeg quantization tables are fixed per encoder.
 */
 typedef struct pipeline_ctx {
-    CircularBuffer *cb;             /**< Pointer to the shared circular buffer */
-    pthread_mutex_t *mutex;         /**< Mutex protecting access to the buffer */
-    sem_t *sem;                     /**< Counting semaphore for frame availability */           
+    struct broadcaster *bus;        /**< Fan-out of encoded frames to all clients */
+    bool idle_enabled;              /**< Skip all processing while nothing consumes frames */
+    bool idle;                      /**< Currently idling (producer thread only) */
+    struct jpeg_encoder *encoder[BROADCAST_TIERS];  /**< Persistent JPEG encoders of the producer thread */
+    unsigned int n_tiers;           /**< Quality tiers encoded on demand (1 = single quality) */
+    int tier_quality[BROADCAST_TIERS];  /**< JPEG quality of each tier */
+    const struct jpeg_profile *profile; /**< Software encoding profile, or NULL for the defaults */
+    struct frame_pool *pool;        /**< Preallocated JPEG frames */
+    struct encoder_pool *encoders;  /**< Encoder worker pool shared by every camera, or NULL to encode on the producer */
+    struct hw_encoder *hw;          /**< Hardware JPEG encoder (producer thread only), or NULL */
+    struct motion_ctx *motion;      /**< Change detection gating the encoder, or NULL */
+    struct jpeg_frame *last_out[BROADCAST_TIERS];   /**< Tier set published last, kept for repeats (with motion only) */
+    struct detector *detector;      /**< Object detection fed from the producer, or NULL */
+    struct res_ladder *ladder;      /**< Reduced-resolution substreams, or NULL for full size only */
     struct camera_ctx *cctx;        /**< Pointer to the camera context */
     struct stream_ctx *sctx;        /**< Pointer to the streaming context */
 } pipeline_ctx;
 
 /** Function prototypes */
-int image_processor(struct yuyv_frame *yuyv, 
-                    struct camera_ctx *cctx, 
-                    struct stream_ctx *sctx,
+bool pipeline_has_demand(struct pipeline_ctx *pipe);
+void pipeline_set_quality(struct pipeline_ctx *pipe, int quality, unsigned int n_tiers);
+int image_encoders_create(const struct pipeline_ctx *pipe, struct jpeg_encoder *enc[BROADCAST_TIERS]);
+void image_encoders_destroy(struct jpeg_encoder *enc[BROADCAST_TIERS]);
+int image_encode_frame(struct jpeg_encoder *enc,
+                       const struct yuyv_frame *yuyv,
+                       struct pipeline_ctx *pipe,
+                       struct jpeg_frame *jpeg);
+int image_encode_tiers(struct jpeg_encoder *const enc[BROADCAST_TIERS],
+                       const struct yuyv_frame *yuyv,
+                       struct pipeline_ctx *pipe,
+                       struct jpeg_frame *out[BROADCAST_TIERS]);
+void image_publish_tiers(struct pipeline_ctx *pipe, struct jpeg_frame *out[BROADCAST_TIERS]);
+void pipeline_release_frames(struct pipeline_ctx *pipe);
+int image_processor(struct yuyv_frame *yuyv, struct pipeline_ctx *pipe);
+int mjpeg_processor(const unsigned char *data,
+                    size_t len,
+                    struct jpeg_frame *held,
+                    const struct frame_times *t,
                     struct pipeline_ctx *pipe);
 
 #endif      /* IMAGE_PROCESSOR_H */
\ No newline at end of file
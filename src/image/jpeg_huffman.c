@@ -0,0 +1,377 @@
+/**
+* @file jpeg_huffman.c
+* @brief Huffman tables trained offline from recorded scenes, and their file format.
+*
+* The standard tables libjpeg codes with by default were derived from a
+* generic image set; tables that fit what a fixed camera actually sees code
+* the same coefficients in fewer bytes, at no cost per frame. Per-frame
+* optimal tables (optimize_coding) save a little more but need a second
+* pass over every frame.
+*
+* Training encodes a stack of recorded frames as one tall image with
+* optimal tables, so the symbol statistics of all of them are combined.
+* Symbols the training frames never produced still get a (long) code,
+* otherwise a frame unlike the training set could not be encoded at all.
+*
+* The tables are stored as text, one line per table:
+*
+*     dc0 <16 code counts by length> : <symbols>
+*
+* for dc0, ac0 (luma) and dc1, ac1 (chroma); '#' lines are comments.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <jpeglib.h>
+
+#include "jpeg_huffman.h"
+#include "image_encoder.h"
+
+/** @brief Longest code the construction below produces before limiting to 16 bits. */
+#define CODE_LEN_MAX        32
+
+/** @brief Largest DC difference category of 8-bit samples. */
+#define DC_CATEGORY_MAX     11
+
+/** @brief Largest AC coefficient size category of 8-bit samples. */
+#define AC_SIZE_MAX         10
+
+/** @brief Names of the tables in file order. */
+static const char *const table_names[4] = { "dc0", "ac0", "dc1", "ac1" };
+
+/**
+* @brief Whether a symbol can occur in a DC or AC table of 8-bit frames
+*/
+static bool symbol_valid(int sym, bool ac)
+{
+    if (!ac) return sym <= DC_CATEGORY_MAX;
+    if (sym == 0x00 || sym == 0xF0) return true;        // End of block, run of 16 zeros
+    return (sym & 0x0F) >= 1 && (sym & 0x0F) <= AC_SIZE_MAX;
+}
+
+/**
+* @brief Table of a set by file index (dc0, ac0, dc1, ac1)
+*/
+static struct jpeg_huffman_table *set_table(struct jpeg_huffman_set *set, int i)
+{
+    return (i & 1) ? &set->ac[i / 2] : &set->dc[i / 2];
+}
+
+/**
+* @brief Build a length-limited Huffman table from symbol frequencies
+*
+* The procedure of JPEG Annex K.2, as libjpeg's optimize_coding uses it: one
+* code point is reserved so no code is all ones, and codes longer than 16
+* bits are folded back into shorter lengths.
+*
+* @param freq   Frequency of every symbol (0 = no code); clobbered
+* @param table  Receives the code counts and symbols
+*
+* @return void
+*/
+static void build_table(long freq[257], struct jpeg_huffman_table *table)
+{
+    int codesize[257] = { 0 };
+    int others[257];
+    int bits[CODE_LEN_MAX + 1] = { 0 };
+
+    for (int i = 0; i < 257; i++) others[i] = -1;
+    freq[256] = 1;                              // Reserved code point
+
+    for (;;) {
+        int c1 = -1, c2 = -1;
+        long v = 1000000000L;
+
+        // Two least frequent symbols (on ties, the larger one first)
+        for (int i = 0; i <= 256; i++) {
+            if (freq[i] && freq[i] <= v) {
+                v = freq[i];
+                c1 = i;
+            }
+        }
+        v = 1000000000L;
+        for (int i = 0; i <= 256; i++) {
+            if (freq[i] && freq[i] <= v && i != c1) {
+                v = freq[i];
+                c2 = i;
+            }
+        }
+        if (c2 < 0) break;
+
+        // Merge the two trees, one bit deeper each
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+
+        codesize[c1]++;
+        while (others[c1] >= 0) {
+            c1 = others[c1];
+            codesize[c1]++;
+        }
+        others[c1] = c2;
+
+        codesize[c2]++;
+        while (others[c2] >= 0) {
+            c2 = others[c2];
+            codesize[c2]++;
+        }
+    }
+
+    for (int i = 0; i <= 256; i++) {
+        if (codesize[i]) bits[codesize[i]]++;
+    }
+
+    // Limit code lengths to 16 bits
+    for (int i = CODE_LEN_MAX; i > 16; i--) {
+        while (bits[i] > 0) {
+            int j = i - 2;
+            while (bits[j] == 0) j--;
+            bits[i] -= 2;
+            bits[i - 1]++;
+            bits[j + 1] += 2;
+            bits[j]--;
+        }
+    }
+
+    // Give back the reserved code point (the longest code)
+    int longest = 16;
+    while (bits[longest] == 0) longest--;
+    bits[longest]--;
+
+    memset(table, 0, sizeof(*table));
+    for (int i = 1; i <= 16; i++) table->bits[i] = (uint8_t)bits[i];
+
+    int p = 0;
+    for (int len = 1; len <= CODE_LEN_MAX; len++) {
+        for (int sym = 0; sym < 256; sym++) {
+            if (codesize[sym] == len) table->vals[p++] = (uint8_t)sym;
+        }
+    }
+}
+
+/**
+* @brief Give every valid symbol a code, keeping the relative code lengths
+*
+* Symbols with a code keep a weight of 2^(17 - length); the others get a
+* weight of 1, so they end up with the longest codes and cost nothing in
+* frames like the training set.
+*
+* @param table  Table to complete in place
+* @param ac     Whether it is an AC table
+*
+* @return void
+*/
+static void complete_table(struct jpeg_huffman_table *table, bool ac)
+{
+    long freq[257] = { 0 };
+    int p = 0;
+
+    for (int len = 1; len <= 16; len++) {
+        for (int k = 0; k < table->bits[len]; k++) freq[table->vals[p++]] = 1L << (17 - len);
+    }
+    for (int sym = 0; sym < 256; sym++) {
+        if (!symbol_valid(sym, ac)) freq[sym] = 0;
+        else if (!freq[sym]) freq[sym] = 1;
+    }
+
+    build_table(freq, table);
+}
+
+/**
+* @brief Check that a table is a valid prefix code covering every symbol
+*
+* @return true if frames can be encoded with the table
+*/
+static bool table_usable(const struct jpeg_huffman_table *table, bool ac)
+{
+    bool seen[256] = { false };
+    unsigned int count = 0;
+    unsigned long code = 0;
+
+    for (int len = 1; len <= 16; len++) {
+        count += table->bits[len];
+        code += table->bits[len];
+        if (code >= (1UL << len)) return false; // Too many codes, or one of all ones
+        code <<= 1;
+    }
+    if (count > 256) return false;
+
+    for (unsigned int i = 0; i < count; i++) seen[table->vals[i]] = true;
+    for (int sym = 0; sym < 256; sym++) {
+        if (symbol_valid(sym, ac) && !seen[sym]) return false;
+    }
+    return true;
+}
+
+/**
+* @brief Train Huffman tables on recorded frames
+*
+* Up to JPEG_TRAIN_MAX_FRAMES frames (fewer if the stack would exceed the
+* largest JPEG height) are stacked and encoded once with optimal tables, in
+* the given quality and profile; the resulting tables are completed so any
+* frame can be coded with them.
+*
+* @param frames     Training frames, all of the same size
+* @param n_frames   Number of frames
+* @param quality    JPEG quality the tables are trained for
+* @param profile    Profile the tables will be used with (NULL = defaults)
+* @param set        Receives the trained tables
+*
+* @return 0 on success, -1 on failure
+*/
+int jpeg_huffman_train(const struct yuyv_frame *frames, unsigned int n_frames, int quality,
+                       const struct jpeg_profile *profile, struct jpeg_huffman_set *set)
+{
+    if (n_frames == 0 || frames[0].width < 2 || frames[0].height < 1) return -1;
+
+    unsigned int max_frames = JPEG_MAX_DIMENSION / frames[0].height;
+    if (n_frames > max_frames) n_frames = max_frames;
+    if (n_frames > JPEG_TRAIN_MAX_FRAMES) n_frames = JPEG_TRAIN_MAX_FRAMES;
+    if (n_frames == 0) return -1;
+
+    struct jpeg_profile train = { 0 };
+    if (profile) train = *profile;
+    train.huffman = JPEG_HUFFMAN_OPTIMIZED;
+    train.tables = NULL;
+    train.abbreviated = false;
+
+    size_t frame_size = (size_t)frames[0].width * frames[0].height * 2;
+    struct yuyv_frame stack = {
+        .width = frames[0].width,
+        .height = frames[0].height * n_frames,
+        .size = frame_size * n_frames,
+        .dmabuf_fd = -1,
+    };
+    struct jpeg_frame out = { 0 };
+    struct jpeg_encoder *enc = jpeg_encoder_create_profile(quality, &train);
+
+    stack.data = malloc(stack.size);
+    if (!enc || !stack.data) {
+        fprintf(stderr, "jpeg_huffman: Failed to allocate %u training frames\n", n_frames);
+        jpeg_encoder_destroy(enc);
+        free(stack.data);
+        return -1;
+    }
+    for (unsigned int i = 0; i < n_frames; i++) {
+        memcpy(stack.data + frame_size * i, frames[i].data, frame_size);
+    }
+
+    int ret = jpeg_encoder_encode_yuyv(enc, &stack, &out);
+    if (ret == 0) {
+        jpeg_encoder_huffman(enc, set);
+        for (int i = 0; i < 4; i++) complete_table(set_table(set, i), i & 1);
+        printf("jpeg_huffman: Trained on %u frames of %ux%u\n", n_frames, stack.width, frames[0].height);
+    }
+
+    jpeg_encoder_destroy(enc);
+    free(stack.data);
+    free(out.data);
+    return ret;
+}
+
+/**
+* @brief Load trained tables from a file
+*
+* @param path   Table file written by jpeg_huffman_save()
+* @param set    Receives the tables
+*
+* @return 0 on success, -1 if the file is missing, malformed or a table
+*         cannot code every symbol
+*/
+int jpeg_huffman_load(const char *path, struct jpeg_huffman_set *set)
+{
+    FILE *f = fopen(path, "r");
+    char line[2048];
+    unsigned int loaded = 0;
+
+    if (!f) {
+        perror("jpeg_huffman: Failed to open table file");
+        return -1;
+    }
+
+    memset(set, 0, sizeof(*set));
+    while (fgets(line, sizeof(line), f)) {
+        char name[8];
+        int pos;
+
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "%7s%n", name, &pos) != 1) continue;
+
+        int t = 0;
+        while (t < 4 && strcmp(name, table_names[t]) != 0) t++;
+        if (t == 4) break;
+
+        struct jpeg_huffman_table *table = set_table(set, t);
+        char *p = line + pos, *end;
+        unsigned int count = 0;
+
+        for (int len = 1; len <= 16; len++) {
+            unsigned long n = strtoul(p, &end, 10);
+            if (end == p || n > 255) goto malformed;
+            table->bits[len] = (uint8_t)n;
+            count += n;
+            p = end;
+        }
+        while (*p == ' ') p++;
+        if (*p++ != ':' || count > 256) goto malformed;
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned long v = strtoul(p, &end, 10);
+            if (end == p || v > 255) goto malformed;
+            table->vals[i] = (uint8_t)v;
+            p = end;
+        }
+        if (!table_usable(table, t & 1)) goto malformed;
+        loaded |= 1U << t;
+    }
+    fclose(f);
+
+    if (loaded != 0xF) {
+        fprintf(stderr, "jpeg_huffman: %s does not hold all four tables\n", path);
+        return -1;
+    }
+    return 0;
+
+malformed:
+    fprintf(stderr, "jpeg_huffman: Malformed or incomplete table in %s\n", path);
+    fclose(f);
+    return -1;
+}
+
+/**
+* @brief Write tables to a file
+*
+* @param path   Destination file
+* @param set    Tables to store
+*
+* @return 0 on success, -1 on failure
+*/
+int jpeg_huffman_save(const char *path, const struct jpeg_huffman_set *set)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror("jpeg_huffman: Failed to create table file");
+        return -1;
+    }
+
+    fprintf(f, "# Huffman tables: code counts for lengths 1-16 : symbols\n");
+    for (int t = 0; t < 4; t++) {
+        const struct jpeg_huffman_table *table = set_table((struct jpeg_huffman_set *)set, t);
+        unsigned int count = 0;
+
+        fprintf(f, "%s", table_names[t]);
+        for (int len = 1; len <= 16; len++) {
+            fprintf(f, " %u", table->bits[len]);
+            count += table->bits[len];
+        }
+        fprintf(f, " :");
+        for (unsigned int i = 0; i < count; i++) fprintf(f, " %u", table->vals[i]);
+        fprintf(f, "\n");
+    }
+
+    if (fclose(f) != 0) {
+        perror("jpeg_huffman: Failed to write table file");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef JPEG_HUFFMAN_H
+#define JPEG_HUFFMAN_H
+
+/**
+* @file jpeg_huffman.h
+* @brief Huffman tables trained offline from recorded scenes, and their file format.
+*/
+
+#include <stdint.h>
+
+struct yuyv_frame;
+struct jpeg_profile;
+
+/** @brief Most frames stacked into one training image. */
+#define JPEG_TRAIN_MAX_FRAMES   16
+
+/**
+* @brief One Huffman table in the form of a JPEG DHT segment
+*/
+struct jpeg_huffman_table {
+    uint8_t bits[17];               /**< bits[n]: number of codes of length n (bits[0] unused) */
+    uint8_t vals[256];              /**< Symbols in order of increasing code length */
+};
+
+/**
+* @brief Every table a YCbCr frame is coded with: index 0 luma, 1 chroma
+*/
+struct jpeg_huffman_set {
+    struct jpeg_huffman_table dc[2];    /**< DC difference tables */
+    struct jpeg_huffman_table ac[2];    /**< AC run/size tables */
+};
+
+/** Function prototypes */
+int jpeg_huffman_train(const struct yuyv_frame *frames, unsigned int n_frames, int quality,
+                       const struct jpeg_profile *profile, struct jpeg_huffman_set *set);
+int jpeg_huffman_load(const char *path, struct jpeg_huffman_set *set);
+int jpeg_huffman_save(const char *path, const struct jpeg_huffman_set *set);
+
+#endif  // JPEG_HUFFMAN_H
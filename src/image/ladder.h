@@ -0,0 +1,61 @@
+#ifndef LADDER_H
+#define LADDER_H
+
+/**
+* @file ladder.h
+* @brief Resolution ladder: reduced-size substreams of one capture.
+*/
+
+#include <stddef.h>
+
+// Forward declare structures
+struct broadcaster;
+struct jpeg_encoder;
+struct jpeg_profile;
+
+/** @brief Most rungs a ladder can have (full, 1/2, 1/4). */
+#define LADDER_MAX_RUNGS    3
+
+/** @brief Smallest rung width or height worth encoding. */
+#define LADDER_MIN_SIZE     32
+
+/**
+* @brief One resolution of the ladder.
+*
+* Rung 0 is the captured frame itself, published on the main broadcaster.
+* Every further rung halves the previous one in both directions and has its
+* own broadcaster, so clients subscribe to the size they want and a rung is
+* only scaled and encoded while somebody is subscribed to it.
+*/
+struct res_rung {
+    unsigned int width;             /**< Width in pixels */
+    unsigned int height;            /**< Height in pixels */
+    struct broadcaster *bus;        /**< Subscribers of this size */
+    unsigned char *data;            /**< Downscaled YUYV422 frame (NULL for rung 0) */
+    unsigned long size;             /**< Bytes in data */
+    struct jpeg_encoder *encoder;   /**< Persistent encoder of this size (NULL for rung 0) */
+};
+
+/**
+* @brief Every resolution served from one capture.
+*
+* The rungs are set up once; the producer thread fills and encodes them,
+* the network thread only reads the sizes and broadcasters.
+*/
+struct res_ladder {
+    unsigned int n_rungs;                       /**< Valid entries in rungs (at least 1) */
+    struct res_rung rungs[LADDER_MAX_RUNGS];    /**< Full size first, then each half */
+};
+
+/** Function prototypes */
+int ladder_init(struct res_ladder *l, struct broadcaster *full, unsigned int width,
+                unsigned int height, unsigned int n_rungs, int quality,
+                const struct jpeg_profile *profile);
+void ladder_destroy(struct res_ladder *l);
+struct broadcaster *ladder_find(const struct res_ladder *l, unsigned int width, unsigned int height);
+unsigned int ladder_subscribers(const struct res_ladder *l);
+void yuyv_halve_scalar(const unsigned char *src, unsigned char *dst, unsigned int width,
+                       unsigned int height);
+void yuyv_halve(const unsigned char *src, unsigned char *dst, unsigned int width, unsigned int height);
+
+#endif  /* LADDER_H */
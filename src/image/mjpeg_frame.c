@@ -0,0 +1,149 @@
+/**
+* @file mjpeg_frame.c
+* @brief Helpers for frames the camera delivers already JPEG-compressed.
+*
+* UVC cameras in MJPEG mode usually omit the Huffman tables from every frame
+* (the "AVI1" convention) and rely on the decoder to assume the standard
+* tables of ITU-T T.81 Annex K.3. Browsers do not, so such frames get the
+* standard DHT segment inserted right after SOI before being served.
+*
+* The DHT segment is serialized once from libjpeg's own default tables, so
+* it is byte-identical to what the software encoder would write.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <jpeglib.h>
+
+#include "mjpeg_frame.h"
+#include "image_encoder.h"
+
+/** @brief JPEG markers inspected while scanning a frame. */
+#define JPEG_MARKER_SOI     0xD8
+#define JPEG_MARKER_DHT     0xC4
+#define JPEG_MARKER_SOS     0xDA
+#define JPEG_MARKER_TEM     0x01
+#define JPEG_MARKER_RST0    0xD0
+#define JPEG_MARKER_RST7    0xD7
+
+/** @brief Standard DHT segment (marker included), built on first use. */
+static unsigned char std_dht[MJPEG_DHT_SIZE];
+static pthread_once_t std_dht_once = PTHREAD_ONCE_INIT;
+
+/**
+* @brief Append one Huffman table to the DHT segment being built
+*
+* @return New write offset
+*/
+static size_t put_huff_table(unsigned char *p, size_t off, int tc_th, const JHUFF_TBL *tbl)
+{
+    int nvals = 0;
+
+    p[off++] = (unsigned char)tc_th;
+    for (int i = 1; i <= 16; i++) {
+        p[off++] = tbl->bits[i];
+        nvals += tbl->bits[i];
+    }
+    memcpy(p + off, tbl->huffval, nvals);
+    return off + nvals;
+}
+
+/**
+* @brief Serialize libjpeg's standard luma/chroma DC/AC tables into std_dht
+*/
+static void build_std_dht(void)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    cinfo.in_color_space = JCS_YCbCr;
+    cinfo.input_components = 3;
+    jpeg_set_defaults(&cinfo);      // Installs the Annex K.3 tables
+
+    size_t off = 4;
+    off = put_huff_table(std_dht, off, 0x00, cinfo.dc_huff_tbl_ptrs[0]);
+    off = put_huff_table(std_dht, off, 0x10, cinfo.ac_huff_tbl_ptrs[0]);
+    off = put_huff_table(std_dht, off, 0x01, cinfo.dc_huff_tbl_ptrs[1]);
+    off = put_huff_table(std_dht, off, 0x11, cinfo.ac_huff_tbl_ptrs[1]);
+
+    std_dht[0] = 0xFF;
+    std_dht[1] = JPEG_MARKER_DHT;
+    std_dht[2] = (unsigned char)((off - 2) >> 8);
+    std_dht[3] = (unsigned char)((off - 2) & 0xFF);
+
+    jpeg_destroy_compress(&cinfo);
+}
+
+/**
+* @brief Check whether a JPEG frame carries its own Huffman tables
+*
+* Walks the marker segments from SOI up to the first SOS.
+*
+* @param data   Compressed frame
+* @param len    Frame length in bytes
+*
+* @return 1 if a DHT segment precedes the scan, 0 if not, -1 if the data is not a JPEG
+*/
+int mjpeg_find_dht(const unsigned char *data, size_t len)
+{
+    if (len < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI) return -1;
+
+    size_t p = 2;
+    while (p + 4 <= len) {
+        if (data[p] != 0xFF) return -1;
+
+        unsigned char marker = data[p + 1];
+        if (marker == 0xFF) {           // Fill byte
+            p++;
+            continue;
+        }
+        if (marker == JPEG_MARKER_DHT) return 1;
+        if (marker == JPEG_MARKER_SOS) return 0;
+
+        // Standalone markers have no length field
+        if (marker == JPEG_MARKER_TEM || (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7)) {
+            p += 2;
+            continue;
+        }
+
+        p += 2 + (((size_t)data[p + 2] << 8) | data[p + 3]);
+    }
+    return -1;
+}
+
+/**
+* @brief Copy a camera frame into a JPEG frame, optionally adding the standard DHT
+*
+* @param data       Compressed frame from the camera
+* @param len        Frame length in bytes
+* @param insert_dht Insert the standard Huffman tables after SOI
+* @param out        Destination frame (grown if needed)
+*
+* @return 0 on success, -1 on failure
+*/
+int mjpeg_copy_frame(const unsigned char *data, size_t len, bool insert_dht,
+                     struct jpeg_frame *out)
+{
+    size_t extra = insert_dht ? MJPEG_DHT_SIZE : 0;
+
+    if (len < 2) return -1;
+    if (jpeg_frame_reserve(out, len + extra) < 0) return -1;
+
+    if (!insert_dht) {
+        memcpy(out->data, data, len);
+        out->size = len;
+        return 0;
+    }
+
+    pthread_once(&std_dht_once, build_std_dht);
+
+    // SOI, then the tables, then the rest of the frame unchanged
+    memcpy(out->data, data, 2);
+    memcpy(out->data + 2, std_dht, MJPEG_DHT_SIZE);
+    memcpy(out->data + 2 + MJPEG_DHT_SIZE, data + 2, len - 2);
+    out->size = len + extra;
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef MJPEG_FRAME_H
+#define MJPEG_FRAME_H
+
+/**
+* @file mjpeg_frame.h
+* @brief Helpers for frames the camera delivers already JPEG-compressed.
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Forward declare the JPEG frame struct
+struct jpeg_frame;
+
+/** @brief Size of the standard Huffman table (DHT) segment added to MJPEG frames. */
+#define MJPEG_DHT_SIZE      420
+
+/** Function prototypes */
+int mjpeg_find_dht(const unsigned char *data, size_t len);
+int mjpeg_copy_frame(const unsigned char *data, size_t len, bool insert_dht,
+                     struct jpeg_frame *out);
+
+#endif  // MJPEG_FRAME_H
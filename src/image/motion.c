@@ -0,0 +1,310 @@
+/**
+* @file motion.c
+* @brief Cheap change detection gating the JPEG encoder.
+*
+* Every MOTION_ROW_STEP-th row of each watched region is sampled, taking the
+* first Y of every YUYV pixel pair, so a 640x480 frame costs 38400 byte
+* compares and touches a quarter of the capture buffer. The samples are
+* compared with those of the last encoded frame by a sum of absolute
+* differences (16 samples per iteration with NEON). A region scores its
+* mean absolute difference in grey levels; the frame changed if any region
+* reaches the threshold. A change keeps the scene "active" for
+* MOTION_HOLD_NS so a moving object does not flicker between encoded and
+* skipped frames.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "motion.h"
+#include "yuyv_rgb.h"
+#include "metrics/metrics.h"
+
+#if IMAGE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+* @brief Scalar sum of absolute differences against the reference
+*
+* @param yuyv   First pixel pair of the sampled run (packed YUYV422)
+* @param ref    Reference samples
+* @param n      Number of pixel pairs
+*
+* @return Sum of |Y0 - ref| over the run
+*/
+unsigned long motion_sad_scalar(const unsigned char *yuyv, const unsigned char *ref, size_t n)
+{
+    unsigned long sad = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int d = (int)yuyv[4 * i] - (int)ref[i];
+        sad += (unsigned long)(d < 0 ? -d : d);
+    }
+    return sad;
+}
+
+#if IMAGE_HAVE_NEON
+/**
+* @brief NEON sum of absolute differences, 16 pixel pairs per iteration
+*
+* vld4 de-interleaves 64 bytes of YUYV so lane 0 holds 16 Y0 samples. The
+* absolute differences are pairwise accumulated in 16 bits and folded into
+* 32 bits every 128 iterations, before they can overflow.
+*/
+static unsigned long motion_sad_neon(const unsigned char *yuyv, const unsigned char *ref, size_t n)
+{
+    uint32x4_t acc32 = vdupq_n_u32(0);
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        uint16x8_t acc16 = vdupq_n_u16(0);
+        size_t end = i + 16 * 128;
+        if (end > n) end = n;
+
+        for (; end - i >= 16; i += 16) {
+            uint8x16x4_t px = vld4q_u8(yuyv + 4 * i);
+            acc16 = vpadalq_u8(acc16, vabdq_u8(px.val[0], vld1q_u8(ref + i)));
+        }
+        acc32 = vpadalq_u16(acc32, acc16);
+    }
+
+    unsigned long sad = (unsigned long)vgetq_lane_u32(acc32, 0) + vgetq_lane_u32(acc32, 1) +
+                        vgetq_lane_u32(acc32, 2) + vgetq_lane_u32(acc32, 3);
+    return sad + motion_sad_scalar(yuyv + 4 * i, ref + i, n - i);
+}
+#endif
+
+/**
+* @brief Sum of absolute differences with the best available kernel
+*
+* @param yuyv   First pixel pair of the sampled run (packed YUYV422)
+* @param ref    Reference samples
+* @param n      Number of pixel pairs
+*
+* @return Sum of |Y0 - ref| over the run
+*/
+unsigned long motion_sad(const unsigned char *yuyv, const unsigned char *ref, size_t n)
+{
+#if IMAGE_HAVE_NEON
+    // yuyv_rgb.c knows whether this CPU has NEON (checked once at runtime on ARMv7)
+    if (yuyv_neon_active()) return motion_sad_neon(yuyv, ref, n);
+#endif
+    return motion_sad_scalar(yuyv, ref, n);
+}
+
+/**
+* @brief Samples taken from one region
+*/
+static size_t region_samples(const struct motion_region *r)
+{
+    return (size_t)((r->h + MOTION_ROW_STEP - 1) / MOTION_ROW_STEP) * (r->w / 2);
+}
+
+/**
+* @brief Set up a change detector for frames of the given size
+*
+* Regions are clamped to the frame and aligned to pixel pairs; regions
+* left empty are dropped. Without regions the whole frame is watched.
+*
+* @param m      Pointer to the detector
+* @param opts   Settings (mode, threshold, keepalive, regions)
+* @param width  Frame width in pixels
+* @param height Frame height in pixels
+* @param camera Camera number the gauges are reported for
+*
+* @return 0 on success, -1 on failure
+*/
+int motion_init(struct motion_ctx *m, const struct motion_opts *opts,
+                unsigned int width, unsigned int height, unsigned int camera)
+{
+    memset(m, 0, sizeof(*m));
+    m->opts = *opts;
+    m->width = width;
+    m->height = height;
+    m->camera = camera;
+    m->opts.n_regions = 0;
+
+    for (unsigned int i = 0; i < opts->n_regions; i++) {
+        struct motion_region r = opts->regions[i];
+
+        r.x &= ~1u;
+        if (r.x >= width || r.y >= height) r.w = r.h = 0;
+        if (r.w > width - r.x) r.w = width - r.x;
+        if (r.h > height - r.y) r.h = height - r.y;
+        r.w &= ~1u;
+
+        if (r.w == 0 || r.h == 0) {
+            fprintf(stderr, "motion: Region %u lies outside the %ux%u frame, ignored\n",
+                    i, width, height);
+            continue;
+        }
+        m->opts.regions[m->opts.n_regions++] = r;
+    }
+
+    if (m->opts.n_regions == 0) {
+        m->opts.regions[0] = (struct motion_region){ 0, 0, width & ~1u, height };
+        m->opts.n_regions = 1;
+    }
+
+    for (unsigned int i = 0; i < m->opts.n_regions; i++) {
+        m->n_samples += region_samples(&m->opts.regions[i]);
+    }
+
+    m->ref = malloc(m->n_samples);
+    if (!m->ref) {
+        perror("motion: Failed to allocate reference");
+        return -1;
+    }
+
+    atomic_init(&m->active, false);
+    return 0;
+}
+
+/**
+* @brief Release a change detector
+*
+* @param m  Pointer to the detector
+*
+* @return void
+*/
+void motion_destroy(struct motion_ctx *m)
+{
+    free(m->ref);
+    m->ref = NULL;
+    m->n_samples = 0;
+}
+
+/**
+* @brief Compare a frame with the reference
+*
+* Updates the active flag and the motion metrics. Without a reference yet
+* every frame counts as changed.
+*
+* @param m      Pointer to the detector
+* @param yuyv   Captured frame (packed YUYV422, m->width x m->height)
+* @param now_ns metrics_now() time of the frame
+*
+* @return true if the scene changed (or still counts as changing)
+*/
+bool motion_detect(struct motion_ctx *m, const unsigned char *yuyv, uint64_t now_ns)
+{
+    if (!m->have_ref) return true;
+
+    const size_t stride = (size_t)m->width * 2;
+    const unsigned char *ref = m->ref;
+    double worst = 0.0;
+
+    for (unsigned int i = 0; i < m->opts.n_regions; i++) {
+        const struct motion_region *r = &m->opts.regions[i];
+        const size_t run = r->w / 2;
+        unsigned long sad = 0;
+
+        for (unsigned int y = r->y; y < r->y + r->h; y += MOTION_ROW_STEP) {
+            sad += motion_sad(yuyv + y * stride + (size_t)r->x * 2, ref, run);
+            ref += run;
+        }
+
+        double score = (double)sad / region_samples(r);
+        if (score > worst) worst = score;
+    }
+
+    if (worst >= m->opts.threshold) m->last_change_ns = now_ns;
+    bool active = m->last_change_ns != 0 && now_ns - m->last_change_ns < MOTION_HOLD_NS;
+
+    if (active != atomic_load_explicit(&m->active, memory_order_relaxed)) {
+        atomic_store_explicit(&m->active, active, memory_order_release);
+        printf("motion: Scene %s (score %.2f)\n", active ? "changing" : "static", worst);
+        if (active) metrics_count(CNT_MOTION_EVENTS, 1);
+    }
+    metrics_set_camera_gauge(m->camera, CAM_GAUGE_MOTION_SCORE, (unsigned long)(worst * 100.0));
+    metrics_set_camera_gauge(m->camera, CAM_GAUGE_MOTION_ACTIVE, active);
+    return active;
+}
+
+/**
+* @brief Make a frame the reference later frames are compared with
+*
+* Called for every frame that gets encoded.
+*
+* @param m      Pointer to the detector
+* @param yuyv   Captured frame (packed YUYV422, m->width x m->height)
+*
+* @return void
+*/
+void motion_set_reference(struct motion_ctx *m, const unsigned char *yuyv)
+{
+    const size_t stride = (size_t)m->width * 2;
+    unsigned char *ref = m->ref;
+
+    for (unsigned int i = 0; i < m->opts.n_regions; i++) {
+        const struct motion_region *r = &m->opts.regions[i];
+        const size_t run = r->w / 2;
+
+        for (unsigned int y = r->y; y < r->y + r->h; y += MOTION_ROW_STEP) {
+            const unsigned char *src = yuyv + y * stride + (size_t)r->x * 2;
+            for (size_t k = 0; k < run; k++) ref[k] = src[4 * k];
+            ref += run;
+        }
+    }
+    m->have_ref = true;
+}
+
+/**
+* @brief Whether the scene is currently changing
+*
+* Safe to call from any thread.
+*
+* @param m  Pointer to the detector, may be NULL (no detection: false)
+*
+* @return true while motion is active
+*/
+bool motion_is_active(struct motion_ctx *m)
+{
+    return m && atomic_load_explicit(&m->active, memory_order_acquire);
+}
+
+/**
+* @brief Parse a motion mode name: off, reuse or skip
+*
+* @return 0 on success, -1 on an unknown name
+*/
+int motion_mode_parse(const char *s, enum motion_mode *mode)
+{
+    if (strcmp(s, "off") == 0) *mode = MOTION_OFF;
+    else if (strcmp(s, "reuse") == 0) *mode = MOTION_REUSE;
+    else if (strcmp(s, "skip") == 0) *mode = MOTION_SKIP;
+    else return -1;
+    return 0;
+}
+
+/**
+* @brief Parse a list of regions "x,y,w,h;x,y,w,h..." (empty = whole frame)
+*
+* @param s      Region list
+* @param opts   Settings receiving the regions
+*
+* @return 0 on success, -1 on a malformed list or too many regions
+*/
+int motion_regions_parse(const char *s, struct motion_opts *opts)
+{
+    unsigned int n = 0;
+
+    while (*s) {
+        struct motion_region r;
+        int used = 0;
+
+        if (n == MOTION_MAX_REGIONS) return -1;
+        if (sscanf(s, "%u,%u,%u,%u%n", &r.x, &r.y, &r.w, &r.h, &used) != 4) return -1;
+        if (r.w == 0 || r.h == 0) return -1;
+        opts->regions[n++] = r;
+
+        s += used;
+        if (*s == ';') s++;
+        else if (*s) return -1;
+    }
+
+    opts->n_regions = n;
+    return 0;
+}
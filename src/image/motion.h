@@ -0,0 +1,97 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+/**
+* @file motion.h
+* @brief Change detection on the luma of captured YUYV frames.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/** @brief Most regions of interest that can be watched. */
+#define MOTION_MAX_REGIONS      8
+
+/** @brief Only every n-th row is sampled (the Y of every pixel pair within a row). */
+#define MOTION_ROW_STEP         4
+
+/** @brief Default mean absolute luma difference (grey levels) that counts as change. */
+#define MOTION_DEFAULT_THRESHOLD    4.0
+
+/** @brief Default interval at which an unchanged scene is re-sent in MOTION_SKIP mode. */
+#define MOTION_DEFAULT_KEEPALIVE_MS 1000
+
+/** @brief Time a scene still counts as changing after the last frame over threshold. */
+#define MOTION_HOLD_NS          500000000ULL
+
+/**
+* @brief What to do with a frame whose scene did not change.
+*/
+enum motion_mode {
+    MOTION_OFF,                     /**< No change detection: encode every frame */
+    MOTION_REUSE,                   /**< Re-publish the previous JPEG (saves CPU, keeps the frame rate) */
+    MOTION_SKIP,                    /**< Publish nothing, re-send the previous JPEG every keepalive_ms */
+};
+
+/**
+* @brief A rectangle of the frame watched for change, in pixels.
+*/
+struct motion_region {
+    unsigned int x;                 /**< Left edge */
+    unsigned int y;                 /**< Top edge */
+    unsigned int w;                 /**< Width */
+    unsigned int h;                 /**< Height */
+};
+
+/**
+* @brief Change detection settings (see config.h).
+*/
+struct motion_opts {
+    enum motion_mode mode;          /**< Handling of unchanged frames */
+    double threshold;               /**< Mean absolute luma difference counting as change */
+    unsigned int keepalive_ms;      /**< Re-send interval of an unchanged scene (MOTION_SKIP) */
+    unsigned int n_regions;         /**< Watched regions (0 = the whole frame) */
+    struct motion_region regions[MOTION_MAX_REGIONS];   /**< Regions of interest */
+};
+
+/**
+* @brief Change detector of one camera.
+*
+* Keeps a subsampled luma reference of the last frame that was encoded and
+* compares every new frame against it with a sum of absolute differences,
+* region by region. Comparing against the last encoded frame, rather than
+* the previous capture, means slow drift (lighting) adds up until it gets
+* encoded. Only the producer thread calls into it; the active flag is
+* readable from any thread (recording, alerts), the score is a metric.
+*/
+struct motion_ctx {
+    struct motion_opts opts;        /**< Settings, regions clamped to the frame */
+    unsigned int width;             /**< Frame width in pixels */
+    unsigned int height;            /**< Frame height in pixels */
+    unsigned char *ref;             /**< Reference luma samples, region after region */
+    size_t n_samples;               /**< Samples in ref */
+    bool have_ref;                  /**< ref holds a frame */
+    uint64_t last_change_ns;        /**< Last frame over threshold */
+    uint64_t last_sent_ns;          /**< Last frame encoded or re-sent */
+    unsigned int last_subs;         /**< Subscribers at the previous frame (new viewers force a frame) */
+    atomic_bool active;             /**< Scene is changing (within MOTION_HOLD_NS of a change) */
+    unsigned int camera;            /**< Camera number, labels the motion gauges */
+};
+
+/** Function prototypes */
+int motion_init(struct motion_ctx *m, const struct motion_opts *opts,
+                unsigned int width, unsigned int height, unsigned int camera);
+void motion_destroy(struct motion_ctx *m);
+bool motion_detect(struct motion_ctx *m, const unsigned char *yuyv, uint64_t now_ns);
+void motion_set_reference(struct motion_ctx *m, const unsigned char *yuyv);
+bool motion_is_active(struct motion_ctx *m);
+
+int motion_mode_parse(const char *s, enum motion_mode *mode);
+int motion_regions_parse(const char *s, struct motion_opts *opts);
+
+unsigned long motion_sad_scalar(const unsigned char *yuyv, const unsigned char *ref, size_t n);
+unsigned long motion_sad(const unsigned char *yuyv, const unsigned char *ref, size_t n);
+
+#endif  // MOTION_H
@@ -0,0 +1,254 @@
+/**
+* @file yuyv_rgb.c
+* @brief YUYV422 -> RGB24 conversion kernels with runtime dispatch.
+*
+* Provides:
+*   1. A scalar reference kernel (BT.601, integer arithmetic)
+*   2. An ARM NEON kernel converting 16 pixels per iteration
+*   3. yuyv_to_rgb(), which picks the best kernel for the running CPU
+*
+* The NEON kernel is bit-exact with the scalar one: it uses the same
+* coefficients, 32-bit intermediates, a rounding narrow for (x + 128) >> 8,
+* and a saturating narrow in place of the CLIP() branches.
+*/
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "yuyv_rgb.h"
+
+#if IMAGE_HAVE_NEON
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON          (1 << 12)
+#endif
+#endif
+#endif
+
+/** @brief Ensure value stays within 8-bit pixel range: [0, 255]  */
+#define CLIP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
+
+/**
+* @brief Scalar reference conversion from YUYV422 to RGB24
+*
+* The conversion follows the BT.601 color space specification and uses 
+* integer arithmetic for performance.
+*
+* @param src     Packed YUYV422 input
+* @param dst     Packed RGB24 output (pixels * 3 bytes)
+* @param pixels  Number of pixels to convert (even)
+*
+* @return void
+*/
+void yuyv_to_rgb_scalar(const unsigned char *src, unsigned char *dst, size_t pixels)
+{
+    /**   In each iteration:
+    *       - Process 2 pixels
+    *       - Consumes 4 bytes of YUYV
+    *       - Produces 6 bytes of RGB (2 pixels x 3 channels) */
+    for (size_t i = 0; i < pixels; i += 2) {
+
+        int y0 = src[0];
+        int u  = src[1];
+        int y1 = src[2];
+        int v  = src[3];
+        src += 4;
+
+        /**
+        u & v are initially stored as unsigned bytes, range: [0, 255]
+        - u = 128 -> no blue shift    (neutral chroma)
+        - v = 128 -> no red shift     (neutral chroma)
+        Subtract 128 to recenter chroma values:
+        original:    0 -> 255
+        Centered:  -128 -> +127    (neutral chroma at 0 now)
+        Result: d & e = signed color offsets
+            - Negative -> reduces color
+            - Positive -> increases color
+            - 0 -> no color contribution 
+        */ 
+        int d = u - 128;
+        int e = v - 128;
+
+        /** Pixel 0
+        Y is initially stored as unsigned byte, range: [0, 255]
+        BT.601 valid luma Range: [16, 235]
+            Y = 16 -> black
+            Y = 235 -> white
+            Subtract 16 to normalize so that black = 0
+        YUYV -> RGB Conversion equation:                                    -> Floating point is slow, scale by 256 to get integer
+            R = 1.164 * (Y - 16) + 1.596 * (V - 128)                        -> 298 * (Y - 16) + 409 * (V - 128)
+            G = 1.164 * (Y - 16) - 0.391 * (U - 128) - 0.813 * (V - 128)    -> 298 * (Y - 16) - 100 * (U - 128) - 208 * (V - 128)
+            B = 1.164 * (Y - 16) + 2.018 * (U - 128)                        -> 298 * (Y - 16) + 516 * (U - 128)
+        */
+        int c = y0 - 16; 
+        *dst++ = CLIP((298*c + 409*e + 128) >> 8);            // Red
+        *dst++ = CLIP((298*c - 100*d - 208*e + 128) >> 8);    // Green
+        *dst++ = CLIP((298*c + 516*d + 128) >> 8);            // Blue
+
+        // Pixel 1
+        c = y1 - 16;
+        *dst++ = CLIP((298*c + 409*e + 128) >> 8);
+        *dst++ = CLIP((298*c - 100*d - 208*e + 128) >> 8);
+        *dst++ = CLIP((298*c + 516*d + 128) >> 8);
+    }
+}
+
+#if IMAGE_HAVE_NEON
+/**
+* @brief Narrow two 32-bit accumulators to 8 clipped pixels.
+*
+* vqrshrn computes (x + 128) >> 8 without overflow and saturates to int16;
+* vqmovun then saturates to [0, 255], which is exactly CLIP().
+*/
+static inline uint8x8_t neon_narrow(int32x4_t lo, int32x4_t hi)
+{
+    return vqmovun_s16(vcombine_s16(vqrshrn_n_s32(lo, 8), vqrshrn_n_s32(hi, 8)));
+}
+
+/**
+* @brief ARM NEON conversion from YUYV422 to RGB24
+*
+* Each iteration de-interleaves 32 bytes of YUYV (16 pixels) with vld4,
+* computes the BT.601 terms in 32-bit lanes (the chroma terms are shared by
+* the even and odd pixel of each pair), narrows with saturation and writes
+* 48 bytes of RGB with vst3. The remainder is handled by the scalar kernel.
+*
+* @param src     Packed YUYV422 input
+* @param dst     Packed RGB24 output (pixels * 3 bytes)
+* @param pixels  Number of pixels to convert (even)
+*
+* @return void
+*/
+void yuyv_to_rgb_neon(const unsigned char *src, unsigned char *dst, size_t pixels)
+{
+    const int16x8_t k16 = vdupq_n_s16(16);
+    const int16x8_t k128 = vdupq_n_s16(128);
+    size_t i = 0;
+
+    for (; i + 16 <= pixels; i += 16, src += 32, dst += 48) {
+        // val[0] = Y of even pixels, val[1] = U, val[2] = Y of odd pixels, val[3] = V
+        uint8x8x4_t in = vld4_u8(src);
+
+        int16x8_t c0 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[0])), k16);
+        int16x8_t c1 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[2])), k16);
+        int16x8_t d  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[1])), k128);
+        int16x8_t e  = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[3])), k128);
+
+        // Chroma contributions, shared by both pixels of a pair
+        int32x4_t r_lo = vmull_n_s16(vget_low_s16(e), 409);
+        int32x4_t r_hi = vmull_n_s16(vget_high_s16(e), 409);
+        int32x4_t g_lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(d), -100), vget_low_s16(e), -208);
+        int32x4_t g_hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(d), -100), vget_high_s16(e), -208);
+        int32x4_t b_lo = vmull_n_s16(vget_low_s16(d), 516);
+        int32x4_t b_hi = vmull_n_s16(vget_high_s16(d), 516);
+
+        // Luma contributions
+        int32x4_t y0_lo = vmull_n_s16(vget_low_s16(c0), 298);
+        int32x4_t y0_hi = vmull_n_s16(vget_high_s16(c0), 298);
+        int32x4_t y1_lo = vmull_n_s16(vget_low_s16(c1), 298);
+        int32x4_t y1_hi = vmull_n_s16(vget_high_s16(c1), 298);
+
+        uint8x8_t r0 = neon_narrow(vaddq_s32(y0_lo, r_lo), vaddq_s32(y0_hi, r_hi));
+        uint8x8_t g0 = neon_narrow(vaddq_s32(y0_lo, g_lo), vaddq_s32(y0_hi, g_hi));
+        uint8x8_t b0 = neon_narrow(vaddq_s32(y0_lo, b_lo), vaddq_s32(y0_hi, b_hi));
+        uint8x8_t r1 = neon_narrow(vaddq_s32(y1_lo, r_lo), vaddq_s32(y1_hi, r_hi));
+        uint8x8_t g1 = neon_narrow(vaddq_s32(y1_lo, g_lo), vaddq_s32(y1_hi, g_hi));
+        uint8x8_t b1 = neon_narrow(vaddq_s32(y1_lo, b_lo), vaddq_s32(y1_hi, b_hi));
+
+        // Re-interleave even/odd pixels back into display order
+        uint8x8x2_t r = vzip_u8(r0, r1);
+        uint8x8x2_t g = vzip_u8(g0, g1);
+        uint8x8x2_t b = vzip_u8(b0, b1);
+
+        uint8x16x3_t out;
+        out.val[0] = vcombine_u8(r.val[0], r.val[1]);
+        out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+        out.val[2] = vcombine_u8(b.val[0], b.val[1]);
+        vst3q_u8(dst, out);
+    }
+
+    // Tail (fewer than 16 pixels)
+    yuyv_to_rgb_scalar(src, dst, pixels - i);
+}
+#endif
+
+/**
+* @brief Select the fastest kernel supported by the running CPU.
+*
+* AArch64 always has NEON. On 32-bit ARM the kernel is only built when the
+* compiler targets NEON, and the HWCAP bit is still checked at runtime.
+*
+* @return Conversion kernel to use
+*/
+static yuyv_to_rgb_fn select_kernel(void)
+{
+#if IMAGE_HAVE_NEON
+#if defined(__arm__)
+    if (!(getauxval(AT_HWCAP) & HWCAP_NEON)) return yuyv_to_rgb_scalar;
+#endif
+    return yuyv_to_rgb_neon;
+#else
+    return yuyv_to_rgb_scalar;
+#endif
+}
+
+/** @brief Kernel chosen by init_kernel(). */
+static yuyv_to_rgb_fn active_kernel;
+
+/** @brief Guards the one-time kernel selection. */
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+* @brief Resolve the conversion kernel once, for every thread
+*
+* @return void
+*/
+static void init_kernel(void)
+{
+    active_kernel = select_kernel();
+}
+
+/**
+* @brief Convert YUYV422 to RGB24 with the best available kernel
+*
+* @param src     Packed YUYV422 input
+* @param dst     Packed RGB24 output (pixels * 3 bytes)
+* @param pixels  Number of pixels to convert (even)
+*
+* @return void
+*/
+void yuyv_to_rgb(const unsigned char *src, unsigned char *dst, size_t pixels)
+{
+    pthread_once(&kernel_once, init_kernel);
+    active_kernel(src, dst, pixels);
+}
+
+/**
+* @brief Whether the running CPU executes the NEON kernels
+*
+* The other image kernels (motion SAD, ladder halving) follow this choice,
+* so the runtime check on ARMv7 is made in one place.
+*
+* @return true if NEON kernels are used
+*/
+bool yuyv_neon_active(void)
+{
+    pthread_once(&kernel_once, init_kernel);
+#if IMAGE_HAVE_NEON
+    return active_kernel == yuyv_to_rgb_neon;
+#else
+    return false;
+#endif
+}
+
+/**
+* @brief Name of the kernel yuyv_to_rgb() dispatches to
+*
+* @return "neon" or "scalar"
+*/
+const char *yuyv_to_rgb_impl(void)
+{
+    return yuyv_neon_active() ? "neon" : "scalar";
+}
@@ -0,0 +1,40 @@
+#ifndef YUYV_RGB_H
+#define YUYV_RGB_H
+
+/**
+* @file yuyv_rgb.h
+* @brief YUYV422 -> RGB24 conversion kernels (scalar and ARM NEON).
+*/
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+* @brief NEON kernel availability.
+*
+* Set when the compiler targets NEON (always on AArch64, -mfpu=neon on ARMv7).
+* Define IMAGE_NO_SIMD to force the scalar kernel, e.g. for comparison builds.
+*/
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && !defined(IMAGE_NO_SIMD)
+#define IMAGE_HAVE_NEON     1
+#else
+#define IMAGE_HAVE_NEON     0
+#endif
+
+/**
+* @brief Signature shared by all conversion kernels.
+*
+* Converts @p pixels pixels (must be even) of packed YUYV422 into packed RGB24.
+*/
+typedef void (*yuyv_to_rgb_fn)(const unsigned char *src, unsigned char *dst, size_t pixels);
+
+/** Function prototypes */
+void yuyv_to_rgb_scalar(const unsigned char *src, unsigned char *dst, size_t pixels);
+#if IMAGE_HAVE_NEON
+void yuyv_to_rgb_neon(const unsigned char *src, unsigned char *dst, size_t pixels);
+#endif
+void yuyv_to_rgb(const unsigned char *src, unsigned char *dst, size_t pixels);
+bool yuyv_neon_active(void);
+const char *yuyv_to_rgb_impl(void);
+
+#endif  /* YUYV_RGB_H */
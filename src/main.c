@@ -3,155 +3,420 @@
 * @brief Entry point for the Raspberry Pi MJPEG streaming.
 *
 * Responsibilities:
-*   1. Initialize the camera
+*   1. Initialize every configured camera and its pipeline
 *   2. Start the HTTP server
-*   3. Setup the multithreaded producer-consumer pipeline
+*   3. Setup the multithreaded producer-consumer pipelines
+*   4. Serve every client from a single epoll event loop
 *
 * This file coordinates the end-to-end streaming process from camera capture
 * to HTTP MJPEG delivery.
 */
 
 #include <stdio.h>
+#include <errno.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <stdbool.h>
-#include <semaphore.h>
+#include <sys/stat.h>
 
 #include "camera/camera.h"
 #include "http/http_server.h"
+#include "http/event_loop.h"
 #include "http/mjpeg_stream.h"
-#include "cb/circular_buffer.h"
+#include "broadcast/broadcaster.h"
 #include "image/image_encoder.h"
+#include "image/jpeg_huffman.h"
 #include "image/image_processor.h"
+#include "mem/frame_pool.h"
+#include "image/encoder_pool.h"
+#include "image/hw_encoder.h"
+#include "image/motion.h"
+#include "image/ladder.h"
+#include "detection/detection.h"
+#include "record/recorder.h"
+#include "config/config.h"
+#include "sched/topology.h"
 
-/** @brief TCP port on which the HTTP MJPEG server listens. */
-#define SERVER_PORT     8080
+/**
+* @brief Everything one camera's pipeline owns.
+*
+* Each camera has its own capture thread, frame pool, broadcasters and
+* change detector, all sized from its negotiated format. The encoder worker
+* pool, the event loop and object detection (first camera only) are shared.
+*/
+struct camera_instance {
+    struct camera_ctx cctx;         /**< Camera context (V4L2) */
+    struct pipeline_ctx pipeline;   /**< Producer side of this camera's pipeline */
+    struct broadcaster bus;         /**< Published once per frame, fanned out to every client's subscriber queue */
+    struct frame_pool pool;         /**< Preallocated frame storage, sized from the negotiated camera format */
+    struct motion_ctx motion;       /**< Change detector gating the encoder (used when motion != off) */
+    struct res_ladder ladder;       /**< Full-size and reduced-size substreams (one broadcaster each) */
+    struct recorder recorder;       /**< Segment recorder (used when a record directory is set) */
+    bool recording;                 /**< The recorder is running */
+    pthread_t producer;             /**< Producer (capture) thread */
+};
 
-/** @brief Instantiate a circular buffer used for producer–consumer data exchange. */
-CircularBuffer cb;
+/** @brief Every configured camera, cfg.n_cameras of them. */
+static struct camera_instance cams[CAMERA_MAX];
 
-/**
-* @brief Semaphore to indicate availability of data in the circular buffer.
-* The consumer blocks on this semaphore when he buffer is empty, avoiding busy-waiting.
-* The producer posts to this semaphore after inserting data. */
-sem_t semData;
+/** @brief Encoder worker pool shared by every camera, used when more than one encoder thread is requested. */
+static struct encoder_pool encoders;
 
-/**
-* @brief Mutex protecting circular buffer access.
-* Ensures mutual exclusion when modifying or reading circular buffer indices and entries. */
-pthread_mutex_t mutexBuffer;
+/** @brief Object detection stage on the first camera (used with detect = 1). */
+static struct detector detector;
+
+/** @brief Runtime configuration (defaults, config file, command line). */
+static struct app_config cfg;
+
+/** @brief Trained Huffman tables of the software encoders (jpeg_huffman = <file>). */
+static struct jpeg_huffman_set huffman;
 
 /** @brief Producer thread */
 static void* producer(void* args) {
     pipeline_ctx *pipeline = args;
 
-    if (capture_frames(pipeline->cctx, pipeline->sctx, pipeline) < 0) {
+    // Capture core (and real-time priority) first: DQBUF deadlines depend on it
+    topology_enter(THREAD_CAPTURE);
+
+    // The encoders belong to this thread and are reused for every frame
+    // (with an encoder pool they are unused; each worker has its own)
+    if (image_encoders_create(pipeline, pipeline->encoder) < 0) {
+        fprintf(stderr, "Producer: Failed to create JPEG encoder\n");
+        return NULL;
+    }
+
+    if (capture_frames(pipeline->cctx, pipeline) < 0) {
         perror("Producer breaking - Error in capturing frames");
     }
 
+    image_encoders_destroy(pipeline->encoder);
     return NULL;
 }
 
-/** @brief Consumer thread */
-static void* consumer(void* args) {
-    pipeline_ctx *pipeline = args;
+/**
+* @brief Open one camera and build its pipeline
+*
+* Everything up to the producer thread: capture, frame pool, resolution
+* ladder, hardware encoder, change detection, detection (first camera
+* only) and recording. The camera is registered with the stream context
+* as camera index, served under /camN/.
+*
+* @param cam        Camera to set up
+* @param index      Camera number
+* @param sctx       Stream context the camera is served from
+* @param n_workers  Software encoder threads (sizes the frame pool)
+*
+* @return 0 on success, -1 on failure (everything set up is released again)
+*/
+static int camera_start(struct camera_instance *cam, unsigned int index, struct stream_ctx *sctx,
+                        unsigned int n_workers)
+{
+    struct camera_ctx *cctx = &cam->cctx;
+    struct pipeline_ctx *pipeline = &cam->pipeline;
+    struct stream_camera *served = &sctx->cams[index];
+    struct camera_opts opts = cfg.camera;
+
+    // The control module has one LED and telemetry page: the first camera drives it
+    snprintf(opts.device, sizeof(opts.device), "%s", cfg.devices[index]);
+    opts.control = cfg.camera.control && index == 0;
+    opts.index = index;
 
-    while(1) {
-        sem_wait(&semData);                     // BLOCK if no data
-        if (send_frames(pipeline->cctx, pipeline->sctx, pipeline) < 0) {
-            perror("Consumer breaking - Error in sending frames");
-            break;
+    if (broadcaster_init(&cam->bus) < 0) {      // Initialize the frame broadcaster
+        return -1;
+    }
+
+    *pipeline = (pipeline_ctx){
+        .bus = &cam->bus,
+        .pool = &cam->pool,
+        .cctx = cctx,
+        .sctx = sctx,
+        .idle_enabled = cfg.idle
+    };
+
+    // 1. Initialize the camera
+    if (camera_init(cctx, &opts) < 0) {
+        fprintf(stderr, "Failed to initialize camera %s.\n", opts.device);
+        goto fail_bus;
+    }
+
+    // Preallocate every frame buffer for the format the driver accepted: one
+    // client queue of distinct frames, a write queue, every zerocopy slot,
+    // and one frame in flight per encoder plus the reorder slack, per quality tier,
+    // and the cached latest frame served as /snapshot.jpg; likewise per reduced
+    // resolution (published from the producer, one quality)
+    unsigned int tiers = (cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) ? cfg.tiers : 1;
+    pipeline_set_quality(pipeline, cfg.quality, tiers);
+    pipeline->profile = &cfg.jpeg;
+
+    // Reduced sizes are halved from the raw frame, so YUYV only
+    unsigned int rungs = (cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) ? cfg.resolutions : 1;
+
+    unsigned int depth = sctx->queue_depth ? sctx->queue_depth : BUFFER_SIZE;
+    unsigned int n_frames = pipeline->n_tiers * (depth + CONN_WQ_DEPTH + ZC_PENDING_MAX + n_workers + 2) + 1;
+    n_frames += (rungs - 1) * (depth + CONN_WQ_DEPTH + ZC_PENDING_MAX + 2);
+    if (cfg.record.dir[0]) n_frames += REC_QUEUE_DEPTH;
+    if (cfg.motion.mode != MOTION_OFF) n_frames += pipeline->n_tiers;    // Tier set kept for repeats
+    if (n_frames < FRAME_POOL_JPEG_FRAMES) n_frames = FRAME_POOL_JPEG_FRAMES;
+    if (frame_pool_init(&cam->pool, cctx->fmt.fmt.pix.width, cctx->fmt.fmt.pix.height, n_frames) < 0) {
+        goto fail_camera;
+    }
+
+    if (ladder_init(&cam->ladder, &cam->bus, cctx->fmt.fmt.pix.width, cctx->fmt.fmt.pix.height,
+                    rungs, cfg.quality, &cfg.jpeg) < 0) {
+        goto fail_pool;
+    }
+    pipeline->ladder = &cam->ladder;
+
+    // Hardware encoding replaces the software path (libjpeg stays as fallback)
+    if (cfg.use_hw && cctx->fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
+        // Import the capture buffers directly when the camera exported them
+        unsigned int import_bufs = (cctx->buffers[0].dmabuf_fd >= 0) ? cctx->n_buffers : 0;
+        pipeline->hw = hw_encoder_open(NULL, cctx->fmt.fmt.pix.width, cctx->fmt.fmt.pix.height,
+                                       cfg.quality, import_bufs);
+        if (pipeline->hw && n_workers > 1) {
+            printf("main: Hardware encoder in use for %s, not using the encoder workers\n", opts.device);
         }
     }
-    return NULL;
+
+    // Skip encoding frames of an unchanged scene (needs the raw luma)
+    if (cfg.motion.mode != MOTION_OFF) {
+        if (cctx->fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+            printf("main: Change detection needs YUYV capture, disabled for %s\n", opts.device);
+        } else if (motion_init(&cam->motion, &cfg.motion, cctx->fmt.fmt.pix.width,
+                               cctx->fmt.fmt.pix.height, index) < 0) {
+            goto fail_ladder;
+        } else {
+            pipeline->motion = &cam->motion;
+        }
+    }
+
+    // Object detection on its own thread, at its own rate (one model, first camera)
+    if (cfg.detect.enabled && index == 0) {
+        if (cctx->fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV) {
+            printf("main: Object detection needs YUYV capture, disabled\n");
+        } else if (detector_start(&detector, &cfg.detect, cctx->fmt.fmt.pix.width,
+                                  cctx->fmt.fmt.pix.height) < 0) {
+            goto fail_motion;
+        } else {
+            pipeline->detector = &detector;
+        }
+    }
+
+    // Record from the broadcaster like any client, on its own writer thread
+    // (several cameras record into one subdirectory each)
+    if (cfg.record.dir[0]) {
+        struct record_opts rec = cfg.record;
+
+        if (cfg.n_cameras > 1) {
+            snprintf(rec.dir, sizeof(rec.dir), "%.*s/cam%u", (int)sizeof(rec.dir) - 16, cfg.record.dir, index);
+            if (mkdir(rec.dir, 0755) < 0 && errno != EEXIST) {
+                perror("main: Failed to create the camera's record directory");
+                goto fail_detector;
+            }
+        }
+        if (recorder_start(&cam->recorder, &rec, &cam->bus, pipeline->motion, pipeline->detector) < 0) {
+            goto fail_detector;
+        }
+        cam->recording = true;
+    }
+
+    *served = (struct stream_camera){
+        .cctx = cctx,
+        .bus = &cam->bus,
+        .n_tiers = pipeline->n_tiers,
+        .detector = pipeline->detector,
+        .ladder = &cam->ladder,
+        .recorder = cam->recording ? &cam->recorder : NULL
+    };
+    return 0;
+
+fail_detector:
+    if (pipeline->detector) detector_stop(&detector);
+fail_motion:
+    if (pipeline->motion) motion_destroy(&cam->motion);
+fail_ladder:
+    hw_encoder_close(pipeline->hw);
+    ladder_destroy(&cam->ladder);
+fail_pool:
+    frame_pool_destroy(&cam->pool);
+fail_camera:
+    close_camera(cctx);
+fail_bus:
+    broadcaster_destroy(&cam->bus);
+    *pipeline = (pipeline_ctx){ 0 };             // Nothing left for cameras_shutdown() to stop
+    return -1;
+}
+
+/**
+* @brief Release everything camera_start() set up, once its producer has stopped
+*
+* The camera is closed last: releasing the broadcasters' frames may still
+* requeue held capture buffers.
+*
+* @param cam    Camera to tear down
+*
+* @return void
+*/
+static void camera_stop(struct camera_instance *cam)
+{
+    if (cam->recording) recorder_stop(&cam->recorder);
+    hw_encoder_close(cam->pipeline.hw);
+    if (cam->pipeline.motion) motion_destroy(&cam->motion);
+    ladder_destroy(&cam->ladder);
+    pipeline_release_frames(&cam->pipeline);
+    broadcaster_destroy(&cam->bus);
+    frame_pool_destroy(&cam->pool);
+    close_camera(&cam->cctx);
+}
+
+/**
+* @brief Stop every producer started so far, then release every camera
+*
+* Producers are stopped and joined before the encoder pool, the detector
+* and the cameras are torn down, so no thread is still inside
+* capture_frames() when its buffers go away.
+*
+* @param sctx           Stream context the cameras are registered with
+* @param n_producers    Producer threads started (cameras 0 .. n_producers - 1)
+*
+* @return void
+*/
+static void cameras_shutdown(struct stream_ctx *sctx, unsigned int n_producers)
+{
+    for (unsigned int i = 0; i < n_producers; i++) camera_stop_capture(&cams[i].cctx);
+    for (unsigned int i = 0; i < n_producers; i++) pthread_join(cams[i].producer, NULL);
+
+    if (encoders.n_workers) encoder_pool_destroy(&encoders);
+    if (cams[0].pipeline.detector) detector_stop(&detector);
+    for (unsigned int i = 0; i < sctx->n_cams; i++) camera_stop(&cams[i]);
+    sctx->n_cams = 0;
 }
 
 /**
 * @brief Application entry point
+*
+* Every setting can come from a config file (-c) and be overridden on the
+* command line; run with an invalid option for the list (see config.h).
+* Capture format, size, frame rate and buffer count are negotiated with
+* each camera, and its frame pool is sized from the negotiated values.
 * 
+* @param argc   Argument count
+* @param argv   Argument vector
+*
 * @return 0 on normal termination, negative value on fatal error.
 */
-int main(void) 
+int main(int argc, char **argv) 
 {
-    circular_buffer_init(&cb);                  // Initialize circular buffer
     signal(SIGPIPE, SIG_IGN);                   // Ignore SIGPIPE to handle socket write error manually
 
-    struct camera_ctx cctx = {0};               // Camera context (V4L2)
     struct stream_ctx sctx = {0};               // Streaming context (MJPEG)
 
-    pthread_t producer_th;                      // Create storage for the thread
-    pthread_t consumer_th;
-
-    pthread_mutex_init(&mutexBuffer, NULL);     // Initialize the mutex
-    sem_init(&semData, 0, 0);                   // Initialize the semphore
-
-    pipeline_ctx pipeline = {
-        .cb = &cb,
-        .mutex = &mutexBuffer,
-        .sem = &semData,
-        .cctx = &cctx,
-        .sctx = &sctx
-    };
-
-    // 1. Initialize the camera
-    if (camera_init(&cctx) < 0) {
-        fprintf(stderr, "Failed to initialize camera.\n");
+    config_defaults(&cfg);
+    if (config_parse_args(&cfg, argc, argv) < 0) {
         return -1;
     }
 
-    // 2. Start Producer Thread ONCE
-    if (pthread_create(&producer_th, NULL, &producer, &pipeline) != 0) {
-        perror("Failed to create producer thread");
-        return -1;
+    if (cfg.list_caps) {
+        for (unsigned int i = 0; i < cfg.n_cameras; i++) {
+            if (camera_list_caps(cfg.devices[i]) < 0) return -1;
+        }
+        return 0;
     }
 
-    // 3. Start HTTP server (bind to port 8080)
-    if (start_http_server(&sctx, SERVER_PORT) < 0) {
-        fprintf(stderr, "main: Failed to start http server.\n");
-        close_camera(&cctx);
-        return -1;
+    if (cfg.jpeg_tables[0]) {
+        if (jpeg_huffman_load(cfg.jpeg_tables, &huffman) < 0) return -1;
+        cfg.jpeg.huffman = JPEG_HUFFMAN_TRAINED;
+        cfg.jpeg.tables = &huffman;
     }
-    printf("main: HTTP server listening on port %d\n", SERVER_PORT);
 
-    // 4. Main server loop
-    while(1) {
-        printf("main: Waiting for a client...\n\n");
+    // Every thread started from here on applies its role's placement
+    topology_init(&cfg.topology);
+
+    sctx.zerocopy_min = cfg.zerocopy_min;
+    sctx.queue_depth = cfg.queue_depth;
+    sctx.queue_policy = cfg.queue_policy;
+    sctx.ws_credits = cfg.ws_credits;
+    unsigned int n_workers = cfg.n_workers;     // Encoder threads, shared by every camera
 
-        // 4a. Accept a browser connection
-        if (accept_client_connection(&sctx) < 0) {
-            fprintf(stderr, "main: Failed to accept client.\n");
-            continue;       // keep server alive
+    for (unsigned int i = 0; i < cfg.n_cameras; i++) {
+        if (camera_start(&cams[i], i, &sctx, n_workers) < 0) {
+            cameras_shutdown(&sctx, 0);
+            return -1;
         }
+        sctx.n_cams++;
+    }
 
-        // 4b. Send HTTP multipart header
-        if (send_mjpeg_http_header(&sctx) < 0) {
-            fprintf(stderr, "main: Failed to send multipart header.\n");
-            close(sctx.client_fd);
-            continue;
+    // Spread software encoding of every camera over several cores (not needed
+    // in MJPEG passthrough or with a hardware encoder)
+    struct pipeline_ctx *lanes[CAMERA_MAX];
+    unsigned int n_lanes = 0;
+    for (unsigned int i = 0; n_workers > 1 && i < sctx.n_cams; i++) {
+        if (!cams[i].pipeline.hw && cams[i].cctx.fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV) {
+            lanes[n_lanes++] = &cams[i].pipeline;
+        }
+    }
+    if (n_lanes > 0) {
+        if (encoder_pool_init(&encoders, n_workers, lanes, n_lanes) < 0) {
+            cameras_shutdown(&sctx, 0);
+            return -1;
         }
+        for (unsigned int l = 0; l < n_lanes; l++) lanes[l]->encoders = &encoders;
+    }
+
+    // Lock memory once everything is allocated; the pools are touched up
+    // front so the first frames take no page faults
+    if (cfg.topology.mlock && topology_lock_memory() == 0) {
+        for (unsigned int c = 0; c < sctx.n_cams; c++) {
+            struct camera_instance *cam = &cams[c];
 
-        // 4c. Start Consumer thread
-        if (pthread_create(&consumer_th, NULL, &consumer, &pipeline) != 0) {
-            perror("Failed to create consumer thread");
-            close(sctx.client_fd);
-            continue;
+            topology_prefault(cam->pool.jpeg_slab, (unsigned long)cam->pool.n_frames * cam->pool.jpeg_cap);
+            for (unsigned int i = 1; i < cam->ladder.n_rungs; i++) {
+                topology_prefault(cam->ladder.rungs[i].data, cam->ladder.rungs[i].size);
+            }
+        }
+        for (unsigned int l = 0; l < encoders.n_lanes; l++) {
+            for (unsigned int i = 0; i < encoders.lanes[l].n_jobs; i++) {
+                topology_prefault(encoders.lanes[l].jobs[i].yuyv, encoders.lanes[l].jobs[i].yuyv_cap);
+            }
         }
+    }
 
-        // Wait ONLY for consumer 
-        pthread_join(consumer_th, NULL);
+    // 2. Start one producer thread per camera
+    for (unsigned int i = 0; i < sctx.n_cams; i++) {
+        if (pthread_create(&cams[i].producer, NULL, &producer, &cams[i].pipeline) != 0) {
+            perror("Failed to create producer thread");
+            cameras_shutdown(&sctx, i);
+            return -1;
+        }
+    }
 
-        printf("main: Client disconnected.\n\n");
+    // 3. Start HTTP server
+    if (start_http_server(&sctx, cfg.port) < 0) {
+        fprintf(stderr, "main: Failed to start http server.\n");
+        cameras_shutdown(&sctx, sctx.n_cams);
+        return -1;
+    }
+    printf("main: HTTP server listening on port %u, serving %u camera(s)\n", cfg.port, sctx.n_cams);
 
-        close(sctx.client_fd);
-        sctx.client_fd = -1;
+    // 4. Main server loop: one thread serves every client of every camera (consumer stage)
+    if (event_loop_init(&sctx) < 0) {
+        fprintf(stderr, "main: Failed to start event loop.\n");
+        cameras_shutdown(&sctx, sctx.n_cams);
+        return -1;
     }
 
-    /* Close the camera and release resources */
-    pthread_join(producer_th, NULL);                // Join producer thread
+    // The main thread becomes the network thread
+    topology_enter(THREAD_NETWORK);
+
+    if (event_loop_run(&sctx) < 0) {
+        fprintf(stderr, "main: Event loop terminated.\n");
+    }
+    event_loop_close(&sctx);
+
+    /* Stop the producers, close the cameras and release resources */
+    cameras_shutdown(&sctx, sctx.n_cams);
     sctx.server_fd = -1;
-    sem_destroy(&semData);
-    pthread_mutex_destroy(&mutexBuffer);
     return 0;
-}
\ No newline at end of file
+}
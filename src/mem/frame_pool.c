@@ -0,0 +1,179 @@
+/**
+* @file frame_pool.c
+* @brief Fixed-capacity pool of preallocated JPEG frames.
+*
+* The pool replaces the per-frame calloc/malloc/free traffic of the pipeline:
+*   1. JPEG frame containers and their data slabs are carved out of two
+*      allocations made once, sized from the negotiated camera format
+*   2. A frame returns to the pool through its recycle hook when the last
+*      reference to it is released, on whichever thread that happens
+*
+* When the pool runs dry or a frame outgrows its slab the code falls back to
+* the heap and counts it, so a misestimate costs performance, not frames.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_pool.h"
+#include "image/image_encoder.h"
+
+/** @brief Smallest JPEG slab per frame, whatever the resolution. */
+#define JPEG_SLAB_MIN       65536
+
+/** @brief Slab sizes are rounded up to whole pages. */
+#define SLAB_ALIGN          4096
+
+/**
+* @brief Data slab reserved for a pooled frame
+*/
+static unsigned char *frame_slot(struct frame_pool *pool, struct jpeg_frame *frame)
+{
+    return pool->jpeg_slab + (size_t)(frame - pool->frames) * pool->jpeg_cap;
+}
+
+/**
+* @brief Recycle hook: return a frame whose last reference was dropped
+*
+* @param frame  Pooled frame (frame->owner is the pool)
+*
+* @return void
+*/
+static void frame_pool_recycle(struct jpeg_frame *frame)
+{
+    struct frame_pool *pool = frame->owner;
+    unsigned char *slot = frame_slot(pool, frame);
+    bool overflowed = (frame->data != slot);
+
+    // The encoder moved an oversized frame to the heap; go back to the slab
+    if (overflowed) {
+        free(frame->data);
+        frame->data = slot;
+        frame->capacity = pool->jpeg_cap;
+        frame->borrowed = true;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (overflowed) pool->overflows++;
+    pool->free_frames[pool->n_free_frames++] = frame;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+* @brief Preallocate every JPEG frame for the given format
+*
+* The slab is written once so its pages are faulted in up front and not
+* during the first seconds of streaming.
+*
+* @param pool   Pointer to the pool
+* @param width  Negotiated frame width in pixels
+* @param height Negotiated frame height in pixels
+* @param n_frames Number of JPEG frames (0 = FRAME_POOL_JPEG_FRAMES)
+*
+* @return 0 on success, -1 on failure
+*/
+int frame_pool_init(struct frame_pool *pool, unsigned int width, unsigned int height,
+                    unsigned int n_frames)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->n_frames = n_frames ? n_frames : FRAME_POOL_JPEG_FRAMES;
+
+    // Half a byte per pixel is far above a quality-80 JPEG of camera content
+    unsigned long cap = (unsigned long)width * height / 2;
+    if (cap < JPEG_SLAB_MIN) cap = JPEG_SLAB_MIN;
+    pool->jpeg_cap = (cap + SLAB_ALIGN - 1) & ~(unsigned long)(SLAB_ALIGN - 1);
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        perror("frame_pool: Failed to initialize mutex");
+        return -1;
+    }
+
+    pool->frames = calloc(pool->n_frames, sizeof(*pool->frames));
+    pool->free_frames = calloc(pool->n_frames, sizeof(*pool->free_frames));
+    pool->jpeg_slab = malloc((size_t)pool->n_frames * pool->jpeg_cap);
+    if (!pool->frames || !pool->free_frames || !pool->jpeg_slab) {
+        perror("frame_pool: Failed to allocate slabs");
+        frame_pool_destroy(pool);
+        return -1;
+    }
+
+    // Fault the pages in now rather than on the streaming path
+    memset(pool->jpeg_slab, 0, (size_t)pool->n_frames * pool->jpeg_cap);
+
+    for (unsigned int i = 0; i < pool->n_frames; i++) {
+        struct jpeg_frame *frame = &pool->frames[i];
+        frame->data = frame_slot(pool, frame);
+        frame->capacity = pool->jpeg_cap;
+        frame->borrowed = true;
+        frame->recycle = frame_pool_recycle;
+        frame->owner = pool;
+        pool->free_frames[pool->n_free_frames++] = frame;
+    }
+
+    printf("frame_pool: %u JPEG frames x %lu bytes\n", pool->n_frames, pool->jpeg_cap);
+    return 0;
+}
+
+/**
+* @brief Release the pool's slabs
+*
+* Every pooled frame must have been released before, i.e. the broadcaster
+* and all connections are already gone.
+*
+* @param pool   Pointer to the pool
+*
+* @return void
+*/
+void frame_pool_destroy(struct frame_pool *pool)
+{
+    if (pool->exhausted || pool->overflows) {
+        printf("frame_pool: %lu heap fallbacks, %lu oversized frames\n",
+               pool->exhausted, pool->overflows);
+    }
+
+    free(pool->frames);
+    free(pool->free_frames);
+    free(pool->jpeg_slab);
+    pool->frames = NULL;
+    pool->jpeg_slab = NULL;
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/**
+* @brief Acquire an empty JPEG frame holding one reference
+*
+* Falls back to a heap frame when the pool is exhausted (or NULL), which is
+* freed rather than recycled on its last release.
+*
+* @param pool   Pointer to the pool, may be NULL
+*
+* @return Pointer to the frame, or NULL on allocation failure
+*/
+struct jpeg_frame *frame_pool_get_jpeg(struct frame_pool *pool)
+{
+    struct jpeg_frame *frame = NULL;
+
+    if (pool) {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->n_free_frames > 0) {
+            frame = pool->free_frames[--pool->n_free_frames];
+        } else {
+            pool->exhausted++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (frame) {
+        frame->size = 0;
+        frame->part_head_len = 0;
+        frame->ws_head_len = 0;
+        memset(&frame->t, 0, sizeof(frame->t));
+    } else {
+        frame = calloc(1, sizeof(*frame));
+        if (!frame) return NULL;
+    }
+
+    atomic_init(&frame->refcount, 1);
+    return frame;
+}
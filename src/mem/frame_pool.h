@@ -0,0 +1,56 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+/**
+* @file frame_pool.h
+* @brief Fixed-capacity pool of preallocated JPEG frames.
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+
+// Forward declare the JPEG frame struct
+struct jpeg_frame;
+
+/**
+* @brief Default number of JPEG frames in the pool.
+*
+* Enough for the worst case of one default subscriber queue full of distinct
+* frames, a full write queue, every MSG_ZEROCOPY slot pending and the frame
+* being encoded. Deeper queues or more encoder threads pass a larger count
+* to frame_pool_init().
+*/
+#define FRAME_POOL_JPEG_FRAMES  32
+
+/**
+* @brief Preallocated frame storage for the capture -> encode -> send path.
+*
+* All JPEG frame containers and their data slabs are allocated once when the
+* pool is initialized from the negotiated camera format. Frames are recycled
+* into the pool when their last reference is released, so the steady state
+* performs no heap allocations.
+*
+* Acquiring happens on the producer thread while releasing usually happens on
+* the network thread, hence the lock.
+*/
+struct frame_pool {
+    pthread_mutex_t lock;               /**< Protects the free stack */
+
+    struct jpeg_frame *frames;          /**< Array of n_frames frame containers */
+    unsigned int n_frames;              /**< Number of pooled JPEG frames */
+    unsigned char *jpeg_slab;           /**< One contiguous slab holding every frame's data */
+    unsigned long jpeg_cap;             /**< Data bytes reserved per frame */
+    struct jpeg_frame **free_frames;    /**< Stack of free frames (n_frames entries) */
+    unsigned int n_free_frames;         /**< Valid entries in free_frames */
+
+    unsigned long exhausted;            /**< Acquires that had to fall back to the heap */
+    unsigned long overflows;            /**< Frames that outgrew their slab */
+};
+
+/** Function prototypes */
+int frame_pool_init(struct frame_pool *pool, unsigned int width, unsigned int height,
+                    unsigned int n_frames);
+void frame_pool_destroy(struct frame_pool *pool);
+struct jpeg_frame *frame_pool_get_jpeg(struct frame_pool *pool);
+
+#endif  // FRAME_POOL_H
@@ -0,0 +1,422 @@
+/**
+* @file metrics.c
+* @brief Lock-free pipeline latency histograms and counters, rendered for Prometheus.
+*
+* Every frame carries the timestamps of its way through the pipeline
+* (struct frame_times); each thread records the stage it just completed
+* into a shared histogram with relaxed atomic adds, so measuring costs a
+* clock read and a few uncontended increments per frame.
+*
+* Histograms use four linear sub-buckets per power of two of microseconds,
+* which bounds the percentile error to 25% over nine decades. p50, p99 and
+* max of every stage, plus counters for frames, drops and bytes, are served
+* on /metrics in the Prometheus text exposition format.
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "metrics.h"
+
+/** @brief Label value of each stage. */
+static const char *const stage_names[STAGE_COUNT] = {
+    [STAGE_CAPTURE] = "capture",
+    [STAGE_CONVERT] = "convert",
+    [STAGE_ENCODE]  = "encode",
+    [STAGE_QUEUE]   = "queue",
+    [STAGE_SEND]    = "send",
+    [STAGE_TOTAL]   = "total",
+    [STAGE_DETECT]  = "detect",
+    [STAGE_SCALE]   = "scale",
+    [STAGE_DISK]    = "disk",
+    [STAGE_ACK]     = "ack",
+    [STAGE_ACK_TOTAL] = "ack_total",
+};
+
+/** @brief Metric name and help text of each counter. */
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[CNT_COUNT] = {
+    [CNT_FRAMES_CAPTURED]  = { "camera_frames_captured_total", "Buffers dequeued from the camera" },
+    [CNT_CAPTURE_DROPS]    = { "camera_capture_drops_total", "Frames dropped by the camera driver" },
+    [CNT_CAPTURE_STARVED]  = { "camera_capture_starved_total", "Capture slots left waiting because every pool buffer was held" },
+    [CNT_FRAMES_ENCODED]   = { "camera_frames_encoded_total", "Frames encoded" },
+    [CNT_ENCODE_ERRORS]    = { "camera_encode_errors_total", "Frames that failed to encode" },
+    [CNT_ENCODER_DROPS]    = { "camera_encoder_drops_total", "Frames dropped because every encoder was busy" },
+    [CNT_FRAMES_PUBLISHED] = { "camera_frames_published_total", "Frames published to clients" },
+    [CNT_BYTES_ENCODED]    = { "camera_encoded_bytes_total", "Bytes of published frames" },
+    [CNT_RING_DROPS]       = { "camera_ring_drops_total", "Frames evicted from full client queues" },
+    [CNT_RATE_SKIPS]       = { "camera_rate_skips_total", "Frames skipped by client rate control" },
+    [CNT_FRAMES_SENT]      = { "camera_frames_sent_total", "Frames fully written to client sockets" },
+    [CNT_BYTES_SENT]       = { "camera_sent_bytes_total", "Frame bytes written to client sockets" },
+    [CNT_CONNECTIONS]      = { "camera_connections_total", "Client connections accepted" },
+    [CNT_SNAPSHOTS]        = { "camera_snapshots_total", "Still frames served" },
+    [CNT_IDLE_FRAMES]      = { "camera_idle_frames_total", "Captured frames not encoded because nobody was watching" },
+    [CNT_STATIC_FRAMES]    = { "camera_static_frames_total", "Frames not encoded because the scene did not change" },
+    [CNT_MOTION_EVENTS]    = { "camera_motion_events_total", "Transitions from a static to a changing scene" },
+    [CNT_DETECTIONS]       = { "camera_detections_total", "Object-detection inferences completed" },
+    [CNT_DETECT_DROPS]     = { "camera_detect_drops_total", "Frames replaced in the detection mailbox before inference" },
+    [CNT_RUNG_FRAMES]      = { "camera_rung_frames_total", "Frames encoded for a reduced-resolution substream" },
+    [CNT_RECORDED_FRAMES]  = { "camera_recorded_frames_total", "Frames staged for a recording segment" },
+    [CNT_RECORD_BYTES]     = { "camera_record_bytes_total", "Bytes written to recording segments" },
+    [CNT_RECORD_ERRORS]    = { "camera_record_errors_total", "Failed recording writes" },
+    [CNT_RECORD_EVENTS]    = { "camera_record_events_total", "Events recorded with pre-roll" },
+    [CNT_WS_ACKS]          = { "camera_ws_acks_total", "Frames acknowledged by WebSocket clients" },
+};
+
+/** @brief Label value of each thread role. */
+static const char *const thread_names[THREAD_COUNT] = {
+    [THREAD_CAPTURE] = "capture",
+    [THREAD_ENCODER] = "encoder",
+    [THREAD_NETWORK] = "network",
+    [THREAD_DETECT]  = "detect",
+    [THREAD_RECORD]  = "record",
+};
+
+/** @brief Process-wide metrics, shared by every thread. */
+static struct {
+    struct histogram stages[STAGE_COUNT];
+    atomic_ulong counters[CNT_COUNT];
+    atomic_ulong gauges[GAUGE_COUNT];
+    atomic_ulong cam_gauges[METRICS_CAMERAS][CAM_GAUGE_COUNT];
+    atomic_ulong last_frame_ns[METRICS_CAMERAS];    /**< Last dequeue of each camera */
+    atomic_uint cameras;                            /**< Mask of the cameras that set a gauge */
+    atomic_ulong thread_cpus[THREAD_COUNT];     /**< CPU mask of each role's threads */
+    atomic_uint thread_prio[THREAD_COUNT];      /**< SCHED_FIFO priority (0 = normal scheduling) */
+    atomic_uint thread_count[THREAD_COUNT];     /**< Threads of each role placed so far */
+} metrics;
+
+/**
+* @brief Monotonic clock shared by every pipeline timestamp
+*
+* CLOCK_MONOTONIC is also the clock of V4L2 buffer timestamps flagged
+* V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC, so driver and pipeline times compare.
+*
+* @return Current time in nanoseconds
+*/
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+* @brief Bucket index of a sample in microseconds
+*/
+static unsigned int bucket_of(unsigned long us)
+{
+    if (us < 4) return (unsigned int)us;
+
+    unsigned int octave = 63 - __builtin_clzl(us);      // >= 2
+    unsigned int idx = 4 + (octave - 2) * 4 + ((us >> (octave - 2)) & 3);
+    return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+/**
+* @brief Exclusive upper bound in microseconds of a bucket
+*/
+static unsigned long bucket_upper(unsigned int idx)
+{
+    if (idx < 4) return idx + 1;
+
+    unsigned int octave = (idx - 4) / 4 + 2;
+    unsigned int sub = (idx - 4) % 4;
+    return (unsigned long)(5 + sub) << (octave - 2);
+}
+
+/**
+* @brief Record the duration of a completed stage
+*
+* Samples with an unknown start (0) or a start after the end are ignored.
+*
+* @param stage      Stage that completed
+* @param start_ns   metrics_now() time the stage began
+* @param end_ns     metrics_now() time the stage ended
+*
+* @return void
+*/
+void metrics_observe(enum metric_stage stage, uint64_t start_ns, uint64_t end_ns)
+{
+    if (start_ns == 0 || end_ns < start_ns) return;
+
+    struct histogram *h = &metrics.stages[stage];
+    unsigned long us = (unsigned long)((end_ns - start_ns) / 1000);
+
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, us, memory_order_relaxed);
+
+    unsigned long max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (us > max &&
+           !atomic_compare_exchange_weak_explicit(&h->max_us, &max, us,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+* @brief Add to a counter
+*
+* @param counter    Counter to increment
+* @param n          Amount to add
+*
+* @return void
+*/
+void metrics_count(enum metric_counter counter, unsigned long n)
+{
+    atomic_fetch_add_explicit(&metrics.counters[counter], n, memory_order_relaxed);
+}
+
+/**
+* @brief Set a gauge
+*
+* @param gauge  Gauge to set
+* @param value  New value
+*
+* @return void
+*/
+void metrics_set_gauge(enum metric_gauge gauge, unsigned long value)
+{
+    atomic_store_explicit(&metrics.gauges[gauge], value, memory_order_relaxed);
+}
+
+/**
+* @brief Set a gauge of one camera
+*
+* @param camera Camera number (values beyond METRICS_CAMERAS are ignored)
+* @param gauge  Gauge to set
+* @param value  New value
+*
+* @return void
+*/
+void metrics_set_camera_gauge(unsigned int camera, enum metric_camera_gauge gauge, unsigned long value)
+{
+    if (camera >= METRICS_CAMERAS) return;
+
+    atomic_store_explicit(&metrics.cam_gauges[camera][gauge], value, memory_order_relaxed);
+    atomic_fetch_or_explicit(&metrics.cameras, 1U << camera, memory_order_relaxed);
+}
+
+/**
+* @brief Note that a camera captured a frame, for its capture frame rate
+*
+* Called by that camera's capture thread only; keeps an EWMA of the frame
+* interval.
+*
+* @param camera     Camera number
+* @param now_ns     metrics_now() time of the dequeue
+*
+* @return void
+*/
+void metrics_frame_interval(unsigned int camera, uint64_t now_ns)
+{
+    if (camera >= METRICS_CAMERAS) return;
+
+    unsigned long last = atomic_exchange_explicit(&metrics.last_frame_ns[camera], now_ns,
+                                                  memory_order_relaxed);
+    if (last == 0 || now_ns <= last) return;
+
+    unsigned long avg = atomic_load_explicit(&metrics.cam_gauges[camera][CAM_GAUGE_FRAME_INTERVAL_NS],
+                                             memory_order_relaxed);
+    long delta = (long)(now_ns - last) - (long)avg;
+    avg = avg ? (unsigned long)((long)avg + delta / 16) : (unsigned long)(now_ns - last);
+    metrics_set_camera_gauge(camera, CAM_GAUGE_FRAME_INTERVAL_NS, avg);
+}
+
+/**
+* @brief Report where a pipeline thread runs
+*
+* Called by each thread once it has applied its placement; threads of the
+* same role (encoder workers) share one entry.
+*
+* @param role           Thread role
+* @param cpus           Mask of the CPUs the thread may run on (bit n = CPU n)
+* @param rt_priority    SCHED_FIFO priority, 0 for normal scheduling
+*
+* @return void
+*/
+void metrics_thread_placement(enum metric_thread role, unsigned long cpus, unsigned int rt_priority)
+{
+    atomic_store_explicit(&metrics.thread_cpus[role], cpus, memory_order_relaxed);
+    atomic_store_explicit(&metrics.thread_prio[role], rt_priority, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.thread_count[role], 1, memory_order_relaxed);
+}
+
+/**
+* @brief Label value of a thread role
+*
+* @param role   Thread role
+*
+* @return "capture", "encoder", "network", "detect" or "record"
+*/
+const char *metrics_thread_name(enum metric_thread role)
+{
+    return thread_names[role];
+}
+
+/**
+* @brief Format a CPU mask as a list such as "0-1,3"
+*
+* @return out
+*/
+static char *cpu_list(unsigned long mask, char *out, size_t cap)
+{
+    size_t len = 0;
+    const unsigned int bits = sizeof(mask) * 8;
+
+    out[0] = '\0';
+    for (unsigned int c = 0; c < bits && len < cap; c++) {
+        if (!(mask & (1UL << c))) continue;
+        unsigned int last = c;
+        while (last + 1 < bits && (mask & (1UL << (last + 1)))) last++;
+
+        int n = (last == c) ? snprintf(out + len, cap - len, "%s%u", len ? "," : "", c)
+                            : snprintf(out + len, cap - len, "%s%u-%u", len ? "," : "", c, last);
+        if (n > 0) len += (size_t)n;
+        c = last;
+    }
+    return out;
+}
+
+/**
+* @brief Estimate a quantile of a histogram snapshot
+*
+* @return Upper bound of the bucket holding the quantile, in microseconds
+*/
+static unsigned long quantile(const unsigned long *buckets, unsigned long count,
+                              unsigned long max_us, double q)
+{
+    unsigned long rank = (unsigned long)(q * count);
+    unsigned long seen = 0;
+
+    if (rank >= count) rank = count ? count - 1 : 0;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            unsigned long ub = bucket_upper(i);
+            return ub < max_us ? ub : max_us;
+        }
+    }
+    return max_us;
+}
+
+/**
+* @brief Append formatted text, tracking the length that would be needed
+*/
+#define EMIT(...)                                                           \
+    do {                                                                    \
+        int n_ = snprintf(buf + (len < cap ? len : cap),                    \
+                          len < cap ? cap - len : 0, __VA_ARGS__);          \
+        if (n_ > 0) len += (size_t)n_;                                      \
+    } while (0)
+
+/**
+* @brief Render every metric in the Prometheus text exposition format
+*
+* Histograms are read without stopping the writers, so a snapshot may be
+* off by the samples recorded while it was taken.
+*
+* @param buf    Output buffer (may be NULL if cap is 0)
+* @param cap    Size of buf
+*
+* @return Length of the full text; if >= cap the output was truncated
+*/
+size_t metrics_render(char *buf, size_t cap)
+{
+    size_t len = 0;
+
+    EMIT("# HELP camera_stage_latency_seconds Per-frame latency of each pipeline stage\n"
+         "# TYPE camera_stage_latency_seconds summary\n");
+
+    for (unsigned int s = 0; s < STAGE_COUNT; s++) {
+        struct histogram *h = &metrics.stages[s];
+        unsigned long snap[HIST_BUCKETS];
+        unsigned long count = 0;
+
+        for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+            snap[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+            count += snap[i];
+        }
+        unsigned long sum = atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+        unsigned long max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+
+        EMIT("camera_stage_latency_seconds{stage=\"%s\",quantile=\"0.5\"} %.6f\n",
+             stage_names[s], quantile(snap, count, max, 0.5) / 1e6);
+        EMIT("camera_stage_latency_seconds{stage=\"%s\",quantile=\"0.99\"} %.6f\n",
+             stage_names[s], quantile(snap, count, max, 0.99) / 1e6);
+        EMIT("camera_stage_latency_seconds{stage=\"%s\",quantile=\"1\"} %.6f\n",
+             stage_names[s], max / 1e6);
+        EMIT("camera_stage_latency_seconds_sum{stage=\"%s\"} %.6f\n", stage_names[s], sum / 1e6);
+        EMIT("camera_stage_latency_seconds_count{stage=\"%s\"} %lu\n", stage_names[s], count);
+    }
+
+    for (unsigned int c = 0; c < CNT_COUNT; c++) {
+        EMIT("# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+             counter_info[c].name, counter_info[c].help, counter_info[c].name, counter_info[c].name,
+             atomic_load_explicit(&metrics.counters[c], memory_order_relaxed));
+    }
+
+    // Per-camera gauges, one sample per camera that has reported
+    unsigned int cameras = atomic_load_explicit(&metrics.cameras, memory_order_relaxed);
+    unsigned long g[METRICS_CAMERAS][CAM_GAUGE_COUNT];
+    for (unsigned int c = 0; c < METRICS_CAMERAS; c++) {
+        for (unsigned int i = 0; i < CAM_GAUGE_COUNT; i++) {
+            g[c][i] = atomic_load_explicit(&metrics.cam_gauges[c][i], memory_order_relaxed);
+        }
+    }
+
+    EMIT("# HELP camera_capture_fps Smoothed capture frame rate\n"
+         "# TYPE camera_capture_fps gauge\n");
+    for (unsigned int c = 0; c < METRICS_CAMERAS; c++) {
+        unsigned long interval = g[c][CAM_GAUGE_FRAME_INTERVAL_NS];
+        if (cameras & (1U << c)) {
+            EMIT("camera_capture_fps{camera=\"%u\"} %.2f\n", c, interval ? 1e9 / interval : 0.0);
+        }
+    }
+    EMIT("# HELP camera_encoding_active 1 while frames are encoded, 0 while idle without viewers\n"
+         "# TYPE camera_encoding_active gauge\n");
+    for (unsigned int c = 0; c < METRICS_CAMERAS; c++) {
+        if (cameras & (1U << c)) EMIT("camera_encoding_active{camera=\"%u\"} %lu\n", c, g[c][CAM_GAUGE_ENCODING]);
+    }
+    EMIT("# HELP camera_motion_score Mean absolute luma change of the last frame (grey levels)\n"
+         "# TYPE camera_motion_score gauge\n");
+    for (unsigned int c = 0; c < METRICS_CAMERAS; c++) {
+        if (cameras & (1U << c)) {
+            EMIT("camera_motion_score{camera=\"%u\"} %.2f\n", c, g[c][CAM_GAUGE_MOTION_SCORE] / 100.0);
+        }
+    }
+    EMIT("# HELP camera_motion_active 1 while the scene is changing\n"
+         "# TYPE camera_motion_active gauge\n");
+    for (unsigned int c = 0; c < METRICS_CAMERAS; c++) {
+        if (cameras & (1U << c)) EMIT("camera_motion_active{camera=\"%u\"} %lu\n", c, g[c][CAM_GAUGE_MOTION_ACTIVE]);
+    }
+    EMIT("# HELP camera_clients Open client connections\n"
+         "# TYPE camera_clients gauge\n"
+         "camera_clients %lu\n",
+         atomic_load_explicit(&metrics.gauges[GAUGE_CLIENTS], memory_order_relaxed));
+
+    EMIT("# HELP camera_thread_affinity Threads of each role, labelled with the CPUs they may run on\n"
+         "# TYPE camera_thread_affinity gauge\n");
+    for (unsigned int t = 0; t < THREAD_COUNT; t++) {
+        unsigned int n = atomic_load_explicit(&metrics.thread_count[t], memory_order_relaxed);
+        char cpus[128];
+        if (!n) continue;
+        EMIT("camera_thread_affinity{thread=\"%s\",cpus=\"%s\"} %u\n", thread_names[t],
+             cpu_list(atomic_load_explicit(&metrics.thread_cpus[t], memory_order_relaxed),
+                      cpus, sizeof(cpus)), n);
+    }
+    EMIT("# HELP camera_thread_rt_priority SCHED_FIFO priority of each thread role (0 = normal scheduling)\n"
+         "# TYPE camera_thread_rt_priority gauge\n");
+    for (unsigned int t = 0; t < THREAD_COUNT; t++) {
+        if (!atomic_load_explicit(&metrics.thread_count[t], memory_order_relaxed)) continue;
+        EMIT("camera_thread_rt_priority{thread=\"%s\"} %u\n", thread_names[t],
+             atomic_load_explicit(&metrics.thread_prio[t], memory_order_relaxed));
+    }
+    EMIT("# HELP camera_memory_locked 1 once the process memory is locked in RAM (mlockall)\n"
+         "# TYPE camera_memory_locked gauge\n"
+         "camera_memory_locked %lu\n",
+         atomic_load_explicit(&metrics.gauges[GAUGE_MEMORY_LOCKED], memory_order_relaxed));
+
+    return len;
+}
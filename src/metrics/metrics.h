@@ -0,0 +1,120 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/**
+* @file metrics.h
+* @brief Lock-free pipeline latency histograms and counters, rendered for Prometheus.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/** @brief Histogram buckets: 4 per power of two of microseconds, up to ~18 minutes. */
+#define HIST_BUCKETS        120
+
+/** @brief Cameras with gauges of their own (CAMERA_MAX in camera.h). */
+#define METRICS_CAMERAS     4
+
+/**
+* @brief Pipeline stages whose latency is measured for every frame.
+*
+* Stages are consecutive: their boundaries are the timestamps carried in
+* struct frame_times plus, per client, the dequeue and write-complete times.
+*/
+enum metric_stage {
+    STAGE_CAPTURE,                  /**< Driver timestamp -> VIDIOC_DQBUF returned */
+    STAGE_CONVERT,                  /**< Dequeue -> encoder input ready (RGB conversion, worker hand-off) */
+    STAGE_ENCODE,                   /**< Encoder input ready -> JPEG complete */
+    STAGE_QUEUE,                    /**< Published -> taken from the client's ring */
+    STAGE_SEND,                     /**< Taken from the ring -> last byte accepted by the socket */
+    STAGE_TOTAL,                    /**< Driver timestamp -> last byte accepted by the socket */
+    STAGE_DETECT,                   /**< One object-detection inference (detection thread) */
+    STAGE_SCALE,                    /**< Dequeue -> reduced-resolution rung ready to encode */
+    STAGE_DISK,                     /**< One batched segment write (recorder thread) */
+    STAGE_ACK,                      /**< Taken from the ring -> acknowledged by a WebSocket client */
+    STAGE_ACK_TOTAL,                /**< Driver timestamp -> acknowledged by a WebSocket client */
+    STAGE_COUNT
+};
+
+/** @brief Monotonic event counters. */
+enum metric_counter {
+    CNT_FRAMES_CAPTURED,            /**< Buffers dequeued from the camera */
+    CNT_CAPTURE_DROPS,              /**< Frames the driver dropped (v4l2_buffer.sequence gaps) */
+    CNT_CAPTURE_STARVED,            /**< Dequeued slots left empty: every capture pool buffer was held (USERPTR) */
+    CNT_FRAMES_ENCODED,             /**< Frames encoded (tier 0) */
+    CNT_ENCODE_ERRORS,              /**< Frames that failed to encode */
+    CNT_ENCODER_DROPS,              /**< Frames dropped because every encoder was busy */
+    CNT_FRAMES_PUBLISHED,           /**< Frames published to the subscribers */
+    CNT_BYTES_ENCODED,              /**< Bytes of published frames (tier 0) */
+    CNT_RING_DROPS,                 /**< Frames evicted from a full client ring */
+    CNT_RATE_SKIPS,                 /**< Frames skipped by client rate control */
+    CNT_FRAMES_SENT,                /**< Frames fully written to a client socket */
+    CNT_BYTES_SENT,                 /**< Bytes of frames fully written to client sockets */
+    CNT_CONNECTIONS,                /**< Client connections accepted */
+    CNT_SNAPSHOTS,                  /**< Still frames served (/snapshot.jpg) */
+    CNT_IDLE_FRAMES,                /**< Captured frames not encoded because nobody was watching */
+    CNT_STATIC_FRAMES,              /**< Frames not encoded because the scene did not change */
+    CNT_MOTION_EVENTS,              /**< Transitions from a static to a changing scene */
+    CNT_DETECTIONS,                 /**< Object-detection inferences completed */
+    CNT_DETECT_DROPS,               /**< Frames replaced in the detection mailbox before inference */
+    CNT_RUNG_FRAMES,                /**< Frames encoded for a reduced-resolution substream */
+    CNT_RECORDED_FRAMES,            /**< Frames staged for a recording segment */
+    CNT_RECORD_BYTES,               /**< Bytes written to recording segments */
+    CNT_RECORD_ERRORS,              /**< Failed recording writes (the segment is abandoned) */
+    CNT_RECORD_EVENTS,              /**< Recorded events (event mode) */
+    CNT_WS_ACKS,                    /**< Frames acknowledged by WebSocket clients */
+    CNT_COUNT
+};
+
+/** @brief Instantaneous values of the whole process. */
+enum metric_gauge {
+    GAUGE_CLIENTS,                  /**< Open client connections */
+    GAUGE_MEMORY_LOCKED,            /**< 1 once the process memory is locked (mlockall) */
+    GAUGE_COUNT
+};
+
+/** @brief Instantaneous values of each camera, rendered with a camera label. */
+enum metric_camera_gauge {
+    CAM_GAUGE_FRAME_INTERVAL_NS,    /**< Smoothed interval between captured frames */
+    CAM_GAUGE_ENCODING,             /**< 1 while frames are encoded, 0 while the pipeline idles */
+    CAM_GAUGE_MOTION_SCORE,         /**< Change score of the last frame, in 1/100 grey levels */
+    CAM_GAUGE_MOTION_ACTIVE,        /**< 1 while the scene is changing */
+    CAM_GAUGE_COUNT
+};
+
+/** @brief Pipeline thread roles whose CPU placement and scheduling are reported. */
+enum metric_thread {
+    THREAD_CAPTURE,                 /**< Producer: VIDIOC_DQBUF, conversion, publishing */
+    THREAD_ENCODER,                 /**< Encoder pool workers */
+    THREAD_NETWORK,                 /**< epoll event loop serving every client */
+    THREAD_DETECT,                  /**< Object detection */
+    THREAD_RECORD,                  /**< Recording writer */
+    THREAD_COUNT
+};
+
+/**
+* @brief Log-linear latency histogram updated with relaxed atomics.
+*
+* Any thread can record into it without a lock; percentiles are estimated
+* from the bucket upper bounds when rendered.
+*/
+struct histogram {
+    atomic_ulong buckets[HIST_BUCKETS];     /**< Sample counts per bucket */
+    atomic_ulong count;                     /**< Number of samples */
+    atomic_ulong sum_us;                    /**< Sum of all samples in microseconds */
+    atomic_ulong max_us;                    /**< Largest sample in microseconds */
+};
+
+/** Function prototypes */
+uint64_t metrics_now(void);
+void metrics_observe(enum metric_stage stage, uint64_t start_ns, uint64_t end_ns);
+void metrics_count(enum metric_counter counter, unsigned long n);
+void metrics_set_gauge(enum metric_gauge gauge, unsigned long value);
+void metrics_set_camera_gauge(unsigned int camera, enum metric_camera_gauge gauge, unsigned long value);
+void metrics_frame_interval(unsigned int camera, uint64_t now_ns);
+const char *metrics_thread_name(enum metric_thread role);
+void metrics_thread_placement(enum metric_thread role, unsigned long cpus, unsigned int rt_priority);
+size_t metrics_render(char *buf, size_t cap);
+
+#endif  // METRICS_H
@@ -0,0 +1,184 @@
+/**
+* @file preroll.c
+* @brief Byte-budgeted store of the most recent encoded frames (pre-event footage).
+*
+* The recorder keeps every frame here while no event is being recorded.
+* When an event triggers, the stored frames are handed to pwritev() as the
+* (at most two) runs of arena bytes they occupy, so they reach the segment
+* without another copy in user space, and the store starts over.
+*
+* One arena of the configured byte budget is allocated up front, plus a
+* descriptor ring sized from it: holding the pre-roll never touches the
+* heap, however many frames fit, and memory use is the same at any frame
+* size or rate.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preroll.h"
+
+/**
+* @brief Allocate the arena and descriptor ring
+*
+* @param p          Pointer to the preroll
+* @param budget     Arena size in bytes
+* @param window_ms  Footage kept before the newest frame, in milliseconds
+*
+* @return 0 on success, -1 on failure
+*/
+int preroll_init(struct preroll *p, size_t budget, unsigned int window_ms)
+{
+    memset(p, 0, sizeof(*p));
+    p->budget = budget;
+    p->window_ns = (uint64_t)window_ms * 1000000ULL;
+    p->cap = (unsigned int)(budget / (1u << 20) + 1) * PREROLL_DESCS_PER_MB;
+
+    p->arena = malloc(budget);
+    p->desc = calloc(p->cap, sizeof(*p->desc));
+    if (!p->arena || !p->desc) {
+        perror("preroll: Failed to allocate arena");
+        preroll_destroy(p);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* @brief Free the arena and descriptor ring
+*
+* @param p  Pointer to the preroll
+*
+* @return void
+*/
+void preroll_destroy(struct preroll *p)
+{
+    free(p->arena);
+    free(p->desc);
+    p->arena = NULL;
+    p->desc = NULL;
+    p->count = 0;
+}
+
+/**
+* @brief Drop the oldest stored frame
+*/
+static void preroll_evict(struct preroll *p)
+{
+    p->bytes -= p->desc[p->first].size;
+    p->first = (p->first + 1) % p->cap;
+    p->count--;
+}
+
+/**
+* @brief Stored frame by age
+*
+* @param p  Pointer to the preroll
+* @param i  0 for the oldest frame, count - 1 for the newest
+*
+* @return Descriptor of the frame
+*/
+const struct preroll_desc *preroll_at(const struct preroll *p, unsigned int i)
+{
+    return &p->desc[(p->first + i) % p->cap];
+}
+
+/**
+* @brief Arena offset at which a frame of the given size can be stored
+*
+* @return The offset, or -1 if the oldest frame must be evicted first
+*/
+static long preroll_fit(const struct preroll *p, size_t size)
+{
+    if (p->count == 0) return 0;
+
+    const struct preroll_desc *oldest = preroll_at(p, 0);
+    const struct preroll_desc *newest = preroll_at(p, p->count - 1);
+    size_t end = newest->off + newest->size;
+
+    if (oldest->off < end) {
+        // Stored bytes are one run: free space behind it, then in front of it
+        if (p->budget - end >= size) return (long)end;
+        if (oldest->off >= size) return 0;
+    } else if (oldest->off - end >= size) {
+        // Wrapped: the free space is the gap between the newest and the oldest frame
+        return (long)end;
+    }
+    return -1;
+}
+
+/**
+* @brief Store a copy of a frame, evicting what no longer fits
+*
+* Frames older than the window relative to this one are evicted too.
+*
+* @param p          Pointer to the preroll
+* @param data       JPEG bytes
+* @param size       JPEG size
+* @param capture_ns Monotonic capture time
+*
+* @return 0 on success, -1 if the frame is larger than the whole arena
+*/
+int preroll_push(struct preroll *p, const unsigned char *data, size_t size, uint64_t capture_ns)
+{
+    if (size == 0 || size > p->budget) return -1;
+
+    while (p->count && capture_ns - preroll_at(p, 0)->capture_ns > p->window_ns) preroll_evict(p);
+    if (p->count == p->cap) preroll_evict(p);
+
+    long off;
+    while ((off = preroll_fit(p, size)) < 0) preroll_evict(p);
+
+    memcpy(p->arena + off, data, size);
+    p->desc[(p->first + p->count) % p->cap] = (struct preroll_desc){
+        .capture_ns = capture_ns, .off = (size_t)off, .size = size,
+    };
+    p->count++;
+    p->bytes += size;
+    return 0;
+}
+
+/**
+* @brief Arena bytes of every stored frame, oldest first
+*
+* Consecutive frames are contiguous except where the ring wrapped to
+* offset 0, so two runs always suffice.
+*
+* @param p      Pointer to the preroll
+* @param iov    Filled with the runs
+*
+* @return Number of runs (0 when empty)
+*/
+unsigned int preroll_runs(const struct preroll *p, struct iovec iov[2])
+{
+    unsigned int n = 0;
+
+    for (unsigned int i = 0; i < p->count; i++) {
+        const struct preroll_desc *d = preroll_at(p, i);
+        unsigned char *start = p->arena + d->off;
+
+        if (n && (unsigned char *)iov[n - 1].iov_base + iov[n - 1].iov_len == start) {
+            iov[n - 1].iov_len += d->size;
+        } else {
+            iov[n].iov_base = start;
+            iov[n].iov_len = d->size;
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+* @brief Forget every stored frame
+*
+* @param p  Pointer to the preroll
+*
+* @return void
+*/
+void preroll_clear(struct preroll *p)
+{
+    p->first = 0;
+    p->count = 0;
+    p->bytes = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef PREROLL_H
+#define PREROLL_H
+
+/**
+* @file preroll.h
+* @brief Byte-budgeted store of the most recent encoded frames (pre-event footage).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/** @brief Frames a preroll can describe per MiB of arena (average frame of 4 KiB or more). */
+#define PREROLL_DESCS_PER_MB    256
+
+/**
+* @brief Where one stored frame lives in the arena.
+*/
+struct preroll_desc {
+    uint64_t capture_ns;            /**< Monotonic capture time */
+    size_t off;                     /**< Offset of the JPEG in the arena */
+    size_t size;                    /**< JPEG size in bytes */
+};
+
+/**
+* @brief Last few seconds of frames in one preallocated arena.
+*
+* Frames are stored back to back in a byte ring. A frame never wraps: if
+* it does not fit before the end of the arena it starts over at offset 0,
+* so every frame is contiguous and the whole store is at most two runs of
+* bytes. The oldest frames are evicted when the byte budget or the time
+* window is exceeded, whichever comes first. Used by one thread only.
+*/
+struct preroll {
+    unsigned char *arena;           /**< Frame bytes (budget bytes, allocated once) */
+    size_t budget;                  /**< Arena size */
+    uint64_t window_ns;             /**< Oldest frame kept, relative to the newest */
+    struct preroll_desc *desc;      /**< Descriptor ring, oldest at first */
+    unsigned int cap;               /**< Descriptor ring capacity */
+    unsigned int first;             /**< Index of the oldest descriptor */
+    unsigned int count;             /**< Stored frames */
+    size_t bytes;                   /**< Stored JPEG bytes */
+};
+
+/** Function prototypes */
+int preroll_init(struct preroll *p, size_t budget, unsigned int window_ms);
+void preroll_destroy(struct preroll *p);
+int preroll_push(struct preroll *p, const unsigned char *data, size_t size, uint64_t capture_ns);
+const struct preroll_desc *preroll_at(const struct preroll *p, unsigned int i);
+unsigned int preroll_runs(const struct preroll *p, struct iovec iov[2]);
+void preroll_clear(struct preroll *p);
+
+#endif  // PREROLL_H
@@ -0,0 +1,646 @@
+/**
+* @file recorder.c
+* @brief Continuous segmented recording of the encoded stream to disk.
+*
+* The recorder is one more subscriber of the frame broadcaster, with a
+* drop-oldest queue of REC_QUEUE_DEPTH frames: the publisher never waits
+* for it, and a stalled SD card only ever costs recorded frames, never
+* captured or streamed ones.
+*
+* A dedicated writer thread copies each frame into an aligned staging
+* buffer and releases it at once, so pooled frames return to the pool
+* without waiting for the disk. Staged bytes are written in batches of at
+* least REC_BATCH_SIZE, in whole REC_ALIGN blocks, with O_DIRECT: no page
+* cache builds up, and writeback can never stall some unrelated thread. A
+* filesystem without O_DIRECT gets the same aligned writes through the
+* page cache.
+*
+* Every segment_s seconds a new segment starts: <dir>/<YYYYmmdd-HHMMSS>.mjpg
+* (with -2, -3, ... appended when a segment of that second exists) holds
+* the JPEGs back to back (playable as raw MJPEG), and the matching
+* .idx file holds a rec_index_header and one rec_index_entry per frame, for
+* seeking without scanning the images. Index entries are appended once the
+* frame they describe is on disk. Segments are preallocated with fallocate()
+* from the size of the previous one, and trimmed to their length on close.
+*
+* In event mode nothing is written until a trigger: motion, a detection, or
+* recorder_trigger() (POST /trigger). Until then frames go to the pre-roll
+* store (see preroll.c). A trigger opens a segment, writes the pre-roll
+* straight from its arena and records live frames until postroll_s after
+* the last trigger.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "broadcast/broadcaster.h"
+#include "image/image_encoder.h"
+#include "image/motion.h"
+#include "detection/detection.h"
+#include "metrics/metrics.h"
+#include "sched/topology.h"
+
+/**
+* @brief Round down to a multiple of REC_ALIGN
+*/
+static inline size_t align_down(size_t n)
+{
+    return n & ~((size_t)REC_ALIGN - 1);
+}
+
+/**
+* @brief Append the index entries whose frames are fully on disk
+*
+* @param r      Pointer to the recorder
+* @param limit  Bytes of the segment that are on disk
+*
+* @return void
+*/
+static void index_flush(struct recorder *r, uint64_t limit)
+{
+    size_t n = r->n_indexed;
+
+    while (n < r->n_entries && r->entries[n].offset + r->entries[n].size <= limit) n++;
+    if (n == r->n_indexed) return;
+
+    if (fwrite(&r->entries[r->n_indexed], sizeof(r->entries[0]), n - r->n_indexed, r->index) !=
+        n - r->n_indexed || fflush(r->index) != 0) {
+        perror("recorder: Failed to write index");
+        metrics_count(CNT_RECORD_ERRORS, 1);
+    }
+    r->n_indexed = n;
+}
+
+/**
+* @brief Write staged data to the segment file
+*
+* Normally only whole REC_ALIGN blocks are written and the remainder stays
+* staged. The final write of a segment pads the last block with zeros; the
+* padding is cut off again by the ftruncate() on close.
+*
+* @param r      Pointer to the recorder
+* @param final  Also write the partial last block
+*
+* @return 0 on success, -1 on a write error
+*/
+static int segment_write(struct recorder *r, bool final)
+{
+    size_t len = final ? align_down(r->staged + REC_ALIGN - 1) : align_down(r->staged);
+    if (len == 0) return 0;
+
+    if (len > r->staged) memset(r->stage + r->staged, 0, len - r->staged);
+
+    uint64_t start = metrics_now();
+    for (size_t done = 0; done < len; ) {
+        ssize_t n = pwrite(r->fd, r->stage + done, len - done, (off_t)(r->written + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("recorder: Failed to write segment");
+            metrics_count(CNT_RECORD_ERRORS, 1);
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    metrics_observe(STAGE_DISK, start, metrics_now());
+    metrics_count(CNT_RECORD_BYTES, len);
+
+    r->written += len;
+    if (final) {
+        r->staged = 0;
+    } else {
+        r->staged -= len;
+        memmove(r->stage, r->stage + len, r->staged);
+    }
+
+    index_flush(r, r->written < r->logical ? r->written : r->logical);
+    return 0;
+}
+
+/**
+* @brief Forget the oldest segments beyond the retention limit
+*
+* @param r      Pointer to the recorder
+* @param path   Segment just finished (without extension)
+*
+* @return void
+*/
+static void segment_retire(struct recorder *r, const char *path)
+{
+    if (!r->opts.keep || !r->old) return;
+
+    if (r->n_old == r->opts.keep) {
+        char file[sizeof(r->old[0]) + 8];
+
+        snprintf(file, sizeof(file), "%s.mjpg", r->old[0]);
+        if (unlink(file) < 0 && errno != ENOENT) perror("recorder: Failed to delete old segment");
+        snprintf(file, sizeof(file), "%s.idx", r->old[0]);
+        unlink(file);
+
+        memmove(r->old[0], r->old[1], (size_t)(r->n_old - 1) * sizeof(r->old[0]));
+        r->n_old--;
+    }
+    snprintf(r->old[r->n_old++], sizeof(r->old[0]), "%s", path);
+}
+
+/**
+* @brief Give up on the current segment after a write error
+*
+* What reached the disk stays, with its index entries; recording resumes
+* in a new segment with the next frame.
+*
+* @param r  Pointer to the recorder
+*
+* @return void
+*/
+static void segment_abort(struct recorder *r)
+{
+    if (ftruncate(r->fd, (off_t)r->written) < 0) perror("recorder: Failed to trim segment");
+    close(r->fd);
+    r->fd = -1;
+    fclose(r->index);
+    r->index = NULL;
+    r->staged = 0;
+}
+
+/**
+* @brief Finish the current segment
+*
+* @param r  Pointer to the recorder
+*
+* @return void
+*/
+static void segment_close(struct recorder *r)
+{
+    if (r->fd < 0) return;
+
+    if (segment_write(r, true) == 0 && ftruncate(r->fd, (off_t)r->logical) < 0) {
+        perror("recorder: Failed to trim segment");
+    }
+    close(r->fd);
+    r->fd = -1;
+
+    index_flush(r, r->logical);
+    fclose(r->index);
+    r->index = NULL;
+
+    // The next segment probably needs about as much
+    r->prealloc = r->logical + r->logical / 8;
+    if (r->prealloc < REC_PREALLOC_MIN) r->prealloc = REC_PREALLOC_MIN;
+
+    printf("recorder: Closed %s.mjpg (%zu frames, %llu bytes)\n", r->path, r->n_entries,
+           (unsigned long long)r->logical);
+    segment_retire(r, r->path);
+    r->staged = 0;
+}
+
+/**
+* @brief Create the file of a new segment, never replacing an existing one
+*
+* Names have one-second resolution, and in event mode a segment can end and
+* the next start within the same second: a taken name gets the next free
+* -N suffix. Sets r->path and r->direct.
+*
+* @param r      Pointer to the recorder
+* @param name   Segment name from its start time
+*
+* @return File descriptor, or -1 on failure
+*/
+static int segment_create(struct recorder *r, const char *name)
+{
+    char file[sizeof(r->path) + 8];
+
+    for (unsigned int seq = 1; seq <= REC_NAME_TRIES; seq++) {
+        if (seq == 1) snprintf(r->path, sizeof(r->path), "%s/%.15s", r->opts.dir, name);
+        else snprintf(r->path, sizeof(r->path), "%s/%.15s-%u", r->opts.dir, name, seq);
+        snprintf(file, sizeof(file), "%s.mjpg", r->path);
+
+        r->direct = true;
+        int fd = open(file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_DIRECT, 0644);
+        if (fd < 0 && errno == EINVAL) {
+            // tmpfs and some FUSE filesystems: same aligned writes, through the page cache
+            r->direct = false;
+            fd = open(file, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        }
+        if (fd >= 0 || errno != EEXIST) return fd;
+    }
+    errno = EEXIST;
+    return -1;
+}
+
+/**
+* @brief Start a new segment for a frame captured at capture_ns
+*
+* @param r          Pointer to the recorder
+* @param capture_ns Monotonic capture time of the segment's first frame
+*
+* @return 0 on success, -1 on failure
+*/
+static int segment_open(struct recorder *r, uint64_t capture_ns)
+{
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    r->wall_offset_ns = (int64_t)(wall.tv_sec * 1000000000ULL + wall.tv_nsec) - (int64_t)metrics_now();
+
+    uint64_t start_ns = capture_ns + r->wall_offset_ns;
+    time_t sec = (time_t)(start_ns / 1000000000ULL);
+    struct tm tm;
+    char name[32];
+    localtime_r(&sec, &tm);
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tm);
+
+    r->fd = segment_create(r, name);
+    if (r->fd < 0) {
+        perror("recorder: Failed to create segment");
+        metrics_count(CNT_RECORD_ERRORS, 1);
+        return -1;
+    }
+
+    // Reserve the blocks up front so the filesystem does not allocate per write
+    // (fallocate(), not posix_fallocate(): never emulated by writing zeros)
+    if (fallocate(r->fd, 0, 0, (off_t)r->prealloc) < 0 && errno != EOPNOTSUPP) {
+        perror("recorder: Failed to preallocate segment");
+    }
+
+    char file[sizeof(r->path) + 8];
+    snprintf(file, sizeof(file), "%s.idx", r->path);
+    r->index = fopen(file, "wbe");
+    struct rec_index_header hdr = { .magic = REC_INDEX_MAGIC, .start_ns = start_ns };
+    if (!r->index || fwrite(&hdr, sizeof(hdr), 1, r->index) != 1) {
+        perror("recorder: Failed to create index");
+        metrics_count(CNT_RECORD_ERRORS, 1);
+        if (r->index) fclose(r->index);
+        r->index = NULL;
+        close(r->fd);
+        r->fd = -1;
+        return -1;
+    }
+
+    r->seg_start_ns = capture_ns;
+    r->logical = 0;
+    r->written = 0;
+    r->staged = 0;
+    r->n_entries = 0;
+    r->n_indexed = 0;
+
+    printf("recorder: Recording to %s.mjpg%s\n", r->path, r->direct ? " (O_DIRECT)" : "");
+    return 0;
+}
+
+/**
+* @brief Make room for one more index entry
+*
+* @param r  Pointer to the recorder
+*
+* @return 0 on success, -1 on failure
+*/
+static int index_reserve(struct recorder *r)
+{
+    if (r->n_entries < r->cap_entries) return 0;
+
+    size_t cap = r->cap_entries ? r->cap_entries * 2 : 1024;
+    struct rec_index_entry *e = realloc(r->entries, cap * sizeof(*e));
+    if (!e) {
+        perror("recorder: Failed to grow index");
+        return -1;
+    }
+    r->entries = e;
+    r->cap_entries = cap;
+    return 0;
+}
+
+/**
+* @brief Record one frame
+*
+* @param r      Pointer to the recorder
+* @param frame  Encoded frame (the caller keeps its reference)
+*
+* @return void
+*/
+static void record_frame(struct recorder *r, const struct jpeg_frame *frame)
+{
+    uint64_t t = frame->t.capture ? frame->t.capture : metrics_now();
+
+    if (r->fd >= 0 && t - r->seg_start_ns >= r->opts.segment_s * 1000000000ULL) segment_close(r);
+    if (r->fd < 0 && segment_open(r, t) < 0) return;
+
+    if (index_reserve(r) < 0) return;
+    r->entries[r->n_entries++] = (struct rec_index_entry){
+        .time_ns = t + r->wall_offset_ns, .offset = r->logical, .size = (uint32_t)frame->size,
+    };
+
+    // Frames larger than the staging buffer go through it in pieces
+    const unsigned char *src = frame->data;
+    size_t left = frame->size;
+    bool failed = false;
+    while (left && !failed) {
+        size_t n = REC_STAGE_SIZE - r->staged;
+        if (n > left) n = left;
+
+        memcpy(r->stage + r->staged, src, n);
+        r->staged += n;
+        r->logical += n;
+        src += n;
+        left -= n;
+
+        if (r->staged == REC_STAGE_SIZE) failed = segment_write(r, false) < 0;
+    }
+    if (!failed && r->staged >= REC_BATCH_SIZE) failed = segment_write(r, false) < 0;
+
+    if (failed) {
+        segment_abort(r);
+        return;
+    }
+    metrics_count(CNT_RECORDED_FRAMES, 1);
+}
+
+/**
+* @brief Start an event segment with the pre-roll footage
+*
+* The stored frames go to the file in one pwritev() of the arena runs,
+* through the page cache (O_DIRECT is switched off for it), so the writer
+* thread is not held up for the whole pre-roll by the card. Only the
+* bytes after the last whole block are copied into the staging buffer;
+* from there on the segment continues with aligned O_DIRECT writes.
+*
+* @param r          Pointer to the recorder
+* @param capture_ns Capture time of the triggering frame
+*
+* @return 0 on success, -1 on failure
+*/
+static int event_start(struct recorder *r, uint64_t capture_ns)
+{
+    struct preroll *p = &r->pre;
+    uint64_t start = p->count ? preroll_at(p, 0)->capture_ns : capture_ns;
+
+    metrics_count(CNT_RECORD_EVENTS, 1);
+    if (segment_open(r, start) < 0) return -1;
+    if (p->count == 0) return 0;
+
+    struct iovec iov[2];
+    unsigned int n = preroll_runs(p, iov);
+    size_t len = p->bytes;
+
+    int flags = fcntl(r->fd, F_GETFL);
+    if (r->direct) fcntl(r->fd, F_SETFL, flags & ~O_DIRECT);
+
+    uint64_t t0 = metrics_now();
+    ssize_t done = pwritev(r->fd, iov, (int)n, 0);
+    while (done >= 0 && (size_t)done < len) {
+        // Short write: continue with what is left of the runs
+        size_t skip = (size_t)done;
+        struct iovec rest[2];
+        unsigned int k = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            if (skip >= iov[i].iov_len) {
+                skip -= iov[i].iov_len;
+                continue;
+            }
+            rest[k].iov_base = (unsigned char *)iov[i].iov_base + skip;
+            rest[k].iov_len = iov[i].iov_len - skip;
+            skip = 0;
+            k++;
+        }
+        ssize_t more = pwritev(r->fd, rest, (int)k, (off_t)done);
+        if (more < 0 && errno == EINTR) continue;
+        if (more <= 0) {
+            if (more == 0) errno = EIO;     // No progress: give up rather than spin
+            done = -1;
+            break;
+        }
+        done += more;
+    }
+    metrics_observe(STAGE_DISK, t0, metrics_now());
+
+    if (r->direct) fcntl(r->fd, F_SETFL, flags);
+    if (done < 0) {
+        perror("recorder: Failed to write pre-roll");
+        metrics_count(CNT_RECORD_ERRORS, 1);
+        preroll_clear(p);
+        return 0;                       // Live frames still start at offset 0
+    }
+    metrics_count(CNT_RECORD_BYTES, len);
+
+    for (unsigned int i = 0; i < p->count && index_reserve(r) == 0; i++) {
+        const struct preroll_desc *d = preroll_at(p, i);
+        r->entries[r->n_entries++] = (struct rec_index_entry){
+            .time_ns = d->capture_ns + r->wall_offset_ns, .offset = r->logical, .size = (uint32_t)d->size,
+        };
+        r->logical += d->size;
+    }
+    metrics_count(CNT_RECORDED_FRAMES, p->count);
+
+    // The partial last block is rewritten by the next aligned write
+    r->written = r->logical & ~((uint64_t)REC_ALIGN - 1);
+    r->staged = (size_t)(r->logical - r->written);
+    for (size_t left = r->staged, i = n; left; ) {
+        struct iovec *v = &iov[--i];
+        size_t take = left < v->iov_len ? left : v->iov_len;
+        memcpy(r->stage + left - take, (unsigned char *)v->iov_base + v->iov_len - take, take);
+        left -= take;
+    }
+    index_flush(r, r->logical);
+
+    printf("recorder: Event, %u pre-roll frames (%zu bytes)\n", p->count, len);
+    preroll_clear(p);
+    return 0;
+}
+
+/**
+* @brief Whether anything asks for an event to be recorded now
+*
+* @param r  Pointer to the recorder
+*
+* @return true on a trigger
+*/
+static bool event_triggered(struct recorder *r)
+{
+    bool hit = atomic_exchange(&r->triggered, false);
+
+    if (r->motion && motion_is_active(r->motion)) hit = true;
+
+    struct detect_result res;
+    if (r->detector && detector_latest(r->detector, &res) == 0 && res.seq != r->det_seq) {
+        r->det_seq = res.seq;
+        if (res.n_boxes) hit = true;
+    }
+    return hit;
+}
+
+/**
+* @brief Event mode: keep a frame as pre-roll, or record it during an event
+*
+* @param r      Pointer to the recorder
+* @param frame  Encoded frame (the caller keeps its reference)
+*
+* @return void
+*/
+static void event_frame(struct recorder *r, const struct jpeg_frame *frame)
+{
+    uint64_t t = frame->t.capture ? frame->t.capture : metrics_now();
+
+    if (event_triggered(r)) {
+        if (r->fd < 0 && event_start(r, t) < 0) return;
+        r->event_until = t + r->opts.postroll_s * 1000000000ULL;
+    }
+
+    if (r->fd < 0) {
+        preroll_push(&r->pre, frame->data, frame->size, t);
+        return;
+    }
+
+    record_frame(r, frame);
+    if (t >= r->event_until) segment_close(r);
+}
+
+/**
+* @brief Writer thread: drain the subscription into segment files
+*/
+static void *recorder_thread(void *arg)
+{
+    struct recorder *r = arg;
+
+    topology_enter(THREAD_RECORD);
+
+    while (!atomic_load(&r->stop)) {
+        if (subscriber_wait(r->sub) < 0) break;
+
+        struct jpeg_frame *frame;
+        while ((frame = subscriber_next(r->sub))) {
+            if (!frame->data || !frame->size) {
+                // Nothing to store
+            } else if (r->opts.event) {
+                event_frame(r, frame);
+            } else {
+                record_frame(r, frame);
+            }
+            jpeg_frame_release(frame);
+        }
+    }
+
+    segment_close(r);
+    return NULL;
+}
+
+/**
+* @brief Start recording every frame published on a broadcaster
+*
+* @param r      Pointer to the recorder
+* @param opts   Settings (opts->dir must exist)
+* @param bus    Broadcaster to record
+* @param motion Change detector whose activity triggers events, or NULL
+* @param detector Object detector whose detections trigger events, or NULL
+*
+* @return 0 on success, -1 on failure
+*/
+int recorder_start(struct recorder *r, const struct record_opts *opts, struct broadcaster *bus,
+                   struct motion_ctx *motion, struct detector *detector)
+{
+    memset(r, 0, sizeof(*r));
+    r->opts = *opts;
+    if (r->opts.segment_s == 0) r->opts.segment_s = REC_DEFAULT_SEGMENT_S;
+    if (r->opts.keep > REC_KEEP_MAX) r->opts.keep = REC_KEEP_MAX;
+    r->bus = bus;
+    r->fd = -1;
+    r->prealloc = REC_PREALLOC_DEFAULT;
+    r->motion = motion;
+    r->detector = detector;
+    atomic_init(&r->stop, false);
+    atomic_init(&r->triggered, false);
+
+    if (access(r->opts.dir, W_OK) < 0) {
+        fprintf(stderr, "recorder: Cannot write to %s: %s\n", r->opts.dir, strerror(errno));
+        return -1;
+    }
+
+    if (posix_memalign((void **)&r->stage, REC_ALIGN, REC_STAGE_SIZE) != 0 ||
+        (r->opts.keep && !(r->old = calloc(r->opts.keep, sizeof(r->old[0]))))) {
+        perror("recorder: Failed to allocate buffers");
+        recorder_stop(r);
+        return -1;
+    }
+
+    if (r->opts.event && preroll_init(&r->pre, (size_t)r->opts.preroll_mb << 20,
+                                      r->opts.preroll_s * 1000) < 0) {
+        recorder_stop(r);
+        return -1;
+    }
+
+    r->sub = broadcaster_subscribe(bus, REC_QUEUE_DEPTH, CB_DROP_OLDEST);
+    if (!r->sub) {
+        recorder_stop(r);
+        return -1;
+    }
+
+    if (pthread_create(&r->thread, NULL, recorder_thread, r) != 0) {
+        perror("recorder: Failed to create thread");
+        recorder_stop(r);
+        return -1;
+    }
+    r->running = true;
+
+    printf("recorder: %u s segments in %s", r->opts.segment_s, r->opts.dir);
+    if (r->opts.keep) printf(", keeping the last %u", r->opts.keep);
+    if (r->opts.event) {
+        printf(", on events only (%u s / %u MiB pre-roll, %u s post-roll)", r->opts.preroll_s,
+               r->opts.preroll_mb, r->opts.postroll_s);
+    }
+    printf("\n");
+    return 0;
+}
+
+/**
+* @brief Finish the current segment and stop recording
+*
+* Frames still queued when the thread wakes up are written first.
+*
+* @param r  Pointer to the recorder
+*
+* @return void
+*/
+void recorder_stop(struct recorder *r)
+{
+    if (r->running) {
+        const uint64_t one = 1;
+
+        atomic_store(&r->stop, true);
+        if (write(r->sub->event_fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("recorder: Failed to wake writer thread");
+        }
+        pthread_join(r->thread, NULL);
+        r->running = false;
+    }
+
+    if (r->sub) broadcaster_unsubscribe(r->bus, r->sub);
+    r->sub = NULL;
+
+    preroll_destroy(&r->pre);
+    free(r->stage);
+    free(r->entries);
+    free(r->old);
+    r->stage = NULL;
+    r->entries = NULL;
+    r->old = NULL;
+}
+
+/**
+* @brief Ask for the current moment to be recorded (event mode)
+*
+* Safe from any thread. The event starts with the next frame, with the
+* pre-roll before it; a trigger during an event extends it.
+*
+* @param r  Pointer to the recorder
+*
+* @return 0 on success, -1 if the recorder does not record on events
+*/
+int recorder_trigger(struct recorder *r)
+{
+    if (!r->running || !r->opts.event) return -1;
+    atomic_store(&r->triggered, true);
+    return 0;
+}
@@ -0,0 +1,152 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+/**
+* @file recorder.h
+* @brief Continuous segmented recording of the encoded stream to disk.
+*/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "preroll.h"
+
+// Forward declare structures
+struct broadcaster;
+struct subscriber;
+struct jpeg_frame;
+struct motion_ctx;
+struct detector;
+
+/** @brief Longest accepted recording directory path. */
+#define REC_PATH_MAX            256
+
+/** @brief Names tried for segments starting in the same second (-2 .. -N suffixes). */
+#define REC_NAME_TRIES          100
+
+/** @brief Default segment length in seconds. */
+#define REC_DEFAULT_SEGMENT_S   60
+
+/** @brief Frames the recorder's subscriber queue absorbs while a write stalls. */
+#define REC_QUEUE_DEPTH         64
+
+/** @brief Alignment of O_DIRECT buffers, offsets and lengths. */
+#define REC_ALIGN               4096
+
+/** @brief Staging buffer size; data is written in full multiples of REC_ALIGN from it. */
+#define REC_STAGE_SIZE          (2u << 20)
+
+/** @brief Staged bytes from which a batch is written. */
+#define REC_BATCH_SIZE          (256u << 10)
+
+/** @brief Space preallocated for the first segment, before its bitrate is known. */
+#define REC_PREALLOC_DEFAULT    (32ull << 20)
+
+/** @brief Most old segments remembered for deletion (record_keep). */
+#define REC_KEEP_MAX            1024
+
+/** @brief Smallest preallocation of a segment. */
+#define REC_PREALLOC_MIN        (1ull << 20)
+
+/** @brief Default footage kept from before an event, in seconds. */
+#define REC_DEFAULT_PREROLL_S   5
+
+/** @brief Default memory budget of the pre-event store, in MiB. */
+#define REC_DEFAULT_PREROLL_MB  16
+
+/** @brief Default recording time after the last trigger of an event, in seconds. */
+#define REC_DEFAULT_POSTROLL_S  10
+
+/** @brief Magic at the start of every index file. */
+#define REC_INDEX_MAGIC         "CAMIDX1"
+
+/**
+* @brief Recorder settings.
+*/
+struct record_opts {
+    char dir[REC_PATH_MAX];         /**< Directory segments are written to (empty = off) */
+    unsigned int segment_s;         /**< Segment length in seconds */
+    unsigned int keep;              /**< Segments kept before the oldest is deleted (0 = all) */
+    bool event;                     /**< Record only around triggers instead of continuously */
+    unsigned int preroll_s;         /**< Footage kept from before a trigger (event mode) */
+    unsigned int preroll_mb;        /**< Memory budget of that footage, in MiB */
+    unsigned int postroll_s;        /**< Recording time after the last trigger */
+};
+
+/**
+* @brief Header of a segment index file.
+*
+* Followed by one rec_index_entry per frame, in recording order.
+*/
+struct rec_index_header {
+    char magic[8];                  /**< REC_INDEX_MAGIC, NUL padded */
+    uint64_t start_ns;              /**< Wall-clock time of the first frame (ns since the epoch) */
+};
+
+/**
+* @brief Where one frame lives in the segment file.
+*
+* Frames are stored back to back as complete JPEG images, so the segment
+* also plays as a raw MJPEG stream; the index only makes seeking cheap.
+*/
+struct rec_index_entry {
+    uint64_t time_ns;               /**< Wall-clock capture time (ns since the epoch) */
+    uint64_t offset;                /**< Byte offset of the JPEG in the segment file */
+    uint32_t size;                  /**< JPEG size in bytes */
+    uint32_t reserved;              /**< Zero */
+};
+
+/**
+* @brief State of the recorder and its writer thread.
+*
+* Everything below opts belongs to the writer thread.
+*/
+struct recorder {
+    struct record_opts opts;        /**< Settings */
+    struct broadcaster *bus;        /**< Broadcaster recorded from */
+    struct subscriber *sub;         /**< Subscription fed by the publisher, drop-oldest */
+
+    pthread_t thread;               /**< Writer thread */
+    bool running;                   /**< Thread started */
+    atomic_bool stop;               /**< Ask the writer thread to finish */
+    atomic_bool triggered;          /**< External trigger pending (recorder_trigger()) */
+    struct motion_ctx *motion;      /**< Motion state that triggers events, or NULL */
+    struct detector *detector;      /**< Detections that trigger events, or NULL */
+
+    int fd;                         /**< Current segment file, or -1 */
+    FILE *index;                    /**< Index file of the current segment, or NULL */
+    char path[REC_PATH_MAX + 32];   /**< Segment path without extension */
+    bool direct;                    /**< Segment opened with O_DIRECT */
+    uint64_t seg_start_ns;          /**< Monotonic capture time of the segment's first frame */
+    int64_t wall_offset_ns;         /**< Wall clock minus monotonic clock at segment start */
+    uint64_t logical;               /**< Bytes appended to the segment */
+    uint64_t written;               /**< Bytes written to the file (multiple of REC_ALIGN) */
+    uint64_t prealloc;              /**< Bytes preallocated for the next segment */
+
+    unsigned char *stage;           /**< Aligned staging buffer (REC_STAGE_SIZE) */
+    size_t staged;                  /**< Valid bytes in stage, the ones after written */
+
+    struct rec_index_entry *entries;    /**< Index entries of the current segment */
+    size_t n_entries;               /**< Valid entries */
+    size_t cap_entries;             /**< Allocated entries */
+    size_t n_indexed;               /**< Entries already in the index file */
+
+    char (*old)[REC_PATH_MAX + 32]; /**< Finished segments, oldest first (record_keep) */
+    unsigned int n_old;             /**< Valid entries in old */
+
+    struct preroll pre;             /**< Frames from before the next event (event mode) */
+    uint64_t event_until;           /**< Capture time at which the current event ends */
+    unsigned long det_seq;          /**< Last detection result looked at */
+};
+
+/** Function prototypes */
+int recorder_start(struct recorder *r, const struct record_opts *opts, struct broadcaster *bus,
+                   struct motion_ctx *motion, struct detector *detector);
+void recorder_stop(struct recorder *r);
+int recorder_trigger(struct recorder *r);
+
+#endif  // RECORDER_H
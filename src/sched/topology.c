@@ -0,0 +1,224 @@
+/**
+* @file topology.c
+* @brief CPU placement and scheduling of the pipeline threads, and memory locking.
+*
+* Every pipeline thread calls topology_enter() with its role as the first
+* thing it does, which pins it to the CPUs configured for that role and,
+* for the capture thread, optionally switches it to SCHED_FIFO. Keeping
+* the encoders, the network loop and the background work (detection,
+* recording) off the capture core means VIDIOC_DQBUF is served on time
+* even while they are busy; a real-time capture thread also preempts
+* whatever else the system runs there.
+*
+* topology_lock_memory() locks the process in RAM so neither a frame nor
+* a stack is ever paged out, and the pools are pre-faulted so the first
+* frames do not pay for page faults either. The placement each thread
+* ended up with is reported on /metrics.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "topology.h"
+
+/** @brief Bits of a CPU mask. */
+#define MASK_BITS   (sizeof(unsigned long) * 8)
+
+/** @brief Settings, fixed before the first thread starts. */
+static struct topology_opts topo;
+
+/** @brief CPUs the process may run on, at topology_init(). */
+static unsigned long allowed;
+
+/**
+* @brief Parse a CPU list such as "2" or "0-1,3"
+*
+* "any" or an empty list leaves the role unpinned.
+*
+* @param list   CPU list
+* @param mask   Receives the CPU mask (bit n = CPU n), 0 if unpinned
+*
+* @return 0 on success, -1 on a malformed list or a CPU beyond the mask
+*/
+int topology_parse_cpus(const char *list, unsigned long *mask)
+{
+    unsigned long m = 0;
+    const char *p = list;
+
+    if (!*p || strcmp(p, "any") == 0) {
+        *mask = 0;
+        return 0;
+    }
+
+    for (;;) {
+        char *end;
+        unsigned long first = strtoul(p, &end, 10);
+        unsigned long last = first;
+
+        if (end == p) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p || last < first) return -1;
+        }
+        if (last >= MASK_BITS) return -1;
+
+        for (unsigned long c = first; c <= last; c++) m |= 1UL << c;
+
+        if (*end == '\0') break;
+        if (*end != ',') return -1;
+        p = end + 1;
+    }
+
+    *mask = m;
+    return 0;
+}
+
+/**
+* @brief Fix the settings for every thread started from now on
+*
+* Must be called before the first pipeline thread is created.
+*
+* @param opts   Thread topology settings
+*
+* @return void
+*/
+void topology_init(const struct topology_opts *opts)
+{
+    cpu_set_t set;
+
+    topo = *opts;
+    allowed = ~0UL;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        allowed = 0;
+        for (unsigned int c = 0; c < MASK_BITS; c++) {
+            if (CPU_ISSET(c, &set)) allowed |= 1UL << c;
+        }
+    }
+}
+
+/**
+* @brief CPUs a role runs on
+*
+* @return The role's CPUs; for an unpinned role every allowed CPU except
+*         the capture CPUs (all of them if that leaves none)
+*/
+static unsigned long role_cpus(enum metric_thread role)
+{
+    unsigned long mask = topo.cpus[role] & allowed;
+
+    if (topo.cpus[role] && !mask) {
+        fprintf(stderr, "topology: No usable CPU for the %s thread, left unpinned\n",
+                metrics_thread_name(role));
+    }
+    if (!mask && role != THREAD_CAPTURE) mask = allowed & ~topo.cpus[THREAD_CAPTURE];
+    return mask ? mask : allowed;
+}
+
+/**
+* @brief Apply the calling thread's placement and scheduling
+*
+* Pins the thread to its role's CPUs, gives the capture thread its
+* SCHED_FIFO priority if one is set and reports the result on /metrics.
+* A setting that cannot be applied (e.g. SCHED_FIFO without CAP_SYS_NICE)
+* is reported and the thread carries on without it.
+*
+* @param role   Role of the calling thread
+*
+* @return 0 on success, -1 if a setting could not be applied
+*/
+int topology_enter(enum metric_thread role)
+{
+    unsigned long mask = role_cpus(role);
+    unsigned int prio = 0;
+    cpu_set_t set;
+    int ret = 0;
+    int err;
+
+    CPU_ZERO(&set);
+    for (unsigned int c = 0; c < MASK_BITS; c++) {
+        if (mask & (1UL << c)) CPU_SET(c, &set);
+    }
+    if (mask != allowed && (err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+        fprintf(stderr, "topology: Failed to pin the %s thread: %s\n", metrics_thread_name(role), strerror(err));
+        mask = allowed;
+        ret = -1;
+    }
+
+    if (role == THREAD_CAPTURE && topo.capture_priority) {
+        struct sched_param sp = { .sched_priority = (int)topo.capture_priority };
+
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+        if (err != 0) {
+            fprintf(stderr, "topology: Failed to set SCHED_FIFO priority %u (needs CAP_SYS_NICE): %s\n",
+                    topo.capture_priority, strerror(err));
+            ret = -1;
+        } else {
+            prio = topo.capture_priority;
+        }
+    }
+
+    metrics_thread_placement(role, mask, prio);
+    return ret;
+}
+
+/**
+* @brief Lock the process memory in RAM
+*
+* Current and future mappings are locked. Where the kernel supports it,
+* pages are locked as they are first touched (MCL_ONFAULT) rather than all
+* populated now: thread stacks only pin the pages they use, and the pools
+* are populated explicitly with topology_prefault().
+*
+* @return 0 on success, -1 on failure (e.g. RLIMIT_MEMLOCK too low)
+*/
+int topology_lock_memory(void)
+{
+    int ret = -1;
+
+#ifdef MCL_ONFAULT
+    ret = mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT);
+    if (ret < 0 && errno != EINVAL) {
+        perror("topology: Failed to lock memory (raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK)");
+        return -1;
+    }
+#endif
+    if (ret < 0 && mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("topology: Failed to lock memory (raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK)");
+        return -1;
+    }
+
+    metrics_set_gauge(GAUGE_MEMORY_LOCKED, 1);
+    printf("topology: Memory locked\n");
+    return 0;
+}
+
+/**
+* @brief Fault in every page of a buffer
+*
+* Each page is written once, so it is backed (and, after
+* topology_lock_memory(), locked) before the pipeline first uses it.
+* Only for buffers no other thread uses yet.
+*
+* @param addr   Start of the buffer
+* @param len    Length in bytes
+*
+* @return void
+*/
+void topology_prefault(void *addr, unsigned long len)
+{
+    volatile unsigned char *p = addr;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (!p || !len) return;
+    if (page <= 0) page = 4096;
+
+    for (unsigned long off = 0; off < len; off += (unsigned long)page) p[off] = p[off];
+    p[len - 1] = p[len - 1];
+}
@@ -0,0 +1,36 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/**
+* @file topology.h
+* @brief CPU placement and scheduling of the pipeline threads, and memory locking.
+*/
+
+#include <stdbool.h>
+
+#include "metrics/metrics.h"
+
+/** @brief Highest SCHED_FIFO priority accepted for the capture thread. */
+#define TOPOLOGY_MAX_PRIORITY   99
+
+/**
+* @brief Thread topology settings.
+*
+* A role without CPUs runs anywhere except on the capture CPUs (when those
+* are set and leave any other CPU), so no pipeline thread lands on the
+* capture core uninvited.
+*/
+struct topology_opts {
+    unsigned long cpus[THREAD_COUNT];   /**< CPU mask per role, bit n = CPU n (0 = unpinned) */
+    unsigned int capture_priority;      /**< SCHED_FIFO priority of the capture thread (0 = normal) */
+    bool mlock;                         /**< Lock all memory in RAM and pre-fault the pools */
+};
+
+/** Function prototypes */
+int topology_parse_cpus(const char *list, unsigned long *mask);
+void topology_init(const struct topology_opts *opts);
+int topology_enter(enum metric_thread role);
+int topology_lock_memory(void);
+void topology_prefault(void *addr, unsigned long len);
+
+#endif  // TOPOLOGY_H
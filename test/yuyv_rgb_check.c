@@ -0,0 +1,167 @@
+/**
+* @file yuyv_rgb_check.c
+* @brief Bit-exactness check of the YUYV422 -> RGB24 kernels.
+*
+* Random frames are converted by every kernel the build has and compared
+* byte for byte with the scalar reference. Pixel counts cover every tail
+* length the 16-pixel NEON loop can leave, plus whole frames whose width
+* is not a multiple of 16. The scalar kernel itself is checked against a
+* direct evaluation of the BT.601 equations, so the check is meaningful on
+* builds without NEON too (x86, SIMD=0).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image/yuyv_rgb.h"
+
+/** @brief Longest pixel run of the tail sweep (several NEON blocks plus every tail). */
+#define TAIL_PIXELS_MAX     96
+
+/** @brief Random frames per frame size. */
+#define FRAMES_PER_SIZE     8
+
+/** @brief Frame sizes converted whole: aligned, and with 2..14 pixel tails per row. */
+static const unsigned int frame_sizes[][2] = {
+    { 640, 480 }, { 642, 3 }, { 1918, 2 }, { 30, 17 }, { 18, 1 }, { 2, 1 },
+};
+
+/**
+* @brief Clip to the 8-bit pixel range
+*/
+static int clip(int x)
+{
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+/**
+* @brief Reference conversion, one pixel at a time from the BT.601 equations
+*/
+static void reference(const unsigned char *src, unsigned char *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        const unsigned char *pair = src + (i / 2) * 4;
+        int c = pair[(i & 1) * 2] - 16, d = pair[1] - 128, e = pair[3] - 128;
+
+        dst[i * 3 + 0] = clip((298 * c + 409 * e + 128) >> 8);
+        dst[i * 3 + 1] = clip((298 * c - 100 * d - 208 * e + 128) >> 8);
+        dst[i * 3 + 2] = clip((298 * c + 516 * d + 128) >> 8);
+    }
+}
+
+/**
+* @brief Run one kernel and compare its output with the expected bytes
+*
+* The output buffer has a guard byte past the end, which the kernel must
+* not touch.
+*
+* @return 0 if identical, -1 (after reporting the first mismatch) otherwise
+*/
+static int compare(const char *name, yuyv_to_rgb_fn kernel, const unsigned char *src,
+                   const unsigned char *expect, unsigned char *out, size_t pixels)
+{
+    size_t size = pixels * 3;
+
+    memset(out, 0xA5, size + 1);
+    kernel(src, out, pixels);
+
+    if (out[size] != 0xA5) {
+        fprintf(stderr, "yuyv_rgb_check: %s wrote past %zu pixels\n", name, pixels);
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (out[i] != expect[i]) {
+            const unsigned char *pair = src + (i / 3 / 2) * 4;
+            fprintf(stderr, "yuyv_rgb_check: %s differs at pixel %zu of %zu, channel %zu: "
+                    "%u != %u (YUYV %u %u %u %u)\n", name, i / 3, pixels, i % 3, out[i],
+                    expect[i], pair[0], pair[1], pair[2], pair[3]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+* @brief Check every kernel on one input
+*
+* @return Number of failed comparisons
+*/
+static int check(const unsigned char *src, unsigned char *expect, unsigned char *out, size_t pixels)
+{
+    int failed = 0;
+
+    reference(src, expect, pixels);
+    failed += compare("scalar", yuyv_to_rgb_scalar, src, expect, out, pixels) < 0;
+#if IMAGE_HAVE_NEON
+    failed += compare("neon", yuyv_to_rgb_neon, src, expect, out, pixels) < 0;
+#endif
+    failed += compare("dispatch", yuyv_to_rgb, src, expect, out, pixels) < 0;
+    return failed;
+}
+
+/**
+* @brief Fill a buffer with random bytes, or with one of the extreme patterns
+*
+* The extremes (all 0, all 255, alternating) drive every channel into
+* the clipping on both sides.
+*/
+static void fill(unsigned char *buf, size_t size, unsigned int round)
+{
+    for (size_t i = 0; i < size; i++) {
+        switch (round % 4) {
+            case 0:  buf[i] = 0; break;
+            case 1:  buf[i] = 255; break;
+            case 2:  buf[i] = (i & 1) ? 0 : 255; break;
+            default: buf[i] = (unsigned char)rand(); break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int seed = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 0) : 1;
+    size_t max_pixels = TAIL_PIXELS_MAX;
+    int failed = 0, runs = 0;
+
+    for (size_t i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+        size_t pixels = (size_t)frame_sizes[i][0] * frame_sizes[i][1];
+        if (pixels > max_pixels) max_pixels = pixels;
+    }
+
+    unsigned char *src = malloc(max_pixels * 2);
+    unsigned char *expect = malloc(max_pixels * 3);
+    unsigned char *out = malloc(max_pixels * 3 + 1);
+    if (!src || !expect || !out) {
+        fprintf(stderr, "yuyv_rgb_check: Out of memory\n");
+        return 1;
+    }
+    srand(seed);
+
+    // Every tail length after zero to several whole 16-pixel blocks
+    for (size_t pixels = 2; pixels <= TAIL_PIXELS_MAX; pixels += 2) {
+        for (unsigned int round = 0; round < FRAMES_PER_SIZE; round++) {
+            fill(src, pixels * 2, round);
+            failed += check(src, expect, out, pixels);
+            runs++;
+        }
+    }
+
+    // Whole frames, converted in one call as the pipeline does
+    for (size_t i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+        size_t pixels = (size_t)frame_sizes[i][0] * frame_sizes[i][1];
+        for (unsigned int round = 0; round < FRAMES_PER_SIZE; round++) {
+            fill(src, pixels * 2, round);
+            failed += check(src, expect, out, pixels);
+            runs++;
+        }
+    }
+
+    printf("yuyv_rgb_check: %d inputs, kernel %s (seed %u): %s\n", runs, yuyv_to_rgb_impl(), seed,
+           failed ? "FAILED" : "bit-exact");
+
+    free(src);
+    free(expect);
+    free(out);
+    return failed ? 1 : 0;
+}